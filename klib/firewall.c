@@ -1,96 +1,16 @@
-#include <kernel.h>
+#include <unix_internal.h>
 #include <lwip.h>
 #include <lwip/prot/tcp.h>
-
-typedef struct firewall_rule {
-    struct list l;
-    u8 ip_version;
-    u8 l4_proto;
-    vector l3_match;
-    vector l4_match;
-    boolean drop;
-} *firewall_rule;
-
-typedef struct firewall_constraint {
-    int type;
-    boolean equals;
-} *firewall_constraint;
-
-enum firewall_l3_constraint {
-    FW_L3_SRC,
-    FW_L3_FRAG,
-    FW_L3_PROTO,
-};
-
-enum firewall_l4_constraint {
-    FW_L4_DEST,
-};
-
-typedef struct firewall_constraint_val {
-    struct firewall_constraint c;
-    u64 val;    /* multi-byte values are in network byte order */
-} *firewall_constraint_val;
-
-typedef struct firewall_constraint_buf {
-    struct firewall_constraint c;
-    u64 len;    /* expressed in number of bits */
-    u8 buf[0];
-} *firewall_constraint_buf;
+#include "firewall.h"
 
 static struct firewall {
+    heap h;
     struct list rules;
+    firewall_classifier classifier;
+    firewall_cache *caches; /* per-CPU decision caches */
+    u64 ncaches;
 } firewall;
 
-static boolean firewall_match_val(u64 val, firewall_constraint c)
-{
-    firewall_constraint_val c_val = struct_from_field(c, firewall_constraint_val, c);
-    return ((val == c_val->val) == c->equals);
-}
-
-static boolean firewall_match_buf(void *buf, firewall_constraint c)
-{
-    firewall_constraint_buf c_buf = struct_from_field(c, firewall_constraint_buf, c);
-    u64 byte_count = c_buf->len / 8;
-    if (byte_count) {
-        boolean match = !runtime_memcmp(buf, c_buf->buf, byte_count);
-        if (!match)
-            return c->equals ? false : true;
-    }
-    u64 bit_count = c_buf->len & 7;
-    if (!bit_count)
-        return true;
-    u8 bit_mask = ~MASK(8 - bit_count);
-    u8 b = ((u8 *)buf)[byte_count] & bit_mask;
-    return ((b == (c_buf->buf[byte_count] & bit_mask)) == c->equals);
-}
-
-static boolean firewall_ip4_match(vector constraints, void *buf, unsigned int len, void **l4_hdr)
-{
-    struct ip_hdr *hdr = buf;
-    int hdr_len = IPH_HL_BYTES(hdr);
-    if (len < hdr_len)
-        return false;
-    firewall_constraint c;
-    vector_foreach(constraints, c) {
-        switch (c->type) {
-        case FW_L3_SRC:
-            if (!firewall_match_buf(&hdr->src, c))
-                return false;
-            break;
-        case FW_L3_FRAG:
-            if (!firewall_match_val((IPH_OFFSET(hdr) & lwip_htons(IP_OFFMASK)) != 0, c))
-                return false;
-            break;
-        case FW_L3_PROTO:
-            if (!firewall_match_val(IPH_PROTO(hdr), c))
-                return false;
-            break;
-        }
-    }
-    *l4_hdr = ((IPH_OFFSET(hdr) & lwip_htons(IP_OFFMASK)) == 0) ? (buf + hdr_len) : 0;
-    return true;
-}
-
 static u8 firewall_ip6_get_hdr(void *buf, unsigned int len, u8 hdr_type, void **hdr_ptr)
 {
     u8 *hdr = &IP6H_NEXTH((struct ip6_hdr *)buf);
@@ -103,7 +23,7 @@ static u8 firewall_ip6_get_hdr(void *buf, unsigned int len, u8 hdr_type, void **
         case IP6_NEXTH_HOPBYHOP: {
             struct ip6_hbh_hdr *hbh_hdr = (struct ip6_hbh_hdr *)buf;
             if (len < sizeof(*hbh_hdr))
-                return false;
+                goto truncated;
             hlen = 8 * (1 + hbh_hdr->_hlen);
             nexth = &IP6_HBH_NEXTH(hbh_hdr);
             break;
@@ -111,7 +31,7 @@ static u8 firewall_ip6_get_hdr(void *buf, unsigned int len, u8 hdr_type, void **
         case IP6_NEXTH_DESTOPTS: {
             struct ip6_dest_hdr *dest_hdr = (struct ip6_dest_hdr *)buf;
             if (len < sizeof(*dest_hdr))
-                return false;
+                goto truncated;
             hlen = 8 * (1 + dest_hdr->_hlen);
             nexth = &IP6_DEST_NEXTH(dest_hdr);
             break;
@@ -119,7 +39,7 @@ static u8 firewall_ip6_get_hdr(void *buf, unsigned int len, u8 hdr_type, void **
         case IP6_NEXTH_ROUTING: {
             struct ip6_rout_hdr *rout_hdr = (struct ip6_rout_hdr *)buf;
             if (len < sizeof(*rout_hdr))
-                return false;
+                goto truncated;
             hlen = 8 * (1 + rout_hdr->_hlen);
             nexth = &IP6_ROUT_NEXTH(rout_hdr);
             break;
@@ -131,10 +51,8 @@ static u8 firewall_ip6_get_hdr(void *buf, unsigned int len, u8 hdr_type, void **
         default:
             hlen = 0;
         }
-        if (len < hlen) {
-            buf = 0;
-            break;
-        }
+        if (len < hlen)
+            goto truncated;
         if ((*hdr == hdr_type) || !hlen)
             break;
         hdr = nexth;
@@ -143,6 +61,9 @@ static u8 firewall_ip6_get_hdr(void *buf, unsigned int len, u8 hdr_type, void **
     }
     *hdr_ptr = buf;
     return *hdr;
+  truncated:
+    *hdr_ptr = 0;
+    return *hdr;
 }
 
 static boolean firewall_ip6_is_fragment(struct ip6_hdr *hdr, unsigned int len)
@@ -153,119 +74,79 @@ static boolean firewall_ip6_is_fragment(struct ip6_hdr *hdr, unsigned int len)
            (frag_hdr->_fragment_offset & PP_HTONS(IP6_FRAG_OFFSET_MASK));
 }
 
-static boolean firewall_ip6_match(vector constraints, void *buf, unsigned int len, void **l4_hdr)
+/* Parses the packet header fields that can be matched by firewall rules. */
+static void firewall_parse_pkt(struct pbuf *p, firewall_pkt pkt)
 {
-    if (len < IP6_HLEN)
-        return false;
-    struct ip6_hdr *hdr = buf;
-    boolean frag_parsed = false;
-    boolean is_fragment;
-    firewall_constraint c;
-    vector_foreach(constraints, c) {
-        switch (c->type) {
-        case FW_L3_SRC:
-            if (!firewall_match_buf(&hdr->src, c))
-                return false;
-            break;
-        case FW_L3_FRAG:
-            if (!frag_parsed)
-                is_fragment = firewall_ip6_is_fragment(hdr, len);
-            if (!firewall_match_val(is_fragment, c))
-                return false;
-            break;
-        case FW_L3_PROTO: {
-            u8 proto = firewall_ip6_get_hdr(buf, len, IP6_NEXTH_NONE, l4_hdr);
-            if (!*l4_hdr || !firewall_match_val(proto, c))
-                return false;
-            if (!frag_parsed)
-                is_fragment = firewall_ip6_is_fragment(hdr, len);
-            if (is_fragment)
-                *l4_hdr = 0;
-            break;
-        }
-        }
+    void *buf = p->payload;
+    unsigned int len = p->len;
+    void *l4_hdr = 0;
+    zero(pkt, sizeof(*pkt));
+    pkt->ip_version = IP_HDR_GET_VERSION(buf);
+    if (pkt->ip_version == 4) {
+        struct ip_hdr *hdr = buf;
+        int hdr_len = IPH_HL_BYTES(hdr);
+        if (len < hdr_len)
+            return;
+        pkt->flags = FW_PKT_L3 | FW_PKT_PROTO;
+        runtime_memcpy(pkt->src, &hdr->src, sizeof(hdr->src));
+        pkt->proto = IPH_PROTO(hdr);
+        if (IPH_OFFSET(hdr) & lwip_htons(IP_OFFMASK))
+            pkt->flags |= FW_PKT_FRAG;
+        else
+            l4_hdr = buf + hdr_len;
+    } else if (pkt->ip_version == 6) {
+        if (len < IP6_HLEN)
+            return;
+        struct ip6_hdr *hdr = buf;
+        pkt->flags = FW_PKT_L3;
+        runtime_memcpy(pkt->src, &hdr->src, sizeof(hdr->src));
+        if (firewall_ip6_is_fragment(hdr, len))
+            pkt->flags |= FW_PKT_FRAG;
+        pkt->proto = firewall_ip6_get_hdr(buf, len, IP6_NEXTH_NONE, &l4_hdr);
+        if (l4_hdr)
+            pkt->flags |= FW_PKT_PROTO;
+        if (pkt->flags & FW_PKT_FRAG)
+            l4_hdr = 0;
+    } else {
+        return;
     }
-    return true;
-}
-
-static boolean firewall_tcp_match(vector constraints, void *buf, unsigned int len)
-{
-    struct tcp_hdr *hdr = buf;
-    if (len < sizeof(*hdr))
-        return false;
-    firewall_constraint c;
-    vector_foreach(constraints, c) {
-        switch (c->type) {
-        case FW_L4_DEST:
-            if (!firewall_match_val(hdr->dest, c))
-                return false;
-            break;
+    if (!l4_hdr)
+        return;
+    len -= l4_hdr - buf;
+    switch (pkt->proto) {
+    case IP_PROTO_TCP: {
+        struct tcp_hdr *hdr = l4_hdr;
+        if (len >= sizeof(*hdr)) {
+            pkt->flags |= FW_PKT_L4;
+            pkt->dest = hdr->dest;
         }
+        break;
     }
-    return true;
-}
-
-static boolean firewall_udp_match(vector constraints, void *buf, unsigned int len)
-{
-    struct udp_hdr *hdr = buf;
-    if (len < sizeof(*hdr))
-        return false;
-    firewall_constraint c;
-    vector_foreach(constraints, c) {
-        switch (c->type) {
-        case FW_L4_DEST:
-            if (!firewall_match_val(hdr->dest, c))
-                return false;
-            break;
+    case IP_PROTO_UDP: {
+        struct udp_hdr *hdr = l4_hdr;
+        if (len >= sizeof(*hdr)) {
+            pkt->flags |= FW_PKT_L4;
+            pkt->dest = hdr->dest;
         }
-    }
-    return true;
-}
-
-static boolean firewall_match(struct pbuf *p, firewall_rule rule)
-{
-    u8 ip_version = IP_HDR_GET_VERSION(p->payload);
-    if (rule->ip_version && (rule->ip_version != ip_version))
-        return false;
-    if (!rule->l3_match)
-        return true;
-    void *l4_hdr;
-    boolean (*l3_match_func)(vector, void *, unsigned int, void **);
-    l3_match_func = (ip_version == 4) ? firewall_ip4_match : firewall_ip6_match;
-    if (!l3_match_func(rule->l3_match, p->payload, p->len, &l4_hdr))
-        return false;
-    if (!rule->l4_match)
-        return true;
-    if (!l4_hdr)
-        return false;
-    boolean (*l4_match_func)(vector, void *, unsigned int);
-    switch (rule->l4_proto) {
-    case IP_PROTO_TCP:
-        l4_match_func = firewall_tcp_match;
-        break;
-    case IP_PROTO_UDP:
-        l4_match_func = firewall_udp_match;
         break;
-    default:
-        return false;   /* should never happen */
     }
-    return l4_match_func(rule->l4_match, l4_hdr, p->len - (l4_hdr - p->payload));
+    }
 }
 
 static int firewall_filter(struct pbuf *pbuf, struct netif *input_netif)
 {
-    list_foreach(&firewall.rules, elem) {
-        firewall_rule rule = struct_from_list(elem, firewall_rule, l);
-        if (firewall_match(pbuf, rule)) {
-            if (rule->drop)
-                goto drop_pkt;
-            break;
-        }
+    struct firewall_pkt pkt;
+    firewall_parse_pkt(pbuf, &pkt);
+    u64 flags = irq_disable_save();
+    u64 cpu = current_cpu()->id;
+    firewall_rule rule = firewall_classify(firewall.classifier, &pkt,
+                                           (cpu < firewall.ncaches) ? firewall.caches[cpu] : 0);
+    irq_restore(flags);
+    if (rule && rule->drop) {
+        pbuf_free(pbuf);
+        return 0;
     }
     return 1;
-  drop_pkt:
-    pbuf_free(pbuf);
-    return 0;
 }
 
 static firewall_constraint_val firewall_create_constraint_val(heap h, value v, int val_size)
@@ -504,7 +385,7 @@ static void firewall_dealloc_udp_constraint(heap h, firewall_constraint c)
     firewall_dealloc_l4_constraint(h, c);
 }
 
-static boolean firewall_create_rule(heap h, value spec)
+static boolean firewall_create_rule(heap h, value spec, u32 index)
 {
     if (!is_tuple(spec)) {
         msg_err("firewall: invalid rule '%v'", spec);
@@ -512,9 +393,11 @@ static boolean firewall_create_rule(heap h, value spec)
     }
     firewall_rule rule = allocate(h, sizeof(*rule));
     assert(rule != INVALID_ADDRESS);
+    rule->index = index;
     rule->ip_version = 0;
     rule->l4_proto = 0;
     rule->l3_match = rule->l4_match = 0;
+    rule->hits = 0;
     list_push_back(&firewall.rules, &rule->l);
     value ip4 = get(spec, sym(ip));
     if (ip4) {
@@ -601,6 +484,80 @@ static void firewall_destroy_rule(heap h, firewall_rule rule)
     deallocate(h, rule, sizeof(*rule));
 }
 
+typedef struct firewall_stats {
+    file f;
+    closure_struct(file_io, read);
+    closure_struct(fdesc_close, close);
+} *firewall_stats;
+
+/* Lists the number of packets matched by each rule, and by no rule. */
+closure_func_basic(file_io, sysreturn, firewall_stats_read,
+                   void *dest, u64 len, u64 offset_arg, context ctx, boolean bh,
+                   io_completion completion)
+{
+    firewall_stats stats = struct_from_field(closure_self(), firewall_stats, read);
+    buffer b = allocate_buffer(firewall.h, 64);
+    if (b == INVALID_ADDRESS)
+        return io_complete(completion, -ENOMEM);
+    list_foreach(&firewall.rules, elem) {
+        firewall_rule rule = struct_from_list(elem, firewall_rule, l);
+        bprintf(b, "%d %s %ld\n", rule->index, rule->drop ? ss("drop") : ss("accept"), rule->hits);
+    }
+    bprintf(b, "default accept %ld\n", firewall_default_hits(firewall.classifier));
+    boolean is_file_offset = (offset_arg == infinity);
+    u64 offset = is_file_offset ? stats->f->offset : offset_arg;
+    sysreturn rv = !context_set_err(ctx) ? buffer_read_at(b, offset, dest, len) : -EFAULT;
+    deallocate_buffer(b);
+    if ((rv > 0) && is_file_offset)
+        stats->f->offset += rv;
+    return io_complete(completion, rv);
+}
+
+closure_func_basic(fdesc_close, sysreturn, firewall_stats_close,
+                   context ctx, io_completion completion)
+{
+    firewall_stats stats = struct_from_field(closure_self(), firewall_stats, close);
+    file_release(stats->f);
+    deallocate(firewall.h, stats, sizeof(*stats));
+    return io_complete(completion, 0);
+}
+
+closure_func_basic(spec_file_open, sysreturn, firewall_stats_open,
+                   file f)
+{
+    firewall_stats stats = allocate(firewall.h, sizeof(*stats));
+    if (stats == INVALID_ADDRESS)
+        return -ENOMEM;
+    stats->f = f;
+    f->f.read = init_closure_func(&stats->read, file_io, firewall_stats_read);
+    f->f.close = init_closure_func(&stats->close, fdesc_close, firewall_stats_close);
+    return 0;
+}
+
+static boolean firewall_compile_rules(heap h)
+{
+    firewall.classifier = firewall_compile(h, &firewall.rules);
+    if (firewall.classifier == INVALID_ADDRESS)
+        return false;
+    firewall.ncaches = present_processors;
+    firewall.caches = allocate_zero(h, firewall.ncaches * sizeof(firewall_cache));
+    if (firewall.caches == INVALID_ADDRESS)
+        goto err_caches;
+    for (u64 cpu = 0; cpu < firewall.ncaches; cpu++) {
+        firewall.caches[cpu] = firewall_cache_alloc(h);
+        if (firewall.caches[cpu] == INVALID_ADDRESS) {
+            while (cpu-- > 0)
+                firewall_cache_dealloc(h, firewall.caches[cpu]);
+            deallocate(h, firewall.caches, firewall.ncaches * sizeof(firewall_cache));
+            goto err_caches;
+        }
+    }
+    return true;
+  err_caches:
+    firewall_classifier_destroy(firewall.classifier);
+    return false;
+}
+
 int init(status_handler complete)
 {
     tuple config = get(get_root_tuple(), sym(firewall));
@@ -620,12 +577,25 @@ int init(status_handler complete)
     list_init(&firewall.rules);
     value rule_spec;
     heap h = heap_locked(get_kernel_heaps());
+    firewall.h = h;
     for (int i = 0; (rule_spec = get(rules, integer_key(i))); i++) {
-        if (!firewall_create_rule(h, rule_spec))
+        if (!firewall_create_rule(h, rule_spec, i))
             goto err_dealloc_rules;
     }
-    if (!list_empty(&firewall.rules))
-        net_ip_input_filter = firewall_filter;
+    if (list_empty(&firewall.rules))
+        return KLIB_INIT_OK;
+    if (!firewall_compile_rules(h)) {
+        msg_err("firewall: failed to compile rules");
+        goto err_dealloc_rules;
+    }
+    net_ip_input_filter = firewall_filter;
+    spec_file_open open = closure_func(h, spec_file_open, firewall_stats_open);
+    if (open == INVALID_ADDRESS) {
+        msg_warn("firewall: failed to allocate statistics file");
+    } else if (!create_special_file(ss("/sys/firewall/stats"), open, 0, 0)) {
+        msg_warn("firewall: failed to create statistics file");
+        deallocate_closure(open);
+    }
     return KLIB_INIT_OK;
   err_dealloc_rules:
     list_foreach(&firewall.rules, elem) {
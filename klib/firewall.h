@@ -0,0 +1,64 @@
+typedef struct firewall_rule {
+    struct list l;
+    u32 index;  /* position in the rule list: lower values take precedence */
+    u8 ip_version;
+    u8 l4_proto;
+    vector l3_match;
+    vector l4_match;
+    boolean drop;
+    u64 hits;
+} *firewall_rule;
+
+typedef struct firewall_constraint {
+    int type;
+    boolean equals;
+} *firewall_constraint;
+
+enum firewall_l3_constraint {
+    FW_L3_SRC,
+    FW_L3_FRAG,
+    FW_L3_PROTO,
+};
+
+enum firewall_l4_constraint {
+    FW_L4_DEST,
+};
+
+typedef struct firewall_constraint_val {
+    struct firewall_constraint c;
+    u64 val;    /* multi-byte values are in network byte order */
+} *firewall_constraint_val;
+
+typedef struct firewall_constraint_buf {
+    struct firewall_constraint c;
+    u64 len;    /* expressed in number of bits */
+    u8 buf[0];
+} *firewall_constraint_buf;
+
+/* Packet header fields matched by firewall rules, parsed once for each packet. */
+#define FW_PKT_L3       U64_FROM_BIT(0) /* network header is complete */
+#define FW_PKT_FRAG     U64_FROM_BIT(1) /* non-first fragment */
+#define FW_PKT_PROTO    U64_FROM_BIT(2) /* transport protocol could be determined */
+#define FW_PKT_L4       U64_FROM_BIT(3) /* transport header is complete (TCP and UDP only) */
+
+typedef struct firewall_pkt {
+    u8 ip_version;
+    u8 flags;
+    u8 proto;
+    u8 pad;
+    u16 dest;   /* network byte order */
+    u8 src[16];
+} *firewall_pkt;
+
+typedef struct firewall_classifier *firewall_classifier;
+typedef struct firewall_cache *firewall_cache;
+
+boolean firewall_rule_match(firewall_rule rule, firewall_pkt pkt);
+firewall_rule firewall_linear_lookup(struct list *rules, firewall_pkt pkt);
+
+firewall_classifier firewall_compile(heap h, struct list *rules);
+void firewall_classifier_destroy(firewall_classifier fc);
+firewall_cache firewall_cache_alloc(heap h);
+void firewall_cache_dealloc(heap h, firewall_cache cache);
+firewall_rule firewall_classify(firewall_classifier fc, firewall_pkt pkt, firewall_cache cache);
+u64 firewall_default_hits(firewall_classifier fc);
@@ -0,0 +1,376 @@
+/* Firewall rule classifier: rules are compiled into lookup structures indexed by the most selective
+ * exact-match constraint of each rule (full source address, transport destination port, source
+ * address prefix), so that the rules tested against a packet are only those that could match it.
+ * First-match semantics are preserved by keeping the rules in each lookup structure in rule order,
+ * and by evaluating each candidate list only up to the best match found so far.
+ * Decisions are memoized in a direct-mapped cache keyed by the parsed packet header fields, so that
+ * packets of an established flow are classified with a single lookup. */
+
+#include <runtime.h>
+#include "firewall.h"
+
+#define FW_CACHE_SIZE   256 /* must be a power of 2 */
+
+typedef struct fw_addr {
+    u8 ip_version;
+    u8 addr[16];
+} *fw_addr;
+
+typedef struct fw_trie_node {
+    struct fw_trie_node *child[2];
+    vector rules;
+} *fw_trie_node;
+
+struct firewall_classifier {
+    heap h;
+    table addr_rules;               /* exact source address */
+    table port_rules;               /* exact transport protocol and destination port */
+    fw_trie_node prefix_rules[2];   /* source address prefix (IPv4 and IPv6) */
+    vector other_rules;
+    u64 default_hits;
+};
+
+struct firewall_cache {
+    struct fw_cache_entry {
+        struct firewall_pkt pkt;
+        firewall_rule rule; /* INVALID_ADDRESS if no rule matches, 0 if unused */
+    } entries[FW_CACHE_SIZE];
+};
+
+static boolean firewall_match_val(u64 val, firewall_constraint c)
+{
+    firewall_constraint_val c_val = struct_from_field(c, firewall_constraint_val, c);
+    return ((val == c_val->val) == c->equals);
+}
+
+static boolean firewall_match_buf(void *buf, firewall_constraint c)
+{
+    firewall_constraint_buf c_buf = struct_from_field(c, firewall_constraint_buf, c);
+    u64 byte_count = c_buf->len / 8;
+    if (byte_count) {
+        boolean match = !runtime_memcmp(buf, c_buf->buf, byte_count);
+        if (!match)
+            return c->equals ? false : true;
+    }
+    u64 bit_count = c_buf->len & 7;
+    if (!bit_count)
+        return true;
+    u8 bit_mask = ~MASK(8 - bit_count);
+    u8 b = ((u8 *)buf)[byte_count] & bit_mask;
+    return ((b == (c_buf->buf[byte_count] & bit_mask)) == c->equals);
+}
+
+boolean firewall_rule_match(firewall_rule rule, firewall_pkt pkt)
+{
+    if (rule->ip_version && (rule->ip_version != pkt->ip_version))
+        return false;
+    if (!rule->l3_match)
+        return true;
+    if (!(pkt->flags & FW_PKT_L3))
+        return false;
+    firewall_constraint c;
+    vector_foreach(rule->l3_match, c) {
+        switch (c->type) {
+        case FW_L3_SRC:
+            if (!firewall_match_buf(pkt->src, c))
+                return false;
+            break;
+        case FW_L3_FRAG:
+            if (!firewall_match_val((pkt->flags & FW_PKT_FRAG) != 0, c))
+                return false;
+            break;
+        case FW_L3_PROTO:
+            if (!(pkt->flags & FW_PKT_PROTO) || !firewall_match_val(pkt->proto, c))
+                return false;
+            break;
+        }
+    }
+    if (!rule->l4_match)
+        return true;
+    if (!(pkt->flags & FW_PKT_L4))
+        return false;
+    vector_foreach(rule->l4_match, c) {
+        switch (c->type) {
+        case FW_L4_DEST:
+            if (!firewall_match_val(pkt->dest, c))
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+/* Reference evaluator: walks the rule list in order. */
+firewall_rule firewall_linear_lookup(struct list *rules, firewall_pkt pkt)
+{
+    list_foreach(rules, elem) {
+        firewall_rule rule = struct_from_list(elem, firewall_rule, l);
+        if (firewall_rule_match(rule, pkt))
+            return rule;
+    }
+    return 0;
+}
+
+static u64 fw_hash(const void *p, bytes len)
+{
+    const u8 *b = p;
+    u64 hash = 0xcbf29ce484222325ull;
+    for (bytes i = 0; i < len; i++) {
+        hash ^= b[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static key fw_addr_key(void *a)
+{
+    return fw_hash(a, sizeof(struct fw_addr));
+}
+
+static boolean fw_addr_equal(void *a, void *b)
+{
+    return !runtime_memcmp(a, b, sizeof(struct fw_addr));
+}
+
+static inline void *fw_port_key(u8 proto, u16 port)
+{
+    return pointer_from_u64(((u64)proto << 16) | port);
+}
+
+static inline int fw_addr_bits(u8 ip_version)
+{
+    return (ip_version == 4) ? 32 : 128;
+}
+
+static boolean fw_vector_push(heap h, vector *v, firewall_rule rule)
+{
+    if (!*v) {
+        *v = allocate_vector(h, 1);
+        if (*v == INVALID_ADDRESS)
+            return false;
+    }
+    vector_push(*v, rule);
+    return true;
+}
+
+static boolean fw_add_addr_rule(firewall_classifier fc, firewall_rule rule,
+                                firewall_constraint_buf src)
+{
+    struct fw_addr k;
+    zero(&k, sizeof(k));
+    k.ip_version = rule->ip_version;
+    runtime_memcpy(k.addr, src->buf, src->len / 8);
+    vector rules = table_find(fc->addr_rules, &k);
+    if (rules)
+        return fw_vector_push(fc->h, &rules, rule);
+    fw_addr a = allocate(fc->h, sizeof(*a));
+    if (a == INVALID_ADDRESS)
+        return false;
+    runtime_memcpy(a, &k, sizeof(k));
+    rules = 0;
+    if (!fw_vector_push(fc->h, &rules, rule)) {
+        deallocate(fc->h, a, sizeof(*a));
+        return false;
+    }
+    table_set(fc->addr_rules, a, rules);
+    return true;
+}
+
+static boolean fw_add_port_rule(firewall_classifier fc, firewall_rule rule,
+                                firewall_constraint_val dest)
+{
+    void *k = fw_port_key(rule->l4_proto, dest->val);
+    vector rules = table_find(fc->port_rules, k);
+    boolean new = (rules == 0);
+    if (!fw_vector_push(fc->h, &rules, rule))
+        return false;
+    if (new)
+        table_set(fc->port_rules, k, rules);
+    return true;
+}
+
+static boolean fw_add_prefix_rule(firewall_classifier fc, firewall_rule rule,
+                                  firewall_constraint_buf src)
+{
+    fw_trie_node *np = &fc->prefix_rules[rule->ip_version == 6];
+    for (u64 bit = 0; ; bit++) {
+        if (!*np) {
+            *np = allocate_zero(fc->h, sizeof(struct fw_trie_node));
+            if (*np == INVALID_ADDRESS) {
+                *np = 0;
+                return false;
+            }
+        }
+        if (bit == src->len)
+            break;
+        np = &(*np)->child[(src->buf[bit / 8] >> (7 - (bit & 7))) & 1];
+    }
+    return fw_vector_push(fc->h, &(*np)->rules, rule);
+}
+
+static void fw_trie_destroy(heap h, fw_trie_node n)
+{
+    if (!n)
+        return;
+    fw_trie_destroy(h, n->child[0]);
+    fw_trie_destroy(h, n->child[1]);
+    if (n->rules)
+        deallocate_vector(n->rules);
+    deallocate(h, n, sizeof(*n));
+}
+
+/* Each rule is indexed by a single constraint, i.e. the one that is expected to be the most
+ * selective; the other constraints are checked when the rule is evaluated. */
+firewall_classifier firewall_compile(heap h, struct list *rules)
+{
+    firewall_classifier fc = allocate_zero(h, sizeof(*fc));
+    if (fc == INVALID_ADDRESS)
+        return fc;
+    fc->h = h;
+    fc->addr_rules = allocate_table(h, fw_addr_key, fw_addr_equal);
+    if (fc->addr_rules == INVALID_ADDRESS)
+        goto error;
+    fc->port_rules = allocate_table(h, identity_key, pointer_equal);
+    if (fc->port_rules == INVALID_ADDRESS)
+        goto error;
+    list_foreach(rules, elem) {
+        firewall_rule rule = struct_from_list(elem, firewall_rule, l);
+        firewall_constraint_buf src = 0;
+        firewall_constraint_val dest = 0;
+        firewall_constraint c;
+        if (rule->l3_match)
+            vector_foreach(rule->l3_match, c) {
+                if ((c->type == FW_L3_SRC) && c->equals)
+                    src = (firewall_constraint_buf)c;
+            }
+        if (rule->l4_match)
+            vector_foreach(rule->l4_match, c) {
+                if ((c->type == FW_L4_DEST) && c->equals)
+                    dest = (firewall_constraint_val)c;
+            }
+        boolean added;
+        if (src && (src->len == fw_addr_bits(rule->ip_version)))
+            added = fw_add_addr_rule(fc, rule, src);
+        else if (dest)
+            added = fw_add_port_rule(fc, rule, dest);
+        else if (src)
+            added = fw_add_prefix_rule(fc, rule, src);
+        else
+            added = fw_vector_push(h, &fc->other_rules, rule);
+        if (!added)
+            goto error;
+    }
+    return fc;
+  error:
+    firewall_classifier_destroy(fc);
+    return INVALID_ADDRESS;
+}
+
+void firewall_classifier_destroy(firewall_classifier fc)
+{
+    heap h = fc->h;
+    if (fc->addr_rules && (fc->addr_rules != INVALID_ADDRESS)) {
+        table_foreach(fc->addr_rules, a, rules) {
+            deallocate(h, a, sizeof(struct fw_addr));
+            deallocate_vector(rules);
+        }
+        deallocate_table(fc->addr_rules);
+    }
+    if (fc->port_rules && (fc->port_rules != INVALID_ADDRESS)) {
+        table_foreach(fc->port_rules, k, rules) {
+            (void)k;
+            deallocate_vector(rules);
+        }
+        deallocate_table(fc->port_rules);
+    }
+    for (int i = 0; i < 2; i++)
+        fw_trie_destroy(h, fc->prefix_rules[i]);
+    if (fc->other_rules)
+        deallocate_vector(fc->other_rules);
+    deallocate(h, fc, sizeof(*fc));
+}
+
+firewall_cache firewall_cache_alloc(heap h)
+{
+    return allocate_zero(h, sizeof(struct firewall_cache));
+}
+
+void firewall_cache_dealloc(heap h, firewall_cache cache)
+{
+    deallocate(h, cache, sizeof(*cache));
+}
+
+/* Candidate rules are sorted by rule index, thus evaluation can stop at the first matching rule,
+ * or at the first rule that comes after the current best match. */
+static void fw_candidates(vector rules, firewall_pkt pkt, firewall_rule *best)
+{
+    if (!rules)
+        return;
+    firewall_rule rule;
+    vector_foreach(rules, rule) {
+        if (*best && (rule->index >= (*best)->index))
+            return;
+        if (firewall_rule_match(rule, pkt)) {
+            *best = rule;
+            return;
+        }
+    }
+}
+
+static firewall_rule fw_lookup(firewall_classifier fc, firewall_pkt pkt)
+{
+    firewall_rule best = 0;
+    boolean ip = (pkt->ip_version == 4) || (pkt->ip_version == 6);
+    if (ip && (pkt->flags & FW_PKT_L3)) {
+        struct fw_addr k;
+        zero(&k, sizeof(k));
+        k.ip_version = pkt->ip_version;
+        int bits = fw_addr_bits(pkt->ip_version);
+        runtime_memcpy(k.addr, pkt->src, bits / 8);
+        fw_candidates(table_find(fc->addr_rules, &k), pkt, &best);
+        fw_trie_node n = fc->prefix_rules[pkt->ip_version == 6];
+        for (int bit = 0; n; bit++) {
+            fw_candidates(n->rules, pkt, &best);
+            if (bit == bits)
+                break;
+            n = n->child[(pkt->src[bit / 8] >> (7 - (bit & 7))) & 1];
+        }
+    }
+    if (pkt->flags & FW_PKT_L4)
+        fw_candidates(table_find(fc->port_rules, fw_port_key(pkt->proto, pkt->dest)), pkt, &best);
+    fw_candidates(fc->other_rules, pkt, &best);
+    return best;
+}
+
+/* The cache (if any) must not be used concurrently by multiple callers. */
+firewall_rule firewall_classify(firewall_classifier fc, firewall_pkt pkt, firewall_cache cache)
+{
+    firewall_rule rule;
+    struct fw_cache_entry *e = 0;
+    if (cache) {
+        e = &cache->entries[fw_hash(pkt, sizeof(*pkt)) & (FW_CACHE_SIZE - 1)];
+        if (e->rule && !runtime_memcmp(&e->pkt, pkt, sizeof(*pkt))) {
+            rule = e->rule;
+            goto done;
+        }
+    }
+    rule = fw_lookup(fc, pkt);
+    if (!rule)
+        rule = INVALID_ADDRESS;
+    if (cache) {
+        runtime_memcpy(&e->pkt, pkt, sizeof(*pkt));
+        e->rule = rule;
+    }
+  done:
+    if (rule == INVALID_ADDRESS) {
+        fetch_and_add(&fc->default_hits, 1);
+        return 0;
+    }
+    fetch_and_add(&rule->hits, 1);
+    return rule;
+}
+
+u64 firewall_default_hits(firewall_classifier fc)
+{
+    return fc->default_hits;
+}
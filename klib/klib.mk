@@ -40,6 +40,7 @@ SRCS-digitalocean= \
 
 SRCS-firewall= \
 	$(KLIB_DIR)/firewall.c \
+	$(KLIB_DIR)/firewall_classifier.c \
 
 SRCS-gcp= \
 	$(KLIB_DIR)/gcp.c \
@@ -4,6 +4,7 @@
 #define _RUNTIME_H_ /* guard against double inclusion of runtime.h */
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/entropy.h>
+#include <mbedtls/gcm.h>
 #include <mbedtls/ssl.h>
 
 typedef struct tls_conn {
@@ -258,6 +259,42 @@ int tls_connect(ip_addr_t *addr, u16 port, connection_handler ch)
     return ret;
 }
 
+/* AEAD cipher for kernel TLS */
+
+static void *tls_aead_alloc(heap h, const u8 *key, u32 key_len)
+{
+    mbedtls_gcm_context *gcm = allocate(h, sizeof(*gcm));
+    if (gcm == INVALID_ADDRESS)
+        return 0;
+    mbedtls_gcm_init(gcm);
+    if (mbedtls_gcm_setkey(gcm, MBEDTLS_CIPHER_ID_AES, key, key_len * 8)) {
+        mbedtls_gcm_free(gcm);
+        deallocate(h, gcm, sizeof(*gcm));
+        return 0;
+    }
+    return gcm;
+}
+
+static void tls_aead_free(heap h, void *aead)
+{
+    mbedtls_gcm_context *gcm = aead;
+    mbedtls_gcm_free(gcm);
+    deallocate(h, gcm, sizeof(*gcm));
+}
+
+static boolean tls_aead_encrypt(void *aead, const u8 *nonce, const u8 *aad, u32 aad_len,
+                                const void *in, u32 len, u8 *out, u8 *tag)
+{
+    return (mbedtls_gcm_crypt_and_tag(aead, MBEDTLS_GCM_ENCRYPT, len, nonce, 12, aad, aad_len,
+                                      in, out, 16, tag) == 0);
+}
+
+static const struct ktls_aead_ops tls_aead_ops = {
+    .alloc = tls_aead_alloc,
+    .free = tls_aead_free,
+    .encrypt = tls_aead_encrypt,
+};
+
 int init(status_handler complete)
 {
     tls.h = heap_malloc();
@@ -272,6 +309,7 @@ int init(status_handler complete)
         MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
     mbedtls_ssl_conf_authmode(&tls.conf, MBEDTLS_SSL_VERIFY_NONE);
     mbedtls_ssl_conf_rng(&tls.conf, mbedtls_ctr_drbg_random, &tls.ctr_drbg);
+    ktls_aead = &tls_aead_ops;
     return KLIB_INIT_OK;
 }
 
@@ -25,6 +25,7 @@
 #define TUN_PKT_STRIP   0x0001
 
 #define TUN_QUEUE_LEN   512
+#define TUN_MAX_QUEUES  256
 
 typedef struct tun_pi { /* packet information */
     u16 flags;
@@ -39,9 +40,12 @@ typedef struct tun_file {
     struct tun *tun;
     closure_struct(file_io, read);
     closure_struct(file_io, write);
+    closure_struct(file_iov, readv);
+    closure_struct(file_iov, writev);
     closure_struct(fdesc_events, events);
     closure_struct(fdesc_ioctl, ioctl);
     closure_struct(fdesc_close, close);
+    u16 queue_index;
     boolean attached;
 } *tun_file;
 
@@ -50,7 +54,8 @@ typedef struct tun {
     struct spinlock lock;
     struct list files;
     short flags;
-    tun_file next_tx;
+    u16 num_queues;
+    tun_file queues[TUN_MAX_QUEUES];    /* attached files */
 } *tun;
 
 static heap tun_heap;
@@ -62,39 +67,44 @@ static void notify_events(fdesc f)
     notify_dispatch(f->ns, events);
 }
 
+static void tun_attach_queue(tun t, tun_file tf)
+{
+    tf->queue_index = t->num_queues;
+    t->queues[t->num_queues++] = tf;
+    tf->attached = true;
+}
+
+static void tun_detach_queue(tun t, tun_file tf)
+{
+    tun_file last = t->queues[--t->num_queues];
+    t->queues[tf->queue_index] = last;
+    last->queue_index = tf->queue_index;
+    tf->attached = false;
+}
+
 static err_t tun_if_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
 {
     tun t = netif->state;
-    u64 min_ql = U64_MAX;
-    tun_file selected = 0;
+    tun_file selected;
     int ret = ERR_WOULDBLOCK;
     spin_lock(&t->lock);
-    tun_file f = t->next_tx;
-    if (f) {
-        do {
-            if (f->attached) {
-                u64 len = queue_length(f->pq);
-                if (len == 0) {
-                    selected = f;
-                    break;
-                }
-                if (len < min_ql) {
-                    selected = f;
-                    min_ql = len;
-                }
-            }
-            list next = f->l.next;
-            if (next == &t->files)
-                next = next->next;
-            f = struct_from_list(next, tun_file, l);
-        } while (f != t->next_tx);
-        if (selected && enqueue(selected->pq, p)) {
-            pbuf_ref(p);
-            if (blockq_wake_one(selected->bq) == INVALID_ADDRESS)
-                notify_events(&selected->f->f);
-            t->next_tx = selected;
-            ret = ERR_OK;
-        }
+    switch (t->num_queues) {
+    case 0:
+        selected = 0;
+        break;
+    case 1:
+        selected = t->queues[0];
+        break;
+    default:
+        /* Steer all packets of a given flow to the same queue, so that each flow is handled by a
+         * single reader (and packets of a flow are not reordered). */
+        selected = t->queues[net_flow_hash(p) % t->num_queues];
+    }
+    if (selected && enqueue(selected->pq, p)) {
+        pbuf_ref(p);
+        if (blockq_wake_one(selected->bq) == INVALID_ADDRESS)
+            notify_events(&selected->f->f);
+        ret = ERR_OK;
     }
     spin_unlock(&t->lock);
     return ret;
@@ -108,17 +118,73 @@ static err_t tun_if_init(struct netif *netif)
     return ERR_OK;
 }
 
-closure_function(4, 1, sysreturn, tun_read_bh,
-                 tun_file, tf, void *, dest, u64, len, io_completion, completion,
+/* Copies a packet to a user buffer scattered over an iovec array (prepending packet information
+ * if enabled); must be called with context error handling set up. */
+static sysreturn tun_copy_packet(tun tun, struct pbuf *p, struct iovec *iov, int iovcnt)
+{
+    u64 len = iov_total_len(iov, iovcnt);
+    struct tun_pi pi;
+    u64 pi_len;
+    if (!(tun->flags & IFF_NO_PI)) {
+        if (len < sizeof(pi))
+            return -EINVAL;
+        if (len < p->tot_len + sizeof(pi))
+            pi.flags = TUN_PKT_STRIP;
+        else
+            pi.flags = 0;
+        int ip_version = IPH_V((struct ip_hdr *)p->payload);
+        switch (ip_version) {
+        case 4:
+            pi.proto = htons(ETHTYPE_IP);
+            break;
+        case 6:
+            pi.proto = htons(ETHTYPE_IPV6);
+            break;
+        }
+        pi_len = sizeof(pi);
+    } else {
+        pi_len = 0;
+    }
+    u64 total = pi_len + MIN(len - pi_len, p->tot_len);
+    u64 offset = 0;
+    for (int i = 0; (i < iovcnt) && (offset < total); i++) {
+        void *dest = iov[i].iov_base;
+        u64 n = MIN(iov[i].iov_len, total - offset);
+        if (offset < pi_len) {
+            u64 l = MIN(n, pi_len - offset);
+            runtime_memcpy(dest, (void *)&pi + offset, l);
+            dest += l;
+            offset += l;
+            n -= l;
+        }
+        if (n > 0) {
+            pbuf_copy_partial(p, dest, n, offset - pi_len);
+            offset += n;
+        }
+    }
+    return total;
+}
+
+/* Reads one packet, scattering it over the buffers of an iovec array. */
+closure_function(6, 1, sysreturn, tun_read_bh,
+                 tun_file, tf, struct iovec *, iov, int, iovcnt, void *, dest, u64, len, io_completion, completion,
                  u64 flags)
 {
     tun_file tf = bound(tf);
     tun tun = tf->tun;
-    sysreturn ret;
+    struct iovec *iov = bound(iov);
+    int iovcnt = bound(iovcnt);
+    struct iovec single;
+    sysreturn ret = 0;
     if (flags & BLOCKQ_ACTION_NULLIFY) {
         ret = -ERESTARTSYS;
         goto out;
     }
+    if (!iov) {
+        single.iov_base = bound(dest);
+        single.iov_len = bound(len);
+        iov = &single;
+    }
     context ctx = get_current_context(current_cpu());
     struct pbuf *p = dequeue(tf->pq);
     if (p == INVALID_ADDRESS) {
@@ -128,43 +194,13 @@ closure_function(4, 1, sysreturn, tun_read_bh,
         }
         return blockq_block_required((unix_context)ctx, flags);
     }
-    void * dest = bound(dest);
-    u64 len = bound(len);
     if (context_set_err(ctx)) {
         ret = -EFAULT;
-        pbuf_free(p);
-        goto out;
-    }
-    if (!(tun->flags & IFF_NO_PI)) {
-        struct tun_pi pi;
-        if (len < sizeof(pi)) {
-            ret = -EINVAL;
-            pbuf_free(p);
-            goto out;
-        }
-        if (len < p->tot_len + sizeof(pi))
-            pi.flags = TUN_PKT_STRIP;
-        else
-            pi.flags = 0;
-        int ip_version = IPH_V((struct ip_hdr *)p->payload);
-        switch (ip_version) {
-        case 4:
-            pi.proto = htons(ETHTYPE_IP);
-            break;
-        case 6:
-            pi.proto = htons(ETHTYPE_IPV6);
-            break;
-        }
-        runtime_memcpy(dest, &pi, sizeof(pi));
-        dest += sizeof(pi);
-        len -= sizeof(pi);
+    } else {
+        ret = tun_copy_packet(tun, p, iov, iovcnt);
+        context_clear_err(ctx);
     }
-    ret = MIN(len, p->tot_len);
-    pbuf_copy_partial(p, dest, ret, 0);
-    context_clear_err(ctx);
     pbuf_free(p);
-    if (!(tun->flags & IFF_NO_PI))
-        ret += sizeof(struct tun_pi);
   out:
     apply(bound(completion), ret);
     if (queue_empty(tf->pq))
@@ -173,59 +209,109 @@ closure_function(4, 1, sysreturn, tun_read_bh,
     return ret;
 }
 
-closure_func_basic(file_io, sysreturn, tun_read,
-                   void *dest, u64 len, u64 offset_arg, context ctx, boolean bh, io_completion completion)
+static sysreturn tun_read_internal(tun_file tf, struct iovec *iov, int iovcnt, void *dest, u64 len,
+                                   context ctx, boolean bh, io_completion completion)
 {
-    tun_file tf = struct_from_closure(tun_file, read);
-    tun tun = tf->tun;
-    if (!tun)
+    if (!tf->tun)
         return io_complete(completion, -EBADFD);
-    blockq_action ba = closure_from_context(ctx, tun_read_bh, tf, dest, len, completion);
+    blockq_action ba = closure_from_context(ctx, tun_read_bh, tf, iov, iovcnt, dest, len,
+                                            completion);
     if (ba == INVALID_ADDRESS)
         return io_complete(completion, -ENOMEM);
     return blockq_check(tf->bq, ba, bh);
 }
 
-closure_func_basic(file_io, sysreturn, tun_write,
-                   void *src, u64 len, u64 offset, context ctx, boolean bh, io_completion completion)
+closure_func_basic(file_io, sysreturn, tun_read,
+                   void *dest, u64 len, u64 offset_arg, context ctx, boolean bh, io_completion completion)
 {
-    tun_file tf = struct_from_closure(tun_file, write);
-    tun tun = tf->tun;
-    if (!tun)
-        return io_complete(completion, -EBADFD);
+    tun_file tf = struct_from_closure(tun_file, read);
+    return tun_read_internal(tf, 0, 1, dest, len, ctx, bh, completion);
+}
+
+closure_func_basic(file_iov, sysreturn, tun_readv,
+                   struct iovec *iov, int count, u64 offset, context ctx, boolean bh, io_completion completion)
+{
+    tun_file tf = struct_from_closure(tun_file, readv);
+    return tun_read_internal(tf, iov, count, 0, 0, ctx, bh, completion);
+}
+
+/* Allocates a pbuf and fills it with a packet gathered from the buffers of an iovec array. */
+static sysreturn tun_get_packet(tun tun, struct iovec *iov, int iovcnt, context ctx, struct pbuf **pp)
+{
+    *pp = 0;
+    u64 len = iov_total_len(iov, iovcnt);
+    u64 pi_len;
     if (tun->flags & IFF_NO_PI) {
         if (len == 0)
-            return io_complete(completion, -EINVAL);
+            return -EINVAL;
+        pi_len = 0;
     } else {
         if (len < sizeof(struct tun_pi))
-            return io_complete(completion, -EINVAL);
+            return -EINVAL;
         if (len == sizeof(struct tun_pi))
-            return io_complete(completion, len);
+            return len;
 
         /* Discard packet information. */
-        src += sizeof(struct tun_pi);
-        len -= sizeof(struct tun_pi);
+        pi_len = sizeof(struct tun_pi);
     }
-    struct pbuf *p = pbuf_alloc(PBUF_LINK, len, PBUF_POOL);
+    if (len - pi_len > U16_MAX)
+        return -EINVAL;
+    struct pbuf *p = pbuf_alloc(PBUF_LINK, len - pi_len, PBUF_POOL);
     if (!p)
-        return io_complete(completion, -ENOMEM);
-    u64 copied = 0;
-    struct pbuf *q = p;
+        return -ENOMEM;
     if (context_set_err(ctx)) {
         pbuf_free(p);
-        return io_complete(completion, -EFAULT);
+        return -EFAULT;
+    }
+    u64 offset = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        void *src = iov[i].iov_base;
+        u64 n = iov[i].iov_len;
+        if (offset < pi_len) {
+            u64 l = MIN(n, pi_len - offset);
+            src += l;
+            offset += l;
+            n -= l;
+        }
+        if (n > 0) {
+            pbuf_take_at(p, src, n, offset - pi_len);
+            offset += n;
+        }
     }
-    do {
-        runtime_memcpy(q->payload, src + copied, q->len);
-        copied += q->len;
-        q = q->next;
-    } while (q);
     context_clear_err(ctx);
-    struct netif *n = &tun->ndev.n;
-    n->input(p, n);
-    if (!(tun->flags & IFF_NO_PI))
-        len += sizeof(struct tun_pi);
-    return io_complete(completion, len);
+    *pp = p;
+    return len;
+}
+
+/* Injects a packet gathered from the buffers of an iovec array into the network stack. */
+static sysreturn tun_write_internal(tun_file tf, struct iovec *iov, int iovcnt, context ctx,
+                                    io_completion completion)
+{
+    tun tun = tf->tun;
+    if (!tun)
+        return io_complete(completion, -EBADFD);
+    struct pbuf *p;
+    sysreturn ret = tun_get_packet(tun, iov, iovcnt, ctx, &p);
+    if (p) {
+        struct netif *n = &tun->ndev.n;
+        n->input(p, n);
+    }
+    return io_complete(completion, ret);
+}
+
+closure_func_basic(file_io, sysreturn, tun_write,
+                   void *src, u64 len, u64 offset, context ctx, boolean bh, io_completion completion)
+{
+    tun_file tf = struct_from_closure(tun_file, write);
+    struct iovec iov = {src, len};
+    return tun_write_internal(tf, &iov, 1, ctx, completion);
+}
+
+closure_func_basic(file_iov, sysreturn, tun_writev,
+                   struct iovec *iov, int count, u64 offset, context ctx, boolean bh, io_completion completion)
+{
+    tun_file tf = struct_from_closure(tun_file, writev);
+    return tun_write_internal(tf, iov, count, ctx, completion);
 }
 
 closure_func_basic(fdesc_events, u32, tun_events,
@@ -297,8 +383,10 @@ closure_func_basic(fdesc_ioctl, sysreturn, tun_ioctl,
             if (is_tun)
                 tun = netif->state;
             netif_unref(netif);
-            if (!is_tun)
+            if (!is_tun || ((tun->flags ^ ifreq->ifr.ifr_flags) & IFF_MULTI_QUEUE))
                 return -EINVAL;
+            if (!(tun->flags & IFF_MULTI_QUEUE))
+                return -EBUSY;
         } else {
             tun = allocate(tun_heap, sizeof(struct tun));
             if (tun == INVALID_ADDRESS)
@@ -323,16 +411,20 @@ closure_func_basic(fdesc_ioctl, sysreturn, tun_ioctl,
             netif_add(n, &ipaddr, &netmask, &ipaddr, tun, tun_if_init, netif_input);
             netif_name_cpy(ifreq->ifr_name, n);
             list_init(&tun->files);
-            tun->next_tx = tf;
+            tun->num_queues = 0;
             if (mtu > 0)
                 n->mtu = mtu;
             if (bringup)
                 netif_set_up(n);
         }
         spin_lock(&tun->lock);
+        if (tun->num_queues == TUN_MAX_QUEUES) {
+            spin_unlock(&tun->lock);
+            return -E2BIG;
+        }
         list_push_back(&tun->files, &tf->l);
         tf->tun = tun;
-        tf->attached = true;
+        tun_attach_queue(tun, tf);
         spin_unlock(&tun->lock);
         break;
     }
@@ -356,10 +448,19 @@ closure_func_basic(fdesc_ioctl, sysreturn, tun_ioctl,
         if ((flags & ~(IFF_ATTACH_QUEUE|IFF_DETACH_QUEUE)) ||
             (flags ^ (IFF_ATTACH_QUEUE|IFF_DETACH_QUEUE)) == 0)
             return -EINVAL;
-        if (flags == IFF_ATTACH_QUEUE)
-            tf->attached = true;
+        if (!tun || !(tun->flags & IFF_MULTI_QUEUE))
+            return -EINVAL;
+        sysreturn rv = 0;
+        spin_lock(&tun->lock);
+        if ((flags == IFF_ATTACH_QUEUE) == tf->attached)
+            rv = -EINVAL;
+        else if (flags == IFF_ATTACH_QUEUE)
+            tun_attach_queue(tun, tf);
         else
-            tf->attached = false;
+            tun_detach_queue(tun, tf);
+        spin_unlock(&tun->lock);
+        if (rv)
+            return rv;
         break;
     }
     default:
@@ -377,17 +478,15 @@ closure_func_basic(fdesc_close, sysreturn, tun_close,
     if (tun) {
         spin_lock(&tun->lock);
         list_delete(&tf->l);
+        if (tf->attached)
+            tun_detach_queue(tun, tf);
         if (list_empty(&tun->files)) {
-            tun->next_tx = 0;
             spin_unlock(&tun->lock);
             netif_remove(&tun->ndev.n);
-            deallocate(tun_heap, tun, sizeof(struct tun_file));
-            tun = 0;
-        } else if (tun->next_tx == tf) {
-            tun->next_tx = struct_from_list(tun->files.next, tun_file, l);
-        }
-        if (tun)
+            deallocate(tun_heap, tun, sizeof(struct tun));
+        } else {
             spin_unlock(&tun->lock);
+        }
     }
     deallocate_blockq(tf->bq);
     deallocate_queue(tf->pq);
@@ -405,6 +504,8 @@ closure_func_basic(spec_file_open, sysreturn, tun_open,
     *tf = (struct tun_file){};
     f->f.read = init_closure_func(&tf->read, file_io, tun_read);
     f->f.write = init_closure_func(&tf->write, file_io, tun_write);
+    f->f.readv = init_closure_func(&tf->readv, file_iov, tun_readv);
+    f->f.writev = init_closure_func(&tf->writev, file_iov, tun_writev);
     f->f.events = init_closure_func(&tf->events, fdesc_events, tun_events);
     f->f.ioctl = init_closure_func(&tf->ioctl, fdesc_ioctl, tun_ioctl);
     f->f.close = init_closure_func(&tf->close, fdesc_close, tun_close);
@@ -172,12 +172,16 @@ closure_func_basic(madt_handler, void, count_processors_handler,
 {
     switch (type) {
     case ACPI_MADT_LAPIC:
-        if (((acpi_lapic)p)->flags & MADT_LAPIC_ENABLED)
+        if (((acpi_lapic)p)->flags & MADT_LAPIC_ENABLED) {
+            numa_set_cpu_node(present_processors, numa_hwid_node(((acpi_lapic)p)->id));
             present_processors++;
+        }
         break;
     case ACPI_MADT_LAPICx2:
-        if (((acpi_lapic_x2)p)->flags & MADT_LAPIC_ENABLED)
+        if (((acpi_lapic_x2)p)->flags & MADT_LAPIC_ENABLED) {
+            numa_set_cpu_node(present_processors, numa_hwid_node(((acpi_lapic_x2)p)->id));
             present_processors++;
+        }
         break;
     }
 }
@@ -206,6 +210,7 @@ void count_cpus_present(void)
 {
     /* Read ACPI tables for MADT access */
     init_acpi_tables(get_kernel_heaps());
+    acpi_parse_numa();
 
 #ifdef SMP_ENABLE
     if (acpi_walk_madt(stack_closure_func(madt_handler, count_processors_handler))) {
@@ -378,6 +378,16 @@ closure_func_basic(thunk, void, gpio_key_handler)
     gpio_irq_clear(U64_FROM_BIT(gpio_key_power));
 }
 
+/* Returns the value of the "numa-node-id" property of the current node (NUMA_MAX_NODES if not
+ * present); consumes all the properties of the node. */
+static u32 platform_dt_numa_node(fdt fdt)
+{
+    dt_prop prop = fdt_get_prop(fdt, ss("numa-node-id"));
+    if ((prop == INVALID_ADDRESS) || (dt_prop_cell_count(prop) < 1))
+        return NUMA_MAX_NODES;
+    return dt_prop_get_cell(prop, 0);
+}
+
 static void platform_dtb_parse(kernel_heaps kh, vector cpu_ids)
 {
     struct fdt fdt;
@@ -414,15 +424,32 @@ static void platform_dtb_parse(kernel_heaps kh, vector cpu_ids)
             u32 cpus_acells, cpus_scells;
             fdt_get_cells(&fdt, &cpus_acells, &cpus_scells);
             fdt_foreach_node(&fdt, node) {
+                void *props = fdt.ptr;
                 dt_reg_iterator iter;
                 if (fdt_get_reg(&fdt, cpus_acells, cpus_scells, &iter)) {
                     dt_reg_foreach(iter, r) {
+                        fdt.ptr = props;
+                        u32 node_id = platform_dt_numa_node(&fdt);
+                        if (node_id != NUMA_MAX_NODES)
+                            numa_set_cpu_node(vector_length(cpu_ids), node_id);
                         present_processors++;
                         vector_push(cpu_ids, pointer_from_u64(r.start));
                         break;
                     }
                 }
             }
+        } else if (runtime_strstr(name, ss("memory@")) == name.ptr) {
+            void *props = fdt.ptr;
+            u32 node_id = platform_dt_numa_node(&fdt);
+            dt_reg_iterator iter;
+            fdt.ptr = props;
+            if ((node_id != NUMA_MAX_NODES) &&
+                fdt_get_reg(&fdt, root_acells, root_scells, &iter)) {
+                dt_reg_foreach(iter, r) {
+                    if (!numa_add_memory(r.start, range_span(r), node_id))
+                        msg_warn("failed to assign memory to NUMA node %d", node_id);
+                }
+            }
         } else if (!runtime_strcmp(name, ss("gpio-keys"))) {
             fdt_foreach_node(&fdt, node) {
                 if (!runtime_strcmp(fdt_node_name(&fdt, node), ss("poweroff"))) {
@@ -65,12 +65,30 @@ heap allocate_tagged_region(kernel_heaps kh, u64 tag, bytes pagesize, boolean lo
     return &th->h;
 }
 
+#define MPIDR_MT    U64_FROM_BIT(24)
+
+/* The topology is derived from the affinity levels in MPIDR: if the MT bit is set, Aff0 identifies
+ * hardware threads within a core; the next affinity level is taken as the cluster of cores sharing
+ * the last level cache, and the remaining levels as the package. */
+static void cpu_topology_init(cpuinfo ci)
+{
+    u64 mpidr = read_psr(MPIDR_EL1);
+    u64 aff = (MPIDR_AFF3(mpidr) << 24) | (MPIDR_AFF2(mpidr) << 16) | (MPIDR_AFF1(mpidr) << 8) |
+              MPIDR_AFF0(mpidr);
+    if (!(mpidr & MPIDR_MT))
+        aff <<= 8;
+    ci->topology.core_id = aff >> 8;
+    ci->topology.llc_id = aff >> 16;
+    ci->topology.package_id = aff >> 24;
+}
+
 void cpu_init(int cpu)
 {
     cpuinfo ci = cpuinfo_from_id(cpu);
     register u64 a = u64_from_pointer(ci);
     asm volatile("mov x18, %0; msr tpidr_el1, %0" ::"r"(a));
     write_psr(CNTKCTL_EL1, CNTKCTL_EL1_EL0VCTEN);
+    cpu_topology_init(ci);
 }
 
 void init_cpuinfo_machine(cpuinfo ci, heap backed)
@@ -13,6 +13,7 @@
 /* contexts with embedded stacks */
 #define KERNEL_CONTEXT_SIZE  (32 * KB)
 #define SYSCALL_CONTEXT_SIZE (32 * KB)
+#define SYSCALL_CONTEXT_ARENA_SIZE  512   /* per-context arena for transient closures */
 #define PROCESS_CONTEXT_SIZE (32 * KB)
 
 #define PAGE_INVAL_QUEUE_LENGTH  4096
@@ -24,6 +25,11 @@
 #define RUNLOOP_TIMER_MAX_PERIOD_US     100000
 #define RUNLOOP_TIMER_MIN_PERIOD_US     1000
 
+/* adaptive halt polling: default maximum poll window (can be overridden with the "halt_poll_us"
+ * manifest option), and initial window when polling is (re-)enabled on a CPU */
+#define HALT_POLL_MAX_US_DEFAULT    200
+#define HALT_POLL_GROW_START_US     10
+
 /* length of thread scheduling queue */
 #define MAX_THREADS 8192
 
@@ -75,6 +81,12 @@
 /* don't go below this minimum amount of physical memory when inflating balloon */
 #define BALLOON_MEMORY_MINIMUM (16 * MB)
 
+/* Packet buffers: size (enough for a full-sized Ethernet frame with headroom for driver metadata,
+ * pbuf structure and protocol headers), and minimum lwIP allocation size served by the packet
+ * buffer pool (smaller allocations, such as control blocks, are served by the malloc heap) */
+#define PKTBUF_SIZE             2048
+#define PKTBUF_MIN_ALLOC        512
+
 /* Number of objects that should be retained in the cache when a cache drain is requested */
 #define NET_RX_BUFFERS_RETAIN           64
 #define STORAGE_REQUESTS_RETAIN         64
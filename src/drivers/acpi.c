@@ -59,6 +59,90 @@ boolean acpi_parse_spcr(spcr_handler h)
     return true;
 }
 
+/* Proximity domains are converted to node numbers in order of appearance. */
+static u32 acpi_pxm_to_node(u32 *pxms, u32 *count, u32 pxm)
+{
+    u32 node;
+    for (node = 0; node < *count; node++)
+        if (pxms[node] == pxm)
+            return node;
+    if (node == NUMA_MAX_NODES)
+        return NUMA_MAX_NODES;  /* ignored by the NUMA code */
+    pxms[node] = pxm;
+    (*count)++;
+    return node;
+}
+
+/* Retrieves the NUMA topology from the SRAT and SLIT tables. */
+boolean acpi_parse_numa(void)
+{
+    ACPI_TABLE_HEADER *t;
+    ACPI_STATUS rv = AcpiGetTable(ACPI_SIG_SRAT, 1, &t);
+    if (ACPI_FAILURE(rv))
+        return false;
+    u32 pxms[NUMA_MAX_NODES];
+    u32 pxm_count = 0;
+    u8 *p = (u8 *)t + sizeof(ACPI_TABLE_SRAT);
+    u8 *pe = (u8 *)t + t->Length;
+    for (; p + sizeof(ACPI_SUBTABLE_HEADER) <= pe; p += p[1]) {
+        if (p[1] == 0)
+            break;
+        switch (p[0]) {
+        case ACPI_SRAT_TYPE_CPU_AFFINITY: {
+            ACPI_SRAT_CPU_AFFINITY *cpu = (ACPI_SRAT_CPU_AFFINITY *)p;
+            if (!(cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY))
+                break;
+            u32 pxm = cpu->ProximityDomainLo;
+            if (t->Revision >= 2)
+                pxm |= (cpu->ProximityDomainHi[0] << 8) | (cpu->ProximityDomainHi[1] << 16) |
+                       (cpu->ProximityDomainHi[2] << 24);
+            numa_set_hwid_node(cpu->ApicId, acpi_pxm_to_node(pxms, &pxm_count, pxm));
+            break;
+        }
+        case ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY: {
+            ACPI_SRAT_X2APIC_CPU_AFFINITY *cpu = (ACPI_SRAT_X2APIC_CPU_AFFINITY *)p;
+            if (cpu->Flags & ACPI_SRAT_CPU_ENABLED)
+                numa_set_hwid_node(cpu->ApicId,
+                                   acpi_pxm_to_node(pxms, &pxm_count, cpu->ProximityDomain));
+            break;
+        }
+        case ACPI_SRAT_TYPE_MEMORY_AFFINITY: {
+            ACPI_SRAT_MEM_AFFINITY *mem = (ACPI_SRAT_MEM_AFFINITY *)p;
+            if (!(mem->Flags & ACPI_SRAT_MEM_ENABLED))
+                break;
+            u32 pxm = mem->ProximityDomain;
+            if (t->Revision < 2)
+                pxm &= 0xff;
+            u32 node = acpi_pxm_to_node(pxms, &pxm_count, pxm);
+            acpi_debug("SRAT memory [0x%lx, 0x%lx) node %d", mem->BaseAddress,
+                       mem->BaseAddress + mem->Length, node);
+            if (!numa_add_memory(mem->BaseAddress, mem->Length, node))
+                msg_warn("failed to assign memory to NUMA node %d", node);
+            break;
+        }
+        }
+    }
+    AcpiPutTable(t);
+    rv = AcpiGetTable(ACPI_SIG_SLIT, 1, &t);
+    if (ACPI_FAILURE(rv))
+        return true;
+    ACPI_TABLE_SLIT *slit = (ACPI_TABLE_SLIT *)t;
+    u64 localities = slit->LocalityCount;
+    if (sizeof(*slit) - 1 + localities * localities <= t->Length) {
+        for (u32 from = 0; from < pxm_count; from++) {
+            if (pxms[from] >= localities)
+                continue;
+            for (u32 to = 0; to < pxm_count; to++) {
+                if (pxms[to] < localities)
+                    numa_set_distance(from, to,
+                                      slit->Entry[pxms[from] * localities + pxms[to]]);
+            }
+        }
+    }
+    AcpiPutTable(t);
+    return true;
+}
+
 u64 acpi_get_hv_id(void)
 {
     ACPI_TABLE_HEADER *t;
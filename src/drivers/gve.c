@@ -43,7 +43,8 @@ enum gve_adminq_opcode {
     GVE_ADMINQ_DESTROY_TX_QUEUE,
     GVE_ADMINQ_DESTROY_RX_QUEUE,
     GVE_ADMINQ_DECONFIGURE_DEVICE_RESOURCES,
-    GVE_ADMINQ_SET_DRIVER_PARAMETER = 11,
+    GVE_ADMINQ_CONFIGURE_RSS,
+    GVE_ADMINQ_SET_DRIVER_PARAMETER,
     GVE_ADMINQ_REPORT_STATS,
     GVE_ADMINQ_REPORT_LINK_SPEED,
     GVE_ADMINQ_GET_PTYPE_MAP,
@@ -156,6 +157,31 @@ struct gve_adminq_destroy_rx_queue {
     u32 queue_id;
 } __attribute__((packed));
 
+#define GVE_RSS_HASH_IPV4       U32_FROM_BIT(0)
+#define GVE_RSS_HASH_TCPV4      U32_FROM_BIT(1)
+#define GVE_RSS_HASH_IPV6       U32_FROM_BIT(2)
+#define GVE_RSS_HASH_IPV6_EX    U32_FROM_BIT(3)
+#define GVE_RSS_HASH_TCPV6      U32_FROM_BIT(4)
+#define GVE_RSS_HASH_TCPV6_EX   U32_FROM_BIT(5)
+#define GVE_RSS_HASH_UDPV4      U32_FROM_BIT(6)
+#define GVE_RSS_HASH_UDPV6      U32_FROM_BIT(7)
+#define GVE_RSS_HASH_UDPV6_EX   U32_FROM_BIT(8)
+
+#define GVE_RSS_HASH_TOEPLITZ   1
+
+#define GVE_RSS_KEY_SIZE    40
+#define GVE_RSS_LUT_SIZE    128
+
+struct gve_adminq_configure_rss {
+    u16 hash_types;
+    u8 hash_alg;
+    u8 reserved;
+    u16 hash_key_size;
+    u16 hash_lut_size;
+    u64 hash_key_addr;
+    u64 hash_lut_addr;
+} __attribute__((packed));
+
 struct gve_adminq_command {
     u32 opcode;
     u32 status;
@@ -168,6 +194,7 @@ struct gve_adminq_command {
         struct gve_adminq_create_rx_queue create_rx_queue;
         struct gve_adminq_destroy_tx_queue destroy_tx_queue;
         struct gve_adminq_destroy_rx_queue destroy_rx_queue;
+        struct gve_adminq_configure_rss configure_rss;
         u8 padding[56]; /* to make the struct size 64 bytes */
     };
 } __attribute__((packed));
@@ -218,8 +245,6 @@ struct gve_tx_seg_desc {
 #define GVE_RXF_ERR         htobe16(1 << 11)
 #define GVE_RXF_PKT_CONT    htobe16(1 << 13)
 
-#define GVE_IRQ_DB_COUNT    2   /* one for TX, one for RX */
-
 /* padding added at the beginning of received Ethernet frames */
 #define GVE_RX_PADDING  2
 
@@ -236,6 +261,7 @@ struct gve_rx_desc {
 } __attribute__((packed));
 
 typedef struct gve_tx_queue {
+    struct spinlock lock;
     u32 head, tail;
     u32 qpl_head, qpl_available;
     struct gve *adapter;
@@ -248,6 +274,7 @@ typedef struct gve_tx_queue {
     } *desc;
     u32 *qpl_allocated;
     struct gve_queue_resources *q_res;
+    netif_qstats stats;
 } *gve_tx_queue;
 
 typedef struct gve_rx_queue {
@@ -265,6 +292,7 @@ typedef struct gve_rx_queue {
     closure_struct(thunk, irq_handler);
     closure_struct(thunk, service);
     struct gve_queue_resources *q_res;
+    netif_qstats stats;
 } *gve_rx_queue;
 
 typedef struct gve {
@@ -278,11 +306,15 @@ typedef struct gve {
     u32 adminq_mask;
     u16 tx_desc_cnt, rx_desc_cnt;
     u16 tx_pages_per_qpl, rx_data_slot_cnt;
+    u64 max_registered_pages;
     u16 num_event_counters;
     u32 *event_counters;
-    struct gve_irq_db *irq_db_indices;
-    struct gve_tx_queue tx;
-    struct gve_rx_queue rx;
+    u16 max_queues;
+    u16 num_queues; /* number of TX/RX queue pairs */
+    struct gve_irq_db *irq_db_indices;  /* one notify block for each TX and RX queue */
+    gve_tx_queue tx;
+    gve_rx_queue rx;
+    gve_tx_queue *txq_map;  /* indexed by CPU id */
     closure_struct(thunk, mgmt_irq_handler);
     closure_struct(thunk, link_status_handler);
     u16 mtu;
@@ -348,6 +380,7 @@ static boolean gve_describe_device(gve adapter)
         adapter->rx_desc_cnt = be16toh(desc->rx_queue_entries);
         adapter->tx_pages_per_qpl = be16toh(desc->tx_pages_per_qpl);
         adapter->rx_data_slot_cnt = be16toh(desc->rx_pages_per_qpl);
+        adapter->max_registered_pages = be64toh(desc->max_registered_pages);
         gve_debug("MAC %02x:%02x:%02x:%02x:%02x:%02x, MTU %d, TX descriptors %d, RX descriptors %d",
                   mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], adapter->mtu,
                   adapter->tx_desc_cnt, adapter->rx_desc_cnt);
@@ -356,7 +389,7 @@ static boolean gve_describe_device(gve adapter)
     return success;
 }
 
-static boolean gve_cfg_device_resources(gve adapter)
+static boolean gve_cfg_device_resources(gve adapter, u32 num_ntfy_blks)
 {
     /* The memory area for event counters must be page-aligned. */
     u64 evt_cnt_size = MAX(adapter->num_event_counters * sizeof(u32), PAGESIZE);
@@ -364,7 +397,7 @@ static boolean gve_cfg_device_resources(gve adapter)
     if (adapter->event_counters == INVALID_ADDRESS)
         return false;
 
-    u64 irq_db_size = sizeof(struct gve_irq_db) * GVE_IRQ_DB_COUNT;
+    u64 irq_db_size = sizeof(struct gve_irq_db) * num_ntfy_blks;
     adapter->irq_db_indices = allocate(adapter->contiguous, irq_db_size);
     if (adapter->irq_db_indices == INVALID_ADDRESS)
         goto err;
@@ -373,7 +406,7 @@ static boolean gve_cfg_device_resources(gve adapter)
     cmd->cfg_dev_resources.counter_array = htobe64(physical_from_virtual(adapter->event_counters));
     cmd->cfg_dev_resources.irq_db_addr = htobe64(physical_from_virtual(adapter->irq_db_indices));
     cmd->cfg_dev_resources.num_counters = htobe32(adapter->num_event_counters);
-    cmd->cfg_dev_resources.num_irq_dbs = htobe32(2);
+    cmd->cfg_dev_resources.num_irq_dbs = htobe32(num_ntfy_blks);
     cmd->cfg_dev_resources.irq_db_stride = htobe32(sizeof(*adapter->irq_db_indices));
     cmd->cfg_dev_resources.ntfy_blk_msix_base_idx = htobe32(0); /* management vector is last */
     cmd->cfg_dev_resources.queue_format = GVE_GQI_QPL_FORMAT;
@@ -392,7 +425,7 @@ static void gve_free_device_resources(gve adapter)
     cmd->opcode = htobe32(GVE_ADMINQ_DECONFIGURE_DEVICE_RESOURCES);
     gve_adminq_execute_cmd(adapter, cmd);
     deallocate(adapter->contiguous, adapter->irq_db_indices,
-               sizeof(struct gve_irq_db) * GVE_IRQ_DB_COUNT);
+               sizeof(struct gve_irq_db) * 2 * adapter->num_queues);
     deallocate(adapter->contiguous, adapter->event_counters,
                MAX(adapter->num_event_counters * sizeof(u32), PAGESIZE));
 }
@@ -447,7 +480,10 @@ static void gve_tx_qpl_cpy(gve_tx_queue tx, struct pbuf *p, u32 *offset, u32 *al
 err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
 {
     gve adapter = netif->state;
-    gve_tx_queue tx = &adapter->tx;
+    if (!adapter->txq_map)
+        return ERR_IF;
+    gve_tx_queue tx = adapter->txq_map[current_cpu()->id];
+    u64 irqflags = spin_lock_irq(&tx->lock);
     gve_tx_cleanup(tx);
     int seg_count = 0;
     u32 head = tx->qpl_head;
@@ -466,6 +502,7 @@ err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
             (head - tx->qpl_head > tx->qpl_available)) {
         gve_debug("cannot transmit (%d available descriptors, %d bytes of QPL space)",
                   tx->adapter->tx_desc_cnt - tx->head + tx->tail, tx->qpl_available);
+        spin_unlock_irq(&tx->lock, irqflags);
         return ERR_MEM;
     }
     u32 offset;
@@ -483,12 +520,15 @@ err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
         struct gve_tx_seg_desc *seg = &tx->desc[tx->head++ & tx->mask].seg;
         seg->type_flags = GVE_TXD_SEG;
         seg->seg_len = htobe16(q->len);
-        pkt->seg_addr = htobe64(offset);
+        seg->seg_addr = htobe64(offset);
     }
     gve_debug("TX head %d, QPL available %d", tx->head, tx->qpl_available);
     write_barrier();
     pci_bar_write_4(&adapter->db_bar, be32toh(tx->q_res->db_index) * sizeof(u32),
                     htobe32(tx->head));
+    tx->stats->tx_packets++;
+    tx->stats->tx_bytes += p->tot_len;
+    spin_unlock_irq(&tx->lock, irqflags);
     return ERR_OK;
 }
 
@@ -527,18 +567,15 @@ closure_func_basic(thunk, void, gve_rx_irq)
     /* further interrupts are masked until this interrupt is acked in the RX service thunk */
 }
 
-closure_func_basic(thunk, void, gve_rx_service)
+/* Processes up to budget received packets; called with the queue lock held. */
+static u32 gve_rx_process(gve_rx_queue rx, u32 budget)
 {
-    gve_rx_queue rx = struct_from_field(closure_self(), gve_rx_queue, service);
     gve adapter = rx->adapter;
     struct netif *net_if = &adapter->ndev.n;
-    u32 tail;
-    boolean irq_acked = false;
-    spin_lock(&rx->lock);
-  begin:
-    tail = be32toh(adapter->event_counters[be32toh(rx->q_res->counter_index)]);
+    u32 tail = be32toh(adapter->event_counters[be32toh(rx->q_res->counter_index)]);
+    u32 processed = 0;
     gve_debug("RX tail %d -> %d", rx->tail, tail);
-    for (; rx->tail != tail; rx->qpl_available++, rx->tail++) {
+    for (; (rx->tail != tail) && (processed < budget); rx->qpl_available++, rx->tail++) {
         struct gve_rx_desc *desc = &rx->desc[rx->tail & rx->mask];
         u16 length = be16toh(desc->len);
         if (length <= GVE_RX_PADDING)
@@ -569,50 +606,89 @@ closure_func_basic(thunk, void, gve_rx_service)
                 continue;
             }
         }
+        rx->stats->rx_packets++;
+        rx->stats->rx_bytes += length;
+        processed++;
         err_t err = net_if->input(p, net_if);
         if (err != ERR_OK)
             pbuf_free(p);
     }
     if (rx->head - rx->tail <= (rx->mask + 1) / 2)
         gve_rx_fill(rx);
-    if (!irq_acked) {
-        pci_bar_write_4(&adapter->db_bar, be32toh(*rx->irq_db_index) * sizeof(u32), GVE_IRQ_ACK);
-        irq_acked = true;
-
-        /* Check the event counter again, to avoid missing any events that may have occurred between
-         * the last check and the interrupt ack. */
-        memory_barrier();
-        goto begin;
-    }
+    return processed;
+}
+
+closure_func_basic(thunk, void, gve_rx_service)
+{
+    gve_rx_queue rx = struct_from_field(closure_self(), gve_rx_queue, service);
+    gve adapter = rx->adapter;
+    spin_lock(&rx->lock);
+    gve_rx_process(rx, U32_MAX);
+    pci_bar_write_4(&adapter->db_bar, be32toh(*rx->irq_db_index) * sizeof(u32), GVE_IRQ_ACK);
+
+    /* Check the event counter again, to avoid missing any events that may have occurred between
+     * the last check and the interrupt ack. */
+    memory_barrier();
+    gve_rx_process(rx, U32_MAX);
     spin_unlock(&rx->lock);
 }
 
-static boolean gve_init_interrupts(gve adapter)
+/* Busy polling: processes received packets from the calling context, skipping any queue that is
+ * being serviced. Interrupts are acknowledged (and thus re-enabled) only by the queue service. */
+closure_func_basic(netif_dev_poll, u32, gve_rx_poll,
+                   u32 budget, boolean defer_irq)
 {
-    int msix_avail = pci_enable_msix(adapter->pdev);
-    if (msix_avail < 3) /* TX irq, RX irq, management irq */
-        return false;
-    if (pci_setup_msix(adapter->pdev, 2,
+    gve adapter = struct_from_closure(gve, ndev.rx_poll);
+    u32 processed = 0;
+    for (u16 i = 0; (i < adapter->ndev.num_queues) && (processed < budget); i++) {
+        gve_rx_queue rx = &adapter->rx[i];
+        if (!spin_try(&rx->lock))
+            continue;
+        processed += gve_rx_process(rx, budget - processed);
+        spin_unlock(&rx->lock);
+    }
+    return processed;
+}
+
+/* Each RX queue interrupt is routed to a subset of CPUs, and each CPU transmits on the TX queue
+ * paired with the RX queue it serves. */
+static boolean gve_init_interrupts(gve adapter, gve_tx_queue *txq_map)
+{
+    u16 nq = adapter->num_queues;
+    int mgmt_vector = 2 * nq;   /* management vector is last */
+    if (pci_setup_msix(adapter->pdev, mgmt_vector,
                        init_closure_func(&adapter->mgmt_irq_handler, thunk, gve_mgmt_irq),
                        ss("gve_mgmt")) == INVALID_PHYSICAL)
-        goto error;
-    if (pci_setup_msix(adapter->pdev, 1,
-                       init_closure_func(&adapter->rx.irq_handler, thunk, gve_rx_irq),
-                       ss("gve_rx")) == INVALID_PHYSICAL)
-        goto err_disable_mgmt;
+        return false;
+    u64 cpus_per_queue = total_processors / nq;
+    u64 excess_cpus = total_processors - cpus_per_queue * nq;
+    u64 first_cpu = 0, num_cpus = 0;
+    u16 i;
+    for (i = 0; i < nq; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_queue + 1) : cpus_per_queue;
+        gve_rx_queue rx = &adapter->rx[i];
+        if (pci_setup_msix_aff(adapter->pdev, nq + i,
+                               init_closure_func(&rx->irq_handler, thunk, gve_rx_irq),
+                               ss("gve_rx"), irangel(first_cpu, num_cpus)) == INVALID_PHYSICAL)
+            goto error;
+        for (u64 cpu = first_cpu; cpu < first_cpu + num_cpus; cpu++)
+            txq_map[cpu] = &adapter->tx[i];
+    }
     return true;
-  err_disable_mgmt:
-    pci_teardown_msix(adapter->pdev, 2);
   error:
-    pci_disable_msix(adapter->pdev);
+    while (i-- > 0)
+        pci_teardown_msix(adapter->pdev, nq + i);
+    pci_teardown_msix(adapter->pdev, mgmt_vector);
     return false;
 }
 
 static void gve_deinit_interrupts(gve adapter)
 {
-    pci_teardown_msix(adapter->pdev, 1);
-    pci_teardown_msix(adapter->pdev, 2);
-    pci_disable_msix(adapter->pdev);
+    u16 nq = adapter->num_queues;
+    for (u16 i = 0; i < nq; i++)
+        pci_teardown_msix(adapter->pdev, nq + i);
+    pci_teardown_msix(adapter->pdev, 2 * nq);
 }
 
 static void *gve_create_qpl(gve adapter, u16 num_pages, u32 id)
@@ -683,6 +759,8 @@ static boolean gve_create_tx_queue(gve adapter, gve_tx_queue tx, u32 index)
     tx->qpl_head = 0;
     tx->qpl_available = tx->qpl_size = num_pages * PAGESIZE;
     tx->adapter = adapter;
+    tx->stats = &adapter->ndev.qstats[index];
+    spin_lock_init(&tx->lock);
     return true;
   err4:
     deallocate(adapter->contiguous, tx->q_res, sizeof(*tx->q_res));
@@ -712,7 +790,7 @@ static void gve_destroy_tx_queue(gve adapter, gve_tx_queue tx, u32 index)
 static boolean gve_create_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
 {
     u16 num_pages = adapter->rx_data_slot_cnt;
-    u32 id = 1 + index; /* used for both QPL and notify block */
+    u32 id = adapter->num_queues + index;   /* used for both QPL and notify block */
     rx->qpl_base = gve_create_qpl(adapter, num_pages, id);
     if (rx->qpl_base == INVALID_ADDRESS)
         return false;
@@ -754,6 +832,7 @@ static boolean gve_create_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
     }
     rx->irq_db_index = &adapter->irq_db_indices[id].index;
     rx->adapter = adapter;
+    rx->stats = &adapter->ndev.qstats[index];
     init_closure_func(&rx->service, thunk, gve_rx_service);
     spin_lock_init(&rx->lock);
     gve_rx_fill(rx);
@@ -771,15 +850,145 @@ static boolean gve_create_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
     return false;
 }
 
+static void gve_destroy_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
+{
+    struct gve_adminq_command *cmd = gve_adminq_new_cmd(adapter);
+    cmd->opcode = htobe32(GVE_ADMINQ_DESTROY_RX_QUEUE);
+    cmd->destroy_rx_queue.queue_id = htobe32(index);
+    gve_adminq_execute_cmd(adapter, cmd);
+    deallocate(adapter->contiguous, rx->q_res, sizeof(*rx->q_res));
+    deallocate(adapter->contiguous, rx->data, adapter->rx_data_slot_cnt * sizeof(*rx->data));
+    deallocate(adapter->contiguous, rx->desc, adapter->rx_desc_cnt * sizeof(*rx->desc));
+    deallocate(adapter->general, rx->pbufs, rx->qpl_count * sizeof(*rx->pbufs));
+    gve_destroy_qpl(adapter, rx->qpl_base, adapter->rx_data_slot_cnt,
+                    adapter->num_queues + index);
+}
+
 static boolean gve_setup_queues(gve adapter)
 {
-    if (!gve_create_tx_queue(adapter, &adapter->tx, 0))
-        return false;
-    if (!gve_create_rx_queue(adapter, &adapter->rx, 0)) {
-        gve_destroy_tx_queue(adapter, &adapter->tx, 0);
-        return false;
+    u16 i;
+    for (i = 0; i < adapter->num_queues; i++) {
+        if (!gve_create_tx_queue(adapter, &adapter->tx[i], i))
+            goto error;
+        if (!gve_create_rx_queue(adapter, &adapter->rx[i], i)) {
+            gve_destroy_tx_queue(adapter, &adapter->tx[i], i);
+            goto error;
+        }
+    }
+    return true;
+  error:
+    while (i-- > 0) {
+        gve_destroy_rx_queue(adapter, &adapter->rx[i], i);
+        gve_destroy_tx_queue(adapter, &adapter->tx[i], i);
+    }
+    return false;
+}
+
+/* Spreads received flows over the RX queues with a random Toeplitz key. If the device does not
+ * accept the configuration, it keeps its default distribution. */
+static void gve_configure_rss(gve adapter)
+{
+    u8 *key = allocate(adapter->contiguous, PAGESIZE);
+    if (key == INVALID_ADDRESS)
+        return;
+    u32 *lut = (u32 *)(key + GVE_RSS_KEY_SIZE);
+    for (int i = 0; i < GVE_RSS_KEY_SIZE; i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(key + i, &r, sizeof(r));
     }
+    for (int i = 0; i < GVE_RSS_LUT_SIZE; i++)
+        lut[i] = htobe32(i % adapter->num_queues);
+    struct gve_adminq_command *cmd = gve_adminq_new_cmd(adapter);
+    cmd->opcode = htobe32(GVE_ADMINQ_CONFIGURE_RSS);
+    cmd->configure_rss.hash_types = htobe16(GVE_RSS_HASH_IPV4 | GVE_RSS_HASH_TCPV4 |
+                                            GVE_RSS_HASH_UDPV4 | GVE_RSS_HASH_IPV6 |
+                                            GVE_RSS_HASH_IPV6_EX | GVE_RSS_HASH_TCPV6 |
+                                            GVE_RSS_HASH_TCPV6_EX | GVE_RSS_HASH_UDPV6 |
+                                            GVE_RSS_HASH_UDPV6_EX);
+    cmd->configure_rss.hash_alg = GVE_RSS_HASH_TOEPLITZ;
+    cmd->configure_rss.hash_key_size = htobe16(GVE_RSS_KEY_SIZE);
+    cmd->configure_rss.hash_lut_size = htobe16(GVE_RSS_LUT_SIZE);
+    cmd->configure_rss.hash_key_addr = htobe64(physical_from_virtual(key));
+    cmd->configure_rss.hash_lut_addr = htobe64(physical_from_virtual(lut));
+    if (!gve_adminq_execute_cmd(adapter, cmd))
+        msg_warn("GVE: failed to configure RSS, using device default");
+    deallocate(adapter->contiguous, key, PAGESIZE);
+}
+
+closure_func_basic(netif_dev_setup, boolean, gve_setup,
+                   tuple config)
+{
+    gve adapter = struct_from_closure(gve, ndev.setup);
+    heap h = adapter->general;
+    u64 nq = adapter->max_queues;
+    u64 io_queues;
+    if (config && get_u64(config, sym_this("io-queues"), &io_queues) && (io_queues > 0))
+        nq = MIN(nq, io_queues);
+    nq = MIN(nq, total_processors);
+
+    /* each queue pair uses 2 MSI-X vectors, plus one vector for the management interrupt */
+    int msix_avail = pci_enable_msix(adapter->pdev);
+    if (msix_avail < 3) {
+        msg_err("GVE: insufficient MSI-X vectors (%d)", msix_avail);
+        goto err;
+    }
+    nq = MIN(nq, (msix_avail - 1) / 2);
+
+    /* each queue registers a queue page list for TX and one for RX */
+    nq = MIN(nq, adapter->max_registered_pages /
+             (adapter->tx_pages_per_qpl + adapter->rx_data_slot_cnt));
+    if (nq == 0) {
+        msg_err("GVE: cannot register queue page lists");
+        goto err;
+    }
+    gve_debug("max queues %d, using %ld", adapter->max_queues, nq);
+    adapter->num_queues = nq;
+    adapter->tx = allocate_zero(h, nq * sizeof(*adapter->tx));
+    if (adapter->tx == INVALID_ADDRESS)
+        goto err;
+    adapter->rx = allocate_zero(h, nq * sizeof(*adapter->rx));
+    if (adapter->rx == INVALID_ADDRESS)
+        goto err1;
+    adapter->ndev.qstats = allocate_zero(h, nq * sizeof(struct netif_qstats));
+    if (adapter->ndev.qstats == INVALID_ADDRESS)
+        goto err2;
+    gve_tx_queue *txq_map = allocate(h, total_processors * sizeof(txq_map[0]));
+    if (txq_map == INVALID_ADDRESS)
+        goto err3;
+    if (!gve_cfg_device_resources(adapter, 2 * nq)) {
+        msg_err("GVE: failed to configure device resources");
+        goto err4;
+    }
+    if (!gve_init_interrupts(adapter, txq_map)) {
+        msg_err("GVE: failed to initialize interrupts");
+        goto err5;
+    }
+    if (!gve_setup_queues(adapter)) {
+        msg_err("GVE: failed to set up TX/RX queues");
+        goto err6;
+    }
+    if (nq > 1)
+        gve_configure_rss(adapter);
+    adapter->txq_map = txq_map;
+    adapter->ndev.num_queues = nq;
+    apply((thunk)&adapter->link_status_handler);
     return true;
+  err6:
+    gve_deinit_interrupts(adapter);
+  err5:
+    gve_free_device_resources(adapter);
+  err4:
+    deallocate(h, txq_map, total_processors * sizeof(txq_map[0]));
+  err3:
+    deallocate(h, adapter->ndev.qstats, nq * sizeof(struct netif_qstats));
+    adapter->ndev.qstats = 0;
+  err2:
+    deallocate(h, adapter->rx, nq * sizeof(*adapter->rx));
+  err1:
+    deallocate(h, adapter->tx, nq * sizeof(*adapter->tx));
+  err:
+    pci_disable_msix(adapter->pdev);
+    return false;
 }
 
 static boolean gve_init(gve adapter)
@@ -797,30 +1006,16 @@ static boolean gve_init(gve adapter)
                     htobe32(physical_from_virtual(adapter->adminq) >> PAGELOG));
     if (!gve_describe_device(adapter)) {
         msg_err("GVE: failed to describe device");
-        goto err1;
-    }
-    if (!gve_cfg_device_resources(adapter)) {
-        msg_err("GVE: failed to configure device resources");
-        goto err1;
-    }
-    if (!gve_init_interrupts(adapter)) {
-        msg_err("GVE: failed to initialize interrupts");
-        goto err2;
-    }
-    if (!gve_setup_queues(adapter)) {
-        msg_err("GVE: failed to set up TX/RX queues");
-        goto err3;
+        pci_bar_deinit(&adapter->db_bar);
+        pci_bar_deinit(&adapter->reg_bar);
+        deallocate(adapter->contiguous, adapter->adminq, PAGESIZE);
+        return false;
     }
+    adapter->max_queues = MIN(be32toh(pci_bar_read_4(&adapter->reg_bar, GVE_REG_MAX_TX_QUEUES)),
+                              be32toh(pci_bar_read_4(&adapter->reg_bar, GVE_REG_MAX_RX_QUEUES)));
+    adapter->max_queues = MAX(adapter->max_queues, 1);
+    adapter->txq_map = 0;
     return true;
-  err3:
-    gve_deinit_interrupts(adapter);
-  err2:
-    gve_free_device_resources(adapter);
-  err1:
-    pci_bar_deinit(&adapter->db_bar);
-    pci_bar_deinit(&adapter->reg_bar);
-    deallocate(adapter->contiguous, adapter->adminq, PAGESIZE);
-    return false;
 }
 
 static err_t gve_if_init(struct netif *netif)
@@ -849,12 +1044,13 @@ closure_function(2, 1, boolean, gve_probe,
     adapter->general = h;
     adapter->contiguous = bound(contiguous);
     adapter->pdev = d;
+    netif_dev_init(&adapter->ndev);
     if (gve_init(adapter)) {
         gve_debug("registering network interface");
-        netif_dev_init(&adapter->ndev);
+        /* queues are set up when the interface configuration is known */
+        init_closure_func(&adapter->ndev.setup, netif_dev_setup, gve_setup);
+        init_closure_func(&adapter->ndev.rx_poll, netif_dev_poll, gve_rx_poll);
         netif_add(&adapter->ndev.n, 0, 0, 0, adapter, gve_if_init, ethernet_input);
-        thunk t = (thunk)&adapter->link_status_handler;
-        apply(t);
         return true;
     } else {
         deallocate(h, adapter, sizeof(struct gve));
@@ -56,6 +56,8 @@ void filesystem_alloc(fsfile f, long offset, long len,
         boolean keep_size, fs_status_handler completion);
 void filesystem_dealloc(fsfile f, long offset, long len,
         fs_status_handler completion);
+void filesystem_clone(fsfile dest, u64 dest_offset, fsfile src, u64 src_offset, u64 length,
+                      fs_status_handler completion);
 int filesystem_truncate(filesystem fs, fsfile f, u64 len);
 int filesystem_truncate_locked(filesystem fs, fsfile f, u64 len);
 
@@ -3,6 +3,9 @@
 #ifdef KERNEL
 #include <dma.h>
 #endif
+#ifndef BOOT
+#include <lz4.h>
+#endif
 
 //#define TFS_DEBUG
 #if defined(TFS_DEBUG)
@@ -35,6 +38,14 @@
 
 #define tfs_from_file(f)    ((tfs)((f)->f.fs))
 
+/* compression algorithm of an extent ingested from a filesystem written by a newer version */
+#define TFS_COMPRESSION_UNSUPPORTED 0xff
+
+static const sstring tfs_compression_names[] = {
+    [TFS_COMPRESSION_NONE] = ss_static_init("none"),
+    [TFS_COMPRESSION_LZ4] = ss_static_init("lz4"),
+};
+
 /* Called with fs locked */
 static tuple tmpfs_get_meta(filesystem fs, inode n)
 {
@@ -45,7 +56,8 @@ static s64 tfsfile_get_blocks(fsfile f)
 {
     s64 blocks = 0;
     rangemap_foreach(((tfsfile)f)->extentmap, n) {
-        blocks += range_span(n->r);
+        extent ex = (extent)n;
+        blocks += ex->compression ? ex->allocated : range_span(n->r);
     }
     return blocks;
 }
@@ -83,9 +95,21 @@ static inline extent allocate_extent(heap h, range file_blocks, range storage_bl
     e->start_block = storage_blocks.start;
     e->allocated = range_span(storage_blocks);
     e->uninited = 0;
+    e->shared = false;
+    e->compression = TFS_COMPRESSION_NONE;
+    e->clength = 0;
     return e;
 }
 
+/* Returns the TFS_COMPRESSION_* value for an algorithm name, or -1 if the name is unknown. */
+int filesystem_compression_from_name(string name)
+{
+    for (int i = 0; i < _countof(tfs_compression_names); i++)
+        if (!buffer_compare_with_sstring(name, tfs_compression_names[i]))
+            return i;
+    return -1;
+}
+
 closure_function(2, 1, boolean, tfs_storage_alloc,
                  u64, nblocks, u64 *, start_block,
                  range r)
@@ -138,6 +162,112 @@ boolean filesystem_free_storage(tfs fs, range blocks)
     return true;
 }
 
+/* Splits the shared storage node (if any) that contains a given block, so that a node starts at the
+ * block. */
+static boolean tfs_shared_split(tfs fs, u64 block)
+{
+    tfs_shared s = (tfs_shared)rangemap_lookup(fs->shared, block);
+    if ((s == INVALID_ADDRESS) || (s->node.r.start == block))
+        return true;
+    tfs_shared n = allocate(fs->fs.h, sizeof(*n));
+    if (n == INVALID_ADDRESS)
+        return false;
+    range r = s->node.r;
+    rangemap_reinsert(fs->shared, &s->node, irange(r.start, block));
+    rmnode_init(&n->node, irange(block, r.end));
+    n->refcount = s->refcount;
+    rangemap_insert(fs->shared, &n->node);
+    return true;
+}
+
+/* Merges the shared storage nodes adjacent to a given block if they have the same reference count. */
+static void tfs_shared_merge(tfs fs, u64 block)
+{
+    if (block == 0)
+        return;
+    tfs_shared prev = (tfs_shared)rangemap_lookup(fs->shared, block - 1);
+    tfs_shared next = (tfs_shared)rangemap_lookup(fs->shared, block);
+    if ((prev == INVALID_ADDRESS) || (next == INVALID_ADDRESS) ||
+        (prev->refcount != next->refcount))
+        return;
+    range r = irange(prev->node.r.start, next->node.r.end);
+    rangemap_remove_node(fs->shared, &next->node);
+    deallocate(fs->fs.h, next, sizeof(*next));
+    rangemap_reinsert(fs->shared, &prev->node, r);
+}
+
+/* Removes a reference from the shared storage nodes in a block range; blocks that are no longer
+ * referenced are freed if `free` is true. */
+static void tfs_shared_release(tfs fs, range blocks, boolean free)
+{
+    rmnode n = rangemap_lookup_at_or_next(fs->shared, blocks.start);
+    while ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        tfs_shared s = (tfs_shared)n;
+        n = rangemap_next_node(fs->shared, n);
+        if (--s->refcount > 0)
+            continue;
+        range r = s->node.r;
+        rangemap_remove_node(fs->shared, &s->node);
+        deallocate(fs->fs.h, s, sizeof(*s));
+        if (free && !rangemap_insert_hole(fs->storage, r))
+            msg_err("TFS: failed to mark shared storage at %R as free", r);
+    }
+    tfs_shared_merge(fs, blocks.start);
+    tfs_shared_merge(fs, blocks.end);
+}
+
+/* Adds a reference to storage blocks shared between extents (and reserves the blocks if they are
+ * not already reserved). Each node in the shared rangemap holds the number of extents referencing
+ * its blocks. */
+boolean filesystem_share_storage(tfs fs, range blocks)
+{
+    if (!fs->shared)
+        return true;
+    boolean success = false;
+    tfs_storage_lock(fs);
+    if (!tfs_shared_split(fs, blocks.start) || !tfs_shared_split(fs, blocks.end) ||
+        !rangemap_insert_range(fs->storage, blocks))
+        goto out;
+    u64 block = blocks.start;
+    while (block < blocks.end) {
+        tfs_shared s = (tfs_shared)rangemap_lookup_at_or_next(fs->shared, block);
+        if ((s != INVALID_ADDRESS) && (s->node.r.start == block)) {
+            s->refcount++;
+            block = s->node.r.end;
+            continue;
+        }
+
+        /* blocks not yet referenced by other extents */
+        u64 end = ((s == INVALID_ADDRESS) || (s->node.r.start >= blocks.end)) ?
+                  blocks.end : s->node.r.start;
+        s = allocate(fs->fs.h, sizeof(*s));
+        if (s == INVALID_ADDRESS) {
+            msg_err("TFS %s: failed to allocate shared storage node", func_ss);
+            tfs_shared_release(fs, irange(blocks.start, block), false);
+            goto out;
+        }
+        rmnode_init(&s->node, irange(block, end));
+        s->refcount = 1;
+        rangemap_insert(fs->shared, &s->node);
+        block = end;
+    }
+    tfs_shared_merge(fs, blocks.start);
+    tfs_shared_merge(fs, blocks.end);
+    success = true;
+  out:
+    tfs_storage_unlock(fs);
+    return success;
+}
+
+/* Called when a compressed extent is added to a file: since reading any part of a cluster
+ * decompresses the whole cluster, page cache fetches are extended to cluster boundaries. */
+static void tfsfile_set_compressed(tfsfile f)
+{
+#ifdef KERNEL
+    pagecache_node_set_fetch_order(f->f.cache_node, find_order(TFS_MAX_CLUSTER_SIZE));
+#endif
+}
+
 void ingest_extent(tfsfile f, symbol off, tuple value)
 {
     tfs_debug("ingest_extent: f %p, off %b, value %v\n", f, symbol_string(off), value);
@@ -152,7 +282,9 @@ void ingest_extent(tfsfile f, symbol off, tuple value)
 
     range storage_blocks = irangel(start_block, allocated);
     tfs fs = tfs_from_file(f);
-    if (!filesystem_reserve_storage(fs, storage_blocks)) {
+    boolean shared = get(value, sym(shared)) != 0;
+    if (!(shared ? filesystem_share_storage(fs, storage_blocks) :
+          filesystem_reserve_storage(fs, storage_blocks))) {
         /* soft error... */
         msg_err("TFS %s: unable to reserve storage blocks %R", func_ss, storage_blocks);
     }
@@ -163,6 +295,21 @@ void ingest_extent(tfsfile f, symbol off, tuple value)
     ex->md = value;
     if (get(value, sym(uninited)))
         ex->uninited = INVALID_ADDRESS;
+    ex->shared = shared;
+    string compression = get_string(value, sym(compression));
+    if (compression) {
+        int c = filesystem_compression_from_name(compression);
+        u64 clength;
+        if ((c > TFS_COMPRESSION_NONE) && ingest_parse_int(value, sym(clength), &clength) &&
+            (clength <= allocated << fs->fs.blocksize_order)) {
+            ex->compression = c;
+            ex->clength = clength;
+            tfsfile_set_compressed(f);
+        } else {
+            msg_err("TFS %s: unsupported compressed extent %v", func_ss, value);
+            ex->compression = TFS_COMPRESSION_UNSUPPORTED;
+        }
+    }
     assert(rangemap_insert(f->extentmap, &ex->node));
 }
 
@@ -233,11 +380,9 @@ closure_function(2, 1, void, zero_blocks_complete,
     closure_finish();
 }
 
-void zero_blocks(tfs fs, range blocks, merge m)
+static void zero_blocks_write(tfs fs, range blocks, status_handler completion)
 {
     int blocks_per_page = U64_FROM_BIT(fs->page_order - fs->fs.blocksize_order);
-    tfs_debug("%s: fs %p, blocks %R\n", func_ss, fs, blocks);
-    status_handler completion = apply_merge(m);
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         apply(completion, timm("result", "failed to allocate sg list"));
@@ -272,6 +417,165 @@ void zero_blocks(tfs fs, range blocks, merge m)
     apply(fs->req_handler, &req);
 }
 
+closure_function(3, 1, void, zero_blocks_op_complete,
+                 tfs, fs, range, blocks, status_handler, completion,
+                 status s)
+{
+    tfs fs = bound(fs);
+    range blocks = bound(blocks);
+    status_handler completion = bound(completion);
+    closure_finish();
+    if (is_ok(s)) {
+        apply(completion, s);
+        return;
+    }
+
+    /* Fall back to writing zero pages, and stop using the zero operation for this volume if the
+     * storage device does not support it. */
+    tfs_debug("%s: zero operation failed (%v), writing blocks %R\n", func_ss, s, blocks);
+    if (storage_status_unsupported(s))
+        fs->storage_no_zero = true;
+    timm_dealloc(s);
+    zero_blocks_write(fs, blocks, completion);
+}
+
+void zero_blocks(tfs fs, range blocks, merge m)
+{
+    tfs_debug("%s: fs %p, blocks %R\n", func_ss, fs, blocks);
+    status_handler completion = apply_merge(m);
+    if (!fs->storage_no_zero) {
+        status_handler sh = closure(fs->fs.h, zero_blocks_op_complete, fs, blocks, completion);
+        if (sh != INVALID_ADDRESS) {
+            struct storage_req req = {
+                .op = STORAGE_OP_ZERO,
+                .blocks = blocks,
+                .completion = sh,
+            };
+            apply(fs->req_handler, &req);
+            return;
+        }
+    }
+    zero_blocks_write(fs, blocks, completion);
+}
+
+#ifndef BOOT
+
+closure_function(7, 1, void, decompress_extent_complete,
+                 tfs, fs, sg_list, sg, void *, cbuf, u64, clength, void *, buf, u64, length,
+                 status_handler, completion,
+                 status s)
+{
+    tfs fs = bound(fs);
+    void *cbuf = bound(cbuf);
+    u64 clength = bound(clength);
+    void *buf = bound(buf);
+    u64 length = bound(length);
+    if (is_ok(s)) {
+        s64 ulength = lz4_decompress(cbuf, clength, buf, length);
+        if (ulength >= 0)
+            zero(buf + ulength, length - ulength);
+        else
+            s = timm("result", "invalid compressed data");
+    }
+    deallocate_sg_list(bound(sg));
+    deallocate(fs->dma, cbuf, pad(clength, fs_blocksize(&fs->fs)));
+    apply(bound(completion), s);
+    closure_finish();
+}
+
+/* Reads the compressed data of an extent from storage and decompresses the whole cluster into buf
+ * (length bytes, i.e. the file range of the extent): any data past the end of the decompressed
+ * cluster is zeroed. */
+static void decompress_extent(tfs fs, u64 start_block, u32 clength, u8 compression, void *buf,
+                              u64 length, status_handler completion)
+{
+    if (compression != TFS_COMPRESSION_LZ4) {
+        apply(completion, timm("result", "unsupported compression algorithm"));
+        return;
+    }
+    u64 csize = pad(clength, fs_blocksize(&fs->fs));
+    void *cbuf = allocate(fs->dma, csize);
+    if (cbuf == INVALID_ADDRESS)
+        goto alloc_fail;
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        goto dealloc_cbuf;
+    status_handler sh = closure(fs->fs.h, decompress_extent_complete, fs, sg, cbuf, clength, buf,
+                                length, completion);
+    if (sh == INVALID_ADDRESS)
+        goto dealloc_sg;
+    sg_buf sgb = sg_list_tail_add(sg, csize);
+    if (sgb == INVALID_ADDRESS) {
+        deallocate_closure(sh);
+        goto dealloc_sg;
+    }
+    sgb->buf = cbuf;
+    sgb->size = csize;
+    sgb->offset = 0;
+    sgb->refcount = 0;
+    filesystem_storage_op(fs, sg, irangel(start_block, csize >> fs->fs.blocksize_order), false,
+                          sh);
+    return;
+  dealloc_sg:
+    deallocate_sg_list(sg);
+  dealloc_cbuf:
+    deallocate(fs->dma, cbuf, csize);
+  alloc_fail:
+    apply(completion, timm("result", "failed to allocate memory for compressed extent"));
+}
+
+closure_function(6, 1, void, read_compressed_complete,
+                 tfs, fs, sg_list, sg, void *, buf, u64, length, range, q, status_handler, completion,
+                 status s)
+{
+    sg_list sg = bound(sg);
+    if (is_ok(s))
+        sg_copy_from_buf(bound(buf) + bound(q).start, sg, range_span(bound(q)));
+    else
+        sg_list_release(sg);
+    deallocate_sg_list(sg);
+    deallocate(bound(fs)->fs.h, bound(buf), bound(length));
+    apply(bound(completion), s);
+    closure_finish();
+}
+
+#endif
+
+/* Reads the file blocks i of a compressed extent into sg: the whole cluster is decompressed, and
+ * the requested data is copied into the sg buffers. */
+static void read_compressed_extent(tfs fs, extent e, range i, sg_list sg,
+                                   status_handler completion)
+{
+    int order = fs->fs.blocksize_order;
+    u64 length = range_span(i) << order;
+#ifndef BOOT
+    u64 cluster_len = range_span(e->node.r) << order;
+    void *buf = allocate(fs->fs.h, cluster_len);
+    if (buf == INVALID_ADDRESS)
+        goto alloc_fail;
+    sg_list dest = allocate_sg_list();
+    if (dest == INVALID_ADDRESS)
+        goto dealloc_buf;
+    status_handler sh = closure(fs->fs.h, read_compressed_complete, fs, dest, buf, cluster_len,
+                                irangel((i.start - e->node.r.start) << order, length), completion);
+    if (sh == INVALID_ADDRESS)
+        goto dealloc_sg;
+    sg_move(dest, sg, length);
+    decompress_extent(fs, e->start_block, e->clength, e->compression, buf, cluster_len, sh);
+    return;
+  dealloc_sg:
+    deallocate_sg_list(dest);
+  dealloc_buf:
+    deallocate(fs->fs.h, buf, cluster_len);
+  alloc_fail:
+    sg_zero_fill(sg, length);
+    apply(completion, timm("result", "failed to allocate memory for compressed extent"));
+#else
+    sg_zero_fill(sg, length);
+    apply(completion, timm("result", "compressed extents not supported"));
+#endif
+}
+
 closure_function(4, 1, boolean, read_extent,
                  tfs, fs, sg_list, sg, merge, m, range, blocks,
                  rmnode node)
@@ -286,7 +590,9 @@ closure_function(4, 1, boolean, read_extent,
     tfs_debug("%s: e %p, uninited %p, sg %p m %p blocks %R, i %R, len %ld, blocks %R\n",
               func_ss, e, e->uninited, bound(sg), bound(m), bound(blocks), i, len, blocks);
     uninited u = e->uninited;
-    if (!u || ((u != INVALID_ADDRESS) && u->initialized))
+    if (e->compression)
+        read_compressed_extent(fs, e, i, sg, apply_merge(bound(m)));
+    else if (!u || ((u != INVALID_ADDRESS) && u->initialized))
         filesystem_storage_op(fs, sg, blocks, false, apply_merge(bound(m)));
     else
         sg_zero_fill(sg, range_span(blocks) << fs->fs.blocksize_order);
@@ -423,14 +729,131 @@ static int create_extent(tfs fs, range blocks, boolean uninited, extent *ex)
     return 0;
 }
 
+static void deallocate_extent(tfs fs, extent ex)
+{
+    if (ex->uninited && ex->uninited != INVALID_ADDRESS)
+        refcount_release(&ex->uninited->refcount);
+    deallocate(fs->fs.h, ex, sizeof(*ex));
+}
+
+/* Drops a reference to shared storage blocks, which are freed when no longer referenced. */
+static void filesystem_unshare_storage(tfs fs, range blocks)
+{
+    tfs_storage_lock(fs);
+    if (tfs_shared_split(fs, blocks.start) && tfs_shared_split(fs, blocks.end))
+        tfs_shared_release(fs, blocks, true);
+    else
+        msg_err("TFS: failed to release shared storage at %R", blocks);
+    tfs_storage_unlock(fs);
+}
+
+/* If the shared storage blocks of an extent are not referenced by any other extent, makes the
+ * extent the exclusive owner of its blocks and returns true. */
+static boolean filesystem_own_storage(tfs fs, extent ex)
+{
+    range blocks = irangel(ex->start_block, ex->allocated);
+    boolean owned = false;
+    tfs_storage_lock(fs);
+    for (u64 block = blocks.start; block < blocks.end;) {
+        tfs_shared s = (tfs_shared)rangemap_lookup(fs->shared, block);
+        if ((s == INVALID_ADDRESS) || (s->refcount != 1))
+            goto out;
+        block = s->node.r.end;
+    }
+    if (!tfs_shared_split(fs, blocks.start) || !tfs_shared_split(fs, blocks.end))
+        goto out;
+    tfs_shared_release(fs, blocks, false);
+    owned = true;
+  out:
+    tfs_storage_unlock(fs);
+    return owned;
+}
+
 static void destroy_extent(tfs fs, extent ex)
 {
     range q = irangel(ex->start_block, ex->allocated);
+    if (ex->shared)
+        filesystem_unshare_storage(fs, q);
+    else if (!filesystem_free_storage(fs, q))
+        msg_err("TFS: failed to mark extent at %R as free", q);
+    deallocate_extent(fs, ex);
+}
+
+closure_function(2, 1, void, discard_extent_complete,
+                 tfs, fs, range, q,
+                 status s)
+{
+    tfs fs = bound(fs);
+    range q = bound(q);
+    closure_finish();
+    if (!is_ok(s)) {
+        if (storage_status_unsupported(s))
+            fs->storage_no_discard = true;
+        timm_dealloc(s);
+    }
     if (!filesystem_free_storage(fs, q))
         msg_err("TFS: failed to mark extent at %R as free", q);
-    if (ex->uninited && ex->uninited != INVALID_ADDRESS)
-        refcount_release(&ex->uninited->refcount);
-    deallocate(fs->fs.h, ex, sizeof(*ex));
+}
+
+/* Discards storage blocks on the storage device (if `discard` is true), then frees them. */
+static void discard_blocks(tfs fs, range q, boolean discard)
+{
+    status_handler sh;
+    if (!discard || fs->storage_no_discard ||
+        ((sh = closure(fs->fs.h, discard_extent_complete, fs, q)) == INVALID_ADDRESS)) {
+        if (!filesystem_free_storage(fs, q))
+            msg_err("TFS: failed to mark extent at %R as free", q);
+        return;
+    }
+    struct storage_req req = {
+        .op = STORAGE_OP_DISCARD,
+        .blocks = q,
+        .completion = sh,
+    };
+    apply(fs->req_handler, &req);
+}
+
+/* Flushes the log so that the removal of the extents whose blocks are pending discard is persisted
+ * before the blocks are discarded. Called with fs locked. */
+static void flush_discards(tfs fs)
+{
+    rangemap discards = fs->discards_flushing;
+    fs->discards_flushing = fs->discards;
+    fs->discards = discards;
+    log_flush(fs->tl, (status_handler)&fs->discards_flushed);
+}
+
+closure_func_basic(status_handler, void, tfs_discards_flushed,
+                   status s)
+{
+    tfs fs = struct_from_field(closure_self(), tfs, discards_flushed);
+    filesystem_lock(&fs->fs);
+
+    /* If the log could not be flushed, the discarded extents may still be referenced by the log on
+     * the storage device, so their contents must be preserved. */
+    rangemap_foreach(fs->discards_flushing, n) {
+        range q = n->r;
+        rangemap_remove_range(fs->discards_flushing, n);
+        discard_blocks(fs, q, is_ok(s));
+    }
+    if (rangemap_count(fs->discards) > 0)
+        flush_discards(fs);
+    filesystem_unlock(&fs->fs);
+}
+
+/* Destroys an extent whose data has been deleted: its storage blocks are discarded on the storage
+ * device after the removal of the extent is written to the log, and can be re-allocated only after
+ * the discard operation completes. */
+static void discard_extent(tfs fs, extent ex)
+{
+    range q = irangel(ex->start_block, ex->allocated);
+    if (ex->shared || fs->storage_no_discard || !rangemap_insert_range(fs->discards, q)) {
+        destroy_extent(fs, ex);
+        return;
+    }
+    deallocate_extent(fs, ex);
+    if (rangemap_count(fs->discards_flushing) == 0)
+        flush_discards(fs);
 }
 
 static int add_extent_to_file(tfsfile f, extent ex)
@@ -458,6 +881,12 @@ static int add_extent_to_file(tfsfile f, extent ex)
         set(e, sym(allocated), value_from_u64(ex->allocated));
         if (ex->uninited == INVALID_ADDRESS)
             set(e, sym(uninited), null_value);
+        if (ex->shared)
+            set(e, sym(shared), null_value);
+        if (ex->compression) {
+            set(e, sym(compression), wrap_string_sstring(tfs_compression_names[ex->compression]));
+            set(e, sym(clength), value_from_u64(ex->clength));
+        }
         symbol offs = intern_u64(ex->node.r.start);
         int s = filesystem_write_eav(fs, extents, offs, e, false);
         if (s != 0) {
@@ -644,6 +1073,11 @@ static int update_extent_length(tfsfile f, extent ex, u64 new_length)
 
 static int extend(tfsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *edge)
 {
+    /* Storage is not allocated to fill a hole between the extent and the written range. */
+    if (ex->shared || ex->compression || (blocks.start > ex->node.r.start + ex->allocated)) {
+        *edge = blocks.start;
+        return 0;
+    }
     tfs fs = tfs_from_file(f);
     blocks.end = MIN(blocks.end, ex->node.r.start + (MAX_EXTENT_SIZE >> fs->fs.blocksize_order));
     u64 free = ex->allocated - range_span(ex->node.r);
@@ -689,12 +1123,179 @@ static int extend(tfsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *
     return s;
 }
 
+static int set_extent_exclusive(tfsfile f, extent ex)
+{
+    if (f->f.md) {
+        assert(ex->md);
+        symbol a = sym(shared);
+        int s = filesystem_write_eav(tfs_from_file(f), ex->md, a, 0, false);
+        if (s != 0)
+            return s;
+        set(ex->md, a, 0);
+        f->f.status |= FSF_DIRTY_DATASYNC;
+    }
+    ex->shared = false;
+    return 0;
+}
+
+/* Adds to a file an extent referencing shared storage blocks. The storage blocks of a compressed
+ * extent contain clength bytes of compressed data. */
+static int add_shared_extent(tfsfile f, range file_blocks, u64 start_block, boolean uninited,
+                             u8 compression, u32 clength)
+{
+    tfs fs = tfs_from_file(f);
+    u64 nblocks = compression ? pad(clength, fs_blocksize(&fs->fs)) >> fs->fs.blocksize_order :
+                                range_span(file_blocks);
+    range storage_blocks = irangel(start_block, nblocks);
+    extent ex = allocate_extent(fs->fs.h, file_blocks, storage_blocks);
+    if (ex == INVALID_ADDRESS)
+        return -ENOMEM;
+    ex->md = 0;
+    if (uninited)
+        ex->uninited = INVALID_ADDRESS;
+    ex->compression = compression;
+    ex->clength = clength;
+    if (!filesystem_share_storage(fs, storage_blocks)) {
+        deallocate_extent(fs, ex);
+        return -ENOMEM;
+    }
+    ex->shared = true;
+    int fss = add_extent_to_file(f, ex);
+    if (fss != 0)
+        destroy_extent(fs, ex);
+    else if (compression)
+        tfsfile_set_compressed(f);
+    return fss;
+}
+
+/* Makes an extent share its storage blocks, so that extents referencing a subset of the blocks can
+ * replace it. */
+static int set_extent_shared(tfsfile f, extent ex)
+{
+    tfs fs = tfs_from_file(f);
+    range storage_blocks = irangel(ex->start_block, ex->allocated);
+    if (!filesystem_share_storage(fs, storage_blocks))
+        return -ENOMEM;
+    if (f->f.md) {
+        assert(ex->md);
+        symbol a = sym(shared);
+        int s = filesystem_write_eav(fs, ex->md, a, null_value, false);
+        if (s != 0) {
+            filesystem_unshare_storage(fs, storage_blocks);
+            return s;
+        }
+        set(ex->md, a, null_value);
+        f->f.status |= FSF_DIRTY_DATASYNC;
+    }
+    ex->shared = true;
+    return 0;
+}
+
+/* Removes a block range from a shared extent: the extent is replaced with extents referencing the
+ * storage blocks outside the range (if any); blocks no longer referenced by any extent are freed. */
+static int trim_shared_extent(tfsfile f, extent ex, range blocks)
+{
+    tfs fs = tfs_from_file(f);
+    tfs_debug("%s: file %p, extent %R, blocks %R\n", func_ss, f, ex->node.r, blocks);
+    range r = ex->node.r;
+    range i = range_intersection(r, blocks);
+    u64 start_block = ex->start_block;
+    boolean uninited = (ex->uninited == INVALID_ADDRESS);
+
+    /* Hold a reference to the blocks while the extent is replaced. */
+    range storage_blocks = irangel(start_block, ex->allocated);
+    if (!filesystem_share_storage(fs, storage_blocks))
+        return -ENOMEM;
+    remove_extent_from_file(f, ex);
+    destroy_extent(fs, ex);
+    int fss = 0;
+    if (i.start > r.start)
+        fss = add_shared_extent(f, irange(r.start, i.start), start_block, uninited,
+                                TFS_COMPRESSION_NONE, 0);
+    if ((fss == 0) && (i.end < r.end))
+        fss = add_shared_extent(f, irange(i.end, r.end), start_block + (i.end - r.start),
+                                uninited, TFS_COMPRESSION_NONE, 0);
+    filesystem_unshare_storage(fs, storage_blocks);
+    return fss;
+}
+
+/* Copy-on-write: before a block range is written, any extents in the range whose storage is shared
+ * with other extents are trimmed so that the range becomes a gap, to be filled with new extents. */
+static int unshare_extents(tfsfile f, range blocks)
+{
+    tfs fs = tfs_from_file(f);
+    rmnode n = rangemap_lookup_at_or_next(f->extentmap, blocks.start);
+    while ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        extent ex = (extent)n;
+        n = rangemap_next_node(f->extentmap, n);
+        if (!ex->shared)
+            continue;
+        if (filesystem_own_storage(fs, ex)) {
+            int fss = set_extent_exclusive(f, ex);
+            if (fss != 0) {
+                filesystem_share_storage(fs, irangel(ex->start_block, ex->allocated));
+                return fss;
+            }
+            continue;
+        }
+        int fss = trim_shared_extent(f, ex, blocks);
+        if (fss != 0)
+            return fss;
+    }
+    return 0;
+}
+
+/* Returns true if a boundary of a block range of a file falls inside a compressed extent, which
+ * cannot be split. */
+static boolean compressed_extent_split(tfsfile f, range blocks)
+{
+    extent ex = (extent)rangemap_lookup(f->extentmap, blocks.start);
+    if ((ex != INVALID_ADDRESS) && ex->compression && (ex->node.r.start < blocks.start))
+        return true;
+    ex = (extent)rangemap_lookup(f->extentmap, blocks.end - 1);
+    return (ex != INVALID_ADDRESS) && ex->compression && (ex->node.r.end > blocks.end);
+}
+
+/* Removes any storage blocks in a block range of a file, so that the range becomes a gap. */
+static int punch_extents(tfsfile f, range blocks)
+{
+    tfs fs = tfs_from_file(f);
+    if (compressed_extent_split(f, blocks))
+        return -EOPNOTSUPP;
+    rmnode n = rangemap_lookup_at_or_next(f->extentmap, blocks.start);
+    while ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        extent ex = (extent)n;
+        n = rangemap_next_node(f->extentmap, n);
+        if (range_contains(blocks, ex->node.r)) {
+            remove_extent_from_file(f, ex);
+            discard_extent(fs, ex);
+            continue;
+        }
+
+        /* The blocks of an extent partially in the range are shared with the extents replacing
+         * it, so that only the blocks in the range are freed. */
+        int fss = ex->shared ? 0 : set_extent_shared(f, ex);
+        if (fss == 0)
+            fss = trim_shared_extent(f, ex, blocks);
+        if (fss != 0)
+            return fss;
+    }
+    return 0;
+}
+
 static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merge m)
 {
     assert(range_span(q) > 0);
     range blocks = range_rshift_pad(q, fs->fs.blocksize_order);
     tfs_debug("%s: file %p blocks %R sg %p m %p\n", func_ss, f, blocks, sg, m);
     assert(!sg || sg->count >= range_span(blocks) << fs->fs.blocksize_order);
+    if (m) {
+        int fss = unshare_extents(f, blocks);
+        if (fss != 0) {
+            status s = timm("result", "unable to unshare extents");
+            return timm_append(s, "fsstatus", "%d", fss);
+        }
+    }
 
     rmnode prev;            /* prior to edge, but could be extended */
     rmnode next;            /* intersecting or succeeding */
@@ -737,8 +1338,8 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
                 }
             }
         } else {
-            /* zero: skip to start of next node */
-            blocks.start = limit;
+            /* zero: skip to start of next node (the range may start inside the current node) */
+            blocks.start = MAX(blocks.start, limit);
         }
 
         prev = next;
@@ -749,7 +1350,7 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
             if (m && !sg && range_contains(blocks, ex->node.r)) {
                 blocks.start = ex->node.r.end;
                 remove_extent_from_file(f, ex);
-                destroy_extent(fs, ex);
+                discard_extent(fs, ex);
                 prev = INVALID_ADDRESS; /* prev isn't used in zero, but just to be safe */
             } else if (blocks.end > ex->node.r.start) {
                 /* TODO: improve write_extent to trim extent on zero */
@@ -773,6 +1374,128 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
     return STATUS_OK;
 }
 
+/* Removes the compressed extents in a block range of a file that is about to be written or zeroed:
+ * extents entirely in the range are discarded, while extents only partially in the range must be
+ * converted to uncompressed extents to preserve the rest of their cluster. Returns the first extent
+ * to be converted, if any. Called with fs locked. */
+static extent remove_compressed_extents(tfsfile f, range blocks)
+{
+    tfs fs = tfs_from_file(f);
+    rmnode n = rangemap_lookup_at_or_next(f->extentmap, blocks.start);
+    while ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        extent ex = (extent)n;
+        n = rangemap_next_node(f->extentmap, n);
+        if (!ex->compression)
+            continue;
+        if (!range_contains(blocks, ex->node.r))
+            return ex;
+        remove_extent_from_file(f, ex);
+        discard_extent(fs, ex);
+    }
+    return 0;
+}
+
+/* Conversion of a compressed extent to uncompressed extents: the cluster is decompressed and
+ * written back to newly allocated storage, then the write that triggered the conversion is
+ * retried. */
+typedef struct tfs_uncompress {
+    tfsfile f;
+    extent ex;
+    u64 start_block;
+    u32 clength;
+    u8 compression;
+    range r;                    /* file blocks of the cluster */
+    void *buf;                  /* decompressed cluster */
+    sg_list sg;
+    sg_list write_sg;           /* write to be retried */
+    range write_q;
+    status_handler write_complete;
+    closure_struct(status_handler, decompressed);
+    closure_struct(status_handler, written);
+} *tfs_uncompress;
+
+static void tfs_write(fsfile fsf, sg_list sg, range q, status_handler complete);
+
+static void uncompress_extent_done(tfs_uncompress u, status s)
+{
+    fsfile f = &u->f->f;
+    tfs fs = (tfs)f->fs;
+    if (u->sg)
+        deallocate_sg_list(u->sg);
+    deallocate(fs->dma, u->buf, range_span(u->r) << fs->fs.blocksize_order);
+    sg_list write_sg = u->write_sg;
+    range write_q = u->write_q;
+    status_handler complete = u->write_complete;
+    deallocate(fs->fs.h, u, sizeof(*u));
+    if (is_ok(s))
+        tfs_write(f, write_sg, write_q, complete);
+    else
+        apply(complete, s);
+}
+
+closure_func_basic(status_handler, void, uncompress_extent_written,
+                   status s)
+{
+    tfs_uncompress u = struct_from_field(closure_self(), tfs_uncompress, written);
+    uncompress_extent_done(u, s);
+}
+
+closure_func_basic(status_handler, void, uncompress_extent_decompressed,
+                   status s)
+{
+    tfs_uncompress u = struct_from_field(closure_self(), tfs_uncompress, decompressed);
+    if (!is_ok(s)) {
+        uncompress_extent_done(u, s);
+        return;
+    }
+    tfsfile f = u->f;
+    tfs fs = tfs_from_file(f);
+    int order = fs->fs.blocksize_order;
+    filesystem_lock(&fs->fs);
+
+    /* The extent may have been removed while its data was being read. */
+    extent ex = (extent)rangemap_lookup(f->extentmap, u->r.start);
+    if ((ex != u->ex) || (ex->start_block != u->start_block) || !ex->compression) {
+        filesystem_unlock(&fs->fs);
+        uncompress_extent_done(u, STATUS_OK);
+        return;
+    }
+    remove_extent_from_file(f, ex);
+    destroy_extent(fs, ex);
+    range q = irange(u->r.start << order, MIN(u->r.end << order, fsfile_get_length(&f->f)));
+    if (q.start >= q.end) {
+        filesystem_unlock(&fs->fs);
+        uncompress_extent_done(u, STATUS_OK);
+        return;
+    }
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS) {
+        filesystem_unlock(&fs->fs);
+        uncompress_extent_done(u, timm("result", "failed to allocate sg list"));
+        return;
+    }
+    u64 length = range_span(u->r) << order;
+    sg_buf sgb = sg_list_tail_add(sg, length);
+    assert(sgb != INVALID_ADDRESS);
+    sgb->buf = u->buf;
+    sgb->size = length;
+    sgb->offset = 0;
+    sgb->refcount = 0;
+    merge m = allocate_merge(fs->fs.h, init_closure_func(&u->written, status_handler,
+                                                         uncompress_extent_written));
+    if (m == INVALID_ADDRESS) {
+        filesystem_unlock(&fs->fs);
+        deallocate_sg_list(sg);
+        uncompress_extent_done(u, timm("result", "failed to allocate merge"));
+        return;
+    }
+    u->sg = sg;
+    status_handler k = apply_merge(m);
+    s = extents_range_handler(fs, f, q, sg, m);
+    filesystem_unlock(&fs->fs);
+    apply(k, s);
+}
+
 static void tfs_write(fsfile fsf,
                  sg_list sg, range q, status_handler complete)
 {
@@ -787,13 +1510,215 @@ static void tfs_write(fsfile fsf,
         return;
     }
 
+    filesystem_lock(&fs->fs);
+    extent ex = remove_compressed_extents(f, range_rshift_pad(q, fs->fs.blocksize_order));
+    if (ex) {
+        tfs_debug("   uncompress extent %R\n", ex->node.r);
+        tfs_uncompress u = allocate(fs->fs.h, sizeof(*u));
+        if (u == INVALID_ADDRESS)
+            goto uncompress_fail;
+        u->buf = allocate(fs->dma, range_span(ex->node.r) << fs->fs.blocksize_order);
+        if (u->buf == INVALID_ADDRESS) {
+            deallocate(fs->fs.h, u, sizeof(*u));
+            goto uncompress_fail;
+        }
+        u->f = f;
+        u->ex = ex;
+        u->start_block = ex->start_block;
+        u->clength = ex->clength;
+        u->compression = ex->compression;
+        u->r = ex->node.r;
+        u->sg = 0;
+        u->write_sg = sg;
+        u->write_q = q;
+        u->write_complete = complete;
+        filesystem_unlock(&fs->fs);
+        decompress_extent(fs, u->start_block, u->clength, u->compression, u->buf,
+                          range_span(u->r) << fs->fs.blocksize_order,
+                          init_closure_func(&u->decompressed, status_handler,
+                                            uncompress_extent_decompressed));
+        return;
+    }
     merge m = allocate_merge(fs->fs.h, complete);
     status_handler sh = apply_merge(m);
-
-    filesystem_lock(&fs->fs);
     status s = extents_range_handler(fs, f, q, sg, m);
     filesystem_unlock(&fs->fs);
     apply(sh, s);
+    return;
+  uncompress_fail:
+    filesystem_unlock(&fs->fs);
+    apply(complete, timm("result", "failed to allocate memory for compressed extent"));
+}
+
+/* Makes a range of the destination file refer to the storage blocks of a range of the source file,
+ * without copying any data: the blocks are shared between the two files until either file range is
+ * written. Any blocks previously allocated in the destination range are released, and holes in the
+ * source range are holes in the destination range. Offsets must be aligned to the filesystem block
+ * size; if the source and destination files are the same, the ranges must not overlap. */
+int filesystem_clone_range(fsfile dest, u64 dest_offset, fsfile src, u64 src_offset, u64 length)
+{
+    if (!fs_is_tfs(src->fs))
+        return -EOPNOTSUPP;
+    if (dest->fs != src->fs)
+        return -EXDEV;
+    tfs fs = (tfs)src->fs;
+    tfsfile df = (tfsfile)dest, sf = (tfsfile)src;
+    int order = fs->fs.blocksize_order;
+    if ((dest_offset | src_offset) & MASK(order))
+        return -EINVAL;
+    if (fs->fs.ro)
+        return -EROFS;
+    if (length == 0)
+        return 0;
+    range src_blocks = range_rshift_pad(irangel(src_offset, length), order);
+    s64 delta = (s64)(dest_offset >> order) - (s64)src_blocks.start;
+    range dest_blocks = range_add(src_blocks, delta);
+    if ((dest == src) && ranges_intersect(src_blocks, dest_blocks))
+        return -EINVAL;
+    filesystem_lock(&fs->fs);
+    int fss;
+    if (compressed_extent_split(sf, src_blocks)) {
+        fss = -EOPNOTSUPP;
+        goto out;
+    }
+    fss = punch_extents(df, dest_blocks);
+    if (fss != 0)
+        goto out;
+    rmnode n = rangemap_lookup_at_or_next(sf->extentmap, src_blocks.start);
+    while ((n != INVALID_ADDRESS) && (n->r.start < src_blocks.end)) {
+        extent ex = (extent)n;
+        n = rangemap_next_node(sf->extentmap, n);
+        if (!ex->shared) {
+            fss = set_extent_shared(sf, ex);
+            if (fss != 0)
+                goto out;
+        }
+        range i = range_intersection(ex->node.r, src_blocks);
+        fss = add_shared_extent(df, range_add(i, delta),
+                                ex->start_block + (i.start - ex->node.r.start),
+                                ex->uninited == INVALID_ADDRESS, ex->compression, ex->clength);
+        if (fss != 0)
+            goto out;
+    }
+    if (fsfile_get_length(dest) < dest_offset + length)
+        fss = filesystem_truncate_locked(&fs->fs, dest, dest_offset + length);
+  out:
+    filesystem_unlock(&fs->fs);
+    return fss;
+}
+
+closure_function(6, 1, void, write_compressed_complete,
+                 tfs, fs, sg_list, sg, void *, buf, u64, size, u64, length,
+                 io_status_handler, io_complete,
+                 status s)
+{
+    sg_list sg = bound(sg);
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    deallocate(bound(fs)->dma, bound(buf), bound(size));
+    apply(bound(io_complete), s, is_ok(s) ? bound(length) : 0);
+    closure_finish();
+}
+
+/* Writes a cluster of file data in compressed form: the file range q, which must be a gap with its
+ * start aligned to the filesystem block size, is mapped to a new extent whose storage blocks
+ * contain the clength bytes of compressed data at cdata. */
+void filesystem_write_compressed(fsfile fsf, range q, void *cdata, u64 clength, int compression,
+                                 io_status_handler io_complete)
+{
+    tfs fs = (tfs)fsf->fs;
+    tfsfile f = (tfsfile)fsf;
+    int order = fs->fs.blocksize_order;
+    range blocks = range_rshift_pad(q, order);
+    u64 size = pad(clength, fs_blocksize(&fs->fs));
+    int fss;
+    if ((q.start & MASK(order)) || (range_span(q) > TFS_MAX_CLUSTER_SIZE) || (clength == 0) ||
+        (size >> order > range_span(blocks)) || (compression <= TFS_COMPRESSION_NONE) ||
+        (compression >= _countof(tfs_compression_names))) {
+        fss = -EINVAL;
+        goto error;
+    }
+    if (fs->fs.ro) {
+        fss = -EROFS;
+        goto error;
+    }
+    void *buf = allocate(fs->dma, size);
+    if (buf == INVALID_ADDRESS) {
+        fss = -ENOMEM;
+        goto error;
+    }
+    runtime_memcpy(buf, cdata, clength);
+    zero(buf + clength, size - clength);
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS) {
+        fss = -ENOMEM;
+        goto dealloc_buf;
+    }
+    sg_buf sgb = sg_list_tail_add(sg, size);
+    if (sgb == INVALID_ADDRESS) {
+        fss = -ENOMEM;
+        goto dealloc_sg;
+    }
+    sgb->buf = buf;
+    sgb->size = size;
+    sgb->offset = 0;
+    sgb->refcount = 0;
+    status_handler sh = closure(fs->fs.h, write_compressed_complete, fs, sg, buf, size,
+                                range_span(q), io_complete);
+    if (sh == INVALID_ADDRESS) {
+        fss = -ENOMEM;
+        goto dealloc_sg;
+    }
+    filesystem_lock(&fs->fs);
+    rmnode n = rangemap_lookup_at_or_next(f->extentmap, blocks.start);
+    if ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) {
+        fss = -EEXIST;
+        goto unlock;
+    }
+    if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) ||
+        !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0)) {
+        fss = -ENOSPC;
+        goto unlock;
+    }
+    u64 start_block = filesystem_allocate_storage(fs, size >> order);
+    if (start_block == u64_from_pointer(INVALID_ADDRESS)) {
+        fss = -ENOSPC;
+        goto unlock;
+    }
+    range storage_blocks = irangel(start_block, size >> order);
+    extent ex = allocate_extent(fs->fs.h, blocks, storage_blocks);
+    if (ex == INVALID_ADDRESS) {
+        filesystem_free_storage(fs, storage_blocks);
+        fss = -ENOMEM;
+        goto unlock;
+    }
+    ex->md = 0;
+    ex->compression = compression;
+    ex->clength = clength;
+    fss = add_extent_to_file(f, ex);
+    if (fss != 0) {
+        destroy_extent(fs, ex);
+        goto unlock;
+    }
+    if (fsfile_get_length(fsf) < q.end)
+        fss = filesystem_truncate_locked(&fs->fs, fsf, q.end);
+    filesystem_unlock(&fs->fs);
+    if (fss != 0) {
+        status s = timm("result", "unable to set file length");
+        apply(sh, timm_append(s, "fsstatus", "%d", fss));
+        return;
+    }
+    filesystem_storage_op(fs, sg, storage_blocks, true, sh);
+    return;
+  unlock:
+    filesystem_unlock(&fs->fs);
+    deallocate_closure(sh);
+  dealloc_sg:
+    deallocate_sg_list(sg);
+  dealloc_buf:
+    deallocate(fs->dma, buf, size);
+  error:
+    apply(io_complete, timm("result", "failed to write compressed extent (%d)", fss), 0);
 }
 
 closure_function(3, 1, void, fs_cache_sync_complete,
@@ -974,6 +1899,74 @@ void filesystem_dealloc(fsfile f, long offset, long len,
     sh = contextual_closure(filesystem_op_complete, completion);
     apply(pagecache_node_get_writer(fsfile_get_cachenode(f)), 0, irangel(offset, len), sh);
 }
+
+closure_function(6, 1, void, filesystem_clone_synced,
+                 fsfile, dest, u64, dest_offset, fsfile, src, u64, src_offset, u64, length, fs_status_handler, completion,
+                 status s)
+{
+    int fss;
+    if (is_ok(s)) {
+        fsfile dest = bound(dest);
+        range q = irangel(bound(dest_offset), bound(length));
+        if (pagecache_node_invalidate(dest->cache_node, q)) {
+            fss = filesystem_clone_range(dest, q.start, bound(src), bound(src_offset), range_span(q));
+
+            /* Pages may have been fetched while the file range was being cloned. */
+            if (fss == 0)
+                pagecache_node_invalidate(dest->cache_node, q);
+        } else {
+            fss = -EBUSY;
+        }
+    } else {
+        tfs_debug("%s: status %v\n", func_ss, s);
+        timm_dealloc(s);
+        fss = -EIO;
+    }
+    apply(bound(completion), fss);
+    closure_finish();
+}
+
+/* Clones a file range (see filesystem_clone_range()) after writing back the dirty cached pages of
+ * both files; the cached pages of the destination range are evicted, and if any of them is in use
+ * (e.g. mapped by a process) the range is not cloned and -EBUSY is returned. Offsets must be aligned
+ * to the page cache page size; the length must be aligned too, unless the source range ends at the
+ * end of the source file and the destination range is not followed by any file data. */
+void filesystem_clone(fsfile dest, u64 dest_offset, fsfile src, u64 src_offset, u64 length,
+                      fs_status_handler completion)
+{
+    filesystem fs = src->fs;
+    int fss;
+    if (!fs_is_tfs(fs)) {
+        fss = -EOPNOTSUPP;
+        goto out;
+    }
+    if (dest->fs != fs) {
+        fss = -EXDEV;
+        goto out;
+    }
+    u64 page_mask = MASK(((tfs)fs)->page_order);
+    if (((dest_offset | src_offset) & page_mask) ||
+        ((length & page_mask) && ((src_offset + length != fsfile_get_length(src)) ||
+                                  (dest_offset + length < fsfile_get_length(dest))))) {
+        fss = -EINVAL;
+        goto out;
+    }
+    status_handler synced = closure(fs->h, filesystem_clone_synced, dest, dest_offset, src,
+                                    src_offset, length, completion);
+    if (synced == INVALID_ADDRESS) {
+        fss = -ENOMEM;
+        goto out;
+    }
+    merge m = allocate_merge(fs->h, synced);
+    status_handler sh = apply_merge(m);
+    pagecache_sync_node(src->cache_node, apply_merge(m));
+    if (dest != src)
+        pagecache_sync_node(dest->cache_node, apply_merge(m));
+    apply(sh, STATUS_OK);
+    return;
+  out:
+    apply(completion, fss);
+}
 #endif
 
 closure_func_basic(binding_handler, boolean, cleanup_directory_each,
@@ -1125,7 +2118,7 @@ closure_function(1, 1, boolean, free_extent,
                  tfs, fs,
                  rmnode n)
 {
-    destroy_extent(bound(fs), (extent)n);
+    discard_extent(bound(fs), (extent)n);
     return true;
 }
 
@@ -1382,6 +2375,7 @@ void create_filesystem(heap h,
         ignore_io_status = closure_func(h, io_status_handler, ignore_io);
     fs->files = allocate_table(h, identity_key, pointer_equal);
     fs->req_handler = req_handler;
+    fs->storage_no_zero = fs->storage_no_discard = false;
     fs->fs.root = 0;
     fs->fs.lookup = fs_lookup;
     fs->fs.get_fsfile = tfs_get_fsfile;
@@ -1399,17 +2393,26 @@ void create_filesystem(heap h,
     fs->fs.destroy_fs = destroy_filesystem;
     fs->storage = allocate_rangemap(h);
     assert(fs->storage != INVALID_ADDRESS);
+    fs->shared = allocate_rangemap(h);
+    assert(fs->shared != INVALID_ADDRESS);
+    fs->discards = allocate_rangemap(h);
+    assert(fs->discards != INVALID_ADDRESS);
+    fs->discards_flushing = allocate_rangemap(h);
+    assert(fs->discards_flushing != INVALID_ADDRESS);
+    init_closure_func(&fs->discards_flushed, status_handler, tfs_discards_flushed);
 #ifdef KERNEL
     spin_lock_init(&fs->storage_lock);
     fs->page_order = pagecache_get_page_order();
     fs->zero_page = pagecache_get_zero_page();
 #else
-    fs->page_order = PAGESIZE;
+    fs->page_order = PAGELOG;
     fs->zero_page = allocate_zero(h, PAGESIZE);
 #endif
     fs->temp_log = 0;
 #else
     fs->storage = 0;
+    fs->shared = 0;
+    fs->discards = fs->discards_flushing = 0;
 #endif
     if (!sstring_is_null(label)) {
         int label_len = label.len;
@@ -1446,6 +2449,14 @@ closure_function(1, 1, boolean, tfs_storage_destroy,
     return false;
 }
 
+closure_function(1, 1, boolean, tfs_shared_destroy,
+                 heap, h,
+                 rmnode n)
+{
+    deallocate(bound(h), n, sizeof(struct tfs_shared));
+    return false;
+}
+
 /* If the filesystem is not read-only, this function can only be called after flushing any pending
  * writes. */
 void destroy_filesystem(filesystem fs)
@@ -1463,6 +2474,9 @@ void destroy_filesystem(filesystem fs)
     filesystem_deinit(fs);
     deallocate_table(tfs->files);
     deallocate_rangemap(tfs->storage, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate_rangemap(tfs->shared, stack_closure(tfs_shared_destroy, fs->h));
+    deallocate_rangemap(tfs->discards, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate_rangemap(tfs->discards_flushing, stack_closure(tfs_storage_destroy, fs->h));
     deallocate(fs->h, fs, sizeof(*fs));
 }
 
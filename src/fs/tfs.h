@@ -9,6 +9,13 @@ extern io_status_handler ignore_io_status;
 #define MAX_EXTENT_SIZE (PAGECACHE_MAX_SG_ENTRIES * PAGESIZE)
 #define MIN_EXTENT_ALLOC_SIZE   (1 * MB)
 
+/* Compression algorithms for file extents: a compressed extent maps a cluster of file data (up to
+ * TFS_MAX_CLUSTER_SIZE bytes) to storage blocks containing the compressed cluster. */
+#define TFS_COMPRESSION_NONE    0
+#define TFS_COMPRESSION_LZ4     1
+
+#define TFS_MAX_CLUSTER_SIZE    (64 * KB)
+
 status filesystem_probe(u8 *first_sector, u8 *uuid, char *label);
 sstring filesystem_get_label(filesystem fs);
 void filesystem_get_uuid(filesystem fs, u8 *uuid);
@@ -26,6 +33,10 @@ fsfile fsfile_from_node(filesystem fs, tuple n);
 tfsfile allocate_fsfile(tfs fs, tuple md);
 
 int filesystem_write_tuple(tfs fs, tuple t);
+int filesystem_clone_range(fsfile dest, u64 dest_offset, fsfile src, u64 src_offset, u64 length);
+int filesystem_compression_from_name(string name);
+void filesystem_write_compressed(fsfile f, range q, void *cdata, u64 clength, int compression,
+                                 io_status_handler io_complete);
 int filesystem_write_eav(tfs fs, tuple t, symbol a, value v, boolean cleanup);
 
 int filesystem_mkentry(filesystem fs, tuple cwd, sstring fp, tuple entry,
@@ -14,6 +14,7 @@ typedef struct log *log;
 typedef struct tfs {
     struct filesystem fs;   /* must be first */
     rangemap storage;
+    rangemap shared;            /* tfs_shared nodes */
 #ifdef KERNEL
     struct spinlock storage_lock;
 #endif
@@ -25,6 +26,11 @@ typedef struct tfs {
     heap dma;
     void *zero_page;
     storage_req_handler req_handler;
+    boolean storage_no_zero;    /* the storage device does not support zeroing blocks */
+    boolean storage_no_discard; /* the storage device does not support discarding blocks */
+    rangemap discards;          /* blocks to be discarded after the next log flush */
+    rangemap discards_flushing; /* blocks to be discarded when the log flush in progress completes */
+    closure_struct(status_handler, discards_flushed);
     log tl;
     log temp_log;
     u64 next_extend_log_offset;
@@ -36,6 +42,13 @@ typedef struct tfsfile {
     rangemap extentmap;
 } *tfsfile;
 
+/* Storage blocks referenced by more than one extent: the reference count is the number of extents
+ * referencing any blocks in the range. */
+typedef struct tfs_shared {
+    struct rmnode node;         /* must be first */
+    u64 refcount;
+} *tfs_shared;
+
 declare_closure_struct(2, 0, void, free_uninited,
                        heap, h, struct uninited *, u);
 
@@ -58,6 +71,9 @@ typedef struct extent {
     u64 allocated;
     tuple md;                   /* shortcut to extent meta */
     uninited uninited;
+    boolean shared;             /* storage blocks may be referenced by other extents */
+    u8 compression;             /* TFS_COMPRESSION_* */
+    u32 clength;                /* length in bytes of the compressed data */
 } *extent;
 
 void ingest_extent(tfsfile f, symbol foff, tuple value);
@@ -70,6 +86,7 @@ void log_destroy(log tl);
 u64 filesystem_allocate_storage(tfs fs, u64 nblocks);
 boolean filesystem_reserve_storage(tfs fs, range storage_blocks);
 boolean filesystem_free_storage(tfs fs, range storage_blocks);
+boolean filesystem_share_storage(tfs fs, range storage_blocks);
 void filesystem_storage_op(tfs fs, sg_list sg, range blocks, boolean write,
                            status_handler completion);
 
@@ -969,7 +969,6 @@ typedef struct hn_softc {
 
 	u16 rxbuflen;
 	caching_heap rxbuffers;
-	closure_struct(mem_cleaner, mem_cleaner);
 } hn_softc_t;
 
 
@@ -40,8 +40,6 @@
  */
 #define NETVSC_MAX_CONFIGURABLE_MTU     (9 * 1024)
 
-#define NETVSC_RX_MAXSEGSIZE       NETVSC_MAX_CONFIGURABLE_MTU
-
 typedef struct xpbuf
 {
     struct pbuf_custom p;
@@ -179,6 +177,9 @@ retry_send:
     int ret = hv_rf_on_send(hn->hn_dev_obj, packet);
 
     if (ret == 0) {
+        /* transmission is not serialized by the driver */
+        fetch_and_add(&hn->ndev.qstats->tx_packets, 1);
+        fetch_and_add(&hn->ndev.qstats->tx_bytes, p->tot_len);
         MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
         if (((u8_t *)p->payload)[0] & 1) {
             /* broadcast or multicast packet*/
@@ -217,14 +218,6 @@ retry_send:
     return ERR_OK;
 }
 
-closure_func_basic(mem_cleaner, u64, hn_mem_cleaner,
-                   u64 clean_bytes)
-{
-    hn_softc_t *hn = struct_from_field(closure_self(), hn_softc_t *, mem_cleaner);
-    return cache_drain(hn->rxbuffers, clean_bytes,
-                       NET_RX_BUFFERS_RETAIN * (sizeof(struct xpbuf) + hn->rxbuflen));
-}
-
 static err_t
 vmxif_init(struct netif *netif)
 {
@@ -255,12 +248,17 @@ netvsc_attach(kernel_heaps kh, hv_device* device)
     hn->hn_dev_obj = device;
     device->device = hn;
 
-    hn->rxbuflen = NETVSC_RX_MAXSEGSIZE;
-    hn->rxbuffers = allocate_objcache(hn->general, hn->contiguous,
-                                      hn->rxbuflen + sizeof(struct xpbuf), PAGESIZE_2M, true);
+    /* received frames are copied into a chain of packet buffers */
+    hn->rxbuflen = PKTBUF_SIZE - sizeof(struct xpbuf);
+    hn->rxbuffers = pktbuf_heap();
 
     netif_dev_init(&hn->ndev);
 
+    /* A single VMBus channel is used, i.e. the device has one queue. */
+    hn->ndev.qstats = allocate_zero(h, sizeof(struct netif_qstats));
+    assert(hn->ndev.qstats != INVALID_ADDRESS);
+    hn->ndev.num_queues = 1;
+
     int ret = hv_rf_on_device_add(device, &hn->ndev.n);
     if (ret != 0)
         return timm("err", "err");
@@ -276,7 +274,6 @@ netvsc_attach(kernel_heaps kh, hv_device* device)
               vmxif_init,
               ethernet_input);
 
-    mm_register_mem_cleaner(init_closure_func(&hn->mem_cleaner, mem_cleaner, hn_mem_cleaner));
     netvsc_debug("%s: hwaddr %02x:%02x:%02x:%02x:%02x:%02x", func_ss,
                  netif->hwaddr[0], netif->hwaddr[1], netif->hwaddr[2],
                  netif->hwaddr[3], netif->hwaddr[4], netif->hwaddr[5]);
@@ -402,6 +399,8 @@ netvsc_recv(struct hv_device *device_ctx, netvsc_packet *packet)
             vaddr + packet->page_buffers[i].gpa_ofs);
     }
 
+    hn->ndev.qstats->rx_packets++;
+    hn->ndev.qstats->rx_bytes += x->p.pbuf.tot_len;
     err_enum_t err = n->input((struct pbuf *)x, n);
     if (err != ERR_OK) {
         msg_err("netvsc: rx drop by stack, err %d", err);
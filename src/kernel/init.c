@@ -442,6 +442,22 @@ boolean mm_register_mem_cleaner(mem_cleaner cleaner)
     return true;
 }
 
+void mm_unregister_mem_cleaner(mem_cleaner cleaner)
+{
+    mm_cleaner mmc = 0;
+    spin_lock(&mm_lock);
+    list_foreach(&mm_cleaners, e) {
+        if (struct_from_list(e, mm_cleaner, l)->cleaner == cleaner) {
+            mmc = struct_from_list(e, mm_cleaner, l);
+            list_delete(e);
+            break;
+        }
+    }
+    spin_unlock(&mm_lock);
+    if (mmc)
+        deallocate(heap_locked(init_heaps), mmc, sizeof(*mmc));
+}
+
 closure_function(1, 1, void, mm_service_sync,
                  context, ctx,
                  status s)
@@ -454,6 +470,11 @@ closure_function(1, 1, void, mm_service_sync,
     closure_finish();
 }
 
+static u32 pageheap_current_cpu(void)
+{
+    return current_cpu()->id;
+}
+
 void mm_service(boolean flush)
 {
     heap phys = (heap)heap_physical(init_heaps);
@@ -464,6 +485,10 @@ void mm_service(boolean flush)
         threshold = MEM_CLEAN_THRESHOLD;
     mm_debug("%s: total %ld, alloc %ld, free %ld\n", func_ss,
              heap_total(phys), heap_allocated(phys), free);
+    if (free < threshold) {
+        /* pages cached in per-CPU lists are released before anything else */
+        free += pageheap_drain_percpu();
+    }
     if (free < threshold) {
         u64 clean_bytes = threshold - free;
         u64 cleaned = mm_clean(clean_bytes);
@@ -640,6 +665,7 @@ void kernel_runtime_init(kernel_heaps kh)
     timm_oom = timm("result", "out of memory");
     init_sg(locked);
     dma_init(kh);
+    init_page_pins(locked);
     list_init(&mm_cleaners);
     spin_lock_init(&mm_lock);
     init_pagecache(locked, (heap)kh->pages, PAGESIZE);
@@ -649,6 +675,7 @@ void kernel_runtime_init(kernel_heaps kh)
     init_extra_prints();
     init_pci(kh);
     init_console(kh);
+    init_numa(misc);
     init_platform_devices(kh);
     init_symtab(kh);
     read_kernel_syms();
@@ -683,6 +710,11 @@ void kernel_runtime_init(kernel_heaps kh)
     init_debug("start_secondary_cores");
     init_scheduler_cpus(misc);
     start_secondary_cores(kh);
+    init_sched_domains(misc);
+    numa_init_done();
+    assert(pageheap_init_percpu(present_processors, pageheap_current_cpu));
+    for (int i = 0; i < present_processors; i++)
+        pageheap_set_cpu_node(i, cpuinfo_from_id(i)->numa_node);
 
 #ifdef CONFIG_TRACELOG
     init_debug("init_tracelog");
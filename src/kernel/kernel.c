@@ -180,6 +180,7 @@ cpuinfo init_cpuinfo(heap backed, int cpu)
     /* state */
     ci->id = cpu;
     ci->state = cpu_not_present;
+    ci->numa_node = numa_cpu_node(cpu);
     assert(sched_queue_init(&ci->thread_queue, backed));
     ci->free_kernel_contexts = allocate_queue(backed, FREE_KERNEL_CONTEXT_QUEUE_SIZE);
     assert(ci->free_kernel_contexts != INVALID_ADDRESS);
@@ -82,6 +82,26 @@ typedef struct sched_queue {
     struct spinlock lock;
 } *sched_queue;
 
+typedef struct halt_poll_stats {
+    u64 successes;  /* new work found while polling */
+    u64 failures;   /* poll window expired, CPU halted */
+} *halt_poll_stats;
+
+/* scheduling domains, from the innermost to the outermost */
+#define SCHED_DOMAIN_CORE       0   /* SMT siblings */
+#define SCHED_DOMAIN_LLC        1   /* cores sharing the last level cache */
+#define SCHED_DOMAIN_PACKAGE    2
+#define SCHED_DOMAIN_SYSTEM     3
+#define SCHED_DOMAINS           4
+
+/* CPU topology identifiers: CPUs with the same identifier at a given level share the
+ * corresponding resource */
+typedef struct cpu_topology {
+    u32 core_id;
+    u32 llc_id;
+    u32 package_id;
+} *cpu_topology;
+
 /* per-cpu, architecture-independent invariants */
 typedef struct cpuinfo *cpuinfo;
 
@@ -94,6 +114,21 @@ struct cpuinfo {
     timestamp last_timer_update;
     int targeted_irqs;
     u64 inval_gen; /* Generation number for invalidates */
+    u32 numa_node;
+    struct cpu_topology topology;
+
+    /* other CPUs sorted by scheduling domain, for work stealing and thread placement */
+    u32 *sched_cpus;
+    u64 sched_migrations[SCHED_DOMAINS];    /* threads migrated to or from this CPU */
+
+    /* adaptive halt polling */
+    timestamp halt_poll_window;
+    timestamp halt_start;
+    struct halt_poll_stats halt_poll_stats;
+
+    /* memory policy override for physical page allocations (if mem_nodes is non-zero) */
+    u32 mem_node;
+    u64 mem_nodes;
 
     cpuinfo mcs_prev;
     cpuinfo mcs_next;
@@ -538,6 +573,7 @@ static inline void count_major_fault(void)
 }
 
 void runloop_internal(void) __attribute__((noreturn));
+boolean runloop_work_pending(void);
 
 NOTRACE static inline __attribute__((always_inline)) __attribute__((noreturn)) void runloop(void)
 {
@@ -659,8 +695,14 @@ static inline u64 phys_from_linear_backed_virt(u64 virt)
 }
 
 void unmap_and_free_phys(u64 virtual, u64 length);
+u64 unmap_and_free_clean_phys(u64 virtual, u64 length);
 void page_free_phys(u64 phys);
 
+/* Pinned pages are not freed until unpinned (see page.c). */
+void init_page_pins(heap h);
+boolean page_pin_phys(u64 phys);
+void page_unpin_phys(u64 phys);
+
 #if !defined(BOOT)
 
 heap allocate_tagged_region(kernel_heaps kh, u64 tag, bytes pagesize, boolean locking);
@@ -704,10 +746,16 @@ void irq_put_target_cpu(u32 cpu_id);
 
 void init_scheduler(heap);
 void init_scheduler_cpus(heap h);
+void init_halt_poll(tuple root);
+void init_sched_domains(heap h);
+int sched_cpu_domain(cpuinfo a, cpuinfo b);
+void sched_get_migrations(u64 *migrations);
+void halt_poll_get_stats(halt_poll_stats stats);
 void mm_service(boolean flush);
 
 closure_type(mem_cleaner, u64, u64 clean_bytes);
 boolean mm_register_mem_cleaner(mem_cleaner cleaner);
+void mm_unregister_mem_cleaner(mem_cleaner cleaner);
 
 kernel_heaps get_kernel_heaps(void);
 
@@ -733,6 +781,36 @@ extern u64 total_processors;
 extern u64 present_processors;
 
 void cpu_init(int cpu);
+
+#define NUMA_MAX_NODES          64
+#define NUMA_LOCAL_DISTANCE     10
+#define NUMA_REMOTE_DISTANCE    20
+
+void init_numa(heap h);
+boolean numa_add_memory(u64 base, u64 length, u32 node);
+void numa_set_hwid_node(u64 hwid, u32 node);
+u32 numa_hwid_node(u64 hwid);
+void numa_set_cpu_node(u32 cpu, u32 node);
+u32 numa_cpu_node(u32 cpu);
+void numa_set_distance(u32 from, u32 to, u8 distance);
+u8 numa_distance(u32 from, u32 to);
+u32 numa_node_count(void);
+void numa_init_done(void);
+
+/* Sets the preferred node and the allowed nodes for physical memory allocations on the current
+ * CPU, until numa_clear_mem_policy() is called. */
+static inline void numa_set_mem_policy(u32 node, u64 allowed)
+{
+    cpuinfo ci = current_cpu();
+    ci->mem_node = node;
+    ci->mem_nodes = allowed;
+}
+
+static inline void numa_clear_mem_policy(void)
+{
+    current_cpu()->mem_nodes = 0;
+}
+
 void start_secondary_cores(kernel_heaps kh);
 void count_cpus_present(void);
 void detect_hypervisor(kernel_heaps kh);
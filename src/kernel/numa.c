@@ -0,0 +1,131 @@
+/* NUMA topology, as reported by platform firmware (ACPI SRAT and SLIT tables, or device tree), and
+ * node-local memory allocation: physical pages are allocated from the node of the CPU requesting
+ * them, unless a memory policy is in effect on that CPU. */
+
+#include <kernel.h>
+
+//#define NUMA_DEBUG
+#ifdef NUMA_DEBUG
+#define numa_debug(x, ...) do {tprintf(sym(numa), 0, ss(x "\n"), ##__VA_ARGS__);} while(0)
+#else
+#define numa_debug(x, ...)
+#endif
+
+BSS_RO_AFTER_INIT static table numa_hwid_nodes;
+BSS_RO_AFTER_INIT static vector numa_cpu_nodes;
+BSS_RO_AFTER_INIT static u32 numa_nodes;
+BSS_RO_AFTER_INIT static u8 numa_distances[NUMA_MAX_NODES][NUMA_MAX_NODES];
+
+void init_numa(heap h)
+{
+    numa_hwid_nodes = allocate_table(h, identity_key, pointer_equal);
+    assert(numa_hwid_nodes != INVALID_ADDRESS);
+    numa_cpu_nodes = allocate_vector(h, 1);
+    assert(numa_cpu_nodes != INVALID_ADDRESS);
+    numa_nodes = 1;
+}
+
+static void numa_add_node(u32 node)
+{
+    if (node >= numa_nodes)
+        numa_nodes = node + 1;
+}
+
+boolean numa_add_memory(u64 base, u64 length, u32 node)
+{
+    numa_debug("memory [0x%lx, 0x%lx) node %d", base, base + length, node);
+    if ((node >= NUMA_MAX_NODES) || !pageheap_set_node(base, length, node))
+        return false;
+    numa_add_node(node);
+    return true;
+}
+
+/* Associates a hardware CPU identifier (e.g. local APIC ID) with a node. */
+void numa_set_hwid_node(u64 hwid, u32 node)
+{
+    if (node >= NUMA_MAX_NODES)
+        return;
+    numa_debug("CPU hwid 0x%lx node %d", hwid, node);
+    table_set(numa_hwid_nodes, pointer_from_u64(hwid), pointer_from_u64((u64)node + 1));
+    numa_add_node(node);
+}
+
+u32 numa_hwid_node(u64 hwid)
+{
+    u64 node = u64_from_pointer(table_find(numa_hwid_nodes, pointer_from_u64(hwid)));
+    return node ? node - 1 : 0;
+}
+
+void numa_set_cpu_node(u32 cpu, u32 node)
+{
+    if (node >= NUMA_MAX_NODES)
+        return;
+    numa_debug("CPU %d node %d", cpu, node);
+    assert(vector_set(numa_cpu_nodes, cpu, pointer_from_u64((u64)node)));
+    numa_add_node(node);
+}
+
+u32 numa_cpu_node(u32 cpu)
+{
+    return u64_from_pointer(vector_get(numa_cpu_nodes, cpu));
+}
+
+void numa_set_distance(u32 from, u32 to, u8 distance)
+{
+    if ((from < NUMA_MAX_NODES) && (to < NUMA_MAX_NODES))
+        numa_distances[from][to] = distance;
+}
+
+u8 numa_distance(u32 from, u32 to)
+{
+    if ((from >= numa_nodes) || (to >= numa_nodes))
+        return 0;
+    u8 distance = numa_distances[from][to];
+    if (distance)
+        return distance;
+    return (from == to) ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+}
+
+u32 numa_node_count(void)
+{
+    return numa_nodes;
+}
+
+static u32 numa_node_pref(u64 *allowed)
+{
+    cpuinfo ci = current_cpu();
+    if (ci->mem_nodes) {
+        *allowed = ci->mem_nodes;
+        return ci->mem_node;
+    }
+    return ci->numa_node;
+}
+
+/* Called when all CPUs are up: from now on, physical memory is allocated from the node of the
+ * current CPU (or from the nearest node with free memory). */
+void numa_init_done(void)
+{
+    if (numa_nodes == 1)
+        return;
+    for (u32 node = 0; node < numa_nodes; node++) {
+        u8 order[NUMA_MAX_NODES];
+        u32 count = 0;
+
+        /* insertion sort by distance: the node itself is always first */
+        order[count++] = node;
+        for (u32 n = 0; n < numa_nodes; n++) {
+            if (n == node)
+                continue;
+            u8 distance = numa_distance(node, n);
+            u32 i = count++;
+            while ((i > 1) && (numa_distance(node, order[i - 1]) > distance)) {
+                order[i] = order[i - 1];
+                i--;
+            }
+            order[i] = n;
+        }
+        pageheap_set_node_fallback(node, order, count);
+    }
+    pageheap_set_node_pref(numa_node_pref);
+    msg_info("%d NUMA nodes", numa_nodes);
+}
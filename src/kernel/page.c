@@ -374,6 +374,33 @@ void zero_mapped_pages(u64 vaddr, u64 length)
     traverse_ptes(vaddr, length, stack_closure_func(entry_handler, zero_page));
 }
 
+/* called with lock held */
+closure_function(1, 3, boolean, clean_page,
+                 flush_entry, fe,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    while (pte_is_present(old_entry) && pte_is_mapping(level, old_entry) &&
+           pte_is_dirty(old_entry)) {
+        pte new_entry = old_entry;
+        pt_pte_clean(&new_entry);
+        if (compare_and_swap_64((u64 *)entry, old_entry, new_entry)) {
+            page_invalidate(bound(fe), vaddr);
+            break;
+        }
+        old_entry = pte_from_pteptr(entry);
+    }
+    return true;
+}
+
+/* Clears the dirty bit of any pages mapped within a given area */
+void clean_mapped_pages(u64 vaddr, u64 length)
+{
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(vaddr, length, stack_closure(clean_page, fe));
+    page_invalidate_sync(fe);
+}
+
 /* called with lock held */
 closure_function(4, 3, boolean, unmap_page,
                  u64, vstart, u64, len, range_handler, rh, flush_entry, fe,
@@ -590,12 +617,144 @@ void unmap(u64 virtual, u64 length)
     unmap_pages(virtual, length);
 }
 
+/* Pinned physical pages: a pinned page that is freed (e.g. because the user mapping it is removed)
+ * is not returned to the page heap until its last pin is dropped, so that devices can keep
+ * accessing it. Pages are pinned and freed with the vmap lock of the process they are mapped in
+ * held, thus checking for the presence of pins without taking the pin lock is not racy.
+ * Pins are spread over shards, each covering a set of 2MB physical regions, so that pinning pages
+ * in different regions (e.g. from different sockets) does not contend on a single lock. */
+typedef struct page_pin {
+    struct rmnode n;            /* one page */
+    u32 refcount;
+    boolean freed;
+} *page_pin;
+
+#define PAGE_PIN_SHARDS 64
+
+static struct {
+    heap h;
+    struct page_pin_shard {
+        struct rangemap pins;
+        struct spinlock lock;
+    } shards[PAGE_PIN_SHARDS];
+} page_pins;
+
+#define page_pin_shard(phys)        (&page_pins.shards[((phys) >> PAGELOG_2M) % PAGE_PIN_SHARDS])
+#define page_pin_region_end(phys)   (((phys) & ~MASK(PAGELOG_2M)) + PAGESIZE_2M)
+
+void init_page_pins(heap h)
+{
+    page_pins.h = h;
+    for (int i = 0; i < PAGE_PIN_SHARDS; i++) {
+        init_rangemap(&page_pins.shards[i].pins, h);
+        spin_lock_init(&page_pins.shards[i].lock);
+    }
+}
+
+static void page_free_range(heap pageheap, range r)
+{
+    deallocate_u64(pageheap, pagemem.pagevirt.start + r.start, range_span(r));
+}
+
+/* Frees a range of physical pages, except for pinned pages, which are freed when unpinned. */
+static void page_free_unpinned(heap pageheap, range r)
+{
+    if (!page_pins.h) {
+        page_free_range(pageheap, r);
+        return;
+    }
+    u64 start = r.start;
+    for (u64 region = r.start, region_end; region < r.end; region = region_end) {
+        region_end = MIN(page_pin_region_end(region), r.end);
+        struct page_pin_shard *shard = page_pin_shard(region);
+        if (!rangemap_count(&shard->pins))
+            continue;
+        u64 flags = spin_lock_irq(&shard->lock);
+        page_pin pin = (page_pin)rangemap_lookup_at_or_next(&shard->pins, region);
+        while ((pin != INVALID_ADDRESS) && (pin->n.r.start < region_end)) {
+            if (pin->n.r.start > start)
+                page_free_range(pageheap, irange(start, pin->n.r.start));
+            pin->freed = true;
+            start = pin->n.r.end;
+            pin = (page_pin)rangemap_next_node(&shard->pins, &pin->n);
+        }
+        spin_unlock_irq(&shard->lock, flags);
+    }
+    if (start < r.end)
+        page_free_range(pageheap, irange(start, r.end));
+}
+
+static boolean page_is_pinned(range r)
+{
+    if (!page_pins.h)
+        return false;
+    for (u64 region = r.start, region_end; region < r.end; region = region_end) {
+        region_end = MIN(page_pin_region_end(region), r.end);
+        struct page_pin_shard *shard = page_pin_shard(region);
+        if (!rangemap_count(&shard->pins))
+            continue;
+        u64 flags = spin_lock_irq(&shard->lock);
+        boolean pinned = rangemap_range_intersects(&shard->pins, irange(region, region_end));
+        spin_unlock_irq(&shard->lock, flags);
+        if (pinned)
+            return true;
+    }
+    return false;
+}
+
+boolean page_pin_phys(u64 phys)
+{
+    page_pin new = 0;
+    phys &= ~PAGEMASK;
+    struct page_pin_shard *shard = page_pin_shard(phys);
+    while (true) {
+        u64 flags = spin_lock_irq(&shard->lock);
+        page_pin pin = (page_pin)rangemap_lookup(&shard->pins, phys);
+        if (pin != INVALID_ADDRESS) {
+            pin->refcount++;
+        } else if (new) {
+            rangemap_insert(&shard->pins, &new->n);
+            pin = new;
+            new = 0;
+        }
+        spin_unlock_irq(&shard->lock, flags);
+        if (pin != INVALID_ADDRESS) {
+            if (new)
+                deallocate(page_pins.h, new, sizeof(*new));
+            return true;
+        }
+        new = allocate(page_pins.h, sizeof(*new));
+        if (new == INVALID_ADDRESS)
+            return false;
+        rmnode_init(&new->n, irangel(phys, PAGESIZE));
+        new->refcount = 1;
+        new->freed = false;
+    }
+}
+
+void page_unpin_phys(u64 phys)
+{
+    phys &= ~PAGEMASK;
+    struct page_pin_shard *shard = page_pin_shard(phys);
+    u64 flags = spin_lock_irq(&shard->lock);
+    page_pin pin = (page_pin)rangemap_lookup(&shard->pins, phys);
+    assert(pin != INVALID_ADDRESS);
+    if (--pin->refcount) {
+        spin_unlock_irq(&shard->lock, flags);
+        return;
+    }
+    rangemap_remove_node(&shard->pins, &pin->n);
+    spin_unlock_irq(&shard->lock, flags);
+    if (pin->freed)
+        page_free_range((heap)heap_page_backed(get_kernel_heaps()), pin->n.r);
+    deallocate(page_pins.h, pin, sizeof(*pin));
+}
+
 closure_function(1, 1, boolean, page_dealloc,
                  heap, pageheap,
                  range r)
 {
-    u64 virt = pagemem.pagevirt.start + r.start;
-    deallocate_u64(bound(pageheap), virt, range_span(r));
+    page_free_unpinned(bound(pageheap), r);
     return true;
 }
 
@@ -605,6 +764,43 @@ void unmap_and_free_phys(u64 virtual, u64 length)
                              stack_closure(page_dealloc, (heap)heap_page_backed(get_kernel_heaps())));
 }
 
+/* called with lock held */
+closure_function(3, 3, boolean, unmap_clean_page,
+                 range, r, flush_entry, fe, u64 *, freed,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (!pte_is_present(old_entry) || !pte_is_mapping(level, old_entry) ||
+        pte_is_dirty(old_entry))
+        return true;
+    u64 map_len = pte_map_size(level, old_entry);
+    if (!range_contains(bound(r), irangel(vaddr, map_len)) ||
+        page_is_pinned(irangel(page_from_pte(old_entry), map_len)))
+        return true;
+
+    /* The page may be written to (and its dirty bit set) concurrently. */
+    if (!compare_and_swap_64((u64 *)entry, old_entry, 0))
+        return true;
+    page_invalidate(bound(fe), vaddr);
+    deallocate_u64((heap)heap_page_backed(get_kernel_heaps()),
+                   pagemem.pagevirt.start + page_from_pte(old_entry), map_len);
+    *bound(freed) += map_len;
+    return true;
+}
+
+/* Unmaps and frees the pages in a virtual address range that have not been written to since their
+ * dirty bit was last cleared; large pages are skipped unless entirely within the range. Returns the
+ * number of bytes freed. */
+u64 unmap_and_free_clean_phys(u64 virtual, u64 length)
+{
+    u64 freed = 0;
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(virtual, length,
+                  stack_closure(unmap_clean_page, irangel(virtual, length), fe, &freed));
+    page_invalidate_sync(fe);
+    return freed;
+}
+
 void page_free_phys(u64 phys)
 {
     u64 virt = pagemem.pagevirt.start + phys;
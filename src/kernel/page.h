@@ -41,6 +41,7 @@ void update_map_flags(u64 vaddr, u64 length, pageflags flags);
 #define remap(v, p, length, flags)  map(v, p, length, flags)
 
 void zero_mapped_pages(u64 vaddr, u64 length);
+void clean_mapped_pages(u64 vaddr, u64 length);
 void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length);
 void unmap(u64 virtual, u64 length);
 void unmap_pages_with_handler(u64 virtual, u64 length, range_handler rh);
@@ -1175,6 +1175,59 @@ void pagecache_purge_node(pagecache_node pn, status_handler complete)
         apply(complete, s);
 }
 
+static boolean pagecache_page_is_clean(pagecache_page pp)
+{
+    switch (page_state(pp)) {
+    case PAGECACHE_PAGESTATE_FREE:
+        return true;
+    case PAGECACHE_PAGESTATE_NEW:
+    case PAGECACHE_PAGESTATE_ACTIVE:
+        return !pp->evicted && (pp->refcount == 1);
+    default:
+        return false;
+    }
+}
+
+/* Evicts the cached pages of a node in a byte range, so that subsequent accesses fetch the data
+ * from the filesystem. Returns false, without evicting any pages, if any page in the range is dirty,
+ * being read or written, or referenced outside the page cache (e.g. mapped by a process). */
+boolean pagecache_node_invalidate(pagecache_node pn, range q)
+{
+    pagecache_debug("%s: pn %p, q %R\n", func_ss, pn, q);
+    pagecache pc = pn->pv->pc;
+    range pages = range_rshift_pad(q, pc->page_order);
+    struct pagecache_page k;
+    k.state_offset = pages.start;
+    pagecache_lock_node(pn);
+    pagecache_page first = (pagecache_page)rbtree_lookup_max_lte(&pn->pages, &k.rbnode);
+    if (first == INVALID_ADDRESS)
+        first = (pagecache_page)rbtree_find_first(&pn->pages);
+    else if (page_offset(first) < pages.start)
+        first = (pagecache_page)rbnode_get_next(&first->rbnode);
+    pagecache_lock_state(pc);
+    boolean clean = true;
+    for (pagecache_page pp = first; (pp != INVALID_ADDRESS) && (page_offset(pp) < pages.end);
+         pp = (pagecache_page)rbnode_get_next(&pp->rbnode)) {
+        if (!pagecache_page_is_clean(pp)) {
+            clean = false;
+            break;
+        }
+    }
+    if (clean) {
+        for (pagecache_page pp = first; (pp != INVALID_ADDRESS) && (page_offset(pp) < pages.end);
+             pp = (pagecache_page)rbnode_get_next(&pp->rbnode)) {
+            if (page_state(pp) == PAGECACHE_PAGESTATE_FREE)
+                continue;
+            /* the node is locked, thus the page remains in the search tree */
+            pp->evicted = true;
+            pagecache_page_release_locked(pc, pp, true);
+        }
+    }
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node(pn);
+    return clean;
+}
+
 void pagecache_node_ref(pagecache_node pn)
 {
     refcount_reserve(&pn->refcount);
@@ -1252,9 +1305,18 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
     if (q.end > pn->length)
         q.end = pn->length;
     u64 read_limit = pad(pn->length, U64_FROM_BIT(pn->pv->block_order));
-    k.state_offset = q.start >> pc->page_order;
-    u64 end = (q.end + MASK(pc->page_order)) >> pc->page_order;
-    end = MIN(end, k.state_offset + PAGECACHE_MAX_SG_ENTRIES);
+    u64 req_start = q.start >> pc->page_order;
+    u64 req_end = (q.end + MASK(pc->page_order)) >> pc->page_order;
+    req_end = MIN(req_end, req_start + PAGECACHE_MAX_SG_ENTRIES);
+    k.state_offset = req_start;
+    u64 end = req_end;
+    if ((pn->fetch_order > pc->page_order) && (req_end > req_start)) {
+        /* extend the fetch to aligned boundaries (without going past the end of the node) */
+        u64 align = U64_FROM_BIT(pn->fetch_order - pc->page_order);
+        k.state_offset &= ~(align - 1);
+        end = MIN(pad(end, align), (read_limit + MASK(pc->page_order)) >> pc->page_order);
+    }
+    u64 fetch_start = k.state_offset;
     boolean mem_cleaned = false;
   begin:
     pagecache_lock_node(pn);
@@ -1327,7 +1389,7 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
             pp->refcount++;
             read_r.end += read_size;
         }
-        if (ph && !apply(ph, pp)) {
+        if (ph && (pi >= req_start) && (pi < req_end) && !apply(ph, pp)) {
             err_msg = ss("page fetch handler error");
             break;
         }
@@ -1346,7 +1408,7 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
             k.state_offset = pi;
             goto begin;
         }
-        if (k.state_offset == q.start >> pc->page_order) {  /* no pages could be fetched */
+        if (k.state_offset == fetch_start) {  /* no pages could be fetched */
             apply(sh, timm_sstring(ss("result"), err_msg));
             return;
         }
@@ -1646,6 +1708,11 @@ closure_function(2, 1, boolean, pagecache_fetch_pp_handler,
     return true;
 }
 
+void pagecache_node_set_fetch_order(pagecache_node pn, int order)
+{
+    pn->fetch_order = order;
+}
+
 void pagecache_node_fetch_pages(pagecache_node pn, range r, sg_list sg, status_handler complete)
 {
     pagecache_debug("%s: node %p, r %R\n", func_ss, pn, r);
@@ -1871,6 +1938,7 @@ pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io
     init_rbtree(&pn->pages, (rb_key_compare)&pv->pc->page_compare,
                 (rbnode_handler)&pv->pc->page_print_key);
     pn->length = 0;
+    pn->fetch_order = 0;
     pn->cache_read = closure(h, pagecache_read_sg, pn);
     pn->cache_write = closure(h, pagecache_write_sg, pn);
     pn->fs_read = fs_read;
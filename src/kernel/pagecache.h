@@ -13,6 +13,7 @@ void pagecache_node_finish_pending_writes(pagecache_node pn, status_handler comp
 
 void pagecache_sync_node(pagecache_node pn, status_handler complete);
 void pagecache_purge_node(pagecache_node pn, status_handler complete);
+boolean pagecache_node_invalidate(pagecache_node pn, range q /* bytes */);
 
 void pagecache_node_ref(pagecache_node pn);
 void pagecache_node_unref(pagecache_node pn);
@@ -46,6 +47,10 @@ void pagecache_node_scan_and_commit_shared_pages(pagecache_node pn, range q /* b
 
 boolean pagecache_node_do_page_cow(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags);
 
+/* Fetches of pages not in the cache are extended to ranges aligned to 2^order bytes, e.g. for
+ * filesystems that can only read whole blocks of file data larger than a page. */
+void pagecache_node_set_fetch_order(pagecache_node pn, int order);
+
 void pagecache_node_fetch_pages(pagecache_node pn, range r /* bytes */, sg_list sg,
                                 status_handler complete);
 
@@ -65,6 +65,7 @@ typedef struct pagecache_node {
     struct rangemap dirty;
     struct list ops;
     u64 length;
+    u8 fetch_order;             /* log2 of the alignment of ranges fetched from the filesystem */
 
     sg_io cache_read;
     sg_io cache_write;
@@ -28,6 +28,89 @@ BSS_RO_AFTER_INIT bitmap idle_cpu_mask;
 BSS_RO_AFTER_INIT timerqueue kernel_timers;
 BSS_RO_AFTER_INIT thunk timer_interrupt_handler;
 
+BSS_RO_AFTER_INIT static timestamp halt_poll_max;
+
+static boolean runloop_has_work(cpuinfo ci)
+{
+    return (queue_length(ci->cpu_queue) || queue_length(async_queue_1) ||
+            queue_length(bhqueue) || queue_length(runqueue) ||
+            (!(shutting_down & SHUTDOWN_ONGOING) && !sched_queue_empty(&ci->thread_queue)));
+}
+
+/* Returns true if the runloop on the current CPU has work to do. */
+boolean runloop_work_pending(void)
+{
+    return runloop_has_work(current_cpu());
+}
+
+/* Returns true if a halted CPU has threads in its queue, which the runloop on this CPU would
+ * steal. */
+static boolean halt_poll_steal_pending(cpuinfo ci)
+{
+    if (shutting_down & SHUTDOWN_ONGOING)
+        return false;
+    bitmap_foreach_set(idle_cpu_mask, cpu) {
+        if ((cpu != ci->id) && !sched_queue_empty(&cpuinfo_from_id(cpu)->thread_queue))
+            return true;
+    }
+    return false;
+}
+
+static void halt_poll_grow(cpuinfo ci)
+{
+    timestamp window = ci->halt_poll_window;
+    window = window ? window * 2 : microseconds(HALT_POLL_GROW_START_US);
+    ci->halt_poll_window = MIN(window, halt_poll_max);
+}
+
+static void halt_poll_shrink(cpuinfo ci)
+{
+    timestamp window = ci->halt_poll_window / 2;
+    ci->halt_poll_window = (window < microseconds(HALT_POLL_GROW_START_US)) ? 0 : window;
+}
+
+/* Called on entry to the runloop after a halt. As with KVM halt polling, the time the CPU has been
+ * idle includes the time spent polling: if the CPU has been woken up within the maximum poll
+ * window, polling for longer would have avoided the halt and wakeup, so the window is grown;
+ * otherwise the poll (if any) missed, and the window is shrunk, so that CPUs with sporadic wakeups
+ * don't waste cycles polling. */
+static void halt_poll_update(cpuinfo ci)
+{
+    timestamp idle = now(CLOCK_ID_MONOTONIC_RAW) - ci->halt_start;
+    ci->halt_start = 0;
+    if (idle <= halt_poll_max) {
+        if (ci->halt_poll_window < halt_poll_max)
+            halt_poll_grow(ci);
+    } else if (ci->halt_poll_window) {
+        halt_poll_shrink(ci);
+    }
+}
+
+/* Spins waiting for new work for the duration of the poll window, leaving the CPU out of the idle
+ * mask so that wakers don't need to send an IPI. Interrupts are enabled while polling: an
+ * interrupt in the idle state brings the CPU back to the runloop, as it would from a halt. */
+static boolean halt_poll(cpuinfo ci)
+{
+    timestamp end = ci->halt_start + ci->halt_poll_window;
+    boolean found = false;
+    enable_interrupts();
+    do {
+        if (runloop_has_work(ci) || halt_poll_steal_pending(ci)) {
+            found = true;
+            break;
+        }
+        kern_pause();
+    } while (now(CLOCK_ID_MONOTONIC_RAW) < end);
+    disable_interrupts();
+    if (found) {
+        ci->halt_poll_stats.successes++;
+        halt_poll_grow(ci);
+    } else {
+        ci->halt_poll_stats.failures++;
+    }
+    return found;
+}
+
 NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
 {
     // we're going to cover up this race by checking the state in the interrupt
@@ -35,6 +118,13 @@ NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
     cpuinfo ci = current_cpu();
     sched_debug("sleep\n");
     ci->state = cpu_idle;
+    if (halt_poll_max) {
+        ci->halt_start = now(CLOCK_ID_MONOTONIC_RAW);
+        if (ci->halt_poll_window && halt_poll(ci)) {
+            ci->halt_start = 0;
+            runloop();
+        }
+    }
     bitmap_set_atomic(idle_cpu_mask, ci->id, 1);
 
     while (1) {
@@ -42,6 +132,23 @@ NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
     }
 }
 
+void halt_poll_get_stats(halt_poll_stats stats)
+{
+    zero(stats, sizeof(*stats));
+    for (int i = 0; i < total_processors; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        stats->successes += ci->halt_poll_stats.successes;
+        stats->failures += ci->halt_poll_stats.failures;
+    }
+}
+
+void init_halt_poll(tuple root)
+{
+    u64 poll_us = HALT_POLL_MAX_US_DEFAULT;
+    get_u64(root, sym(halt_poll_us), &poll_us);
+    halt_poll_max = microseconds(poll_us);
+}
+
 void wakeup_or_interrupt_cpu_all()
 {
     cpuinfo ci = current_cpu();
@@ -88,41 +195,135 @@ static sched_task sched_dequeue_for_cpu(sched_queue sq, u64 cpu)
     return task;
 }
 
-static sched_task migrate_to_self(sched_task t, u64 self, u64 first_cpu, u64 ncpus)
+BSS_RO_AFTER_INIT static u32 sched_domain_cpus;
+
+int sched_cpu_domain(cpuinfo a, cpuinfo b)
+{
+    if (a->topology.core_id == b->topology.core_id)
+        return SCHED_DOMAIN_CORE;
+    if (a->topology.llc_id == b->topology.llc_id)
+        return SCHED_DOMAIN_LLC;
+    if (a->topology.package_id == b->topology.package_id)
+        return SCHED_DOMAIN_PACKAGE;
+    return SCHED_DOMAIN_SYSTEM;
+}
+
+static inline u64 sched_cpu_count(cpuinfo ci)
+{
+    return (ci->sched_cpus ? sched_domain_cpus : total_processors) - 1;
+}
+
+/* Returns the index-th CPU (out of count) to be looked at when stealing or placing threads: CPUs
+ * in inner scheduling domains come first. Until scheduling domains are set up, CPUs are scanned
+ * linearly starting from the next one. */
+static inline u64 sched_cpu(cpuinfo ci, u64 index, u64 count)
 {
-    u64 cpu;
-    while ((ncpus > 0) &&
-            ((cpu = bitmap_range_get_first(idle_cpu_mask, first_cpu, ncpus)) != INVALID_PHYSICAL)) {
+    if (ci->sched_cpus)
+        return ci->sched_cpus[index];
+    u64 cpu = ci->id + 1 + index;
+    return (cpu <= count) ? cpu : cpu - count - 1;
+}
+
+static inline void sched_migrated(cpuinfo ci, cpuinfo cpui)
+{
+    ci->sched_migrations[sched_cpu_domain(ci, cpui)]++;
+}
+
+static sched_task migrate_to_self(cpuinfo ci, sched_task t)
+{
+    u64 count = sched_cpu_count(ci);
+    for (u64 i = 0; i < count; i++) {
+        u64 cpu = sched_cpu(ci, i, count);
+        if (!bitmap_get(idle_cpu_mask, cpu))
+            continue;
         cpuinfo cpui = cpuinfo_from_id(cpu);
         if (t == INVALID_ADDRESS) {
-            t = sched_dequeue_for_cpu(&cpui->thread_queue, self);
-            if (t != INVALID_ADDRESS)
+            t = sched_dequeue_for_cpu(&cpui->thread_queue, ci->id);
+            if (t != INVALID_ADDRESS) {
                 sched_debug("migrating thread from idle CPU %d to self\n", cpu);
+                sched_migrated(ci, cpui);
+            }
         }
         if (!sched_queue_empty(&cpui->thread_queue))
             wakeup_cpu(cpu);
-        ncpus -= cpu - first_cpu + 1;
-        first_cpu = cpu + 1;
     }
     return t;
 }
 
-static void migrate_from_self(cpuinfo ci, u64 first_cpu, u64 ncpus)
+static void migrate_from_self(cpuinfo ci)
 {
-    u64 cpu;
-    while ((ncpus > 0) &&
-            ((cpu = bitmap_range_get_first(idle_cpu_mask, first_cpu, ncpus)) != INVALID_PHYSICAL)) {
+    u64 count = sched_cpu_count(ci);
+    for (u64 i = 0; i < count; i++) {
+        u64 cpu = sched_cpu(ci, i, count);
+        if (!bitmap_get(idle_cpu_mask, cpu))
+            continue;
         cpuinfo cpui = cpuinfo_from_id(cpu);
         sched_task task;
         if (!sched_queue_empty(&cpui->thread_queue)) {
             wakeup_cpu(cpu);
         } else if ((task = sched_dequeue_for_cpu(&ci->thread_queue, cpu)) != INVALID_ADDRESS) {
             sched_debug("migrating thread from self to idle CPU %d\n", cpu);
+            sched_migrated(ci, cpui);
             sched_enqueue(&cpui->thread_queue, task);
             wakeup_cpu(cpu);
         }
-        ncpus -= cpu - first_cpu + 1;
-        first_cpu = cpu + 1;
+    }
+}
+
+/* Steals a thread from a CPU that is currently running another thread. */
+static sched_task migrate_from_busy(cpuinfo ci)
+{
+    u64 count = sched_cpu_count(ci);
+    for (u64 i = 0; i < count; i++) {
+        cpuinfo cpui = cpuinfo_from_id(sched_cpu(ci, i, count));
+        if (cpui->state == cpu_user) {
+            sched_task t = sched_dequeue_for_cpu(&cpui->thread_queue, ci->id);
+            if (t != INVALID_ADDRESS) {
+                sched_debug("migrating thread from CPU %d to self\n", cpui->id);
+                sched_migrated(ci, cpui);
+                return t;
+            }
+        }
+    }
+    return INVALID_ADDRESS;
+}
+
+/* Sets up scheduling domains once all CPUs are online: each CPU looks for threads to steal (and
+ * places threads) first on its SMT siblings, then on CPUs sharing its last level cache, then on
+ * CPUs in the same package, so that threads stay close to their cached data. */
+void init_sched_domains(heap h)
+{
+    u32 ncpus = total_processors;
+    if (ncpus == 1)
+        return;
+    sched_domain_cpus = ncpus;
+    write_barrier();
+    for (u32 self = 0; self < ncpus; self++) {
+        cpuinfo ci = cpuinfo_from_id(self);
+        u32 *cpus = allocate(h, (ncpus - 1) * sizeof(u32));
+        assert(cpus != INVALID_ADDRESS);
+        u32 count = 0;
+        for (int domain = SCHED_DOMAIN_CORE; domain < SCHED_DOMAINS; domain++) {
+            for (u32 i = 1; i < ncpus; i++) {
+                u32 cpu = (self + i) % ncpus;
+                if (sched_cpu_domain(ci, cpuinfo_from_id(cpu)) == domain)
+                    cpus[count++] = cpu;
+            }
+        }
+        sched_debug("CPU %d: core %d, LLC %d, package %d\n", self, ci->topology.core_id,
+                    ci->topology.llc_id, ci->topology.package_id);
+        write_barrier();
+        ci->sched_cpus = cpus;
+    }
+}
+
+void sched_get_migrations(u64 *migrations)
+{
+    zero(migrations, SCHED_DOMAINS * sizeof(u64));
+    for (int i = 0; i < total_processors; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        for (int domain = SCHED_DOMAIN_CORE; domain < SCHED_DOMAINS; domain++)
+            migrations[domain] += ci->sched_migrations[domain];
     }
 }
 
@@ -185,6 +386,8 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
                 state_strings[ci->state], queue_length(ci->cpu_queue),
                 queue_length(async_queue_1), queue_length(bhqueue),
                 queue_length(runqueue), sched_queue_length(&ci->thread_queue));
+    if (ci->halt_start)
+        halt_poll_update(ci);
     ci->state = cpu_kernel;
     /* Make sure TLB entries are appropriately flushed before doing any work */
     page_invalidate_flush();
@@ -211,41 +414,21 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
         timeout = next_timeout;
 
     if (!(shutting_down & SHUTDOWN_ONGOING)) {
-        u64 self = ci->id;
         sched_task t = sched_dequeue(&ci->thread_queue);
         if (t == INVALID_ADDRESS) {
             /* Try to steal a thread from an idle CPU (so that it doesn't
              * have to be woken up), and wake up CPUs that have a non-empty
              * thread queue). */
-            if (self + 1 < total_processors)
-                t = migrate_to_self(t, self, self + 1, total_processors - self - 1);
-            if (ci->id > 0)
-                t = migrate_to_self(t, self, 0, self);
+            t = migrate_to_self(ci, t);
             if (t == INVALID_ADDRESS) {
                 /* No threads found in idle CPUs: try to steal a thread from a
                  * CPU that is currently running another thread. */
-                for (u64 cpu = self + 1; ; cpu++) {
-                    if (cpu == total_processors)
-                        cpu = 0;
-                    if (cpu == self)
-                        break;
-                    cpuinfo cpui = cpuinfo_from_id(cpu);
-                    if (cpui->state == cpu_user) {
-                        t = sched_dequeue_for_cpu(&cpui->thread_queue, self);
-                        if (t != INVALID_ADDRESS) {
-                            sched_debug("migrating thread from CPU %d to self\n", cpu);
-                            break;
-                        }
-                    }
-                }
+                t = migrate_from_busy(ci);
             }
         } else {
             /* Wake up idle CPUs that have a non-empty thread queue, and if our
              * thread queue is non-empty, migrate our threads to idle CPUs. */
-            if (self + 1 < total_processors)
-                migrate_from_self(ci, self + 1, total_processors - self - 1);
-            if (self > 0)
-                migrate_from_self(ci, 0, self);
+            migrate_from_self(ci);
         }
         if (t != INVALID_ADDRESS) {
             if (!timeout) {
@@ -270,12 +453,8 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
     }
 
     /* We want to pick up items that were enqueued during this last pass, else
-       runnable items may get stuck waiting for the next interrupt.
-
-       Find cost of sleep / wakeup and consider spinning this check for that interval. */
-    if (queue_length(ci->cpu_queue) || queue_length(async_queue_1) ||
-        queue_length(bhqueue) || queue_length(runqueue) ||
-        (!(shutting_down & SHUTDOWN_ONGOING) && !sched_queue_empty(&ci->thread_queue)))
+       runnable items may get stuck waiting for the next interrupt. */
+    if (runloop_has_work(ci))
         goto retry;
 
     if (timeout && (timeout != ci->last_timer_update)) {
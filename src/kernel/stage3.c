@@ -68,6 +68,7 @@ closure_function(6, 0, void, startup,
     /* register root tuple with management and kick off interfaces, if any */
     init_management_root(root);
     init_kernel_heaps_management(root);
+    init_halt_poll(root);
     if (get(root, sym(readonly_rootfs)))
         filesystem_set_readonly(fs);
     value p = get(root, sym(program));
@@ -202,6 +202,8 @@ define_closure_function(2, 1, void, storage_simple_req_handler,
     case STORAGE_OP_WRITE:
         apply(bound(write), req->data, req->blocks, req->completion);
         break;
+    default:
+        storage_op_unsupported(req);
     }
 }
 
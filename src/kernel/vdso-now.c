@@ -121,10 +121,12 @@ VDSO int
 vdso_getcpu(unsigned *cpu, unsigned *node)
 {
     if (__vdso_dat->machine.platform_has_rdtscp) {
+        u32 aux;
+        asm volatile("rdtscp" : "=c" (aux) :: "eax", "edx");
         if (cpu)
-            asm volatile("rdtscp" : "=c" (*cpu) :: "eax", "edx");
+            *cpu = aux & TSC_AUX_CPU_MASK;
         if (node)
-            *node = 0;
+            *node = aux >> TSC_AUX_NODE_SHIFT;
         return 0;
     }
     return -1;
@@ -0,0 +1,278 @@
+/* Generic receive offload: in-order TCP segments of the same flow received by a network driver
+ * within a batch are coalesced into a single packet before being passed to the network stack.
+ * Payload data is never touched: the TCP checksum of a coalesced packet is derived from the
+ * checksums of its segments. */
+
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/prot/ethernet.h>
+#include <lwip/prot/tcp.h>
+
+#define GRO_MAX_SEGS    64
+
+#define GRO_TCP_FLAGS_OFFSET    13
+
+enum gro_action {
+    GRO_PASS,   /* not a TCP segment: deliver immediately */
+    GRO_FLUSH,  /* TCP segment that cannot be coalesced: deliver after any held segments */
+    GRO_HOLD,   /* TCP segment that can be coalesced */
+};
+
+static inline u8 gro_tcp_flags(struct tcp_hdr *tcph)
+{
+    return ((u8 *)tcph)[GRO_TCP_FLAGS_OFFSET];
+}
+
+/* Ones' complement sum of 16-bit words in memory byte order; len must be even. */
+static u32 gro_csum_add(u32 sum, void *data, u16 len)
+{
+    u16 *w = data;
+    for (; len > 0; len -= sizeof(u16))
+        sum += *w++;
+    return sum;
+}
+
+static u16 gro_csum_fold(u32 sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+static u32 gro_pseudo_hdr_sum(u8 *iph, boolean ipv6, u16 tcp_len)
+{
+    u32 sum = lwip_htons(IP_PROTO_TCP) + lwip_htons(tcp_len);
+    if (ipv6) {
+        struct ip6_hdr *ip6h = (struct ip6_hdr *)iph;
+        sum = gro_csum_add(sum, &ip6h->src, 2 * sizeof(ip6h->src));
+    } else {
+        struct ip_hdr *ip4h = (struct ip_hdr *)iph;
+        sum = gro_csum_add(sum, &ip4h->src, 2 * sizeof(ip4h->src));
+    }
+    return sum;
+}
+
+static enum gro_action gro_parse(struct pbuf *p, gro_seg s)
+{
+    if (p->len < SIZEOF_ETH_HDR)
+        return GRO_PASS;
+    struct eth_hdr *ethh = p->payload;
+    u8 *iph = (u8 *)(ethh + 1);
+    u16 l3_len = p->tot_len - SIZEOF_ETH_HDR;
+    boolean holdable = true;
+    switch (ethh->type) {
+    case PP_HTONS(ETHTYPE_IP): {
+        struct ip_hdr *ip4h = (struct ip_hdr *)iph;
+        if ((p->len < SIZEOF_ETH_HDR + IP_HLEN) || (IPH_V(ip4h) != 4) ||
+            (IPH_PROTO(ip4h) != IP_PROTO_TCP))
+            return GRO_PASS;
+        if (IPH_OFFSET(ip4h) & PP_HTONS(IP_OFFMASK | IP_MF))
+            return GRO_PASS;
+        s->ip_hdr_len = IPH_HL_BYTES(ip4h);
+        if ((s->ip_hdr_len != IP_HLEN) || (lwip_ntohs(IPH_LEN(ip4h)) != l3_len) ||
+            inet_chksum(ip4h, IP_HLEN))
+            holdable = false;
+        s->ipv6 = false;
+        break;
+    }
+    case PP_HTONS(ETHTYPE_IPV6): {
+        struct ip6_hdr *ip6h = (struct ip6_hdr *)iph;
+        if ((p->len < SIZEOF_ETH_HDR + IP6_HLEN) || (IP6H_V(ip6h) != 6) ||
+            (IP6H_NEXTH(ip6h) != IP6_NEXTH_TCP))
+            return GRO_PASS;
+        s->ip_hdr_len = IP6_HLEN;
+        if (IP6H_PLEN(ip6h) != l3_len - IP6_HLEN)
+            holdable = false;
+        s->ipv6 = true;
+        break;
+    }
+    default:
+        return GRO_PASS;
+    }
+    if (p->len < SIZEOF_ETH_HDR + s->ip_hdr_len + TCP_HLEN)
+        return GRO_PASS;
+    s->iph = iph;
+    s->tcph = (struct tcp_hdr *)(iph + s->ip_hdr_len);
+    if (!holdable)
+        return GRO_FLUSH;
+    s->tcp_hdr_len = TCPH_HDRLEN_BYTES(s->tcph);
+    s->hdr_len = SIZEOF_ETH_HDR + s->ip_hdr_len + s->tcp_hdr_len;
+    if ((s->tcp_hdr_len < TCP_HLEN) || (p->len < s->hdr_len) || (p->tot_len <= s->hdr_len))
+        return GRO_FLUSH;
+    if ((gro_tcp_flags(s->tcph) & ~TCP_PSH) != TCP_ACK)
+        return GRO_FLUSH;
+    s->payload_len = p->tot_len - s->hdr_len;
+    return GRO_HOLD;
+}
+
+static boolean gro_flow_match(gro_flow f, gro_seg s)
+{
+    if (f->s.ipv6 != s->ipv6)
+        return false;
+    if (s->ipv6) {
+        struct ip6_hdr *h1 = (struct ip6_hdr *)f->s.iph, *h2 = (struct ip6_hdr *)s->iph;
+        if (runtime_memcmp(&h1->src, &h2->src, 2 * sizeof(h1->src)))
+            return false;
+    } else {
+        struct ip_hdr *h1 = (struct ip_hdr *)f->s.iph, *h2 = (struct ip_hdr *)s->iph;
+        if ((h1->src.addr != h2->src.addr) || (h1->dest.addr != h2->dest.addr))
+            return false;
+    }
+    return (f->s.tcph->src == s->tcph->src) && (f->s.tcph->dest == s->tcph->dest);
+}
+
+static boolean gro_can_merge(gro_flow f, gro_seg s)
+{
+    struct tcp_hdr *h1 = f->s.tcph, *h2 = s->tcph;
+    if ((f->segs >= GRO_MAX_SEGS) || (gro_tcp_flags(h1) & TCP_PSH) ||
+        (lwip_ntohl(h2->seqno) != f->next_seq) || (h1->ackno != h2->ackno) ||
+        (f->s.tcp_hdr_len != s->tcp_hdr_len) ||
+        (f->s.hdr_len + f->payload_len + s->payload_len > U16_MAX))
+        return false;
+    if (runtime_memcmp(h1 + 1, h2 + 1, s->tcp_hdr_len - TCP_HLEN))
+        return false;
+    if (s->ipv6) {
+        struct ip6_hdr *ip1 = (struct ip6_hdr *)f->s.iph, *ip2 = (struct ip6_hdr *)s->iph;
+        return (ip1->_v_tc_fl == ip2->_v_tc_fl) && (IP6H_HOPLIM(ip1) == IP6H_HOPLIM(ip2));
+    } else {
+        struct ip_hdr *ip1 = (struct ip_hdr *)f->s.iph, *ip2 = (struct ip_hdr *)s->iph;
+        return (IPH_TOS(ip1) == IPH_TOS(ip2)) && (IPH_TTL(ip1) == IPH_TTL(ip2)) &&
+               (IPH_OFFSET(ip1) == IPH_OFFSET(ip2));
+    }
+}
+
+/* Returns the ones' complement sum of the TCP payload of a segment, derived from the segment
+ * checksum. */
+static u16 gro_payload_sum(gro_seg s)
+{
+    u32 sum = gro_pseudo_hdr_sum(s->iph, s->ipv6, s->tcp_hdr_len + s->payload_len);
+    sum = gro_csum_add(sum, s->tcph, s->tcp_hdr_len);
+    return ~gro_csum_fold(sum);
+}
+
+static void gro_deliver(net_gro g, struct pbuf *p)
+{
+    struct netif *n = g->netif;
+    if (n->input(p, n) != ERR_OK)
+        pbuf_free(p);
+}
+
+static void gro_flush_flow(net_gro g, gro_flow f)
+{
+    struct pbuf *p = f->head;
+    f->head = 0;
+    if (f->segs > 1) {
+        u16 tot_len = f->s.hdr_len + f->payload_len;
+        for (struct pbuf *q = p; q; q = q->next) {
+            q->tot_len = tot_len;
+            tot_len -= q->len;
+        }
+        u16 tcp_len = f->s.tcp_hdr_len + f->payload_len;
+        if (f->s.ipv6) {
+            IP6H_PLEN_SET((struct ip6_hdr *)f->s.iph, tcp_len);
+        } else {
+            struct ip_hdr *iph = (struct ip_hdr *)f->s.iph;
+            IPH_LEN_SET(iph, lwip_htons(IP_HLEN + tcp_len));
+            IPH_CHKSUM_SET(iph, 0);
+            IPH_CHKSUM_SET(iph, inet_chksum(iph, IP_HLEN));
+        }
+        struct tcp_hdr *tcph = f->s.tcph;
+        tcph->chksum = 0;
+        u32 sum = gro_pseudo_hdr_sum(f->s.iph, f->s.ipv6, tcp_len);
+        sum = gro_csum_add(sum, tcph, f->s.tcp_hdr_len);
+        tcph->chksum = ~gro_csum_fold(sum + f->csum);
+        g->coalesced += f->segs - 1;
+    }
+    gro_deliver(g, p);
+}
+
+static void gro_hold(gro_flow f, struct pbuf *p, gro_seg s)
+{
+    f->head = f->tail = p;
+    while (f->tail->next)
+        f->tail = f->tail->next;
+    runtime_memcpy(&f->s, s, sizeof(*s));
+    f->next_seq = lwip_ntohl(s->tcph->seqno) + s->payload_len;
+    f->payload_len = s->payload_len;
+    f->csum = gro_payload_sum(s);
+    f->segs = 1;
+}
+
+static void gro_merge(gro_flow f, struct pbuf *p, gro_seg s)
+{
+    u16 sum = gro_payload_sum(s);
+    if (f->payload_len & 1)
+        sum = (sum << 8) | (sum >> 8);
+    f->csum += sum;
+
+    /* The coalesced packet carries the window and push flag of the latest segment. */
+    struct tcp_hdr *tcph = f->s.tcph;
+    tcph->wnd = s->tcph->wnd;
+    ((u8 *)tcph)[GRO_TCP_FLAGS_OFFSET] |= gro_tcp_flags(s->tcph) & TCP_PSH;
+
+    pbuf_remove_header(p, s->hdr_len);
+    f->tail->next = p;
+    for (f->tail = p; f->tail->next; f->tail = f->tail->next);
+    f->next_seq += s->payload_len;
+    f->payload_len += s->payload_len;
+    f->segs++;
+}
+
+void gro_receive(net_gro g, struct pbuf *p)
+{
+    struct gro_seg s;
+    enum gro_action action = gro_parse(p, &s);
+    if (action == GRO_PASS) {
+        gro_deliver(g, p);
+        return;
+    }
+    gro_flow f = 0, free_flow = 0;
+    for (int i = 0; i < GRO_MAX_FLOWS; i++) {
+        gro_flow flow = &g->flows[i];
+        if (!flow->head) {
+            if (!free_flow)
+                free_flow = flow;
+        } else if (gro_flow_match(flow, &s)) {
+            f = flow;
+            break;
+        }
+    }
+    if (action == GRO_FLUSH) {
+        if (f)
+            gro_flush_flow(g, f);
+        gro_deliver(g, p);
+        return;
+    }
+    if (f && gro_can_merge(f, &s)) {
+        gro_merge(f, p, &s);
+    } else {
+        if (!f) {
+            f = free_flow;
+            if (!f) {
+                f = &g->flows[g->evict];
+                g->evict = (g->evict + 1) % GRO_MAX_FLOWS;
+            }
+        }
+        if (f->head)
+            gro_flush_flow(g, f);
+        gro_hold(f, p, &s);
+    }
+    if (gro_tcp_flags(s.tcph) & TCP_PSH)
+        gro_flush_flow(g, f);
+}
+
+void gro_flush(net_gro g)
+{
+    for (int i = 0; i < GRO_MAX_FLOWS; i++) {
+        gro_flow f = &g->flows[i];
+        if (f->head)
+            gro_flush_flow(g, f);
+    }
+}
+
+void gro_init(net_gro g, struct netif *n)
+{
+    zero(g, sizeof(*g));
+    g->netif = n;
+}
@@ -0,0 +1,203 @@
+/* Kernel TLS, transmit side: application data written to a TCP socket is framed into TLS records
+ * and encrypted in the kernel, using the key material installed by the application after the TLS
+ * handshake (Linux-compatible TCP_ULP and SOL_TLS/TLS_TX socket options). Since data is encrypted
+ * directly from its source buffers, sendfile() on a TLS socket encrypts page cache data without
+ * any round trip through user memory.
+ * The AEAD cipher implementation is provided by the TLS klib. */
+
+#include <kernel.h>
+#include <errno.h>
+#include <lwip.h>
+
+#define TLS_HEADER_SIZE     5
+#define TLS_TAG_SIZE        16
+#define TLS_SALT_SIZE       4
+#define TLS_IV_SIZE         8
+#define TLS_NONCE_SIZE      (TLS_SALT_SIZE + TLS_IV_SIZE)
+#define TLS_AAD_SIZE_1_2    13
+#define TLS_RECORD_TYPE_APPLICATION_DATA    23
+
+struct tls_crypto_info {
+    u16 version;
+    u16 cipher_type;
+};
+
+struct tls12_crypto_info_aes_gcm_128 {
+    struct tls_crypto_info info;
+    u8 iv[TLS_IV_SIZE];
+    u8 key[16];
+    u8 salt[TLS_SALT_SIZE];
+    u8 rec_seq[8];
+};
+
+struct tls12_crypto_info_aes_gcm_256 {
+    struct tls_crypto_info info;
+    u8 iv[TLS_IV_SIZE];
+    u8 key[32];
+    u8 salt[TLS_SALT_SIZE];
+    u8 rec_seq[8];
+};
+
+struct ktls_tx {
+    u16 version;
+    u8 nonce[TLS_NONCE_SIZE];   /* salt followed by IV (incremented with each TLS 1.2 record) */
+    u64 seq;
+    void *aead;
+};
+
+BSS_RO_AFTER_INIT const struct ktls_aead_ops *ktls_aead;
+
+static inline void ktls_put_be16(u8 *p, u16 val)
+{
+    p[0] = val >> 8;
+    p[1] = val;
+}
+
+static inline void ktls_put_be64(u8 *p, u64 val)
+{
+    for (int i = 7; i >= 0; i--, val >>= 8)
+        p[i] = val;
+}
+
+static inline u64 ktls_get_be64(const u8 *p)
+{
+    u64 val = 0;
+    for (int i = 0; i < 8; i++)
+        val = (val << 8) | p[i];
+    return val;
+}
+
+/* Returns a negative errno value if the crypto info is not valid or not supported. */
+ktls_tx ktls_tx_alloc(heap h, const void *crypto_info, u64 len, int *err)
+{
+    const struct tls_crypto_info *info = crypto_info;
+    const u8 *iv, *key, *salt, *rec_seq;
+    u32 key_len;
+    if (!ktls_aead) {
+        *err = -ENOENT;
+        return 0;
+    }
+    if (len < sizeof(*info)) {
+        *err = -EINVAL;
+        return 0;
+    }
+    if ((info->version != TLS_1_2_VERSION) && (info->version != TLS_1_3_VERSION)) {
+        *err = -EINVAL;
+        return 0;
+    }
+    switch (info->cipher_type) {
+    case TLS_CIPHER_AES_GCM_128: {
+        const struct tls12_crypto_info_aes_gcm_128 *ci = crypto_info;
+        if (len != sizeof(*ci)) {
+            *err = -EINVAL;
+            return 0;
+        }
+        iv = ci->iv;
+        key = ci->key;
+        key_len = sizeof(ci->key);
+        salt = ci->salt;
+        rec_seq = ci->rec_seq;
+        break;
+    }
+    case TLS_CIPHER_AES_GCM_256: {
+        const struct tls12_crypto_info_aes_gcm_256 *ci = crypto_info;
+        if (len != sizeof(*ci)) {
+            *err = -EINVAL;
+            return 0;
+        }
+        iv = ci->iv;
+        key = ci->key;
+        key_len = sizeof(ci->key);
+        salt = ci->salt;
+        rec_seq = ci->rec_seq;
+        break;
+    }
+    default:
+        *err = -EINVAL;
+        return 0;
+    }
+    ktls_tx tx = allocate(h, sizeof(*tx));
+    if (tx == INVALID_ADDRESS) {
+        *err = -ENOMEM;
+        return 0;
+    }
+    tx->aead = ktls_aead->alloc(h, key, key_len);
+    if (!tx->aead) {
+        deallocate(h, tx, sizeof(*tx));
+        *err = -ENOMEM;
+        return 0;
+    }
+    tx->version = info->version;
+    runtime_memcpy(tx->nonce, salt, TLS_SALT_SIZE);
+    runtime_memcpy(tx->nonce + TLS_SALT_SIZE, iv, TLS_IV_SIZE);
+    tx->seq = ktls_get_be64(rec_seq);
+    return tx;
+}
+
+void ktls_tx_free(heap h, ktls_tx tx)
+{
+    ktls_aead->free(h, tx->aead);
+    zero(tx, sizeof(*tx));
+    deallocate(h, tx, sizeof(*tx));
+}
+
+bytes ktls_tx_overhead(ktls_tx tx)
+{
+    if (tx->version == TLS_1_2_VERSION)
+        return TLS_HEADER_SIZE + TLS_IV_SIZE + TLS_TAG_SIZE;
+    return TLS_HEADER_SIZE + 1 + TLS_TAG_SIZE;  /* inner content type */
+}
+
+/* Encrypts a record (with at most TLS_MAX_PLAINTEXT bytes of data) into `out`, which must be able
+ * to hold the data plus the record overhead; returns the record length, or 0 on failure.
+ * The record sequence number is not advanced until the record is committed, so that a record that
+ * could not be queued for transmission can be discarded. */
+bytes ktls_tx_encrypt(ktls_tx tx, u8 type, const void *data, bytes len, u8 *out)
+{
+    u8 nonce[TLS_NONCE_SIZE];
+    u8 aad[TLS_AAD_SIZE_1_2];
+    const void *in;
+    u8 *payload;
+    bytes payload_len, aad_len;
+    runtime_memcpy(nonce, tx->nonce, TLS_NONCE_SIZE);
+    out[0] = type;
+    ktls_put_be16(out + 1, TLS_1_2_VERSION);   /* legacy record version for TLS 1.3 too */
+    if (tx->version == TLS_1_2_VERSION) {
+        runtime_memcpy(out + TLS_HEADER_SIZE, nonce + TLS_SALT_SIZE, TLS_IV_SIZE);
+        in = data;
+        payload = out + TLS_HEADER_SIZE + TLS_IV_SIZE;
+        payload_len = len;
+        ktls_put_be64(aad, tx->seq);
+        aad[8] = type;
+        ktls_put_be16(aad + 9, TLS_1_2_VERSION);
+        ktls_put_be16(aad + 11, len);
+        aad_len = TLS_AAD_SIZE_1_2;
+        ktls_put_be16(out + 3, TLS_IV_SIZE + len + TLS_TAG_SIZE);
+    } else {
+        /* The actual record type is encrypted, and the outer record type is application data. */
+        u8 seq[8];
+        ktls_put_be64(seq, tx->seq);
+        for (int i = 0; i < sizeof(seq); i++)
+            nonce[TLS_NONCE_SIZE - sizeof(seq) + i] ^= seq[i];
+        payload = out + TLS_HEADER_SIZE;
+        runtime_memcpy(payload, data, len);
+        payload[len] = type;
+        in = payload;
+        payload_len = len + 1;
+        out[0] = TLS_RECORD_TYPE_APPLICATION_DATA;
+        ktls_put_be16(out + 3, payload_len + TLS_TAG_SIZE);
+        runtime_memcpy(aad, out, TLS_HEADER_SIZE);
+        aad_len = TLS_HEADER_SIZE;
+    }
+    if (!ktls_aead->encrypt(tx->aead, nonce, aad, aad_len, in, payload_len, payload,
+                            payload + payload_len))
+        return 0;
+    return payload + payload_len + TLS_TAG_SIZE - out;
+}
+
+void ktls_tx_commit(ktls_tx tx)
+{
+    tx->seq++;
+    if (tx->version == TLS_1_2_VERSION)
+        ktls_put_be64(tx->nonce + TLS_SALT_SIZE, ktls_get_be64(tx->nonce + TLS_SALT_SIZE) + 1);
+}
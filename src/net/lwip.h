@@ -19,20 +19,122 @@
 status direct_connect(heap h, ip_addr_t *addr, u16 port, connection_handler ch);
 
 closure_type(netif_dev_setup, boolean, tuple config);
+closure_type(netif_dev_poll, u32, u32 budget, boolean defer_irq);
+
+/* Per-queue packet counters of a multi-queue network device; each queue is updated only by the
+ * context that services the queue. */
+typedef struct netif_qstats {
+    u64 rx_packets, rx_bytes;
+    u64 tx_packets, tx_bytes;
+} *netif_qstats;
 
 typedef struct netif_dev {
     struct netif n;
     closure_struct(netif_dev_setup, setup);
+    u32 num_queues;
+    netif_qstats qstats;    /* array of num_queues elements, exposed via SIOCETHTOOL */
+    closure_struct(thunk, tx_flush);    /* notifies the device of packets queued on this CPU */
+    closure_struct(netif_dev_poll, rx_poll);    /* busy polling (see netif_busy_poll()) */
 } *netif_dev;
 
 static inline void netif_dev_init(netif_dev dev)
 {
     dev->setup.__apply = 0;
+    dev->num_queues = 0;
+    dev->qstats = 0;
+    dev->tx_flush.__apply = 0;
+    dev->rx_poll.__apply = 0;
 }
 
+/* Transmit batching: while a batch is open in the current context, drivers that implement the
+ * tx_flush closure may queue outgoing packets without notifying the device (if
+ * netif_tx_defer() returns true), and the device is notified when the batch is closed. A batch
+ * must be closed on the CPU where it has been opened, without blocking in between. */
+boolean netif_tx_batch_begin(void);
+void netif_tx_batch_end(void);
+boolean netif_tx_defer(netif_dev dev);
+
+/* Busy polling: processes packets received by the interface with index if_idx (or by any
+ * interface, if if_idx is NETIF_NO_INDEX) in the calling context, instead of waiting for the
+ * device to raise an interrupt; drivers that implement the rx_poll closure process up to budget
+ * packets from their receive queues, and if defer_irq is set keep device interrupts disabled for
+ * a short time after processing any packets. Returns the number of packets processed. */
+u32 netif_busy_poll(u8 if_idx, u32 budget, boolean defer_irq);
+
 u16 ifflags_from_netif(struct netif *netif);
 boolean ifflags_to_netif(struct netif *netif, u16 flags); /* do not call with lwIP lock held */
 bytes netif_name_cpy(char *dest, struct netif *netif);
+u32 net_flow_hash(struct pbuf *p);
+
+/* Packet buffer pool, with per-CPU caches of PKTBUF_SIZE-byte DMA-capable buffers; pktbuf_heap()
+ * returns a caching heap interface to the pool, for allocations of up to PKTBUF_SIZE bytes. */
+void init_pktbuf(kernel_heaps kh);
+void *pktbuf_alloc(void);
+void pktbuf_free(void *buf);
+boolean is_pktbuf(void *p);
+caching_heap pktbuf_heap(void);
+
+/* Generic receive offload, used by network drivers to coalesce TCP segments received within a
+ * batch: packets are passed to gro_receive() and any held segments are delivered to the netif
+ * input function by gro_flush() at the end of the batch. */
+#define GRO_MAX_FLOWS   8
+
+typedef struct gro_seg {
+    u8 *iph;
+    struct tcp_hdr *tcph;
+    u16 hdr_len;    /* link + network + transport headers */
+    u16 ip_hdr_len;
+    u16 tcp_hdr_len;
+    u16 payload_len;
+    boolean ipv6;
+} *gro_seg;
+
+typedef struct gro_flow {
+    struct pbuf *head, *tail;
+    struct gro_seg s;   /* headers of the coalesced packet */
+    u32 next_seq;
+    u32 csum;           /* ones' complement sum of coalesced payload */
+    u16 payload_len;
+    u16 segs;
+} *gro_flow;
+
+typedef struct net_gro {
+    struct netif *netif;
+    u64 coalesced;      /* number of segments merged into a preceding segment */
+    int evict;
+    struct gro_flow flows[GRO_MAX_FLOWS];
+} *net_gro;
+
+void gro_init(net_gro g, struct netif *n);
+void gro_receive(net_gro g, struct pbuf *p);
+void gro_flush(net_gro g);
+
+#define TLS_1_2_VERSION 0x0303
+#define TLS_1_3_VERSION 0x0304
+
+#define TLS_CIPHER_AES_GCM_128  51
+#define TLS_CIPHER_AES_GCM_256  52
+
+#define TLS_MAX_PLAINTEXT   (16 * KB)
+#define TLS_MAX_OVERHEAD    29  /* header, explicit nonce and authentication tag */
+
+/* AEAD cipher used by kernel TLS (registered by the TLS klib); the nonce is 12 bytes and the tag
+ * is 16 bytes long. */
+struct ktls_aead_ops {
+    void *(*alloc)(heap h, const u8 *key, u32 key_len);
+    void (*free)(heap h, void *aead);
+    boolean (*encrypt)(void *aead, const u8 *nonce, const u8 *aad, u32 aad_len,
+                       const void *in, u32 len, u8 *out, u8 *tag);
+};
+extern const struct ktls_aead_ops *ktls_aead;
+
+typedef struct ktls_tx *ktls_tx;
+
+ktls_tx ktls_tx_alloc(heap h, const void *crypto_info, u64 len, int *err);
+void ktls_tx_free(heap h, ktls_tx tx);
+bytes ktls_tx_overhead(ktls_tx tx);
+bytes ktls_tx_encrypt(ktls_tx tx, u8 type, const void *data, bytes len, u8 *out);
+void ktls_tx_commit(ktls_tx tx);
 
 #define netif_is_loopback(netif)    (((netif)->name[0] == 'l') && ((netif)->name[1] == 'o'))
 
@@ -11,6 +11,7 @@
 #define IFF_MULTICAST   (1 << 12)
 
 BSS_RO_AFTER_INIT static heap lwip_heap;
+BSS_RO_AFTER_INIT static u32 flow_hash_seed;
 BSS_RO_AFTER_INIT int (*net_ip_input_filter)(struct pbuf *pbuf, struct netif *input_netif);
 
 typedef struct net_complete {
@@ -24,6 +25,24 @@ typedef struct net_complete {
 
 static struct list net_complete_list;
 
+#define NETIF_TX_BATCH_DEVS 4
+#define NETIF_TX_BATCH_MAX  64  /* maximum number of packets queued without notifying a device */
+
+/* Per-CPU transmit batch */
+typedef struct netif_tx_batch {
+    context ctx;    /* context that opened the batch */
+    u32 ndevs;
+    struct {
+        netif_dev dev;
+        u32 pkts;   /* number of packets queued since the device was last notified */
+    } devs[NETIF_TX_BATCH_DEVS];
+} *netif_tx_batch;
+
+static struct {
+    netif_tx_batch batches;
+    u64 count;
+} tx_batches;
+
 static struct spinlock net_lock;
 
 /* Pretty silly. LWIP offers lwip_cyclic_timers for use elsewhere, but
@@ -74,12 +93,23 @@ u32 sys_now(void)
 
 void *lwip_allocate(u64 size)
 {
-    void *p = allocate(lwip_heap, size);
+    void *p;
+    if ((size > PKTBUF_MIN_ALLOC) && (size <= PKTBUF_SIZE)) {
+        /* packet buffers */
+        p = pktbuf_alloc();
+        if (p != INVALID_ADDRESS)
+            return p;
+    }
+    p = allocate(lwip_heap, size);
     return ((p != INVALID_ADDRESS) ? p : 0);
 }
 
 void lwip_deallocate(void *x)
 {
+    if (is_pktbuf(x)) {
+        pktbuf_free(x);
+        return;
+    }
     /* no size info; mcache won't care */
     deallocate(lwip_heap, x, -1ull);
 }
@@ -217,6 +247,147 @@ bytes netif_name_cpy(char *dest, struct netif *netif)
     return sizeof(netif->name) + 1;
 }
 
+static inline u32 flow_hash_mix(u32 h, u32 v)
+{
+    h ^= v;
+    h *= 0x9e3779b1;
+    return h ^ (h >> 15);
+}
+
+static netif_tx_batch netif_tx_batch_local(void)
+{
+    u64 cpu = current_cpu()->id;
+    return (cpu < tx_batches.count) ? &tx_batches.batches[cpu] : 0;
+}
+
+/* Returns false if a batch could not be opened (e.g. because another batch is already open on
+ * this CPU), in which case netif_tx_batch_end() must not be called. */
+boolean netif_tx_batch_begin(void)
+{
+    netif_tx_batch b = netif_tx_batch_local();
+    if (!b || b->ctx)
+        return false;
+    b->ndevs = 0;
+    b->ctx = get_current_context(current_cpu());
+    return true;
+}
+
+void netif_tx_batch_end(void)
+{
+    netif_tx_batch b = netif_tx_batch_local();
+    assert(b->ctx == get_current_context(current_cpu()));
+    for (u32 i = 0; i < b->ndevs; i++) {
+        if (b->devs[i].pkts)
+            apply((thunk)&b->devs[i].dev->tx_flush);
+    }
+    b->ctx = 0;
+}
+
+/* Called by drivers when queueing a packet for transmission: returns true if device
+ * notification can be deferred until the end of the current batch. */
+boolean netif_tx_defer(netif_dev dev)
+{
+    if (!dev->tx_flush.__apply)
+        return false;
+    netif_tx_batch b = netif_tx_batch_local();
+    if (!b || (b->ctx != get_current_context(current_cpu())))
+        return false;
+    u32 i;
+    for (i = 0; i < b->ndevs; i++)
+        if (b->devs[i].dev == dev)
+            break;
+    if (i == b->ndevs) {
+        if (i == NETIF_TX_BATCH_DEVS)
+            return false;
+        b->devs[i].dev = dev;
+        b->devs[i].pkts = 0;
+        b->ndevs++;
+    }
+    if (++b->devs[i].pkts == NETIF_TX_BATCH_MAX) {
+        b->devs[i].pkts = 0;
+        return false;
+    }
+    return true;
+}
+
+static u32 netif_dev_rx_poll(struct netif *n, u32 budget, boolean defer_irq)
+{
+    if (netif_is_loopback(n))
+        return 0;
+    netif_dev dev = n->state;
+    if (!dev->rx_poll.__apply)
+        return 0;
+    return apply((netif_dev_poll)&dev->rx_poll, budget, defer_irq);
+}
+
+u32 netif_busy_poll(u8 if_idx, u32 budget, boolean defer_irq)
+{
+    struct netif *n;
+    u32 processed = 0;
+    if (if_idx != NETIF_NO_INDEX) {
+        n = netif_get_by_index(if_idx);
+        if (n) {
+            processed = netif_dev_rx_poll(n, budget, defer_irq);
+            netif_unref(n);
+        }
+        return processed;
+    }
+    for (int i = 1; (processed < budget) && (n = netif_get_by_index(i)); i++) {
+        processed += netif_dev_rx_poll(n, budget - processed, defer_irq);
+        netif_unref(n);
+    }
+    return processed;
+}
+
+/* Computes a hash of the flow (addresses, protocol and, for TCP and UDP, ports) to which an IP
+ * packet belongs; the IP header and transport ports are expected to be in the first pbuf. */
+u32 net_flow_hash(struct pbuf *p)
+{
+    u8 *hdr = p->payload;
+    u32 h = flow_hash_seed;
+    u16 hdr_len;
+    u8 proto;
+    boolean has_ports;
+    if (p->len < 1)
+        return h;
+    switch (hdr[0] >> 4) {
+    case 4: {
+        struct ip_hdr *iph = (struct ip_hdr *)hdr;
+        if (p->len < IP_HLEN)
+            return h;
+        h = flow_hash_mix(h, iph->src.addr);
+        h = flow_hash_mix(h, iph->dest.addr);
+        proto = IPH_PROTO(iph);
+        hdr_len = IPH_HL(iph) * 4;
+        has_ports = !(IPH_OFFSET(iph) & PP_HTONS(IP_OFFMASK | IP_MF));
+        break;
+    }
+    case 6: {
+        struct ip6_hdr *ip6h = (struct ip6_hdr *)hdr;
+        if (p->len < IP6_HLEN)
+            return h;
+        for (int i = 0; i < 4; i++) {
+            h = flow_hash_mix(h, ip6h->src.addr[i]);
+            h = flow_hash_mix(h, ip6h->dest.addr[i]);
+        }
+        proto = IP6H_NEXTH(ip6h);
+        hdr_len = IP6_HLEN;
+        has_ports = true;
+        break;
+    }
+    default:
+        return h;
+    }
+    h = flow_hash_mix(h, proto);
+    if (has_ports && ((proto == IP_PROTO_TCP) || (proto == IP_PROTO_UDP)) &&
+        (hdr_len + sizeof(u32) <= p->len)) {
+        u32 ports;
+        runtime_memcpy(&ports, hdr + hdr_len, sizeof(ports));
+        h = flow_hash_mix(h, ports);
+    }
+    return h;
+}
+
 static boolean get_config_addr(tuple root, symbol s, ip4_addr_t *addr)
 {
     string v = get_string(root, s);
@@ -413,6 +584,12 @@ extern void lwip_init();
 void init_net(kernel_heaps kh)
 {
     lwip_heap = kh->malloc;
+    init_pktbuf(kh);
+    tx_batches.count = present_processors;
+    tx_batches.batches = allocate_zero(heap_locked(kh),
+                                       tx_batches.count * sizeof(struct netif_tx_batch));
+    assert(tx_batches.batches != INVALID_ADDRESS);
+    flow_hash_seed = random_u64();
     list_init(&net_complete_list);
     lwip_init();
     BSS_RO_AFTER_INIT NETIF_DECLARE_EXT_CALLBACK(netif_callback);
@@ -30,6 +30,64 @@ enum protocol_type {
 #define SIOCGIFHWADDR  0x8927
 #define SIOCGIFINDEX   0x8933
 #define SIOCDIFADDR    0x8936
+#define SIOCETHTOOL    0x8946
+
+/* ethtool commands (in the cmd field of the structure pointed to by ifr_data) */
+#define ETHTOOL_GDRVINFO    0x00000003
+#define ETHTOOL_GSTRINGS    0x0000001b
+#define ETHTOOL_GSTATS      0x0000001d
+#define ETHTOOL_GSSET_INFO  0x00000037
+#define ETHTOOL_GCHANNELS   0x0000003c
+
+#define ETH_SS_STATS    1
+#define ETH_GSTRING_LEN 32
+
+struct ethtool_drvinfo {
+    u32 cmd;
+    char driver[32];
+    char version[32];
+    char fw_version[32];
+    char bus_info[32];
+    char erom_version[32];
+    char reserved2[12];
+    u32 n_priv_flags;
+    u32 n_stats;
+    u32 testinfo_len;
+    u32 eedump_len;
+    u32 regdump_len;
+};
+
+struct ethtool_gstrings {
+    u32 cmd;
+    u32 string_set;
+    u32 len;
+    u8 data[0];
+};
+
+struct ethtool_sset_info {
+    u32 cmd;
+    u32 reserved;
+    u64 sset_mask;
+    u32 data[0];
+};
+
+struct ethtool_stats {
+    u32 cmd;
+    u32 n_stats;
+    u64 data[0];
+};
+
+struct ethtool_channels {
+    u32 cmd;
+    u32 max_rx;
+    u32 max_tx;
+    u32 max_other;
+    u32 max_combined;
+    u32 rx_count;
+    u32 tx_count;
+    u32 other_count;
+    u32 combined_count;
+};
 
 /* ARP protocol HARDWARE identifiers */
 #define ARPHRD_ETHER    1
@@ -39,14 +97,17 @@ enum protocol_type {
 #define MSG_OOB         0x00000001
 #define MSG_PEEK        0x00000002
 #define MSG_DONTROUTE   0x00000004
+#define MSG_CTRUNC      0x00000008
 #define MSG_PROBE       0x00000010
 #define MSG_TRUNC       0x00000020
 #define MSG_DONTWAIT    0x00000040
 #define MSG_EOR         0x00000080
 #define MSG_CONFIRM     0x00000800
+#define MSG_ERRQUEUE    0x00002000
 #define MSG_NOSIGNAL    0x00004000
 #define MSG_MORE        0x00008000
 #define MSG_WAITFORONE  0x00010000
+#define MSG_ZEROCOPY    0x04000000
 
 // tuplify
 #define SOCK_NONBLOCK 00004000
@@ -78,6 +139,35 @@ enum protocol_type {
 #define TCP_CC_INFO		26	/* Get Congestion Control (optional) info */
 #define TCP_SAVE_SYN		27	/* Record SYN headers for new connections */
 #define TCP_SAVED_SYN		28	/* Get SYN headers recorded for connection */
+#define TCP_ULP			31	/* Attach a ULP to a TCP connection */
+
+#define SOL_TLS         282
+
+#define TLS_TX          1   /* Set transmit parameters */
+#define TLS_RX          2   /* Set receive parameters */
+
+#define TLS_SET_RECORD_TYPE 1   /* control message type */
+
+#define SOL_UDP         17
+
+#define UDP_SEGMENT     103 /* Set GSO segmentation size */
+#define UDP_GRO         104 /* This socket can receive UDP GRO packets */
+
+#define UDP_MAX_SEGMENTS    64  /* maximum number of segments in a UDP GSO/GRO message */
+
+/* socket error queue (MSG_ERRQUEUE) messages */
+struct sock_extended_err {
+    u32 ee_errno;
+    u8 ee_origin;
+    u8 ee_type;
+    u8 ee_code;
+    u8 ee_pad;
+    u32 ee_info;
+    u32 ee_data;
+};
+
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
 
 #define SHUT_RD   0
 #define SHUT_WR   1
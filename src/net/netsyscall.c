@@ -87,6 +87,17 @@ typedef struct netsock {
     queue incoming;
     err_t lwip_error;             /* lwIP error code; ERR_OK if normal */
     u8 ipv6only:1;
+    u8 reuseport:1;
+    u8 tls_ulp:1;                 /* TLS upper layer protocol attached */
+    u8 zerocopy:1;                /* SO_ZEROCOPY */
+    u8 prefer_busy_poll:1;        /* SO_PREFER_BUSY_POLL */
+    u8 rx_if_idx;                 /* index of the interface that received the last packet */
+    u32 busy_poll;                /* SO_BUSY_POLL: busy poll time in microseconds */
+    int incoming_cpu;             /* SO_INCOMING_CPU (-1 if not set) */
+    struct reuseport_group *rp_group;
+    ktls_tx tls_tx;
+    u8 *tls_rec;                  /* buffer for TLS records being transmitted */
+    struct netsock_zc *zc;        /* allocated when SO_ZEROCOPY is first enabled */
     union {
 	struct {
 	    struct tcp_pcb *lw;
@@ -96,6 +107,8 @@ typedef struct netsock {
 	struct {
 	    struct udp_pcb *lw;
 	    enum udp_socket_state state;
+	    u16 gso_size;   /* UDP_SEGMENT option */
+	    boolean gro;    /* UDP_GRO option */
 	} udp;
     } info;
     closure_struct(file_io, read);
@@ -106,6 +119,73 @@ typedef struct netsock {
     closure_struct(fdesc_close, close);
 } *netsock;
 
+/* SO_REUSEPORT group: TCP sockets listening on the same address and port. lwIP allows a single
+ * listening PCB for a given address and port, which is owned by the group leader; incoming
+ * connections are distributed among the accept queues of the group members based on a hash of
+ * the connection addresses and ports, so that each worker of a multi-threaded or multi-process
+ * server can accept connections from its own listening socket. A member with SO_INCOMING_CPU set
+ * gets the connections whose requests are processed on that CPU, so that with receive-side scaling
+ * a worker running on each CPU can accept and serve the connections steered to that CPU.
+ * Lock ordering: PCB lock, then reuseport lock, then socket lock. */
+typedef struct reuseport_group {
+    struct list l;
+    netsock leader;
+    vector members;
+} *reuseport_group;
+
+static struct list reuseport_groups;
+static struct spinlock reuseport_lock;
+
+/* MSG_ZEROCOPY state of a TCP socket. The data of a zerocopy send is not copied: each user page is
+ * pinned and referenced via its direct mapping by PBUF_ROM pbufs, which the network device
+ * transmits via scatter-gather. Sends are assigned sequential ids; a send is complete when the
+ * network stack and the device have released all the pbufs referencing its data (i.e. when its
+ * data has been acknowledged and transmitted), at which point its pages are unpinned. The pbufs
+ * are tracked by taking a reference on each of them: a pbuf whose only reference is ours has been
+ * released. Completions are reported in id order through the socket error queue, as ranges of ids.
+ * Sends that are too small to benefit from zerocopy, and sends (or parts thereof) whose data
+ * cannot be pinned, are copied and reported with SO_EE_CODE_ZEROCOPY_COPIED.
+ * Lock ordering: PCB lock, then zerocopy lock. */
+typedef struct netsock_zc {
+    heap h;
+    struct spinlock lock;
+    u32 next_id;        /* id of the next send */
+    u32 done_id;        /* sends with a lower id are complete */
+    buffer pbufs;       /* struct netsock_zc_pbuf records, in transmission order */
+    buffer pages;       /* struct netsock_zc_page records, in id order */
+    buffer copied;      /* ids (u32) of incomplete sends whose data has been copied */
+    buffer errqueue;    /* struct sock_extended_err notifications */
+    struct list l;      /* link in orphans list */
+} *netsock_zc;
+
+struct netsock_zc_pbuf {
+    struct pbuf *p;
+    u32 id;             /* first send with data in this pbuf */
+};
+
+struct netsock_zc_page {
+    u64 phys;
+    u32 id;
+};
+
+/* Smaller sends are copied: the cost of pinning pages and tracking completions would exceed the
+ * cost of copying. */
+#define ZEROCOPY_MIN_LEN    (10 * KB)
+
+/* interval (in units of the lwIP slow timer) of the PCB poll for completions that could not be
+ * detected when data was acknowledged, because the device was still holding the pbufs */
+#define ZEROCOPY_POLL_INTERVAL          1
+
+#define ZEROCOPY_ORPHAN_CHECK_INTERVAL  milliseconds(100)
+
+/* Zerocopy state of closed sockets with data still referenced by their PCBs. */
+static struct {
+    struct list l;
+    struct spinlock lock;
+    struct timer t;
+    closure_struct(timer_handler, check);
+} netsock_zc_orphans;
+
 /* Mask of TCP flags expressing socket configuration settings (as opposed to flags describing the
  * current state of a socket). */
 #define SOCK_TCP_CFG_FLAGS   TF_NODELAY
@@ -117,8 +197,29 @@ typedef struct netsock {
 
 #define TCP_CONG_CTRL_ALGO  "reno"  /* TCP congestion control algorithm name */
 
+#define UDP_MAX_PAYLOAD     65507   /* maximum IPv4 datagram size minus IP and UDP headers */
+
+#define TCP_ULP_NAME_MAX    16
+#define TLS_RECORD_TYPE_APPLICATION_DATA    23
+#define TLS_REC_BUF_SIZE    (TLS_MAX_PLAINTEXT + TLS_MAX_OVERHEAD)
+
 int so_rcvbuf;
 
+/* Busy polling: a thread that would block waiting for data polls the network devices for up to
+ * the busy poll time, and processes received packets in its own context. */
+#define BUSY_POLL_BUDGET    8   /* packets processed by each device poll */
+#define BUSY_POLL_MAX       1000    /* maximum busy poll time in microseconds */
+
+/* busy poll time (in microseconds) for socket reads and epoll waits, unless set via SO_BUSY_POLL */
+static u32 busy_poll_default;
+
+static struct {
+    u64 loops;
+    u64 hits;       /* loops ended by the arrival of data */
+    u64 misses;     /* loops ended by the expiry of the busy poll time */
+    u64 packets;    /* packets processed while busy polling */
+} busy_poll_stats;
+
 static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
 static sysreturn netsock_listen(struct sock *sock, int backlog);
@@ -142,6 +243,12 @@ static sysreturn netsock_sendmsg(struct sock *sock, const struct msghdr *msg,
                                  int flags, boolean in_bh, io_completion completion);
 static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
                                  int flags, boolean in_bh, io_completion completion);
+static sysreturn netsock_sendmmsg(struct sock *sock, struct mmsghdr *msgvec, unsigned int vlen,
+                                  int flags);
+static sysreturn netsock_recvmmsg(struct sock *sock, struct mmsghdr *msgvec, unsigned int vlen,
+                                  int flags);
+static boolean netsock_reuseport_leave(netsock s);
+static err_t lwip_tcp_poll(void *arg, struct tcp_pcb *pcb);
 
 BSS_RO_AFTER_INIT static thunk net_loop_poll;
 static boolean net_loop_poll_queued;
@@ -199,6 +306,9 @@ static u32 netsock_events_locked(netsock s)
         assert(s->sock.type == SOCK_DGRAM);
         rv = (in ? EPOLLIN | EPOLLRDNORM : 0) | EPOLLOUT | EPOLLWRNORM;
     }
+    /* the error queue is read without the zerocopy lock, like the TCP send buffer above */
+    if (s->zc && buffer_length(s->zc->errqueue))
+        rv |= EPOLLERR;
     return rv;
 }
 
@@ -392,6 +502,45 @@ static void netsock_tcp_close(netsock s, struct tcp_pcb *tcp_lw)
     netsock_unlock(s);
 }
 
+/* Polls the network devices until cond returns true or the busy poll time elapses. Returns the
+ * value of cond. Since the polling thread cannot be preempted, polling stops early if the thread
+ * has signals to handle or other work is waiting to run on this CPU. Called without locks held. */
+static boolean netsock_busy_poll_loop(u8 if_idx, u32 usecs, boolean prefer, busy_poll_cond cond)
+{
+    timestamp deadline = now(CLOCK_ID_MONOTONIC_RAW) + microseconds(usecs);
+    u64 packets = 0;
+    boolean done;
+    while (!(done = apply(cond)) && (now(CLOCK_ID_MONOTONIC_RAW) < deadline)) {
+        if (thread_signal_pending(current) || runloop_work_pending())
+            break;
+        u32 n = netif_busy_poll(if_idx, BUSY_POLL_BUDGET, prefer);
+        if (n)
+            packets += n;
+        else
+            kern_pause();
+    }
+    fetch_and_add(&busy_poll_stats.loops, 1);
+    fetch_and_add(done ? &busy_poll_stats.hits : &busy_poll_stats.misses, 1);
+    if (packets)
+        fetch_and_add(&busy_poll_stats.packets, packets);
+    return done;
+}
+
+boolean netsock_busy_poll_wait(busy_poll_cond cond)
+{
+    if (!busy_poll_default)
+        return apply(cond);
+    return netsock_busy_poll_loop(NETIF_NO_INDEX, busy_poll_default, false, cond);
+}
+
+sysreturn netsock_busy_poll_stats_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(128);
+    bprintf(b, "loops hits misses packets\n%ld %ld %ld %ld\n", busy_poll_stats.loops,
+            busy_poll_stats.hits, busy_poll_stats.misses, busy_poll_stats.packets);
+    return buffer_read_at(b, offset, dest, length);
+}
+
 static inline s64 lwip_to_errno(s8 err)
 {
     switch (err) {
@@ -429,10 +578,117 @@ struct udp_entry {
     u16 rport;
 };
 
+/* Copies a packet buffer chain to an iovec array, starting at the current position (iov index
+ * and offset); returns the number of bytes copied, which is less than p->tot_len if the iovec
+ * array is not large enough. */
+static u64 pbuf_to_iov(struct pbuf *p, struct iovec *iov, u64 iovlen, u64 *index, u64 *offset)
+{
+    u64 copied = 0;
+    for (; p && (*index < iovlen); p = p->next) {
+        u64 pbuf_offset = 0;
+        while ((pbuf_offset < p->len) && (*index < iovlen)) {
+            struct iovec *v = &iov[*index];
+            u64 xfer = MIN(v->iov_len - *offset, p->len - pbuf_offset);
+            runtime_memcpy(v->iov_base + *offset, p->payload + pbuf_offset, xfer);
+            pbuf_offset += xfer;
+            *offset += xfer;
+            copied += xfer;
+            if (*offset == v->iov_len) {
+                (*index)++;
+                *offset = 0;
+            }
+        }
+    }
+    return copied;
+}
+
+static void udp_entry_consume(netsock s, struct udp_entry *e)
+{
+    assert(dequeue(s->incoming) == e);
+    s->sock.rx_len -= e->pbuf->tot_len;
+    pbuf_free(e->pbuf);
+    deallocate(s->sock.h, e, sizeof(*e));
+}
+
+/* Receives a datagram into msg; if UDP_GRO is enabled on the socket, the following datagrams from
+ * the same sender with the same size (except the last one, which may be shorter) are coalesced
+ * into the same message, and the segment size is reported in a UDP_GRO control message.
+ * Called with the socket lock held and a non-empty receive queue. */
+static sysreturn udp_recv_locked(netsock s, struct msghdr *msg, int flags, context ctx)
+{
+    struct udp_entry *e = queue_peek(s->incoming);
+    if (context_set_err(ctx))
+        return -EFAULT;
+    struct iovec *iov = msg->msg_iov;
+    u64 iovlen = msg->msg_iovlen;
+    struct cmsghdr *cmsg = msg->msg_control;
+    u64 controllen = msg->msg_controllen;
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+    if (msg->msg_name)
+        addrport_to_sockaddr(s->sock.domain, &e->raddr, e->rport, msg->msg_name,
+                             &msg->msg_namelen);
+    u64 iov_index = 0, iov_offset = 0;
+    u16 seg_size = e->pbuf->tot_len;
+    u64 xfer_total = pbuf_to_iov(e->pbuf, iov, iovlen, &iov_index, &iov_offset);
+    if (xfer_total < seg_size) {
+        msg->msg_flags |= MSG_TRUNC;
+        if (flags & MSG_TRUNC)
+            xfer_total = seg_size;
+    }
+    if (flags & MSG_PEEK)
+        goto out;
+    if (!s->info.udp.gro || (msg->msg_flags & MSG_TRUNC)) {
+        udp_entry_consume(s, e);
+        goto out;
+    }
+    u64 space = iov_total_len(iov, iovlen) - xfer_total;
+    ip_addr_t raddr = e->raddr;
+    u16 rport = e->rport;
+    udp_entry_consume(s, e);
+    int segs = 1;
+    u16 len = seg_size;
+    while ((segs < UDP_MAX_SEGMENTS) && (len == seg_size)) {
+        e = queue_peek(s->incoming);
+        if (e == INVALID_ADDRESS)
+            break;
+        len = e->pbuf->tot_len;
+        if ((len == 0) || (len > seg_size) || (len > space) || (e->rport != rport) ||
+            !ip_addr_cmp(&e->raddr, &raddr))
+            break;
+        xfer_total += pbuf_to_iov(e->pbuf, iov, iovlen, &iov_index, &iov_offset);
+        space -= len;
+        segs++;
+        udp_entry_consume(s, e);
+    }
+    if (segs > 1) {
+        if (cmsg && (controllen >= CMSG_LEN(sizeof(int)))) {
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_GRO;
+            *(int *)CMSG_DATA(cmsg) = seg_size;
+            msg->msg_controllen = MIN(CMSG_ALIGN(cmsg->cmsg_len), controllen);
+        } else {
+            msg->msg_flags |= MSG_CTRUNC;
+        }
+    }
+  out:
+    context_clear_err(ctx);
+    return xfer_total;
+}
+
+closure_function(1, 0, boolean, netsock_busy_poll_cond,
+                 netsock, s)
+{
+    netsock s = bound(s);
+    return !queue_empty(s->incoming) || (get_lwip_error(s) != ERR_OK);
+}
+
 static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
                                        io_completion completion, u64 bqflags, context ctx)
 {
     sysreturn rv = 0;
+    boolean busy_polled = false;
     if (context_set_err(ctx)) {
         rv = -EFAULT;
         goto out;
@@ -442,9 +698,11 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
     context_clear_err(ctx);
 
     netsock_lock(s);
-    err_t err = get_lwip_error(s);
     struct tcp_pcb *tcp_lw = 0;
     boolean notify = false;
+    err_t err;
+  check:
+    err = get_lwip_error(s);
     net_debug("sock %d, ctx %p, iov %p, len %ld, flags 0x%x, bqflags 0x%lx, lwip err %d\n",
               s->sock.fd, ctx, iov, length, flags, bqflags, err);
     assert(s->sock.type == SOCK_STREAM || s->sock.type == SOCK_DGRAM);
@@ -478,9 +736,23 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
             goto out_unlock;
         }
         netsock_unlock(s);
+        if (s->busy_poll && !busy_polled && !(bqflags & BLOCKQ_ACTION_BLOCKED)) {
+            /* busy poll before blocking */
+            busy_polled = true;
+            netsock_busy_poll_loop(s->rx_if_idx, s->busy_poll, s->prefer_busy_poll,
+                                   stack_closure(netsock_busy_poll_cond, s));
+            netsock_lock(s);
+            goto check;
+        }
         return blockq_block_required((unix_context)ctx, bqflags);
     }
 
+    if (s->sock.type == SOCK_DGRAM) {
+        rv = udp_recv_locked(s, msg, flags, ctx);
+        notify = (rv >= 0) && !(flags & MSG_PEEK) && queue_empty(s->incoming);
+        goto out_unlock;
+    }
+
     u64 xfer_total = 0;
     if (context_set_err(ctx)) {
         rv = -EFAULT;
@@ -488,29 +760,19 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
     }
     msg->msg_controllen = 0;
     msg->msg_flags = 0;
-    sockaddr src_addr = msg->msg_name;
-    if (src_addr) {
-        socklen_t *addrlen = &msg->msg_namelen;
-        if (s->sock.type == SOCK_STREAM) {
-            remote_sockaddr(s, src_addr, addrlen);
-        } else {
-            struct udp_entry * e = p;
-            addrport_to_sockaddr(s->sock.domain, &e->raddr, e->rport, src_addr,
-                                 addrlen);
-        }
-    }
+    if (msg->msg_name)
+        remote_sockaddr(s, msg->msg_name, &msg->msg_namelen);
 
     u64 iov_offset = 0;
     u32 pbuf_idx = 0;
-    if ((s->sock.type == SOCK_STREAM) && !(flags & MSG_PEEK)) {
+    if (!(flags & MSG_PEEK)) {
         tcp_lw = s->info.tcp.lw;
         tcp_ref(tcp_lw);
     }
 
-    /* TCP: consume multiple buffers to fill request, if available. */
+    /* consume multiple buffers to fill request, if available */
     do {
-        struct pbuf * pbuf = s->sock.type == SOCK_STREAM ? (struct pbuf *)p :
-            ((struct udp_entry *)p)->pbuf;
+        struct pbuf *pbuf = p;
         struct pbuf *cur_buf = pbuf;
 
         while ((length > 0) && cur_buf) {
@@ -519,8 +781,7 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
                 runtime_memcpy(iov->iov_base + iov_offset, cur_buf->payload, xfer);
                 if (!(flags & MSG_PEEK)) {
                     pbuf_consume(cur_buf, xfer);
-                    if (s->sock.type == SOCK_STREAM)
-                        s->sock.rx_len -= xfer;
+                    s->sock.rx_len -= xfer;
                 }
                 xfer_total += xfer;
                 iov_offset += xfer;
@@ -537,30 +798,20 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
         if (flags & MSG_PEEK) {
             if (!cur_buf)
                 p = queue_peek_at(s->incoming, ++pbuf_idx);
-        } else if (!cur_buf || (s->sock.type == SOCK_DGRAM)) {
+        } else if (!cur_buf) {
             assert(dequeue(s->incoming) == p);
-            if (s->sock.type == SOCK_DGRAM) {
-                s->sock.rx_len -= pbuf->tot_len;
-                if (cur_buf) {
-                    msg->msg_flags |= MSG_TRUNC;
-                    if (flags & MSG_TRUNC)
-                        xfer_total = pbuf->tot_len;
-                }
-                deallocate(s->sock.h, p, sizeof(struct udp_entry));
-            }
             pbuf_free(pbuf);
             p = queue_peek(s->incoming);
             if (p == INVALID_ADDRESS)
                 notify = true;  /* reset a triggered EPOLLIN condition */
         }
-    } while(s->sock.type == SOCK_STREAM && length > 0 && p != INVALID_ADDRESS); /* XXX simplify expression */
+    } while (length > 0 && p != INVALID_ADDRESS);
     context_clear_err(ctx);
 
   rx_done:
     if (xfer_total) {
-        if (s->sock.type == SOCK_STREAM)
-            /* Calls to tcp_recved() may have enqueued new packets in the loopback interface. */
-            netsock_check_loop();
+        /* Calls to tcp_recved() may have enqueued new packets in the loopback interface. */
+        netsock_check_loop();
         rv = xfer_total;
     }
   out_unlock:
@@ -647,8 +898,270 @@ closure_func_basic(file_io, sysreturn, socket_read,
     return blockq_check(s->sock.rxbq, ba, bh);
 }
 
-closure_function(6, 1, sysreturn, socket_write_tcp_bh,
-                 netsock, s, void *, buf, struct iovec *, iov, u64, length, int, flags, io_completion, completion,
+/* Encrypts data into a TLS record and queues the record for transmission. */
+static err_t netsock_tls_write(netsock s, struct tcp_pcb *tcp_lw, void *buf, u64 len, u8 type,
+                               u8 apiflags)
+{
+    bytes rec_len = ktls_tx_encrypt(s->tls_tx, type, buf, len, s->tls_rec);
+    if (rec_len == 0)
+        return ERR_VAL;
+    err_t err = tcp_write(tcp_lw, s->tls_rec, rec_len, apiflags);
+    if (err == ERR_OK)
+        ktls_tx_commit(s->tls_tx);
+    return err;
+}
+
+static void netsock_zc_free(netsock_zc zc)
+{
+    if (zc->pages != INVALID_ADDRESS) {
+        while (buffer_length(zc->pages)) {
+            struct netsock_zc_page *page = buffer_ref(zc->pages, 0);
+            page_unpin_phys(page->phys);
+            buffer_consume(zc->pages, sizeof(*page));
+        }
+    }
+    buffer b[] = {zc->pbufs, zc->pages, zc->copied, zc->errqueue};
+    for (int i = 0; i < _countof(b); i++)
+        if (b[i] != INVALID_ADDRESS)
+            deallocate_buffer(b[i]);
+    deallocate(zc->h, zc, sizeof(*zc));
+}
+
+static netsock_zc netsock_zc_alloc(heap h)
+{
+    netsock_zc zc = allocate(h, sizeof(*zc));
+    if (zc == INVALID_ADDRESS)
+        return zc;
+    zc->h = h;
+    spin_lock_init(&zc->lock);
+    zc->next_id = zc->done_id = 0;
+    zc->pbufs = allocate_buffer(h, 32 * sizeof(struct netsock_zc_pbuf));
+    zc->pages = allocate_buffer(h, 32 * sizeof(struct netsock_zc_page));
+    zc->copied = allocate_buffer(h, 8 * sizeof(u32));
+    zc->errqueue = allocate_buffer(h, 4 * sizeof(struct sock_extended_err));
+    if ((zc->pbufs == INVALID_ADDRESS) || (zc->pages == INVALID_ADDRESS) ||
+        (zc->copied == INVALID_ADDRESS) || (zc->errqueue == INVALID_ADDRESS)) {
+        netsock_zc_free(zc);
+        return INVALID_ADDRESS;
+    }
+    return zc;
+}
+
+/* Adds the completion of a send to the error queue, coalescing it with the last notification if
+ * possible. Called with the zerocopy lock held. */
+static void netsock_zc_notify(netsock_zc zc, u32 id, u8 code)
+{
+    bytes len = buffer_length(zc->errqueue);
+    if (len) {
+        struct sock_extended_err *last = buffer_ref(zc->errqueue,
+                                                     len - sizeof(struct sock_extended_err));
+        if ((last->ee_code == code) && (last->ee_data + 1 == id)) {
+            last->ee_data = id;
+            return;
+        }
+    }
+    struct sock_extended_err ee = {
+        .ee_origin = SO_EE_ORIGIN_ZEROCOPY,
+        .ee_code = code,
+        .ee_info = id,
+        .ee_data = id,
+    };
+    buffer_write(zc->errqueue, &ee, sizeof(ee));
+}
+
+/* Releases the pbufs and pages of completed sends and queues the notifications for these sends.
+ * Returns true if any send has completed. Called with the zerocopy lock held. */
+static boolean netsock_zc_complete(netsock_zc zc)
+{
+    u32 bound = zc->next_id;    /* sends with a lower id are complete */
+    while (buffer_length(zc->pbufs)) {
+        struct netsock_zc_pbuf *zp = buffer_ref(zc->pbufs, 0);
+        if (zp->p->ref > 1) {
+            bound = zp->id;
+            break;
+        }
+        pbuf_free(zp->p);
+        buffer_consume(zc->pbufs, sizeof(*zp));
+    }
+    while (buffer_length(zc->pages)) {
+        struct netsock_zc_page *page = buffer_ref(zc->pages, 0);
+        if ((s32)(page->id - bound) >= 0)
+            break;
+        page_unpin_phys(page->phys);
+        buffer_consume(zc->pages, sizeof(*page));
+    }
+    if (zc->done_id == bound)
+        return false;
+    do {
+        u32 id = zc->done_id;
+        u8 code = 0;
+        if (buffer_length(zc->copied) && (*(u32 *)buffer_ref(zc->copied, 0) == id)) {
+            buffer_consume(zc->copied, sizeof(id));
+            code = SO_EE_CODE_ZEROCOPY_COPIED;
+        }
+        netsock_zc_notify(zc, id, code);
+    } while (++zc->done_id != bound);
+    return true;
+}
+
+static boolean netsock_zc_check(netsock_zc zc)
+{
+    spin_lock(&zc->lock);
+    boolean completed = netsock_zc_complete(zc);
+    spin_unlock(&zc->lock);
+    return completed;
+}
+
+/* Queues for transmission user data from a single page without copying it, or copies the data if
+ * the page cannot be pinned. Called with the PCB lock held. */
+static err_t netsock_zc_write(netsock s, struct tcp_pcb *lw, void *buf, u64 len, u8 apiflags,
+                              u32 id, boolean *copied)
+{
+    netsock_zc zc = s->zc;
+    u64 vaddr = u64_from_pointer(buf);
+    (void)*(volatile u8 *)buf;  /* fault in the page */
+    u64 phys = pin_user_page(s->p, vaddr);
+    if (phys == INVALID_PHYSICAL) {
+        *copied = true;
+        return tcp_write(lw, buf, len, apiflags);
+    }
+    void *data = pointer_from_u64(virt_from_linear_backed_phys(phys) + (vaddr & PAGEMASK));
+
+    /* Make room for the records of the new pbufs: lwIP creates at most one pbuf per segment, plus
+     * one appended to the last unsent segment. */
+    u16 mss = MIN(lw->mss, TCPWND_MIN16(lw->snd_wnd_max / 2));
+    u64 max_pbufs = len / MAX(mss, 1) + 2;
+    spin_lock(&zc->lock);
+    boolean reserved = buffer_extend(zc->pbufs, max_pbufs * sizeof(struct netsock_zc_pbuf)) &&
+                       buffer_extend(zc->pages, sizeof(struct netsock_zc_page));
+    spin_unlock(&zc->lock);
+    if (!reserved) {
+        page_unpin_phys(phys);
+        return ERR_MEM;
+    }
+
+    /* lwIP may extend the last pbuf of the last unsent segment (if it references the data
+     * preceding the new data), or chain new pbufs to it */
+    struct tcp_seg *seg = lw->unsent;
+    struct pbuf *tail = 0;
+    if (seg) {
+        while (seg->next)
+            seg = seg->next;
+        for (tail = seg->p; tail->next; tail = tail->next);
+    }
+    err_t err = tcp_write(lw, data, len, apiflags & ~TCP_WRITE_FLAG_COPY);
+    if (err != ERR_OK) {
+        page_unpin_phys(phys);
+        return err;
+    }
+    range r = irangel(u64_from_pointer(data), len);
+    struct pbuf *q = tail ? tail->next : 0;
+    spin_lock(&zc->lock);
+    while (true) {
+        for (; q; q = q->next) {
+            if (!point_in_range(r, u64_from_pointer(q->payload)))
+                continue;
+            struct netsock_zc_pbuf zp = {
+                .p = q,
+                .id = id,
+            };
+            pbuf_ref(q);
+            buffer_write(zc->pbufs, &zp, sizeof(zp));
+        }
+        seg = seg ? seg->next : lw->unsent;
+        if (!seg)
+            break;
+        q = seg->p;
+    }
+    struct netsock_zc_page page = {
+        .phys = phys,
+        .id = id,
+    };
+    buffer_write(zc->pages, &page, sizeof(page));
+    spin_unlock(&zc->lock);
+    return ERR_OK;
+}
+
+/* Called with the PCB lock held after a send has queued data. */
+static void netsock_zc_commit(netsock s, struct tcp_pcb *lw, boolean copied)
+{
+    netsock_zc zc = s->zc;
+    spin_lock(&zc->lock);
+    if (copied)
+        buffer_write(zc->copied, &zc->next_id, sizeof(zc->next_id));
+    zc->next_id++;
+    boolean completed = netsock_zc_complete(zc);
+    spin_unlock(&zc->lock);
+    tcp_poll(lw, lwip_tcp_poll, ZEROCOPY_POLL_INTERVAL);
+    if (completed) {
+        netsock_lock(s);
+        netsock_notify_events(s);
+    }
+}
+
+/* Called when a socket is closed: if some of the data sent with MSG_ZEROCOPY is still referenced
+ * by the PCB, the zerocopy state is kept until the data is released. */
+static void netsock_zc_release(netsock_zc zc)
+{
+    netsock_zc_check(zc);
+    if (!buffer_length(zc->pbufs)) {
+        netsock_zc_free(zc);
+        return;
+    }
+    spin_lock(&netsock_zc_orphans.lock);
+    boolean idle = list_empty(&netsock_zc_orphans.l);
+    list_push_back(&netsock_zc_orphans.l, &zc->l);
+    spin_unlock(&netsock_zc_orphans.lock);
+    if (idle)
+        register_timer(kernel_timers, &netsock_zc_orphans.t, CLOCK_ID_MONOTONIC,
+                       ZEROCOPY_ORPHAN_CHECK_INTERVAL, false, 0,
+                       (timer_handler)&netsock_zc_orphans.check);
+}
+
+closure_func_basic(timer_handler, void, netsock_zc_orphans_check,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    spin_lock(&netsock_zc_orphans.lock);
+    list_foreach(&netsock_zc_orphans.l, e) {
+        netsock_zc zc = struct_from_list(e, netsock_zc, l);
+        netsock_zc_check(zc);
+        if (!buffer_length(zc->pbufs)) {
+            list_delete(e);
+            netsock_zc_free(zc);
+        }
+    }
+    boolean idle = list_empty(&netsock_zc_orphans.l);
+    spin_unlock(&netsock_zc_orphans.lock);
+    if (!idle)
+        register_timer(kernel_timers, &netsock_zc_orphans.t, CLOCK_ID_MONOTONIC,
+                       ZEROCOPY_ORPHAN_CHECK_INTERVAL, false, 0,
+                       (timer_handler)closure_self());
+}
+
+static sysreturn netsock_set_zerocopy(netsock s, boolean enable)
+{
+    netsock_zc zc = 0;
+    if (enable && !s->zc) {
+        zc = netsock_zc_alloc(s->sock.h);
+        if (zc == INVALID_ADDRESS)
+            return -ENOMEM;
+    }
+    netsock_lock(s);
+    if (zc && !s->zc) {
+        s->zc = zc;
+        zc = 0;
+    }
+    s->zerocopy = enable;
+    netsock_unlock(s);
+    if (zc)
+        netsock_zc_free(zc);
+    return 0;
+}
+
+closure_function(7, 1, sysreturn, socket_write_tcp_bh,
+                 netsock, s, void *, buf, struct iovec *, iov, u64, length, int, flags, u8, tls_type, io_completion, completion,
                  u64 bqflags)
 {
     netsock s = bound(s);
@@ -680,6 +1193,7 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
 
     context ctx = context_from_closure(closure_self());
     struct tcp_pcb *tcp_lw = s->info.tcp.lw;
+    boolean zerocopy = (flags & MSG_ZEROCOPY) && s->zerocopy;
     tcp_ref(tcp_lw);
     netsock_unlock(s);
     tcp_lock(tcp_lw);
@@ -710,11 +1224,16 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         }
     }
     struct iovec *iov = bound(iov);
+    boolean zc_queued = false, zc_copied = false;
     if (context_set_err(ctx)) {
         if (rv == 0)
             rv = -EFAULT;
         goto write_done;
     }
+    if (zerocopy) {
+        u64 total = iov ? iov_total_len(iov, remain) : remain;
+        zc_copied = s->tls_tx || (total < ZEROCOPY_MIN_LEN);
+    }
 
     /* Figure actual length and flags */
     u64 buf_offset = 0;
@@ -738,13 +1257,40 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         } else {
             n = remain;
         }
-        if (avail < n) {
-            n = avail;
-            apiflags |= TCP_WRITE_FLAG_MORE;
+        if (s->tls_tx) {
+            /* each record must be queued as a whole */
+            bytes overhead = ktls_tx_overhead(s->tls_tx);
+            if (avail <= overhead) {
+                if (rv > 0)
+                    break;
+                goto full;
+            }
+            u64 max_len = MIN(avail - overhead, TLS_MAX_PLAINTEXT);
+            if (max_len < n) {
+                n = max_len;
+                apiflags |= TCP_WRITE_FLAG_MORE;
+            }
+            err = netsock_tls_write(s, tcp_lw, buf + buf_offset, n, bound(tls_type), apiflags);
+        } else {
+            if (avail < n) {
+                n = avail;
+                apiflags |= TCP_WRITE_FLAG_MORE;
+            }
+            if (zerocopy && !zc_copied) {
+                /* pages are queued one at a time */
+                u64 page_len = PAGESIZE - (u64_from_pointer(buf + buf_offset) & PAGEMASK);
+                if (page_len < n) {
+                    n = page_len;
+                    apiflags |= TCP_WRITE_FLAG_MORE;
+                }
+                err = netsock_zc_write(s, tcp_lw, buf + buf_offset, n, apiflags,
+                                       s->zc->next_id, &zc_copied);
+            } else {
+                err = tcp_write(tcp_lw, buf + buf_offset, n, apiflags);
+            }
         }
-
-        err = tcp_write(tcp_lw, buf + buf_offset, n, apiflags);
         if (err == ERR_OK) {
+            zc_queued = true;
             buf_offset += n;
             rv += n;
             if ((avail = tcp_sndbuf(tcp_lw)) == 0)
@@ -756,6 +1302,11 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         if (err == ERR_MEM) {
             /* XXX some ambiguity in lwIP - investigate */
             net_debug(" tcp_write() returned ERR_MEM\n");
+            if (rv > 0) {
+                /* return the amount of data queued so far (and commit any zerocopy pages) */
+                err = ERR_OK;
+                break;
+            }
             goto full;
         } else {
             net_debug(" tcp_write() lwip error: %d\n", err);
@@ -780,6 +1331,8 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
             /* XXX map error to socket tcp state */
         }
     }
+    if (zerocopy && zc_queued)
+        netsock_zc_commit(s, tcp_lw, zc_copied);
     tcp_unlock(tcp_lw);
     tcp_unref(tcp_lw);
     goto out;
@@ -792,63 +1345,112 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
     return rv;
 }
 
-static sysreturn socket_write_udp(netsock s, void *source, struct iovec *iov, u64 length,
-                                  struct sockaddr *dest_addr, socklen_t addrlen)
+/* Copies user data from an iovec array, starting at the current position (iov index and offset),
+ * to a packet buffer chain; the iovec array must contain at least p->tot_len bytes after the
+ * current position. */
+static void iov_to_pbuf(struct pbuf *p, struct iovec *iov, u64 *index, u64 *offset)
+{
+    for (; p; p = p->next) {
+        u64 pbuf_offset = 0;
+        while (pbuf_offset < p->len) {
+            struct iovec *v = &iov[*index];
+            u64 xfer = MIN(v->iov_len - *offset, p->len - pbuf_offset);
+            runtime_memcpy(p->payload + pbuf_offset, v->iov_base + *offset, xfer);
+            pbuf_offset += xfer;
+            *offset += xfer;
+            if (*offset == v->iov_len) {
+                (*index)++;
+                *offset = 0;
+            }
+        }
+    }
+}
+
+/* Sends a datagram or, if gso_size is non-zero, a train of datagrams carrying gso_size bytes of
+ * data each (except the last one, which may be shorter): UDP segmentation is done in software,
+ * so that a single call moves up to UDP_MAX_SEGMENTS datagrams through the network stack.
+ * Called with the socket lock held. */
+static sysreturn udp_send_locked(netsock s, void *source, struct iovec *iov, u64 length,
+                                 struct sockaddr *dest_addr, socklen_t addrlen, u16 gso_size)
 {
     ip_addr_t ipaddr;
     u16 port = 0;
     context ctx = get_current_context(current_cpu());
+    struct iovec src_iov;
+    if (context_set_err(ctx))
+        return -EFAULT;
     if (dest_addr) {
-        if (context_set_err(ctx))
-            return -EFAULT;
-        sysreturn ret = sockaddr_to_addrport(s, dest_addr, addrlen,
-            &ipaddr, &port);
-        context_clear_err(ctx);
-        if (ret)
+        sysreturn ret = sockaddr_to_addrport(s, dest_addr, addrlen, &ipaddr, &port);
+        if (ret) {
+            context_clear_err(ctx);
             return ret;
+        }
     }
-    err_t err = ERR_OK;
-
-    /* XXX check how much we can queue, maybe make udp bh */
-    netsock_lock(s);
-    if (!dest_addr && !udp_is_flag_set(s->info.udp.lw, UDP_FLAGS_CONNECTED)) {
-        netsock_unlock(s);
+    if (source) {
+        src_iov.iov_base = source;
+        src_iov.iov_len = length;
+        iov = &src_iov;
+        length = 1;
+    }
+    u64 xfer_len = iov_total_len(iov, length);
+    context_clear_err(ctx);
+    if (!dest_addr && !udp_is_flag_set(s->info.udp.lw, UDP_FLAGS_CONNECTED))
         return -EDESTADDRREQ;
+    u64 seg_size;
+    if (!gso_size || (xfer_len <= gso_size)) {
+        seg_size = xfer_len;
+    } else {
+        if (xfer_len > gso_size * UDP_MAX_SEGMENTS)
+            return -EINVAL;
+        seg_size = gso_size;
     }
+    if (seg_size > UDP_MAX_PAYLOAD)
+        return -EMSGSIZE;
 
-    u64 xfer_len = source ? length : iov_total_len(iov, length);
-    struct pbuf *pbuf = pbuf_alloc(PBUF_TRANSPORT, xfer_len, PBUF_RAM);
-    if (!pbuf) {
-        netsock_unlock(s);
-        msg_err("%s: failed to allocate pbuf for udp_send()", func_ss);
-        return -ENOBUFS;
-    }
-    if (context_set_err(ctx)) {
-        netsock_unlock(s);
+    /* XXX check how much we can queue, maybe make udp bh */
+    u64 iov_index = 0, iov_offset = 0;
+    u64 sent = 0;
+    do {
+        u16 seg_len = MIN(xfer_len - sent, seg_size);
+        struct pbuf *pbuf = pbuf_alloc(PBUF_TRANSPORT, seg_len, PBUF_RAM);
+        if (!pbuf) {
+            msg_err("%s: failed to allocate pbuf for udp_send()", func_ss);
+            return -ENOBUFS;
+        }
+        if (context_set_err(ctx)) {
+            pbuf_free(pbuf);
+            return -EFAULT;
+        }
+        iov_to_pbuf(pbuf, iov, &iov_index, &iov_offset);
+        context_clear_err(ctx);
+        err_t err;
+        if (dest_addr)
+            err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
+        else
+            err = udp_send(s->info.udp.lw, pbuf);
         pbuf_free(pbuf);
-        return -EFAULT;
-    }
-    if (source)
-        runtime_memcpy(pbuf->payload, source, length);
-    else
-        iov_to_buf(pbuf->payload, iov, length);
-    context_clear_err(ctx);
-    if (dest_addr)
-        err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
-    else
-        err = udp_send(s->info.udp.lw, pbuf);
-    netsock_unlock(s);
-    pbuf_free(pbuf);
-    if (err != ERR_OK) {
-        net_debug("lwip error %d\n", err);
-        return lwip_to_errno(err);
-    }
-    netsock_check_loop();
+        if (err != ERR_OK) {
+            net_debug("lwip error %d\n", err);
+            return lwip_to_errno(err);
+        }
+        sent += seg_len;
+    } while (sent < xfer_len);
     return xfer_len;
 }
 
+static sysreturn socket_write_udp(netsock s, void *source, struct iovec *iov, u64 length,
+                                  struct sockaddr *dest_addr, socklen_t addrlen, u16 gso_size)
+{
+    netsock_lock(s);
+    sysreturn rv = udp_send_locked(s, source, iov, length, dest_addr, addrlen, gso_size);
+    netsock_unlock(s);
+    if (rv >= 0)
+        netsock_check_loop();
+    return rv;
+}
+
 static sysreturn socket_write_internal(struct sock *sock, void *source, struct iovec *iov,
-                                       u64 length, int flags,
+                                       u64 length, int flags, u8 tls_type,
                                        struct sockaddr *dest_addr, socklen_t addrlen,
                                        context ctx, boolean bh, io_completion completion)
 {
@@ -866,10 +1468,10 @@ static sysreturn socket_write_internal(struct sock *sock, void *source, struct i
             goto out;
         }
         blockq_action ba = closure_from_context(ctx, socket_write_tcp_bh, s, source, iov, length,
-                                                flags, completion);
+                                                flags, tls_type, completion);
         return blockq_check(sock->txbq, ba, bh);
     } else {
-        rv = socket_write_udp(s, source, iov, length, dest_addr, addrlen);
+        rv = socket_write_udp(s, source, iov, length, dest_addr, addrlen, s->info.udp.gso_size);
     }
     net_debug("completed\n");
 out:
@@ -884,7 +1486,8 @@ closure_func_basic(file_io, sysreturn, socket_write,
     struct sock *s = &ns->sock;
     net_debug("sock %d, type %d, ctx %p, source %p, length %ld, offset %ld\n",
               s->fd, s->type, ctx, source, length, offset);
-    return socket_write_internal(s, source, 0, length, 0, 0, 0, ctx, bh, completion);
+    return socket_write_internal(s, source, 0, length, 0, TLS_RECORD_TYPE_APPLICATION_DATA, 0, 0,
+                                 ctx, bh, completion);
 }
 
 closure_func_basic(file_iov, sysreturn, socket_writev,
@@ -893,7 +1496,8 @@ closure_func_basic(file_iov, sysreturn, socket_writev,
     netsock ns = struct_from_field(closure_self(), netsock, writev);
     struct sock *s = &ns->sock;
     net_debug("sock %d, type %d, count %d, offset %ld\n", s->fd, s->type, count, offset);
-    return socket_write_internal(s, 0, iov, count, 0, 0, 0, ctx, bh, completion);
+    return socket_write_internal(s, 0, iov, count, 0, TLS_RECORD_TYPE_APPLICATION_DATA, 0, 0,
+                                 ctx, bh, completion);
 }
 
 static boolean siocgifconf_get_len(struct netif *n, void *priv)
@@ -1033,6 +1637,92 @@ static sysreturn socket_get_index(struct ifreq *ifreq, struct netif *netif)
     return 0;
 }
 
+#define ETHTOOL_QSTATS  (sizeof(struct netif_qstats) / sizeof(u64))
+
+static const sstring ethtool_qstat_names[ETHTOOL_QSTATS] = {
+    ss_static_init("rx_queue_%d_packets"), ss_static_init("rx_queue_%d_bytes"),
+    ss_static_init("tx_queue_%d_packets"), ss_static_init("tx_queue_%d_bytes"),
+};
+
+/* The only string set supported is the per-queue packet counters of multi-queue devices. */
+static sysreturn socket_ethtool(struct ifreq *ifreq, struct netif *netif)
+{
+    void *data = ifreq->ifr.ifr_data;
+    if (!validate_user_memory(data, sizeof(u32), false))
+        return -EFAULT;
+    if (netif_is_loopback(netif))
+        return -EOPNOTSUPP;
+    netif_dev dev = netif->state;
+    u32 n_stats = dev->num_queues * ETHTOOL_QSTATS;
+    switch (*(u32 *)data) {
+    case ETHTOOL_GDRVINFO: {
+        struct ethtool_drvinfo *info = data;
+        if (!validate_user_memory(info, sizeof(*info), true))
+            return -EFAULT;
+        zero(info, sizeof(*info));
+        info->cmd = ETHTOOL_GDRVINFO;
+        info->n_stats = n_stats;
+        break;
+    }
+    case ETHTOOL_GSSET_INFO: {
+        struct ethtool_sset_info *info = data;
+        if (!validate_user_memory(info, sizeof(*info), true))
+            return -EFAULT;
+        u64 mask = info->sset_mask & U64_FROM_BIT(ETH_SS_STATS);
+        if (mask) {
+            if (!validate_user_memory(info->data, sizeof(info->data[0]), true))
+                return -EFAULT;
+            info->data[0] = n_stats;
+        }
+        info->sset_mask = mask;
+        break;
+    }
+    case ETHTOOL_GSTRINGS: {
+        struct ethtool_gstrings *gstrings = data;
+        if (!validate_user_memory(gstrings, sizeof(*gstrings), true))
+            return -EFAULT;
+        if (gstrings->string_set != ETH_SS_STATS)
+            return -EOPNOTSUPP;
+        if (!validate_user_memory(gstrings->data, n_stats * ETH_GSTRING_LEN, true))
+            return -EFAULT;
+        gstrings->len = n_stats;
+        u8 *name = gstrings->data;
+        for (u32 q = 0; q < dev->num_queues; q++) {
+            for (int i = 0; i < ETHTOOL_QSTATS; i++) {
+                zero(name, ETH_GSTRING_LEN);
+                rsnprintf_sstring((char *)name, ETH_GSTRING_LEN, ethtool_qstat_names[i], q);
+                name += ETH_GSTRING_LEN;
+            }
+        }
+        break;
+    }
+    case ETHTOOL_GSTATS: {
+        struct ethtool_stats *stats = data;
+        if (!validate_user_memory(stats, sizeof(*stats), true) ||
+            !validate_user_memory(stats->data, n_stats * sizeof(u64), true))
+            return -EFAULT;
+        stats->n_stats = n_stats;
+        for (u32 q = 0; q < dev->num_queues; q++)
+            runtime_memcpy(&stats->data[q * ETHTOOL_QSTATS], &dev->qstats[q],
+                           sizeof(struct netif_qstats));
+        break;
+    }
+    case ETHTOOL_GCHANNELS: {
+        struct ethtool_channels *channels = data;
+        if (!validate_user_memory(channels, sizeof(*channels), true))
+            return -EFAULT;
+        u32 queues = MAX(dev->num_queues, 1);
+        zero(channels, sizeof(*channels));
+        channels->cmd = ETHTOOL_GCHANNELS;
+        channels->max_combined = channels->combined_count = queues;
+        break;
+    }
+    default:
+        return -EOPNOTSUPP;
+    }
+    return 0;
+}
+
 /* socket configuration controls; not netsock specific, but reliant on lwIP calls */
 sysreturn socket_ioctl(struct sock *s, unsigned long request, vlist ap)
 {
@@ -1098,6 +1788,8 @@ sysreturn socket_ioctl(struct sock *s, unsigned long request, vlist ap)
         return socket_ifreq(varg(ap, struct ifreq *), false, socket_get_hwaddr);
     case SIOCGIFINDEX:
         return socket_ifreq(varg(ap, struct ifreq *), false, socket_get_index);
+    case SIOCETHTOOL:
+        return socket_ifreq(varg(ap, struct ifreq *), false, socket_ethtool);
     default:
         return ioctl_generic(&s->f, request, ap);
     }
@@ -1159,6 +1851,11 @@ closure_func_basic(fdesc_close, sysreturn, socket_close,
          * using a stale reference to the socket structure, set the callback
          * argument to NULL. */
         tcp_lw = netsock_tcp_get(s);
+        if (tcp_lw && s->rp_group && netsock_reuseport_leave(s)) {
+            /* the listening PCB now belongs to another socket */
+            netsock_tcp_put(tcp_lw);
+            tcp_lw = netsock_tcp_get(s);
+        }
         if (tcp_lw) {
             netsock_tcp_close(s, tcp_lw);
             netsock_tcp_put(tcp_lw);
@@ -1186,6 +1883,12 @@ closure_func_basic(fdesc_close, sysreturn, socket_close,
         }
     }
     deallocate_queue(s->incoming);
+    if (s->zc)
+        netsock_zc_release(s->zc);
+    if (s->tls_tx) {
+        ktls_tx_free(s->sock.h, s->tls_tx);
+        deallocate(s->sock.h, s->tls_rec, TLS_REC_BUF_SIZE);
+    }
     socket_deinit(&s->sock);
     unix_cache_free(s->p->uh, socket, s);
     return io_complete(completion, 0);
@@ -1296,6 +1999,7 @@ static void udp_input_lower(void *z, struct udp_pcb *pcb, struct pbuf *p,
 	e->rport = port;
 	assert(enqueue(s->incoming, e));
 	s->sock.rx_len += p->tot_len;
+	s->rx_if_idx = p->if_idx;
 	wakeup_sock(s, WAKEUP_SOCK_RX);
     } else {
 	msg_err("%s error: null pbuf", func_ss);
@@ -1343,6 +2047,16 @@ static int allocate_sock(process p, int af, int type, u32 flags, boolean alloc_f
     s->sock.recvmsg = netsock_recvmsg;
     s->sock.shutdown = netsock_shutdown;
     s->ipv6only = 0;
+    s->reuseport = 0;
+    s->rp_group = 0;
+    s->tls_ulp = 0;
+    s->zerocopy = 0;
+    s->zc = 0;
+    s->prefer_busy_poll = 0;
+    s->rx_if_idx = NETIF_NO_INDEX;
+    s->busy_poll = busy_poll_default;
+    s->incoming_cpu = -1;
+    s->tls_tx = 0;
     set_lwip_error(s, ERR_OK);
     if (alloc_fd) {
         fd = s->sock.fd = allocate_fd(p, s);
@@ -1384,6 +2098,10 @@ static int allocate_udp_sock(process p, int af, struct udp_pcb *pcb, u32 flags)
     if (fd >= 0) {
         s->info.udp.lw = pcb;
         s->info.udp.state = UDP_SOCK_CREATED;
+        s->info.udp.gso_size = 0;
+        s->info.udp.gro = false;
+        s->sock.sendmmsg = netsock_sendmmsg;
+        s->sock.recvmmsg = netsock_recvmmsg;
         udp_recv(pcb, udp_input_lower, s);
     }
     return fd;
@@ -1473,6 +2191,11 @@ static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t
             return ERR_BUF;     /* XXX verify */
         }
         s->sock.rx_len += p->tot_len;
+        s->rx_if_idx = p->if_idx;
+
+        /* Data coalesced by GRO from multiple segments is acknowledged without delay. */
+        if (p->tot_len > pcb->mss)
+            tcp_ack_now(pcb);
     }
     wakeup_sock(s, WAKEUP_SOCK_RX);
 
@@ -1556,11 +2279,25 @@ static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
     }
     netsock s = (netsock)arg;
     net_debug("fd %d, pcb %p, len %d\n", s->sock.fd, pcb, len);
+    if (s->zc)
+        netsock_zc_check(s->zc);
     netsock_lock(s);
     wakeup_sock(s, WAKEUP_SOCK_TX);
     return ERR_OK;
 }
 
+/* Checks for zerocopy completions that could not be detected when data was acknowledged, because
+ * the network device had not released the pbufs yet. */
+static err_t lwip_tcp_poll(void *arg, struct tcp_pcb *pcb)
+{
+    netsock s = arg;
+    if (s && s->zc && netsock_zc_check(s->zc)) {
+        netsock_lock(s);
+        netsock_notify_events(s);
+    }
+    return ERR_OK;
+}
+
 closure_function(2, 1, sysreturn, connect_tcp_bh,
                  netsock, s, thread, t,
                  u64 flags)
@@ -1763,8 +2500,8 @@ static sysreturn netsock_sendto(struct sock *sock, void *buf, u64 len,
     if (rv < 0) {
         return io_complete(completion, rv);
     }
-    return socket_write_internal(sock, buf, 0, len, flags, dest_addr, addrlen,
-                                 ctx, in_bh, completion);
+    return socket_write_internal(sock, buf, 0, len, flags, TLS_RECORD_TYPE_APPLICATION_DATA,
+                                 dest_addr, addrlen, ctx, in_bh, completion);
 }
 
 sysreturn sendto(int sockfd, void *buf, u64 len, int flags,
@@ -1797,19 +2534,111 @@ sysreturn socket_send(fdesc f, void *buf, u64 len, context ctx, boolean in_bh,
     return sock->sendto(sock, buf, len, 0, 0, 0, ctx, in_bh, completion);
 }
 
+/* Retrieves the settings passed via control messages to sendmsg(): the record type of the data
+ * sent on a kernel TLS socket (TLS_SET_RECORD_TYPE), and the segment size of the data sent on a
+ * UDP socket (UDP_SEGMENT). */
+static sysreturn netsock_send_cmsgs(netsock s, const struct msghdr *msg, u8 *tls_type,
+                                    u16 *gso_size)
+{
+    *tls_type = TLS_RECORD_TYPE_APPLICATION_DATA;
+    *gso_size = (s->sock.type == SOCK_DGRAM) ? s->info.udp.gso_size : 0;
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return -EFAULT;
+    sysreturn rv = 0;
+    if (!msg->msg_control)
+        goto out;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_TLS) && (cmsg->cmsg_type == TLS_SET_RECORD_TYPE)) {
+            if (!s->tls_tx || (cmsg->cmsg_len != CMSG_LEN(sizeof(u8)))) {
+                rv = -EINVAL;
+                break;
+            }
+            *tls_type = *(u8 *)CMSG_DATA(cmsg);
+        } else if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_SEGMENT)) {
+            if ((s->sock.type != SOCK_DGRAM) || (cmsg->cmsg_len != CMSG_LEN(sizeof(u16)))) {
+                rv = -EINVAL;
+                break;
+            }
+            *gso_size = *(u16 *)CMSG_DATA(cmsg);
+        }
+    }
+  out:
+    context_clear_err(ctx);
+    return rv;
+}
+
 static sysreturn netsock_sendmsg(struct sock *s, const struct msghdr *msg, int flags,
                                  boolean in_bh, io_completion completion)
 {
+    netsock ns = (netsock)s;
     sysreturn rv = sendto_prepare(s, flags);
     if (rv < 0)
         goto out;
-    return socket_write_internal(s, 0, msg->msg_iov, msg->msg_iovlen, flags,
+    u8 tls_type;
+    u16 gso_size;
+    rv = netsock_send_cmsgs(ns, msg, &tls_type, &gso_size);
+    if (rv < 0)
+        goto out;
+    if (s->type == SOCK_DGRAM) {
+        rv = socket_write_udp(ns, 0, msg->msg_iov, msg->msg_iovlen, msg->msg_name,
+                              msg->msg_namelen, gso_size);
+        goto out;
+    }
+    return socket_write_internal(s, 0, msg->msg_iov, msg->msg_iovlen, flags, tls_type,
                                  msg->msg_name, msg->msg_namelen,
                                  get_current_context(current_cpu()), in_bh, completion);
   out:
     return io_complete(completion, rv);
 }
 
+/* Sends the messages of a sendmmsg() call on a UDP socket as a single batch: the socket lock is
+ * held for the entire vector, and network devices are notified of the queued packets once. */
+static sysreturn netsock_sendmmsg(struct sock *sock, struct mmsghdr *msgvec, unsigned int vlen,
+                                  int flags)
+{
+    netsock s = (netsock)sock;
+    sysreturn rv = sendto_prepare(sock, flags);
+    if (rv < 0)
+        return rv;
+    context ctx = get_current_context(current_cpu());
+    boolean batch = netif_tx_batch_begin();
+    unsigned int sent;
+    netsock_lock(s);
+    for (sent = 0; sent < vlen; sent++) {
+        struct msghdr *msg = &msgvec[sent].msg_hdr;
+        u8 tls_type;
+        u16 gso_size;
+        rv = netsock_send_cmsgs(s, msg, &tls_type, &gso_size);
+        if (rv < 0)
+            break;
+        if (context_set_err(ctx)) {
+            rv = -EFAULT;
+            break;
+        }
+        struct iovec *iov = msg->msg_iov;
+        u64 iovlen = msg->msg_iovlen;
+        struct sockaddr *dest_addr = msg->msg_name;
+        socklen_t addrlen = msg->msg_namelen;
+        context_clear_err(ctx);
+        rv = udp_send_locked(s, 0, iov, iovlen, dest_addr, addrlen, gso_size);
+        if (rv < 0)
+            break;
+        unsigned int msg_len = rv;
+        if (!set_user_value(&msgvec[sent].msg_len, msg_len)) {
+            rv = -EFAULT;
+            break;
+        }
+    }
+    netsock_unlock(s);
+    if (batch)
+        netif_tx_batch_end();
+    if (sent == 0)
+        return rv;
+    netsock_check_loop();
+    return sent;
+}
+
 sysreturn sendmsg(int sockfd, const struct msghdr *msg, int flags)
 {
     if (!validate_msghdr(msg, false))
@@ -1875,6 +2704,11 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
     struct sock *s = resolve_socket(t->p, sockfd);
 
     net_debug("sock %d, type %d, flags 0x%x, vlen %d\n", s->fd, s->type, flags, vlen);
+    if (s->sendmmsg) {
+        sysreturn rv = s->sendmmsg(s, msgvec, vlen, flags);
+        socket_release(s);
+        return rv;
+    }
     closure_struct(sendmmsg_next, next);
     contextual_closure_init(sendmmsg_next, &next);
     io_completion completion = contextual_closure(sendmmsg_complete,
@@ -1947,12 +2781,66 @@ sysreturn socket_recv(fdesc f, void *buf, u64 len, context ctx, boolean in_bh,
     return sock->recvfrom(sock, buf, len, 0, 0, 0, ctx, in_bh, completion);
 }
 
+/* Dequeues a zerocopy completion notification from the socket error queue; the notification is
+ * returned in an IP_RECVERR (or IPV6_RECVERR) control message, followed by the (unspecified)
+ * address of the offender, as in Linux. */
+static sysreturn netsock_recv_errqueue(netsock s, struct msghdr *msg)
+{
+    netsock_zc zc = s->zc;
+    struct {
+        struct sock_extended_err ee;
+        union {
+            struct sockaddr_in sin;
+            struct sockaddr_in6 sin6;
+        } offender;
+    } err;
+    if (!zc)
+        return -EAGAIN;
+    spin_lock(&zc->lock);
+    netsock_zc_complete(zc);
+    boolean found = buffer_read(zc->errqueue, &err.ee, sizeof(err.ee));
+    spin_unlock(&zc->lock);
+    if (!found)
+        return -EAGAIN;
+    zero(&err.offender, sizeof(err.offender));
+    boolean ipv6 = (s->sock.domain == AF_INET6);
+    bytes len = sizeof(err.ee) + (ipv6 ? sizeof(err.offender.sin6) : sizeof(err.offender.sin));
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return -EFAULT;
+    struct cmsghdr *cmsg = msg->msg_control;
+    u64 controllen = msg->msg_controllen;
+    msg->msg_controllen = 0;
+    msg->msg_flags = MSG_ERRQUEUE;
+    if (msg->msg_name)
+        msg->msg_namelen = 0;
+    if (cmsg && (controllen >= CMSG_LEN(len))) {
+        cmsg->cmsg_len = CMSG_LEN(len);
+        cmsg->cmsg_level = ipv6 ? IPPROTO_IPV6 : IPPROTO_IP;
+        cmsg->cmsg_type = ipv6 ? IPV6_RECVERR : IP_RECVERR;
+        runtime_memcpy(CMSG_DATA(cmsg), &err, len);
+        msg->msg_controllen = MIN(CMSG_ALIGN(cmsg->cmsg_len), controllen);
+    } else {
+        msg->msg_flags |= MSG_CTRUNC;
+    }
+    context_clear_err(ctx);
+    return 0;
+}
+
 static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
                                  int flags, boolean in_bh, io_completion completion)
 {
     netsock s = (netsock) sock;
     sysreturn rv;
 
+    if (flags & MSG_ERRQUEUE) {
+        rv = netsock_recv_errqueue(s, msg);
+        if (rv == 0) {
+            netsock_lock(s);
+            netsock_notify_events(s);   /* reset a triggered EPOLLERR condition */
+        }
+        goto out;
+    }
     if ((sock->type == SOCK_STREAM) && (s->info.tcp.state != TCP_SOCK_OPEN)) {
         rv = (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : -ENOTCONN;
         goto out;
@@ -1976,6 +2864,42 @@ sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
     return s->recvmsg(s, msg, flags, false, (io_completion)&s->f.io_complete);
 }
 
+/* Receives the datagrams queued in a UDP socket into the messages of a recvmmsg() call, with a
+ * single acquisition of the socket lock. */
+static sysreturn netsock_recvmmsg(struct sock *sock, struct mmsghdr *msgvec, unsigned int vlen,
+                                  int flags)
+{
+    netsock s = (netsock)sock;
+    context ctx = get_current_context(current_cpu());
+    unsigned int received = 0;
+    sysreturn rv = 0;
+    netsock_lock(s);
+
+    /* error conditions are reported by the non-batched receive path */
+    if ((s->info.udp.state == UDP_SOCK_SHUTDOWN) || (get_lwip_error(s) != ERR_OK)) {
+        netsock_unlock(s);
+        return 0;
+    }
+    while ((received < vlen) && !queue_empty(s->incoming)) {
+        rv = udp_recv_locked(s, &msgvec[received].msg_hdr, flags, ctx);
+        if (rv < 0)
+            break;
+        unsigned int msg_len = rv;
+        if (!set_user_value(&msgvec[received].msg_len, msg_len)) {
+            rv = -EFAULT;
+            break;
+        }
+        received++;
+        if (flags & MSG_PEEK)
+            break;
+    }
+    if ((received > 0) && !(flags & MSG_PEEK) && queue_empty(s->incoming))
+        netsock_notify_events(s);   /* reset a triggered EPOLLIN condition */
+    else
+        netsock_unlock(s);
+    return (received > 0) ? received : rv;
+}
+
 declare_closure_struct(0, 0, void, recvmmsg_next);
 
 closure_function(6, 1, void, recvmmsg_complete,
@@ -2032,29 +2956,75 @@ sysreturn recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int fl
     thread t = current;
     struct sock *s = resolve_socket(t->p, sockfd);
     net_debug("sock %d, type %d, flags 0x%x, vlen %d\n", s->fd, s->type, flags, vlen);
+    unsigned int received = 0;
+    if (s->recvmmsg) {
+        /* Messages that are not immediately available are received via the non-batched path,
+         * which may block. */
+        sysreturn rv = s->recvmmsg(s, msgvec, vlen, flags & ~MSG_WAITFORONE);
+        if ((rv < 0) || (rv == vlen) ||
+            ((rv > 0) && ((flags & (MSG_WAITFORONE | MSG_DONTWAIT | MSG_PEEK)) ||
+                          (s->f.flags & SOCK_NONBLOCK)))) {
+            socket_release(s);
+            return rv;
+        }
+        received = rv;
+    }
     closure_struct(recvmmsg_next, next);
     contextual_closure_init(recvmmsg_next, &next);
     io_completion completion = contextual_closure(recvmmsg_complete,
-                                                  s, msgvec, vlen, flags, 0, next);
+                                                  s, msgvec, vlen, flags, received, next);
     if (completion == INVALID_ADDRESS) {
         socket_release(s);
-        return -ENOMEM;
+        return (received > 0) ? received : -ENOMEM;
     }
-    s->recvmsg(s, &msgvec->msg_hdr, flags & ~MSG_WAITFORONE, false, completion);
+    s->recvmsg(s, &msgvec[received].msg_hdr, flags & ~MSG_WAITFORONE, false, completion);
     return thread_maybe_sleep_uninterruptible(t);
 }
 
+static u64 reuseport_hash(struct tcp_pcb *lw)
+{
+    u64 hash = ((u64)lw->remote_port << 16) | lw->local_port;
+    if (IP_IS_V6_VAL(lw->remote_ip)) {
+        const u32 *addr = ip_2_ip6(&lw->remote_ip)->addr;
+        for (int i = 0; i < 4; i++)
+            hash = (hash ^ addr[i]) * 0x9e3779b97f4a7c15ull;
+    } else {
+        hash = (hash ^ ip_2_ip4(&lw->remote_ip)->addr) * 0x9e3779b97f4a7c15ull;
+    }
+    return hash ^ (hash >> 32);
+}
+
+/* Called with the reuseport lock held. */
+static netsock reuseport_select(reuseport_group g, struct tcp_pcb *lw)
+{
+    int cpu = current_cpu()->id;
+    netsock s;
+    vector_foreach(g->members, s) {
+        if (s->incoming_cpu == cpu)
+            return s;
+    }
+    return vector_get(g->members, reuseport_hash(lw) % vector_length(g->members));
+}
+
 static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
 {
     if (!z) {
         return ERR_CLSD;
     }
     netsock s = z;
+    spin_lock(&reuseport_lock);
+    reuseport_group g = s->rp_group;
+    if (!g)
+        spin_unlock(&reuseport_lock);
+    else if (err != ERR_MEM)
+        s = reuseport_select(g, lw);
     netsock_lock(s);
 
     if (err == ERR_MEM) {
         set_lwip_error(s, err);
         wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
+        if (g)
+            spin_unlock(&reuseport_lock);
         return err;               /* lwIP doesn't care */
     }
 
@@ -2069,6 +3039,10 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     sn->info.tcp.lw = lw;
     tcp_ref(lw);
     sn->info.tcp.state = TCP_SOCK_OPEN;
+    sn->incoming_cpu = current_cpu()->id;
+    /* SO_ZEROCOPY is inherited from the listening socket (if the zerocopy state cannot be allocated, data is always copied) */
+    if (s->zerocopy)
+        netsock_set_zerocopy(sn, true);
     set_lwip_error(s, ERR_OK);
     tcp_arg(lw, sn);
     tcp_recv(lw, tcp_input_lower);
@@ -2084,12 +3058,106 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     tcp_backlog_delayed(lw);
 
     wakeup_sock(s, WAKEUP_SOCK_RX);
+    if (g)
+        spin_unlock(&reuseport_lock);
     return ERR_OK;
   unlock_out:
     netsock_unlock(s);
+    if (g)
+        spin_unlock(&reuseport_lock);
     return err;
 }
 
+/* Called with the socket lock held (the socket cannot be targeted by incoming connections until it
+ * joins a group); if there is a group listening on the same address and port as the socket, adds
+ * the socket to the group and returns true. */
+static boolean netsock_reuseport_join(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    boolean joined = false;
+    spin_lock(&reuseport_lock);
+    list_foreach(&reuseport_groups, e) {
+        reuseport_group g = struct_from_list(e, reuseport_group, l);
+        struct tcp_pcb *listen_lw = g->leader->info.tcp.lw;
+        if ((listen_lw->local_port == lw->local_port) &&
+            ip_addr_cmp(&listen_lw->local_ip, &lw->local_ip)) {
+            vector_push(g->members, s);
+            s->rp_group = g;
+            s->info.tcp.state = TCP_SOCK_LISTENING;
+            joined = true;
+            break;
+        }
+    }
+    spin_unlock(&reuseport_lock);
+    return joined;
+}
+
+static reuseport_group reuseport_group_alloc(heap h)
+{
+    reuseport_group g = allocate(h, sizeof(*g));
+    if (g == INVALID_ADDRESS)
+        return 0;
+    g->members = allocate_vector(h, 4);
+    if (g->members == INVALID_ADDRESS) {
+        deallocate(h, g, sizeof(*g));
+        return 0;
+    }
+    return g;
+}
+
+static void reuseport_group_free(heap h, reuseport_group g)
+{
+    deallocate_vector(g->members);
+    deallocate(h, g, sizeof(*g));
+}
+
+/* Makes a listening socket the leader of a newly allocated group. */
+static void netsock_reuseport_create(netsock s, reuseport_group g)
+{
+    g->leader = s;
+    vector_push(g->members, s);
+    spin_lock(&reuseport_lock);
+    list_push_back(&reuseport_groups, &g->l);
+    s->rp_group = g;
+    spin_unlock(&reuseport_lock);
+}
+
+/* Called with the lock of the socket PCB held. If the socket is the group leader and other sockets
+ * remain in the group, the listening PCB is handed over to another group member (whose own PCB is
+ * taken by the leaving socket), and true is returned. */
+static boolean netsock_reuseport_leave(netsock s)
+{
+    reuseport_group g = s->rp_group;
+    boolean handover = false;
+    spin_lock(&reuseport_lock);
+    s->rp_group = 0;
+    for (int i = 0; i < vector_length(g->members); i++) {
+        if (vector_get(g->members, i) == s) {
+            vector_delete(g->members, i);
+            break;
+        }
+    }
+    if (vector_length(g->members) == 0) {
+        list_delete(&g->l);
+        spin_unlock(&reuseport_lock);
+        reuseport_group_free(s->sock.h, g);
+        return false;
+    }
+    if (g->leader == s) {
+        netsock n = vector_get(g->members, 0);
+        struct tcp_pcb *listen_lw = s->info.tcp.lw;
+        netsock_lock(n);
+        s->info.tcp.lw = n->info.tcp.lw;
+        n->info.tcp.lw = listen_lw;
+        netsock_unlock(n);
+        tcp_arg(listen_lw, n);
+        g->leader = n;
+        handover = true;
+    }
+    spin_unlock(&reuseport_lock);
+    return handover;
+}
+
 static sysreturn netsock_listen(struct sock *sock, int backlog)
 {
     netsock s = (netsock) sock;
@@ -2102,16 +3170,31 @@ static sysreturn netsock_listen(struct sock *sock, int backlog)
     }
     if (s->info.tcp.state != TCP_SOCK_CREATED) {
         if (s->info.tcp.state == TCP_SOCK_LISTENING) {
-            tcp_backlog_set(s->info.tcp.lw, backlog);
+            if (!s->rp_group || (s->rp_group->leader == s))
+                tcp_backlog_set(s->info.tcp.lw, backlog);
             rv = 0;
         } else {
             rv = -EINVAL;
         }
         goto unlock_out;
     }
+    reuseport_group g = 0;
+    if (s->reuseport) {
+        if (netsock_reuseport_join(s)) {
+            rv = 0;
+            goto unlock_out;
+        }
+        g = reuseport_group_alloc(s->sock.h);
+        if (!g) {
+            rv = -ENOMEM;
+            goto unlock_out;
+        }
+    }
     err_t err;
     struct tcp_pcb * lw = tcp_listen_with_backlog_and_err(s->info.tcp.lw, backlog, &err);
     if (!lw) {
+        if (g)
+            reuseport_group_free(s->sock.h, g);
         rv = lwip_to_errno(err);
         goto unlock_out;
     }
@@ -2120,6 +3203,8 @@ static sysreturn netsock_listen(struct sock *sock, int backlog)
     s->info.tcp.lw = lw;
     s->info.tcp.state = TCP_SOCK_LISTENING;
     set_lwip_error(s, ERR_OK);
+    if (g)
+        netsock_reuseport_create(s, g);
     tcp_arg(lw, s);
     tcp_accept(lw, accept_tcp_from_lwip);
     rv = 0;
@@ -2364,6 +3449,71 @@ sysreturn getpeername(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
     return rv;
 }
 
+static sysreturn netsock_set_ulp(netsock s, void *optval, socklen_t optlen)
+{
+    char name[TCP_ULP_NAME_MAX];
+    if ((optlen <= 0) || !copy_from_user(optval, name, MIN(optlen, sizeof(name) - 1)))
+        return -EFAULT;
+    name[MIN(optlen, sizeof(name) - 1)] = '\0';
+    if (runtime_memcmp(name, "tls", sizeof("tls")) || !ktls_aead)
+        return -ENOENT;
+    if ((s->sock.type != SOCK_STREAM) || (s->info.tcp.state != TCP_SOCK_OPEN))
+        return -ENOTCONN;
+    netsock_lock(s);
+    sysreturn rv;
+    if (s->tls_ulp) {
+        rv = -EEXIST;
+    } else {
+        s->tls_ulp = 1;
+        rv = 0;
+    }
+    netsock_unlock(s);
+    return rv;
+}
+
+static sysreturn netsock_set_tls_tx(netsock s, void *optval, socklen_t optlen)
+{
+    u8 crypto_info[64];
+    if ((optlen <= 0) || (optlen > sizeof(crypto_info)))
+        return -EINVAL;
+    if (!copy_from_user(optval, crypto_info, optlen))
+        return -EFAULT;
+    heap h = s->sock.h;
+    int err;
+    ktls_tx tx = ktls_tx_alloc(h, crypto_info, optlen, &err);
+    zero(crypto_info, sizeof(crypto_info));
+    if (!tx)
+        return err;
+    u8 *rec = allocate(h, TLS_REC_BUF_SIZE);
+    if (rec == INVALID_ADDRESS) {
+        ktls_tx_free(h, tx);
+        return -ENOMEM;
+    }
+
+    /* Install the transmit state with the TCP lock held, so that it does not change under a
+     * concurrent write. */
+    struct tcp_pcb *tcp_lw = netsock_tcp_get(s);
+    if (!tcp_lw) {
+        ktls_tx_free(h, tx);
+        deallocate(h, rec, TLS_REC_BUF_SIZE);
+        return -ENOTCONN;
+    }
+    sysreturn rv;
+    if (s->tls_tx) {
+        rv = -EBUSY;
+    } else {
+        s->tls_rec = rec;
+        s->tls_tx = tx;
+        rv = 0;
+    }
+    netsock_tcp_put(tcp_lw);
+    if (rv) {
+        ktls_tx_free(h, tx);
+        deallocate(h, rec, TLS_REC_BUF_SIZE);
+    }
+    return rv;
+}
+
 static sysreturn netsock_setsockopt(struct sock *sock, int level,
                                     int optname, void *optval, socklen_t optlen)
 {
@@ -2433,7 +3583,62 @@ static sysreturn netsock_setsockopt(struct sock *sock, int level,
             }
             break;
         case SO_REUSEPORT:
-            goto unimplemented;
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->reuseport = !!int_optval;
+            if (s->sock.type == SOCK_DGRAM) {
+                /* UDP sockets can bind to the same address and port, but datagrams are not
+                 * distributed among them */
+                if (int_optval)
+                    ip_set_option(s->info.udp.lw, SOF_REUSEADDR);
+                netsock_unlock(s);
+                break;
+            }
+            netsock_unlock(s);
+
+            /* sockets in a group are bound to the same address and port */
+            struct tcp_pcb *tcp_lw = netsock_tcp_get(s);
+            if (tcp_lw) {
+                if (int_optval)
+                    ip_set_option(tcp_lw, SOF_REUSEADDR);
+                netsock_tcp_put(tcp_lw);
+            }
+            break;
+        case SO_INCOMING_CPU:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            s->incoming_cpu = int_optval;
+            break;
+        case SO_ZEROCOPY:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            /* MSG_ZEROCOPY is only supported for TCP */
+            if (s->sock.type != SOCK_STREAM) {
+                rv = -EOPNOTSUPP;
+                goto out;
+            }
+            rv = netsock_set_zerocopy(s, !!int_optval);
+            break;
+        case SO_BUSY_POLL:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if (int_optval < 0) {
+                rv = -EINVAL;
+                goto out;
+            }
+            s->busy_poll = MIN(int_optval, BUSY_POLL_MAX);
+            break;
+        case SO_PREFER_BUSY_POLL:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            s->prefer_busy_poll = !!int_optval;
+            break;
         default:
             goto unimplemented;
         }
@@ -2468,10 +3673,54 @@ static sysreturn netsock_setsockopt(struct sock *sock, int level,
                 netsock_unlock(s);
             }
             break;
+        case TCP_ULP:
+            rv = netsock_set_ulp(s, optval, optlen);
+            goto out;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_UDP:
+        if (s->sock.type != SOCK_DGRAM) {
+            rv = -ENOPROTOOPT;
+            goto out;
+        }
+        switch (optname) {
+        case UDP_SEGMENT:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if ((int_optval < 0) || (int_optval > UDP_MAX_PAYLOAD)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            s->info.udp.gso_size = int_optval;
+            break;
+        case UDP_GRO:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            s->info.udp.gro = !!int_optval;
+            break;
         default:
             goto unimplemented;
         }
         break;
+    case SOL_TLS:
+        if (!s->tls_ulp) {
+            rv = -ENOPROTOOPT;
+            goto out;
+        }
+        switch (optname) {
+        case TLS_TX:
+            rv = netsock_set_tls_tx(s, optval, optlen);
+            goto out;
+        default:
+            /* receive offload is not supported: applications fall back to user space decryption */
+            rv = -ENOPROTOOPT;
+            goto out;
+        }
+        break;
     default:
         goto unimplemented;
     }
@@ -2637,7 +3886,10 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             break;
         }
         case SO_REUSEPORT:
-            ret_optval.val = 0;
+            ret_optval.val = s->reuseport;
+            break;
+        case SO_INCOMING_CPU:
+            ret_optval.val = s->incoming_cpu;
             break;
         case SO_PROTOCOL:
             ret_optval.val = s->sock.type == SOCK_STREAM ? IP_PROTO_TCP : IP_PROTO_UDP;
@@ -2645,6 +3897,15 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
         case SO_DOMAIN:
             ret_optval.val = s->sock.domain;
             break;
+        case SO_ZEROCOPY:
+            ret_optval.val = s->zerocopy;
+            break;
+        case SO_BUSY_POLL:
+            ret_optval.val = s->busy_poll;
+            break;
+        case SO_PREFER_BUSY_POLL:
+            ret_optval.val = s->prefer_busy_poll;
+            break;
         default:
             goto unimplemented;
         }
@@ -2689,6 +3950,15 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             runtime_memcpy(ret_optval.str, TCP_CONG_CTRL_ALGO, sizeof(TCP_CONG_CTRL_ALGO));
             ret_optlen = sizeof(ret_optval.str);
             break;
+        case TCP_ULP:
+            zero(ret_optval.str, sizeof(ret_optval.str));
+            if (s->tls_ulp) {
+                runtime_memcpy(ret_optval.str, "tls", sizeof("tls"));
+                ret_optlen = sizeof("tls");
+            } else {
+                ret_optlen = 0;
+            }
+            break;
         case TCP_CORK:
         case TCP_DEFER_ACCEPT:
         case TCP_QUICKACK:
@@ -2723,6 +3993,22 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             goto unimplemented;
         }
         break;
+    case SOL_UDP:
+        if (s->sock.type != SOCK_DGRAM) {
+            rv = -EOPNOTSUPP;
+            goto out;
+        }
+        switch (optname) {
+        case UDP_SEGMENT:
+            ret_optval.val = s->info.udp.gso_size;
+            break;
+        case UDP_GRO:
+            ret_optval.val = s->info.udp.gro;
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
     default:
         rv = -EOPNOTSUPP;
         goto out;
@@ -2786,6 +4072,9 @@ boolean netsyscall_init(unix_heaps uh, tuple cfg)
         so_rcvbuf = MIN(MAX(rcvbuf, 256), MASK(sizeof(so_rcvbuf) * 8 - 1));
     else
         so_rcvbuf = DEFAULT_SO_RCVBUF;
+    u64 busy_poll;
+    if (get_u64(cfg, sym(busy_poll), &busy_poll))
+        busy_poll_default = MIN(busy_poll, BUSY_POLL_MAX);
     kernel_heaps kh = get_kernel_heaps();
     heap h = heap_locked(kh);
     caching_heap socket_cache = allocate_objcache(h, (heap)heap_page_backed(kh),
@@ -2794,6 +4083,12 @@ boolean netsyscall_init(unix_heaps uh, tuple cfg)
 	return false;
     uh->socket_cache = socket_cache;
     net_loop_poll = closure(h, netsock_poll);
+    list_init(&reuseport_groups);
+    spin_lock_init(&reuseport_lock);
+    list_init(&netsock_zc_orphans.l);
+    spin_lock_init(&netsock_zc_orphans.lock);
+    init_timer(&netsock_zc_orphans.t);
+    init_closure_func(&netsock_zc_orphans.check, timer_handler, netsock_zc_orphans_check);
     netlink_init();
     vsock_init();
     return true;
@@ -0,0 +1,168 @@
+/* Packet buffers: fixed-size, DMA-capable buffers shared by network drivers (for received packets)
+ * and by lwIP (for packet allocations). Each CPU keeps a cache of free buffers, so that a buffer
+ * can be allocated and freed without taking any lock; buffers are moved between per-CPU caches and
+ * a shared depot in batches. A buffer received on a CPU and freed on another CPU (e.g. after the
+ * packet has been consumed by the network stack) is recycled in the local cache of the latter. */
+
+#include <kernel.h>
+#include <lwip.h>
+
+//#define PKTBUF_DEBUG
+#ifdef PKTBUF_DEBUG
+#define pktbuf_debug(x, ...) do {tprintf(sym(pktbuf), 0, ss(x "\n"), ##__VA_ARGS__);} while(0)
+#else
+#define pktbuf_debug(x, ...)
+#endif
+
+#define PKTBUF_PAGESIZE     (64 * KB)
+#define PKTBUF_CACHE_SIZE   64
+#define PKTBUF_BATCH        (PKTBUF_CACHE_SIZE / 2)
+
+typedef struct pktbuf_cache {
+    u32 count;
+    void *bufs[PKTBUF_CACHE_SIZE];
+} *pktbuf_cache;
+
+static struct pktbuf_pool {
+    struct caching_heap ch; /* heap interface, for drivers */
+    caching_heap depot;
+    struct spinlock lock;
+    pktbuf_cache caches;
+    u64 ncaches;
+    closure_struct(mem_cleaner, mem_cleaner);
+} pktbufs;
+
+static pktbuf_cache pktbuf_local_cache(void)
+{
+    u64 cpu = current_cpu()->id;
+    return (cpu < pktbufs.ncaches) ? &pktbufs.caches[cpu] : 0;
+}
+
+/* Moves a batch of buffers from the depot into a per-CPU cache. */
+static void pktbuf_refill(pktbuf_cache c)
+{
+    spin_lock(&pktbufs.lock);
+    while (c->count < PKTBUF_BATCH) {
+        void *buf = allocate((heap)pktbufs.depot, PKTBUF_SIZE);
+        if (buf == INVALID_ADDRESS)
+            break;
+        c->bufs[c->count++] = buf;
+    }
+    spin_unlock(&pktbufs.lock);
+}
+
+/* Moves a batch of buffers from a per-CPU cache back to the depot. */
+static void pktbuf_flush(pktbuf_cache c)
+{
+    spin_lock(&pktbufs.lock);
+    while (c->count > PKTBUF_CACHE_SIZE - PKTBUF_BATCH)
+        deallocate((heap)pktbufs.depot, c->bufs[--c->count], PKTBUF_SIZE);
+    spin_unlock(&pktbufs.lock);
+}
+
+void *pktbuf_alloc(void)
+{
+    void *buf;
+    u64 flags = irq_disable_save();
+    pktbuf_cache c = pktbuf_local_cache();
+    if (c) {
+        if (c->count == 0)
+            pktbuf_refill(c);
+        buf = c->count ? c->bufs[--c->count] : INVALID_ADDRESS;
+    } else {
+        spin_lock(&pktbufs.lock);
+        buf = allocate((heap)pktbufs.depot, PKTBUF_SIZE);
+        spin_unlock(&pktbufs.lock);
+    }
+    irq_restore(flags);
+    return buf;
+}
+
+void pktbuf_free(void *buf)
+{
+    u64 flags = irq_disable_save();
+    pktbuf_cache c = pktbuf_local_cache();
+    if (c) {
+        if (c->count == PKTBUF_CACHE_SIZE)
+            pktbuf_flush(c);
+        c->bufs[c->count++] = buf;
+    } else {
+        spin_lock(&pktbufs.lock);
+        deallocate((heap)pktbufs.depot, buf, PKTBUF_SIZE);
+        spin_unlock(&pktbufs.lock);
+    }
+    irq_restore(flags);
+}
+
+/* Memory for packet buffers comes from the linear mapping, so looking up the object cache footer
+ * is safe for any object allocated from a DMA-capable heap. */
+boolean is_pktbuf(void *p)
+{
+    return pktbufs.depot &&
+        (objcache_from_object(u64_from_pointer(p), PKTBUF_PAGESIZE) == (heap)pktbufs.depot);
+}
+
+static u64 pktbuf_heap_alloc(heap h, bytes b)
+{
+    if (b > PKTBUF_SIZE)
+        return INVALID_PHYSICAL;
+    return u64_from_pointer(pktbuf_alloc());
+}
+
+static void pktbuf_heap_dealloc(heap h, u64 a, bytes b)
+{
+    pktbuf_free(pointer_from_u64(a));
+}
+
+static bytes pktbuf_heap_allocated(heap h)
+{
+    return heap_allocated((heap)pktbufs.depot);
+}
+
+static bytes pktbuf_heap_total(heap h)
+{
+    return heap_total((heap)pktbufs.depot);
+}
+
+/* Buffers in per-CPU caches are not drained. */
+static bytes pktbuf_drain(caching_heap ch, bytes len, bytes retain)
+{
+    spin_lock(&pktbufs.lock);
+    bytes drained = cache_drain(pktbufs.depot, len, retain);
+    spin_unlock(&pktbufs.lock);
+    pktbuf_debug("drained %ld bytes", drained);
+    return drained;
+}
+
+caching_heap pktbuf_heap(void)
+{
+    return &pktbufs.ch;
+}
+
+closure_func_basic(mem_cleaner, u64, pktbuf_mem_cleaner,
+                   u64 clean_bytes)
+{
+    return pktbuf_drain(&pktbufs.ch, clean_bytes, NET_RX_BUFFERS_RETAIN * PKTBUF_SIZE);
+}
+
+void init_pktbuf(kernel_heaps kh)
+{
+    heap h = heap_locked(kh);
+    pktbufs.depot = allocate_objcache(h, (heap)heap_linear_backed(kh), PKTBUF_SIZE,
+                                      PKTBUF_PAGESIZE, false);
+    assert(pktbufs.depot != INVALID_ADDRESS);
+    spin_lock_init(&pktbufs.lock);
+    pktbufs.ncaches = present_processors;
+    pktbufs.caches = allocate_zero(h, pktbufs.ncaches * sizeof(struct pktbuf_cache));
+    assert(pktbufs.caches != INVALID_ADDRESS);
+    heap ph = &pktbufs.ch.h;
+    zero(ph, sizeof(*ph));
+    ph->alloc = pktbuf_heap_alloc;
+    ph->dealloc = pktbuf_heap_dealloc;
+    ph->allocated = pktbuf_heap_allocated;
+    ph->total = pktbuf_heap_total;
+    ph->pagesize = PKTBUF_SIZE;
+    pktbufs.ch.drain = pktbuf_drain;
+    mm_register_mem_cleaner(init_closure_func(&pktbufs.mem_cleaner, mem_cleaner,
+                                              pktbuf_mem_cleaner));
+}
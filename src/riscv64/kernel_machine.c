@@ -43,6 +43,10 @@ void cpu_init(int cpu)
     asm volatile("csrw sstatus, %0" :: "r"(a));
     asm volatile("csrw stvec, %0" :: "r"(&trap_handler));
     asm volatile("csrw sie, %0" :: "r"(SI_SEIP | SI_STIP | SI_SSIP));
+
+    /* no topology information: each hart is a separate core, sharing a cache with all others */
+    ci->topology.core_id = cpu;
+    ci->topology.llc_id = ci->topology.package_id = 0;
 }
 
 void init_cpuinfo_machine(cpuinfo ci, heap backed)
@@ -1,4 +1,9 @@
-/* Heap that implements a buddy memory allocator. */
+/* Heap that implements a buddy memory allocator.
+ * Each physical memory range belongs to a NUMA node; allocations are served from the node returned
+ * by the node preference callback (if any), falling back to the other allowed nodes in order of
+ * increasing distance.
+ * Once per-CPU lists are enabled, single pages and pages of the maximum order are cached in front
+ * of the buddy allocator on each CPU, and are moved to and from the buddy allocator in batches. */
 
 #include <runtime.h>
 
@@ -8,6 +13,16 @@
 
 #define PAGE_INDEX_INVALID  0xffff
 
+#define PAGEHEAP_MAX_NODES  64
+
+/* Per-CPU lists: index 0 caches single pages, index 1 caches pages of the maximum order. Pages in
+ * per-CPU lists are accounted as allocated. */
+#define PAGEHEAP_PCP_LISTS  2
+#define PAGEHEAP_PCP_MAX    128
+
+static const u32 pageheap_pcp_high[PAGEHEAP_PCP_LISTS] = {PAGEHEAP_PCP_MAX, 2};
+static const u32 pageheap_pcp_batch[PAGEHEAP_PCP_LISTS] = {32, 1};
+
 //#define PAGEHEAP_DEBUG
 #if defined(PAGEHEAP_DEBUG)
 #define pageheap_debug(x, ...)  rprintf("pageheap: " x "\n", ##__VA_ARGS__)
@@ -18,6 +33,7 @@
 typedef struct pageheap_range {
     struct rmnode n;
     u64 inited;
+    u32 node;
 } *pageheap_range;
 build_assert(offsetof(pageheap_range, n) == 0);
 
@@ -29,10 +45,20 @@ typedef struct pageheap_area {
     struct list l;
     u64 buddies[PAGEHEAP_AREA_MAX_PAGES / 64];  /* 1 bit per pair of buddies per page order */
     u32 page_count;
+    u16 node;
     u16 first[PAGEHEAP_MAX_ORDER + 1];  /* first elements in free page lists */
     struct page_list_elem free_pages[0];
 } *pageheap_area;
 
+typedef struct pageheap_pcp {
+    struct spinlock lock;   /* only contended when lists are drained from a remote CPU */
+    u32 node;
+    struct {
+        u32 count;
+        u64 pages[PAGEHEAP_PCP_MAX];
+    } lists[PAGEHEAP_PCP_LISTS];
+} *pageheap_pcp;
+
 static struct page_heap {
     struct heap h;
     heap meta;
@@ -41,9 +67,15 @@ static struct page_heap {
     u64 allocated;
     void *virt_base;
     int max_order;
-    /* A page area is inserted in the list corresponding to the order of the largest free page
-     * present in the area. */
-    struct list areas[PAGEHEAP_MAX_ORDER + 1];
+    /* A page area is inserted in the list (of the node it belongs to) corresponding to the order of
+     * the largest free page present in the area. */
+    struct list areas[PAGEHEAP_MAX_NODES][PAGEHEAP_MAX_ORDER + 1];
+    u32 node_count;
+    u8 fallback[PAGEHEAP_MAX_NODES][PAGEHEAP_MAX_NODES];  /* node lookup order for each node */
+    pageheap_node_pref node_pref;
+    pageheap_pcp pcp;
+    u32 pcp_count;
+    pageheap_cpu_id cpu_id;
     struct spinlock lock;
 } page_heap;
 build_assert(offsetof(struct page_heap *, h) == 0);
@@ -101,11 +133,14 @@ static boolean page_buddy_toggle(u64 *buddies, u16 index, int order)
     return is_set;
 }
 
-static pageheap_area pageheap_area_new(void)
+static pageheap_area pageheap_area_new(u32 node)
 {
     u64 start, end;
     pageheap_range r = (pageheap_range)rangemap_first_node(&page_heap.ranges);
-    while (r != INVALID_ADDRESS) {
+    for (; r != INVALID_ADDRESS;
+         r = (pageheap_range)rangemap_next_node(&page_heap.ranges, &r->n)) {
+        if (r->node != node)
+            continue;
         pageheap_debug("looking for new area in range %R (0x%lx)", r->n.r, r->inited);
         start = r->inited;
         end = r->n.r.end;
@@ -125,7 +160,6 @@ static pageheap_area pageheap_area_new(void)
                 break;
             }
         }
-        r = (pageheap_range)rangemap_next_node(&page_heap.ranges, &r->n);
     }
     if (r == INVALID_ADDRESS)
         return 0;
@@ -164,6 +198,7 @@ static pageheap_area pageheap_area_new(void)
     pageheap_area area = page_heap.virt_base + start * PAGESIZE;
     pageheap_debug("new area at %p, pages [0x%x, 0x%x)", area, page_offset, page_count);
     area->page_count = page_count;
+    area->node = node;
     zero(area->buddies, sizeof(area->buddies));
     for (int o = 0; o <= page_heap.max_order; o++)
         area->first[o] = PAGE_INDEX_INVALID;
@@ -211,7 +246,7 @@ static pageheap_area pageheap_area_new(void)
         page_buddy_set(area->buddies, page_count, order);
     for (order = page_heap.max_order; order >= 0; order--) {
         if (area->first[order] != PAGE_INDEX_INVALID) {
-            list_push(&page_heap.areas[order], &area->l);
+            list_push(&page_heap.areas[node][order], &area->l);
             break;
         }
     }
@@ -305,11 +340,8 @@ static int pageheap_dealloc_locked(pageheap_area area, u32 index, u16 page_count
     return updated_order;
 }
 
-static void pageheap_dealloc(heap h, u64 p, bytes size)
+static void pageheap_dealloc_area_locked(pageheap_area area, u64 p, bytes size)
 {
-    pageheap_area area = pageheap_area_from_page(p);
-    pageheap_debug("dealloc 0x%lx, size 0x%lx, area %p", p, size, area);
-    spin_lock(&page_heap.lock);
     int updated_order = pageheap_dealloc_locked(area, pageheap_index(area, p), size / PAGESIZE);
     if (updated_order >= 0) {
         int max_free_order = 0;
@@ -325,29 +357,90 @@ static void pageheap_dealloc(heap h, u64 p, bytes size)
             list l = &area->l;
             if (list_inserted(l))
                 list_delete(l);
-            list_push(&page_heap.areas[max_free_order], l);
+            list_push(&page_heap.areas[area->node][max_free_order], l);
         }
     }
     page_heap.allocated -= size;
+}
+
+/* Returns the per-CPU list index for an allocation size, or -1 if allocations of that size are
+ * not cached. */
+static int pageheap_pcp_list(bytes size)
+{
+    if (size == PAGESIZE)
+        return 0;
+    if (size == U64_FROM_BIT(page_heap.max_order + PAGELOG))
+        return 1;
+    return -1;
+}
+
+static pageheap_pcp pageheap_local_pcp(void)
+{
+    if (!page_heap.cpu_id)
+        return 0;
+    u32 cpu = page_heap.cpu_id();
+    return (cpu < page_heap.pcp_count) ? &page_heap.pcp[cpu] : 0;
+}
+
+/* Moves pages from the tail of a per-CPU list back to the buddy allocator; called with the
+ * per-CPU lock held. */
+static void pageheap_pcp_drain_list(pageheap_pcp pcp, int list, u32 count)
+{
+    bytes size = U64_FROM_BIT(list ? page_heap.max_order + PAGELOG : PAGELOG);
+    u32 *list_count = &pcp->lists[list].count;
+    spin_lock(&page_heap.lock);
+    while (count-- > 0) {
+        u64 p = pcp->lists[list].pages[--(*list_count)];
+        pageheap_dealloc_area_locked(pageheap_area_from_page(p), p, size);
+    }
     spin_unlock(&page_heap.lock);
 }
 
-static u64 pageheap_alloc(heap h, bytes size)
+static boolean pageheap_pcp_free(pageheap_pcp pcp, int list, u64 p)
 {
-    int page_order = find_order(size) - PAGELOG;
-    pageheap_debug("alloc size 0x%lx, page order %d", size, page_order);
-    if (page_order > page_heap.max_order)
-        return INVALID_PHYSICAL;
+    spin_lock(&pcp->lock);
+
+    /* Pages from remote nodes are returned to the buddy allocator, so that they are not handed out
+     * again to local allocations. */
+    if ((page_heap.node_count > 1) && (pageheap_area_from_page(p)->node != pcp->node)) {
+        spin_unlock(&pcp->lock);
+        return false;
+    }
+    u32 count = pcp->lists[list].count;
+    if (count >= pageheap_pcp_high[list])
+        pageheap_pcp_drain_list(pcp, list, pageheap_pcp_batch[list]);
+    pcp->lists[list].pages[pcp->lists[list].count++] = p;
+    spin_unlock(&pcp->lock);
+    return true;
+}
+
+static void pageheap_dealloc(heap h, u64 p, bytes size)
+{
+    int list = pageheap_pcp_list(size);
+    if (list >= 0) {
+        pageheap_pcp pcp = pageheap_local_pcp();
+        if (pcp && pageheap_pcp_free(pcp, list, p))
+            return;
+    }
+    pageheap_area area = pageheap_area_from_page(p);
+    pageheap_debug("dealloc 0x%lx, size 0x%lx, area %p", p, size, area);
+    spin_lock(&page_heap.lock);
+    pageheap_dealloc_area_locked(area, p, size);
+    spin_unlock(&page_heap.lock);
+}
+
+static u64 pageheap_alloc_locked(bytes size, int page_order, u32 node)
+{
+    struct list *areas = page_heap.areas[node];
     int list_order;
     list l;
-    spin_lock(&page_heap.lock);
     for (list_order = page_order; list_order <= page_heap.max_order; list_order++) {
-        l = list_get_next(page_heap.areas + list_order);
+        l = list_get_next(areas + list_order);
         if (l)
             break;
     }
     while (!l) {
-        pageheap_area new_area = pageheap_area_new();
+        pageheap_area new_area = pageheap_area_new(node);
         if (!new_area)
             break;
         for (list_order = page_heap.max_order; list_order >= page_order; list_order--) {
@@ -389,7 +482,7 @@ static u64 pageheap_alloc(heap h, bytes size)
         if (list_deleted) {
             for (free_order = list_order - 1; free_order >= 0; free_order--) {
                 if (area->first[free_order] != PAGE_INDEX_INVALID) {
-                    list_push_back(&page_heap.areas[free_order], l);
+                    list_push_back(&areas[free_order], l);
                     break;
                 }
             }
@@ -398,7 +491,75 @@ static u64 pageheap_alloc(heap h, bytes size)
     } else {
         p = INVALID_PHYSICAL;
     }
+    return p;
+}
+
+static u64 pageheap_alloc_nodes(bytes size, int page_order, u32 node, u64 allowed)
+{
+    u64 p = INVALID_PHYSICAL;
+    for (u32 i = 0; (p == INVALID_PHYSICAL) && (i < page_heap.node_count); i++) {
+        u32 n = page_heap.fallback[node][i];
+        if (allowed & U64_FROM_BIT(n))
+            p = pageheap_alloc_locked(size, page_order, n);
+    }
+    return p;
+}
+
+static u64 pageheap_pcp_alloc(pageheap_pcp pcp, int list, bytes size, int page_order)
+{
+    u64 p;
+    spin_lock(&pcp->lock);
+    u32 count = pcp->lists[list].count;
+    if (count == 0) {
+        spin_lock(&page_heap.lock);
+        for (; count < pageheap_pcp_batch[list]; count++) {
+            p = pageheap_alloc_nodes(size, page_order, pcp->node, U64_FROM_BIT(pcp->node));
+            if (p == INVALID_PHYSICAL)
+                break;
+            pcp->lists[list].pages[count] = p;
+        }
+        spin_unlock(&page_heap.lock);
+        pageheap_debug("pcp refill: %d pages, list %d", count, list);
+    }
+    p = (count > 0) ? pcp->lists[list].pages[--count] : INVALID_PHYSICAL;
+    pcp->lists[list].count = count;
+    spin_unlock(&pcp->lock);
+    return p;
+}
+
+static u64 pageheap_alloc(heap h, bytes size)
+{
+    int page_order = find_order(size) - PAGELOG;
+    pageheap_debug("alloc size 0x%lx, page order %d", size, page_order);
+    if (page_order > page_heap.max_order)
+        return INVALID_PHYSICAL;
+    u64 allowed = -1ull;
+    u32 node = page_heap.node_pref ? page_heap.node_pref(&allowed) : 0;
+    if (node >= page_heap.node_count)
+        node = 0;
+    u64 p;
+
+    /* The per-CPU lists cache pages from the node of their CPU, and are refilled only from that
+     * node: allocations restricted by a memory policy or preferring a different node bypass them,
+     * and when the local node is out of memory, pages are allocated from the fallback nodes. */
+    int list = pageheap_pcp_list(size);
+    if ((list >= 0) && (allowed == -1ull)) {
+        pageheap_pcp pcp = pageheap_local_pcp();
+        if (pcp && (pcp->node == node)) {
+            p = pageheap_pcp_alloc(pcp, list, size, page_order);
+            if (p != INVALID_PHYSICAL)
+                return p;
+        }
+    }
+    spin_lock(&page_heap.lock);
+    p = pageheap_alloc_nodes(size, page_order, node, allowed);
     spin_unlock(&page_heap.lock);
+    /* free memory may be cached in the per-CPU lists */
+    if ((p == INVALID_PHYSICAL) && (pageheap_drain_percpu() > 0)) {
+        spin_lock(&page_heap.lock);
+        p = pageheap_alloc_nodes(size, page_order, node, allowed);
+        spin_unlock(&page_heap.lock);
+    }
     return p;
 }
 
@@ -421,6 +582,17 @@ heap pageheap_init(heap meta)
     page_heap.h.pagesize = PAGESIZE;
     page_heap.meta = meta;
     init_rangemap(&page_heap.ranges, 0);
+    page_heap.node_count = 1;
+    page_heap.node_pref = 0;
+    page_heap.cpu_id = 0;
+    page_heap.pcp_count = 0;
+    for (u32 node = 0; node < PAGEHEAP_MAX_NODES; node++) {
+        page_heap.fallback[node][0] = node;
+        for (u32 i = 0; i < node; i++)
+            page_heap.fallback[node][i + 1] = i;
+        for (u32 i = node + 1; i < PAGEHEAP_MAX_NODES; i++)
+            page_heap.fallback[node][i] = i;
+    }
     return &page_heap.h;
 }
 
@@ -436,16 +608,145 @@ boolean pageheap_add_range(u64 base, u64 length)
         return false;
     }
     r->inited = page_start;
+    r->node = 0;
     page_heap.total += length;
     return true;
 }
 
+/* Splits a range at a given page (which must not be below the initialized part of the range), and
+ * returns the range starting at that page. */
+static pageheap_range pageheap_split_range(pageheap_range r, u64 page)
+{
+    if (page == r->n.r.start)
+        return r;
+    pageheap_range split = allocate(page_heap.meta, sizeof(*split));
+    if (split == INVALID_ADDRESS)
+        return split;
+    u64 end = r->n.r.end;
+    assert(rangemap_reinsert(&page_heap.ranges, &r->n, irange(r->n.r.start, page)));
+    rmnode_init(&split->n, irange(page, end));
+    split->inited = page;
+    split->node = r->node;
+    assert(rangemap_insert(&page_heap.ranges, &split->n));
+    return split;
+}
+
+/* Assigns the physical memory in [base, base + length) to a NUMA node. Memory that has already
+ * been carved into page areas stays in its current node. */
+boolean pageheap_set_node(u64 base, u64 length, u32 node)
+{
+    if (node >= PAGEHEAP_MAX_NODES)
+        return false;
+    range q = irangel(base >> PAGELOG, length >> PAGELOG);
+    boolean success = true;
+    spin_lock(&page_heap.lock);
+    pageheap_range r = (pageheap_range)rangemap_first_node(&page_heap.ranges);
+    while (r != INVALID_ADDRESS) {
+        pageheap_range next = (pageheap_range)rangemap_next_node(&page_heap.ranges, &r->n);
+        u64 start = MAX(q.start, r->inited);
+        u64 end = MIN(q.end, r->n.r.end);
+        if ((start < end) && (r->node != node)) {
+            r = pageheap_split_range(r, start);
+            if ((r == INVALID_ADDRESS) ||
+                ((end < r->n.r.end) && (pageheap_split_range(r, end) == INVALID_ADDRESS))) {
+                success = false;
+                break;
+            }
+            r->node = node;
+        }
+        r = next;
+    }
+    if (node >= page_heap.node_count)
+        page_heap.node_count = node + 1;
+    spin_unlock(&page_heap.lock);
+    return success;
+}
+
+/* Sets the order in which nodes are looked up when memory is allocated with a given preferred
+ * node; the first element of the `order` array must be the preferred node itself. */
+void pageheap_set_node_fallback(u32 node, const u8 *order, u32 count)
+{
+    assert(node < PAGEHEAP_MAX_NODES);
+    assert(count <= PAGEHEAP_MAX_NODES);
+    spin_lock(&page_heap.lock);
+    runtime_memcpy(page_heap.fallback[node], order, count);
+    spin_unlock(&page_heap.lock);
+}
+
+void pageheap_set_node_pref(pageheap_node_pref pref)
+{
+    page_heap.node_pref = pref;
+}
+
+u32 pageheap_node_count(void)
+{
+    return page_heap.node_count;
+}
+
+u32 pageheap_page_node(u64 p)
+{
+    rmnode n = rangemap_lookup(&page_heap.ranges, p >> PAGELOG);
+    return (n != INVALID_ADDRESS) ? ((pageheap_range)n)->node : 0;
+}
+
+/* Enables per-CPU page lists; cpu_id returns the index (lower than cpu_count) of the current CPU. */
+boolean pageheap_init_percpu(u32 cpu_count, pageheap_cpu_id cpu_id)
+{
+    pageheap_pcp pcp = allocate_zero(page_heap.meta, cpu_count * sizeof(*pcp));
+    if (pcp == INVALID_ADDRESS)
+        return false;
+    for (u32 cpu = 0; cpu < cpu_count; cpu++)
+        spin_lock_init(&pcp[cpu].lock);
+    page_heap.pcp = pcp;
+    page_heap.pcp_count = cpu_count;
+    write_barrier();
+    page_heap.cpu_id = cpu_id;
+    return true;
+}
+
+/* Sets the NUMA node of a CPU: the per-CPU lists of the CPU only cache pages from this node. */
+void pageheap_set_cpu_node(u32 cpu, u32 node)
+{
+    assert(cpu < page_heap.pcp_count);
+    pageheap_pcp pcp = &page_heap.pcp[cpu];
+    spin_lock(&pcp->lock);
+    if (pcp->node != node) {
+        for (int list = 0; list < PAGEHEAP_PCP_LISTS; list++)
+            if (pcp->lists[list].count)
+                pageheap_pcp_drain_list(pcp, list, pcp->lists[list].count);
+        pcp->node = node;
+    }
+    spin_unlock(&pcp->lock);
+}
+
+/* Returns all pages cached in per-CPU lists to the buddy allocator; returns the number of bytes
+ * released. */
+bytes pageheap_drain_percpu(void)
+{
+    bytes drained = 0;
+    for (u32 cpu = 0; cpu < page_heap.pcp_count; cpu++) {
+        pageheap_pcp pcp = &page_heap.pcp[cpu];
+        spin_lock(&pcp->lock);
+        for (int list = 0; list < PAGEHEAP_PCP_LISTS; list++) {
+            u32 count = pcp->lists[list].count;
+            if (count) {
+                pageheap_pcp_drain_list(pcp, list, count);
+                drained += count * U64_FROM_BIT(list ? page_heap.max_order + PAGELOG : PAGELOG);
+            }
+        }
+        spin_unlock(&pcp->lock);
+    }
+    pageheap_debug("pcp drained 0x%lx bytes", drained);
+    return drained;
+}
+
 void pageheap_init_done(void *virt_base, u64 max_page_size)
 {
     page_heap.virt_base = virt_base;
     page_heap.max_order = find_order(max_page_size) - PAGELOG;
-    for (int i = 0; i <= page_heap.max_order; i++)
-        list_init(&page_heap.areas[i]);
+    for (u32 node = 0; node < PAGEHEAP_MAX_NODES; node++)
+        for (int i = 0; i <= page_heap.max_order; i++)
+            list_init(&page_heap.areas[node][i]);
     spin_lock_init(&page_heap.lock);
 }
 
@@ -1,10 +1,24 @@
 #ifndef _PAGE_HEAP_H_
 #define _PAGE_HEAP_H_
 
+/* Returns the preferred NUMA node for an allocation, and updates the mask of allowed nodes. */
+typedef u32 (*pageheap_node_pref)(u64 *allowed);
+
+/* Returns the index of the current CPU. */
+typedef u32 (*pageheap_cpu_id)(void);
+
 heap pageheap_init(heap meta);
 boolean pageheap_add_range(u64 base, u64 length);
 void pageheap_init_done(void *virt_base, u64 max_page_size);
 bytes pageheap_max_pagesize(void);
 void pageheap_range_foreach(range_handler rh);
+boolean pageheap_set_node(u64 base, u64 length, u32 node);
+void pageheap_set_node_fallback(u32 node, const u8 *order, u32 count);
+void pageheap_set_node_pref(pageheap_node_pref pref);
+u32 pageheap_node_count(void);
+u32 pageheap_page_node(u64 p);
+boolean pageheap_init_percpu(u32 cpu_count, pageheap_cpu_id cpu_id);
+void pageheap_set_cpu_node(u32 cpu, u32 node);
+bytes pageheap_drain_percpu(void);
 
 #endif
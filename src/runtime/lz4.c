@@ -0,0 +1,176 @@
+#include <runtime.h>
+#include <lz4.h>
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5   /* the last bytes of a block are always literals */
+#define LZ4_MF_LIMIT        12  /* a match cannot start in the last bytes of a block */
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_RUN_MASK        15
+#define LZ4_SKIP_TRIGGER    6   /* log2 of the literal bytes after which the search speeds up */
+
+/* unaligned accesses */
+struct lz4_u32 {
+    u32 v;
+} __attribute__((packed));
+
+struct lz4_u64 {
+    u64 v;
+} __attribute__((packed));
+
+static inline u32 lz4_read32(const u8 *p)
+{
+    return ((struct lz4_u32 *)p)->v;
+}
+
+/* Copies len bytes in 8-byte words: the caller must ensure that up to 7 bytes past the end of dest
+ * can be overwritten, and that src is at least 8 bytes before dest if the two overlap. */
+static inline void lz4_wildcopy(u8 *dest, const u8 *src, u64 len)
+{
+    u8 *end = dest + len;
+    do {
+        ((struct lz4_u64 *)dest)->v = ((struct lz4_u64 *)src)->v;
+        dest += 8;
+        src += 8;
+    } while (dest < end);
+}
+
+static inline u32 lz4_hash(u32 v)
+{
+    return (v * 2654435761u) >> (32 - LZ4_HASH_ORDER);
+}
+
+static u8 *lz4_write_length(u8 *op, u64 len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/* worst case space needed for a sequence, excluding the match length bytes */
+static inline u64 lz4_sequence_bound(u64 literals)
+{
+    return 1 + literals / 255 + 1 + literals + 2;
+}
+
+u64 lz4_compress(const void *src, u64 src_len, void *dest, u64 dest_len, void *workmem)
+{
+    const u8 *base = src;
+    const u8 *ip = base, *anchor = base, *end = base + src_len;
+    u8 *op = dest, *oend = op + dest_len;
+    u32 *table = workmem;
+    zero(table, LZ4_WORKMEM_SIZE);
+    if (src_len > LZ4_MF_LIMIT) {
+        const u8 *mflimit = end - LZ4_MF_LIMIT;
+        const u8 *matchlimit = end - LZ4_LAST_LITERALS;
+        ip++;
+        while (ip <= mflimit) {
+            u32 seq = lz4_read32(ip);
+            u32 *entry = &table[lz4_hash(seq)];
+            const u8 *ref = base + *entry;
+            *entry = ip - base;
+            if ((ref >= ip) || (ip - ref > LZ4_MAX_OFFSET) || (lz4_read32(ref) != seq)) {
+                /* incompressible data is skipped faster and faster */
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+
+            /* extend the match backwards over the pending literals, then forwards */
+            while ((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])) {
+                ip--;
+                ref--;
+            }
+            const u8 *p = ip + LZ4_MIN_MATCH, *m = ref + LZ4_MIN_MATCH;
+            while ((p < matchlimit) && (*p == *m)) {
+                p++;
+                m++;
+            }
+            u64 literals = ip - anchor;
+            u64 match_len = p - ip - LZ4_MIN_MATCH;
+            if (oend - op < lz4_sequence_bound(literals) + match_len / 255 + 1)
+                return 0;
+            u8 *token = op++;
+            *token = (MIN(literals, LZ4_RUN_MASK) << 4) | MIN(match_len, LZ4_RUN_MASK);
+            if (literals >= LZ4_RUN_MASK)
+                op = lz4_write_length(op, literals - LZ4_RUN_MASK);
+            runtime_memcpy(op, anchor, literals);
+            op += literals;
+            u64 offset = ip - ref;
+            *op++ = offset;
+            *op++ = offset >> 8;
+            if (match_len >= LZ4_RUN_MASK)
+                op = lz4_write_length(op, match_len - LZ4_RUN_MASK);
+            anchor = ip = p;
+        }
+    }
+
+    /* last literals */
+    u64 literals = end - anchor;
+    if (oend - op < 1 + literals / 255 + 1 + literals)
+        return 0;
+    *op++ = MIN(literals, LZ4_RUN_MASK) << 4;
+    if (literals >= LZ4_RUN_MASK)
+        op = lz4_write_length(op, literals - LZ4_RUN_MASK);
+    runtime_memcpy(op, anchor, literals);
+    op += literals;
+    return op - (u8 *)dest;
+}
+
+static boolean lz4_read_length(const u8 **ip, const u8 *iend, u64 *len)
+{
+    u8 b;
+    do {
+        if (*ip >= iend)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+s64 lz4_decompress(const void *src, u64 src_len, void *dest, u64 dest_len)
+{
+    const u8 *ip = src, *iend = ip + src_len;
+    u8 *op = dest, *oend = op + dest_len;
+    while (ip < iend) {
+        u8 token = *ip++;
+        u64 len = token >> 4;
+        if ((len == LZ4_RUN_MASK) && !lz4_read_length(&ip, iend, &len))
+            return -1;
+        if ((len > iend - ip) || (len > oend - op))
+            return -1;
+        if ((iend - ip >= len + 8) && (oend - op >= len + 8))
+            lz4_wildcopy(op, ip, len);
+        else
+            runtime_memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend)     /* the last sequence has no match */
+            break;
+        if (iend - ip < 2)
+            return -1;
+        u64 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > op - (u8 *)dest))
+            return -1;
+        len = token & LZ4_RUN_MASK;
+        if ((len == LZ4_RUN_MASK) && !lz4_read_length(&ip, iend, &len))
+            return -1;
+        len += LZ4_MIN_MATCH;
+        if (len > oend - op)
+            return -1;
+        const u8 *m = op - offset;
+        if ((offset >= 8) && (oend - op >= len + 8)) {
+            lz4_wildcopy(op, m, len);
+            op += len;
+        } else if (offset >= len) {
+            runtime_memcpy(op, m, len);
+            op += len;
+        } else {
+            /* overlapping copy, which repeats the last offset bytes */
+            for (u64 i = 0; i < len; i++)
+                *op++ = *m++;
+        }
+    }
+    return op - (u8 *)dest;
+}
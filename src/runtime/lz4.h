@@ -0,0 +1,24 @@
+/* LZ4 block format: a compressed block is a sequence of literal runs, each followed by a copy of
+ * data found at most 64 KB back in the uncompressed output (see
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md). Decompression only involves byte
+ * copies, so it is fast enough to be done when data is read from storage. */
+
+#define LZ4_HASH_ORDER  12
+
+/* Size of the working memory needed by the compressor. */
+#define LZ4_WORKMEM_SIZE    (U64_FROM_BIT(LZ4_HASH_ORDER) * sizeof(u32))
+
+/* Maximum length of the compressed data for an input of len bytes (incompressible data expands
+ * slightly). */
+static inline u64 lz4_compress_bound(u64 len)
+{
+    return len + len / 255 + 16;
+}
+
+/* Returns the length of the compressed data, or 0 if it does not fit in dest_len bytes. The input
+ * length must be less than 4 GB; workmem must point to LZ4_WORKMEM_SIZE bytes. */
+u64 lz4_compress(const void *src, u64 src_len, void *dest, u64 dest_len, void *workmem);
+
+/* Returns the length of the decompressed data, or -1 if the compressed data is malformed or
+ * decompresses to more than dest_len bytes. */
+s64 lz4_decompress(const void *src, u64 src_len, void *dest, u64 dest_len);
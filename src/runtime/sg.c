@@ -115,7 +115,8 @@ u64 sg_move(sg_list dest, sg_list src, u64 n)
         dsgb->buf = ssgb->buf;
         dsgb->size = ssgb->offset + len;
         dsgb->offset = ssgb->offset;
-        refcount_reserve(ssgb->refcount);
+        if (ssgb->refcount)
+            refcount_reserve(ssgb->refcount);
         dsgb->refcount = ssgb->refcount;
         ssgb->offset += len;
         remain -= len;
@@ -77,6 +77,8 @@ enum storage_op {
     STORAGE_OP_READSG,
     STORAGE_OP_WRITESG,
     STORAGE_OP_FLUSH,
+    STORAGE_OP_ZERO,    /* write zeros to the blocks */
+    STORAGE_OP_DISCARD, /* the blocks no longer hold valid data */
 };
 
 typedef struct storage_req {
@@ -86,6 +88,20 @@ typedef struct storage_req {
     status_handler completion;
 } *storage_req;
 
+/* Completes a request for an operation that a storage device does not support (callers are
+ * expected to fall back to a different operation, if needed). */
+static inline void storage_op_unsupported(storage_req req)
+{
+    status s = timm("result", "unsupported storage operation %d", req->op);
+    apply(req->completion, timm_append(s, "unsupported", "%d", req->op));
+}
+
+/* Returns true if a request failed because the storage device does not support its operation. */
+static inline boolean storage_status_unsupported(status s)
+{
+    return (get(s, sym(unsupported)) != 0);
+}
+
 declare_closure_struct(2, 1, void, storage_simple_req_handler,
                        block_io, read, block_io, write,
                        storage_req req);
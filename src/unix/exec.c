@@ -539,9 +539,8 @@ closure_function(4, 2, void, exec_elf_read,
     exec_elf_finish(b, f, kp, load_range, interp_path, ingest_symbols, complete);
 }
 
-void exec_elf(process kp, string program_path, status_handler complete)
+static void exec_program(process kp, string program_path, status_handler complete)
 {
-    exec_debug("%s: path \"%b\", complete %p (%F)\n", func_ss, program_path, complete, complete);
     kernel_heaps kh = get_kernel_heaps();
     heap general = heap_locked(kh);
     tuple root = kp->process_root;
@@ -567,3 +566,37 @@ void exec_elf(process kp, string program_path, status_handler complete)
     io_status_handler sh = closure(general, exec_elf_read, f, b, kp, complete);
     filesystem_read_linear(f, buffer_ref(b, 0), irange(0, length), sh);
 }
+
+closure_function(3, 1, void, exec_snapshot_complete,
+                 process, kp, string, program_path, status_handler, complete,
+                 status s)
+{
+    if (is_ok(s)) {
+        apply(bound(complete), s);
+    } else {
+        msg_warn("failed to restore process snapshot (%v); starting program", s);
+        timm_dealloc(s);
+        exec_program(bound(kp), bound(program_path), bound(complete));
+    }
+    closure_finish();
+}
+
+void exec_elf(process kp, string program_path, status_handler complete)
+{
+    exec_debug("%s: path \"%b\", complete %p (%F)\n", func_ss, program_path, complete, complete);
+    string snapshot_path = get_string(kp->process_root, sym(snapshot));
+    if (snapshot_path) {
+        fsfile f = fsfile_open(buffer_to_sstring(snapshot_path));
+        if (f) {
+            status_handler sh = closure(heap_locked(get_kernel_heaps()), exec_snapshot_complete,
+                                        kp, program_path, complete);
+            if (sh != INVALID_ADDRESS) {
+                exec_debug("restoring snapshot %b\n", snapshot_path);
+                snapshot_restore(kp, f, sh);
+                return;
+            }
+            fsfile_release(f);
+        }
+    }
+    exec_program(kp, program_path, complete);
+}
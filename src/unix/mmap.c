@@ -1,4 +1,5 @@
 #include <unix_internal.h>
+#include <filesystem.h>
 #include <storage.h>
 
 //#define VMAP_PARANOIA
@@ -62,15 +63,19 @@ closure_func_basic(thunk, void, pending_fault_complete)
         s = STATUS_OK;
     pagecache_node pn;
     range ra;   /* read-ahead */
+    u64 ra_size;
     if (pf->type == PENDING_FAULT_FILEBACKED) {
         pn = pf->filebacked.pn;
-        if (is_ok(s))
+        if (is_ok(s) && (vm != INVALID_ADDRESS) && !(vm->flags & VMAP_FLAG_RAND_READ)) {
             /* File read-ahead must be done without holding the vmap lock, because it can suspend
              * the current context. */
             ra = irange(pf->filebacked.node_offset + PAGESIZE,
                         vm->node_offset + range_span(vm->node.r));
-        else
+            ra_size = (vm->flags & VMAP_FLAG_SEQ_READ) ? 2 * FILE_READAHEAD_DEFAULT :
+                      FILE_READAHEAD_DEFAULT;
+        } else {
             ra = irange(1, 0);  /* dummy invalid range */
+        }
     } else {
         pn = 0;
     }
@@ -84,8 +89,8 @@ closure_func_basic(thunk, void, pending_fault_complete)
     context_schedule_return(ctx);
     if (pn) {
         if (range_valid(ra)) {
-            if (range_span(ra) > FILE_READAHEAD_DEFAULT)
-                ra.end = ra.start + FILE_READAHEAD_DEFAULT;
+            if (range_span(ra) > ra_size)
+                ra.end = ra.start + ra_size;
             pagecache_node_fetch_pages(pn, ra, 0, 0);
         }
         pagecache_node_unref(pn);
@@ -160,6 +165,49 @@ closure_function(3, 3, boolean, vmap_anon_ptes,
     return false;
 }
 
+/* Returns the n-th (modulo the number of nodes) node in a node mask. */
+static u32 mempolicy_interleave_node(u64 nodes, u64 n)
+{
+    n %= __builtin_popcountll(nodes);
+    while (n--)
+        nodes &= nodes - 1;
+    return lsb(nodes);
+}
+
+/* Applies the memory policy of a vmap (or, if the vmap does not have a policy, the policy of the
+ * current thread) to the physical memory allocations done on the current CPU; returns true if the
+ * default policy (i.e. allocate from the local node) has been overridden. */
+static boolean mempolicy_apply(vmap vm, u64 vaddr)
+{
+    mempolicy mpol = &vm->mpol;
+    u64 il_index;
+    if (mpol->mode == MPOL_DEFAULT) {
+        thread t = current;
+        if (!t || (t->mpol.mode == MPOL_DEFAULT))
+            return false;
+        mpol = &t->mpol;
+        il_index = t->il_next++;
+    } else {
+        il_index = (vaddr - vm->node.r.start) >> PAGELOG;
+    }
+    u32 local = current_cpu()->numa_node;
+    switch (mpol->mode) {
+    case MPOL_PREFERRED:
+        numa_set_mem_policy(mpol->nodes ? lsb(mpol->nodes) : local, -1ull);
+        break;
+    case MPOL_BIND:
+        numa_set_mem_policy((mpol->nodes & U64_FROM_BIT(local)) ? local : lsb(mpol->nodes),
+                            mpol->nodes);
+        break;
+    case MPOL_INTERLEAVE:
+        numa_set_mem_policy(mempolicy_interleave_node(mpol->nodes, il_index), -1ull);
+        break;
+    default:    /* MPOL_LOCAL */
+        numa_set_mem_policy(local, -1ull);
+    }
+    return true;
+}
+
 /* returns true if successful */
 boolean new_zeroed_pages(u64 v, vmap vm, pageflags flags)
 {
@@ -186,13 +234,18 @@ boolean new_zeroed_pages(u64 v, vmap vm, pageflags flags)
         /* The mapping must have been done in parallel by another CPU. */
         return true;
     void *m;
+    boolean mpol = mempolicy_apply(vm, page_addr);
     while ((m = allocate(mmap_info.virtual_backed, page_size)) == INVALID_ADDRESS) {
         if (page_size == PAGESIZE) {
             vmap_debug("%s: cannot get physical page\n", func_ss);
+            if (mpol)
+                numa_clear_mem_policy();
             return false;
         }
         VMAP_PAGE_SHRINK(v, page_addr, page_size);
     }
+    if (mpol)
+        numa_clear_mem_policy();
     zero(m, page_size);
     write_barrier();
     u64 p = physical_from_virtual(m);
@@ -505,6 +558,7 @@ static boolean vmap_compare_attributes(vmap a, vmap b)
             a->allowed_flags == b->allowed_flags &&
             a->cache_node == b->cache_node &&
             a->fd == b->fd /* and bss_offset */ &&
+            a->mpol.mode == b->mpol.mode && a->mpol.nodes == b->mpol.nodes &&
             (!a->cache_node || (node_vstart(a) == node_vstart(b))));
 }
 
@@ -606,6 +660,7 @@ static vmap allocate_vmap_locked(rangemap rm, struct vmap *k)
     vm->node_offset = k->node_offset;
     vm->cache_node = k->cache_node;
     vm->fd = k->fd;
+    vm->mpol = k->mpol;
     if (!rangemap_insert(rm, &vm->node)) {
         deallocate(rm->h, vm, sizeof(struct vmap));
         return INVALID_ADDRESS;
@@ -958,14 +1013,18 @@ static void alter_vmap_key(vmap k, vmap match, u32 flags, u64 offset_delta)
     k->cache_node = match->cache_node;
     if (!(flags & VMAP_FLAG_TAIL_BSS))
         k->fd = match->fd;
+    k->mpol = match->mpol;
     vmap_set_offsets(k, match, offset_delta);
 }
 
+/* Updates the flags and (if mpol is non-null) the memory policy of the part of a vmap that
+ * intersects with a given range. */
 static void vmap_update_flags_intersection(rangemap pvmap, range q, u32 clear_mask, u32 set_mask,
-                                          vmap match)
+                                          mempolicy mpol, vmap match)
 {
     vmap_debug("%s: vm %p %R prev flags 0x%x\n", func_ss, match, match->node.r, match->flags);
-    if ((match->flags & clear_mask) == set_mask)
+    if (((match->flags & clear_mask) == set_mask) &&
+        (!mpol || ((match->mpol.mode == mpol->mode) && (match->mpol.nodes == mpol->nodes))))
         return;
 
     range rn = match->node.r;
@@ -981,6 +1040,8 @@ static void vmap_update_flags_intersection(rangemap pvmap, range q, u32 clear_ma
            removing and reinserting the node will take care of merging */
         rangemap_remove_node(pvmap, &match->node);
         match->flags = newflags;
+        if (mpol)
+            match->mpol = *mpol;
         vmap_assert(allocate_vmap_locked(pvmap, match) != INVALID_ADDRESS);
         deallocate_vmap_locked(pvmap, match);
         return;
@@ -993,6 +1054,8 @@ static void vmap_update_flags_intersection(rangemap pvmap, range q, u32 clear_ma
 
         /* create node for intersection */
         alter_vmap_key(&k, match, newflags, ri.start - rn.start);
+        if (mpol)
+            k.mpol = *mpol;
         k.node.r = ri;
         vmap_assert(allocate_vmap_locked(pvmap, &k) != INVALID_ADDRESS);
 
@@ -1006,6 +1069,8 @@ static void vmap_update_flags_intersection(rangemap pvmap, range q, u32 clear_ma
         /* move node start back */
         vmap_assert(rangemap_reinsert(pvmap, &match->node, irange(ri.end, rn.end)));
         alter_vmap_key(&k, match, newflags, ri.start - rn.start);
+        if (mpol)
+            k.mpol = *mpol;
         vmap_set_offsets(match, match, ri.end - rn.start);
 
         /* create node for intersection */
@@ -1047,7 +1112,7 @@ static sysreturn vmap_update_protections_locked(heap h, rangemap pvmap, range q,
     while (range_span(r)) {
         vmap vm = (vmap)rangemap_lookup(pvmap, r.start);
         vmap_assert(vm != INVALID_ADDRESS);
-        vmap_update_flags_intersection(pvmap, q, VMAP_FLAG_PROT_MASK, newflags, vm);
+        vmap_update_flags_intersection(pvmap, q, VMAP_FLAG_PROT_MASK, newflags, 0, vm);
         r.start = MIN(r.end, vm->node.r.end);
     }
     update_map_flags(q.start, range_span(q), pageflags_from_vmflags(newflags));
@@ -1159,6 +1224,7 @@ closure_function(1, 1, boolean, vmap_unmap,
 static void process_remove_range_locked(process p, range q, boolean unmap)
 {
     vmap_debug("%s: q %R\n", func_ss, q);
+    rangemap_insert_hole(p->lazyfree, q);
     vmap_handler vh = unmap ? stack_closure(vmap_unmap, p) : 0;
     rangemap_range_lookup(p->vmaps, q,
                           (rmnode_handler)stack_closure(vmap_remove_intersection, p->vmaps, q, vh));
@@ -1433,7 +1499,195 @@ closure_function(2, 1, boolean, madvise_vmap_validate,
                  int, advice, sysreturn *, rv,
                  rmnode n)
 {
+    vmap vm = (vmap)n;
+    u32 type = vm->flags & VMAP_MMAP_TYPE_MASK;
+    switch (bound(advice)) {
+    case MADV_DONTNEED:
+        if (type == VMAP_MMAP_TYPE_CUSTOM)
+            goto inval;
+        break;
+    case MADV_FREE:
+        /* only private anonymous memory can be freed lazily */
+        if ((type != VMAP_MMAP_TYPE_ANONYMOUS) || (vm->flags & VMAP_FLAG_SHARED))
+            goto inval;
+        break;
+    case MADV_REMOVE:
+        if (!(vm->flags & VMAP_FLAG_SHARED))
+            goto inval;
+        if (type == VMAP_MMAP_TYPE_FILEBACKED) {
+            if (!vm->fd || (vm->fd->type != FDESC_TYPE_REGULAR))
+                goto inval;
+        } else if (type != VMAP_MMAP_TYPE_ANONYMOUS) {
+            goto inval;
+        }
+        if (!(vm->flags & VMAP_FLAG_WRITABLE)) {
+            *bound(rv) = -EACCES;
+            return false;
+        }
+        break;
+    }
     return true;
+  inval:
+    *bound(rv) = -EINVAL;
+    return false;
+}
+
+closure_function(2, 1, boolean, madvise_dontneed_vmap,
+                 process, p, range, q,
+                 rmnode n)
+{
+    vmap vm = (vmap)n;
+    range ri = range_intersection(bound(q), n->r);
+    struct vmap k;
+    alter_vmap_key(&k, vm, vm->flags, ri.start - n->r.start);
+    k.node.r = ri;
+    vmap_unmap_page_range(bound(p), &k);
+    return true;
+}
+
+/* Drops the pages mapped in an address range: the next access to a page finds zero-filled memory
+ * (anonymous mappings) or the file contents (file-backed mappings). */
+static void madvise_dontneed_locked(process p, range q)
+{
+    rangemap_insert_hole(p->lazyfree, q);
+    rangemap_range_lookup(p->vmaps, q, stack_closure(madvise_dontneed_vmap, p, q));
+}
+
+/* Pages in the range can be freed, unless they are written to, when memory is needed; until then,
+ * reading from the range returns either the existing contents or zeros. */
+static void madvise_free_locked(process p, range q)
+{
+#ifdef __x86_64__
+    clean_mapped_pages(q.start, range_span(q));
+    if (!rangemap_insert_range(p->lazyfree, q))
+        madvise_dontneed_locked(p, q);
+#else
+    /* without hardware tracking of written pages, freeing the pages right away is the only option */
+    madvise_dontneed_locked(p, q);
+#endif
+}
+
+/* Reclaims the pages of MADV_FREE ranges that have not been written to since the madvise() call. */
+closure_func_basic(mem_cleaner, u64, mmap_lazyfree_cleaner,
+                   u64 clean_bytes)
+{
+    process p = struct_from_closure(process, lazyfree_cleaner);
+    u64 cleaned = 0;
+    u64 flags = irq_disable_save();
+    if (!spin_try(&p->vmap_lock)) {
+        /* memory is being cleaned while holding the vmap lock */
+        irq_restore(flags);
+        return 0;
+    }
+    rmnode n;
+    while ((cleaned < clean_bytes) &&
+           ((n = rangemap_first_node(p->lazyfree)) != INVALID_ADDRESS)) {
+        range r = n->r;
+        rangemap_remove_range(p->lazyfree, n);
+        cleaned += unmap_and_free_clean_phys(r.start, range_span(r));
+    }
+    spin_unlock(&p->vmap_lock);
+    irq_restore(flags);
+    vmap_debug("%s: cleaned %ld bytes\n", func_ss, cleaned);
+    return cleaned;
+}
+
+/* File read-ahead can suspend the current context, thus it must be done without holding the vmap
+ * lock. */
+static void madvise_willneed(process p, range q)
+{
+    while (range_span(q)) {
+        vmap_lock(p);
+        vmap vm = (vmap)rangemap_lookup_at_or_next(p->vmaps, q.start);
+        if ((vm == INVALID_ADDRESS) || (vm->node.r.start >= q.end)) {
+            vmap_unlock(p);
+            break;
+        }
+        range ri = range_intersection(q, vm->node.r);
+        pagecache_node pn = 0;
+        range r;
+        if ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED) {
+            pn = vm->cache_node;
+            pagecache_node_ref(pn);
+            r = irangel(vm->node_offset + (ri.start - vm->node.r.start), range_span(ri));
+        }
+        vmap_unlock(p);
+        q.start = ri.end;
+        if (pn) {
+            pagecache_node_fetch_pages(pn, r, 0, 0);
+            pagecache_node_unref(pn);
+        }
+    }
+}
+
+closure_function(1, 1, void, madvise_remove_complete,
+                 thread, t,
+                 status s)
+{
+    syscall_return(bound(t), sysreturn_from_fs_status_value(s));
+    closure_finish();
+}
+
+closure_function(2, 1, void, madvise_remove_file_complete,
+                 fdesc, desc, status_handler, sh,
+                 int ret)
+{
+    fdesc_put(bound(desc));
+    status s = STATUS_OK;
+    if (ret != 0) {
+        s = timm("result", "failed to remove file range");
+        s = timm_append(s, "fsstatus", "%d", ret);
+    }
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+/* Frees the pages and backing storage of shared memory: in file-backed mappings, the mapped file
+ * ranges are deallocated (as with fallocate(FALLOC_FL_PUNCH_HOLE)). */
+static sysreturn madvise_remove(process p, range q)
+{
+    heap h = mmap_info.h;
+    status_handler complete = closure(h, madvise_remove_complete, current);
+    if (complete == INVALID_ADDRESS)
+        return -ENOMEM;
+    merge m = allocate_merge(h, complete);
+    if (m == INVALID_ADDRESS) {
+        deallocate_closure(complete);
+        return -ENOMEM;
+    }
+    status_handler sh = apply_merge(m);
+    status s = STATUS_OK;
+    while (range_span(q)) {
+        vmap_lock(p);
+        vmap vm = (vmap)rangemap_lookup_at_or_next(p->vmaps, q.start);
+        if ((vm == INVALID_ADDRESS) || (vm->node.r.start >= q.end)) {
+            vmap_unlock(p);
+            break;
+        }
+        range ri = range_intersection(q, vm->node.r);
+        fdesc desc = 0;
+        u64 offset;
+        if ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED) {
+            desc = vm->fd;
+            fetch_and_add(&desc->refcnt, 1);
+            offset = vm->node_offset + (ri.start - vm->node.r.start);
+        } else {
+            madvise_dontneed_locked(p, ri);
+        }
+        vmap_unlock(p);
+        q.start = ri.end;
+        if (desc) {
+            fs_status_handler fsh = closure(h, madvise_remove_file_complete, desc, apply_merge(m));
+            if (fsh == INVALID_ADDRESS) {
+                fdesc_put(desc);
+                s = timm_oom;
+                break;
+            }
+            filesystem_dealloc(((file)desc)->fsf, offset, range_span(ri), fsh);
+        }
+    }
+    apply(sh, s);
+    return thread_maybe_sleep_uninterruptible(current);
 }
 
 sysreturn madvise(void *addr, s64 length, int advice)
@@ -1442,14 +1696,41 @@ sysreturn madvise(void *addr, s64 length, int advice)
         return -EINVAL;
     u32 clear_mask = 0, set_mask = 0;
     switch (advice) {
+    case MADV_NORMAL:
+        clear_mask = VMAP_FLAG_SEQ_READ | VMAP_FLAG_RAND_READ;
+        break;
+    case MADV_RANDOM:
+        clear_mask = VMAP_FLAG_SEQ_READ | VMAP_FLAG_RAND_READ;
+        set_mask = VMAP_FLAG_RAND_READ;
+        break;
+    case MADV_SEQUENTIAL:
+        clear_mask = VMAP_FLAG_SEQ_READ | VMAP_FLAG_RAND_READ;
+        set_mask = VMAP_FLAG_SEQ_READ;
+        break;
     case MADV_HUGEPAGE:
         set_mask = VMAP_FLAG_THP;
         break;
     case MADV_NOHUGEPAGE:
         clear_mask = VMAP_FLAG_THP;
         break;
-    default:
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+    case MADV_FREE:
+    case MADV_REMOVE:
+        break;
+    case MADV_DONTFORK:
+    case MADV_DOFORK:
+    case MADV_MERGEABLE:
+    case MADV_UNMERGEABLE:
+    case MADV_DONTDUMP:
+    case MADV_DODUMP:
+    case MADV_WIPEONFORK:
+    case MADV_KEEPONFORK:
+    case MADV_COLD:
+    case MADV_PAGEOUT:
         return 0;   /* ignore non-supported advice values */
+    default:
+        return -EINVAL;
     }
     process p = current->p;
     rangemap vmaps = p->vmaps;
@@ -1460,15 +1741,198 @@ sysreturn madvise(void *addr, s64 length, int advice)
     vmap_lock(p);
     int res = rangemap_range_lookup_with_gaps(vmaps, q, vmap_handler, gap_handler);
     if (res == RM_MATCH) {
+        switch (advice) {
+        case MADV_DONTNEED:
+            madvise_dontneed_locked(p, q);
+            break;
+        case MADV_FREE:
+            madvise_free_locked(p, q);
+            break;
+        case MADV_WILLNEED:
+        case MADV_REMOVE:
+            break;
+        default:
+            while (range_span(q)) {
+                vmap vm = (vmap)rangemap_lookup(vmaps, q.start);
+                vmap_update_flags_intersection(vmaps, q, clear_mask, set_mask, 0, vm);
+                q.start = MIN(q.end, vm->node.r.end);
+            }
+        }
+        rv = 0;
+    } else {
+        if (rv == 0)    /* either the address range is not mapped, or there are unmapped gaps */
+            rv = -ENOMEM;
+    }
+    vmap_unlock(p);
+    if (rv == 0) {
+        if (advice == MADV_WILLNEED)
+            madvise_willneed(p, q);
+        else if (advice == MADV_REMOVE)
+            rv = madvise_remove(p, q);
+    }
+    return rv;
+}
+
+static sysreturn mempolicy_get_nodes(const unsigned long *nodemask, unsigned long maxnode,
+                                     u64 *nodes)
+{
+    *nodes = 0;
+    if (!nodemask || (maxnode <= 1))
+        return 0;
+    /* as in Linux, the last bit of the node mask is ignored */
+    maxnode--;
+    if (!get_user_value(nodemask, nodes))
+        return -EFAULT;
+    if (maxnode < 64)
+        *nodes &= MASK(maxnode);
+    if (*nodes & ~MASK(numa_node_count()))
+        return -EINVAL;
+    return 0;
+}
+
+static sysreturn mempolicy_from_user(int mode, const unsigned long *nodemask,
+                                     unsigned long maxnode, mempolicy mpol)
+{
+    mode &= ~MPOL_MODE_FLAGS;
+    if ((mode < 0) || (mode >= MPOL_MAX))
+        return -EINVAL;
+    u64 nodes;
+    sysreturn rv = mempolicy_get_nodes(nodemask, maxnode, &nodes);
+    if (rv)
+        return rv;
+    switch (mode) {
+    case MPOL_DEFAULT:
+    case MPOL_LOCAL:
+        if (nodes)
+            return -EINVAL;
+        break;
+    case MPOL_BIND:
+    case MPOL_INTERLEAVE:
+        if (!nodes)
+            return -EINVAL;
+        break;
+    }
+    mpol->mode = mode;
+    mpol->nodes = nodes;
+    return 0;
+}
+
+static sysreturn mempolicy_put_nodes(unsigned long *nodemask, unsigned long maxnode, u64 nodes)
+{
+    if (!nodemask)
+        return 0;
+    if (maxnode < numa_node_count())
+        return -EINVAL;
+    u64 len = pad(maxnode, 64) / 8;
+    if (len > PAGESIZE)
+        return -EINVAL;
+    u64 words[len / sizeof(u64)];
+    zero(words, len);
+    words[0] = nodes;
+    if (!copy_to_user(nodemask, words, len))
+        return -EFAULT;
+    return 0;
+}
+
+static sysreturn set_mempolicy(int mode, const unsigned long *nodemask, unsigned long maxnode)
+{
+    struct mempolicy mpol;
+    sysreturn rv = mempolicy_from_user(mode, nodemask, maxnode, &mpol);
+    if (rv)
+        return rv;
+    thread t = current;
+    t->mpol = mpol;
+    t->il_next = 0;
+    return 0;
+}
+
+static sysreturn get_mempolicy(int *mode, unsigned long *nodemask, unsigned long maxnode,
+                               void *addr, unsigned long flags)
+{
+    if (flags & ~(MPOL_F_NODE | MPOL_F_ADDR | MPOL_F_MEMS_ALLOWED))
+        return -EINVAL;
+    thread t = current;
+    int policy = MPOL_DEFAULT;
+    u64 nodes = 0;
+    if (flags & MPOL_F_MEMS_ALLOWED) {
+        if (flags & (MPOL_F_NODE | MPOL_F_ADDR))
+            return -EINVAL;
+        policy = MPOL_DEFAULT;
+        nodes = MASK(numa_node_count());
+    } else if (flags & MPOL_F_ADDR) {
+        u64 vaddr = u64_from_pointer(addr);
+        process p = t->p;
+        vmap_lock(p);
+        vmap vm = (vmap)rangemap_lookup(p->vmaps, vaddr);
+        if (vm != INVALID_ADDRESS) {
+            policy = vm->mpol.mode;
+            nodes = vm->mpol.nodes;
+        }
+        vmap_unlock(p);
+        if (vm == INVALID_ADDRESS)
+            return -EFAULT;
+        if (flags & MPOL_F_NODE) {
+            /* return the node where the page at the given address is located */
+            u64 phys = physical_from_virtual(pointer_from_u64(vaddr));
+            if (phys == INVALID_PHYSICAL) {
+                if (!fault_in_user_memory(addr, 1, false))
+                    return -EFAULT;
+                phys = physical_from_virtual(pointer_from_u64(vaddr));
+                if (phys == INVALID_PHYSICAL)
+                    return -EFAULT;
+            }
+            policy = pageheap_page_node(phys);
+        }
+    } else {
+        if (addr)
+            return -EINVAL;
+        if (flags & MPOL_F_NODE) {
+            /* return the next node that will be used for interleaving */
+            if (t->mpol.mode != MPOL_INTERLEAVE)
+                return -EINVAL;
+            policy = mempolicy_interleave_node(t->mpol.nodes, t->il_next);
+        } else {
+            policy = t->mpol.mode;
+        }
+        nodes = t->mpol.nodes;
+    }
+    if (mode && !set_user_value(mode, policy))
+        return -EFAULT;
+    return mempolicy_put_nodes(nodemask, maxnode, nodes);
+}
+
+static sysreturn mbind(void *addr, unsigned long len, int mode, const unsigned long *nodemask,
+                       unsigned long maxnode, unsigned int flags)
+{
+    if ((u64_from_pointer(addr) & PAGEMASK) ||
+        (flags & ~(MPOL_MF_STRICT | MPOL_MF_MOVE | MPOL_MF_MOVE_ALL)))
+        return -EINVAL;
+    struct mempolicy mpol;
+    sysreturn rv = mempolicy_from_user(mode, nodemask, maxnode, &mpol);
+    if (rv)
+        return rv;
+    if (mpol.mode == MPOL_PREFERRED && !mpol.nodes)
+        mpol.mode = MPOL_LOCAL;
+    if (len == 0)
+        return 0;
+
+    /* Pages that have already been allocated are not moved between nodes: the new policy only
+     * applies to future page faults. */
+    process p = current->p;
+    rangemap vmaps = p->vmaps;
+    range q = irangel(u64_from_pointer(addr), pad(len, PAGESIZE));
+    rmnode_handler vmap_handler = (rmnode_handler)stack_closure(vmap_validate_node, 0);
+    range_handler gap_handler = stack_closure_func(range_handler, vmap_validate_gap);
+    vmap_lock(p);
+    if (rangemap_range_lookup_with_gaps(vmaps, q, vmap_handler, gap_handler) == RM_MATCH) {
         while (range_span(q)) {
             vmap vm = (vmap)rangemap_lookup(vmaps, q.start);
-            vmap_update_flags_intersection(vmaps, q, clear_mask, set_mask, vm);
+            vmap_update_flags_intersection(vmaps, q, 0, 0, &mpol, vm);
             q.start = MIN(q.end, vm->node.r.end);
         }
         rv = 0;
     } else {
-        if (rv == 0)    /* either the address range is not mapped, or there are unmapped gaps */
-            rv = -ENOMEM;
+        rv = -EFAULT;
     }
     vmap_unlock(p);
     return rv;
@@ -1561,6 +2025,26 @@ boolean fault_in_user_memory(const void *buf, bytes length, boolean writable)
     return fault_in_memory(buf, length);
 }
 
+/* Pins the physical page mapped at a user address, so that devices can access it even after the
+ * address is unmapped. Only anonymous memory can be pinned (file-backed pages are owned by the page
+ * cache). Returns the physical address of the page, or INVALID_PHYSICAL if the page cannot be
+ * pinned; the page must be unpinned with page_unpin_phys(). */
+u64 pin_user_page(process p, u64 vaddr)
+{
+    u64 phys = INVALID_PHYSICAL;
+    vmap_lock(p);
+    vmap vm = (vmap)rangemap_lookup(p->vmaps, vaddr);
+    if ((vm != INVALID_ADDRESS) && (vm->flags & VMAP_FLAG_READABLE) &&
+        (((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS) ||
+         (vm->flags & (VMAP_FLAG_STACK | VMAP_FLAG_HEAP | VMAP_FLAG_BSS)))) {
+        phys = physical_from_virtual(pointer_from_u64(vaddr & ~PAGEMASK));
+        if ((phys != INVALID_PHYSICAL) && !page_pin_phys(phys))
+            phys = INVALID_PHYSICAL;
+    }
+    vmap_unlock(p);
+    return phys;
+}
+
 void mmap_process_init(process p, tuple root)
 {
     kernel_heaps kh = get_kernel_heaps();
@@ -1587,6 +2071,10 @@ void mmap_process_init(process p, tuple root)
         p->mmap_min_addr = PAGESIZE;
     p->vmaps = allocate_rangemap(h);
     assert(p->vmaps != INVALID_ADDRESS);
+    p->lazyfree = allocate_rangemap(h);
+    assert(p->lazyfree != INVALID_ADDRESS);
+    assert(mm_register_mem_cleaner(init_closure_func(&p->lazyfree_cleaner, mem_cleaner,
+                                                     mmap_lazyfree_cleaner)));
     vmap_heap vmh = allocate(h, sizeof(struct vmap_heap));
     assert(vmh != INVALID_ADDRESS);
     vmh->h.alloc = vmh_alloc;
@@ -1624,6 +2112,36 @@ void mmap_process_init(process p, tuple root)
     list_init(&mmap_info.pf_freelist);
 }
 
+closure_function(1, 1, boolean, mmap_deinit_vmap,
+                 rangemap, rm,
+                 rmnode n)
+{
+    deallocate_vmap_locked(bound(rm), (vmap)n);
+    return true;
+}
+
+closure_function(1, 1, boolean, mmap_deinit_lazyfree,
+                 rangemap, rm,
+                 rmnode n)
+{
+    deallocate(bound(rm)->h, n, sizeof(*n));
+    return true;
+}
+
+/* Releases the address space of a process that has never run (i.e. no pages have been faulted in
+ * for its mappings). */
+void mmap_process_deinit(process p)
+{
+    mm_unregister_mem_cleaner((mem_cleaner)&p->lazyfree_cleaner);
+    unmap(p->vdso_base, vdso_raw_length + VVAR_NR_PAGES * PAGESIZE);
+#ifdef __x86_64__
+    unmap_and_free_phys(VSYSCALL_BASE, PAGESIZE);
+#endif
+    deallocate_rangemap(p->vmaps, stack_closure(mmap_deinit_vmap, p->vmaps));
+    deallocate_rangemap(p->lazyfree, stack_closure(mmap_deinit_lazyfree, p->lazyfree));
+    deallocate(mmap_info.h, p->virtual, sizeof(struct vmap_heap));
+}
+
 void register_mmap_syscalls(struct syscall *map)
 {
     register_syscall(map, mincore, mincore);
@@ -1633,4 +2151,7 @@ void register_mmap_syscalls(struct syscall *map)
     register_syscall(map, munmap, munmap);
     register_syscall(map, mprotect, mprotect);
     register_syscall(map, madvise, madvise);
+    register_syscall(map, mbind, mbind);
+    register_syscall(map, set_mempolicy, set_mempolicy);
+    register_syscall(map, get_mempolicy, get_mempolicy);
 }
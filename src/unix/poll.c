@@ -496,6 +496,16 @@ static void epoll_check_epollfds(epoll e, epoll_blocked w)
     }
 }
 
+closure_function(1, 0, boolean, epoll_busy_poll_cond,
+                 epoll_blocked, w)
+{
+    epoll_blocked w = bound(w);
+    spin_lock(&w->lock);
+    boolean ready = (w->retval != 0) || (user_event_count(w) != 0);
+    spin_unlock(&w->lock);
+    return ready;
+}
+
 /* It would be nice to devise a way to allow a poll waiter to continue
    to collect events between wakeup (first event) and running. */
 
@@ -573,6 +583,10 @@ sysreturn epoll_wait(int epfd,
     epoll_check_epollfds(e, w);
     spin_runlock(&e->fds_lock);
 
+    /* give network events a chance to occur without blocking */
+    if (timeout != 0)
+        netsock_busy_poll_wait(stack_closure(epoll_busy_poll_cond, w));
+
     timestamp ts = (timeout > 0) ? milliseconds(timeout) : 0;
     return blockq_check_timeout(w->t->thread_bq,
                                 contextual_closure(epoll_wait_bh, w, current,
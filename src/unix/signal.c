@@ -1090,6 +1090,12 @@ static void default_signal_action(thread t, queued_signal qs)
     halt_with_code(VM_EXIT_SIGNAL(signum), ss("%s\n"), fate);
 }
 
+/* Returns true if the thread has signals to handle. */
+boolean thread_signal_pending(thread t)
+{
+    return get_effective_signals(t) != 0;
+}
+
 boolean dispatch_signals(thread t)
 {
     /* dequeue (and thus reset) a pending signal */
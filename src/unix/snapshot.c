@@ -0,0 +1,533 @@
+/* Process snapshot and restore.
+ * When the application signals readiness via prctl(PR_NANOS_SNAPSHOT), the state of the (single)
+ * user thread and the process address space are saved to the file designated by the "snapshot"
+ * manifest option. On a subsequent boot, exec_elf() finds the snapshot and restores the process
+ * from it instead of loading the program: memory contents are not read upfront, but are mapped
+ * privately from the snapshot file and faulted in lazily through the page cache, with
+ * copy-on-write semantics for any page written by the restored process.
+ * Anonymous pages that have never been touched are not written to the snapshot file, and are
+ * restored as file holes (which read as zero). */
+
+#include <unix_internal.h>
+#include <filesystem.h>
+
+//#define SNAPSHOT_DEBUG
+#ifdef SNAPSHOT_DEBUG
+#define snapshot_debug(x, ...) do {tprintf(sym(snapshot), 0, ss(x), ##__VA_ARGS__);} while(0)
+#else
+#define snapshot_debug(x, ...)
+#endif
+
+#define SNAPSHOT_MAGIC      0x504e534e  /* "NSNP" */
+#define SNAPSHOT_VERSION    1
+
+/* maximum length of memory written to the snapshot file with a single request */
+#define SNAPSHOT_WRITE_MAX  (64 * MB)
+
+/* see vdso.c */
+extern unsigned char vdso_raw[];
+
+struct snapshot_header {
+    u32 magic;
+    u32 version;
+    u64 hdr_len;        /* length (page-aligned) of the data preceding the memory image */
+    u64 vdso_base;
+    u64 vdso_hash;
+    u64 vmap_count;
+    u64 extended_len;   /* length of extended frame state following the vmap array */
+    u64 brk;
+    u64 heap_base;
+    u64 rlimit_stack;
+    u64 saved_args_begin;
+    u64 saved_args_end;
+    struct aux saved_aux[NAUX];
+    struct sigaction sigactions[NSIG];
+    u64 signal_mask;
+    u64 clear_tid;
+    u64 robust_list;
+    char name[16];
+    char cwd[PATH_MAX];
+    u64 frame[FRAME_N_PSTATE];
+};
+
+struct snapshot_vmap {
+    u64 start;
+    u64 end;
+    u32 flags;
+    u32 allowed_flags;
+    u64 offset;         /* offset of memory contents in snapshot file */
+};
+
+static boolean snapshot_restored;
+
+static u64 snapshot_vdso_hash(void)
+{
+    return fnv64(alloca_wrap_buffer(vdso_raw, vdso_raw_length));
+}
+
+static u64 snapshot_extended_len(void)
+{
+#ifdef __x86_64__
+    return extended_frame_size;
+#else
+    return 0;
+#endif
+}
+
+static inline struct snapshot_vmap *snapshot_vmaps(struct snapshot_header *h)
+{
+    return (struct snapshot_vmap *)(h + 1);
+}
+
+static inline void *snapshot_extended(struct snapshot_header *h)
+{
+    return snapshot_vmaps(h) + h->vmap_count;
+}
+
+static boolean snapshot_vmap_has_data(struct snapshot_vmap *sv)
+{
+    return (sv->flags & VMAP_FLAG_READABLE) != 0;
+}
+
+/* Finds the next run of mapped pages to be written to the snapshot file, starting from vmap index
+ * *index and address *addr. */
+static boolean snapshot_next_run(struct snapshot_header *h, u64 *index, u64 *addr, range *run,
+                                 u64 *offset)
+{
+    for (; *index < h->vmap_count; (*index)++) {
+        struct snapshot_vmap *sv = &snapshot_vmaps(h)[*index];
+        if (!snapshot_vmap_has_data(sv))
+            continue;
+        u64 start = MAX(*addr, sv->start);
+        while ((start < sv->end) &&
+               (physical_from_virtual(pointer_from_u64(start)) == INVALID_PHYSICAL))
+            start += PAGESIZE;
+        u64 end = start;
+        while ((end < sv->end) && (end - start < SNAPSHOT_WRITE_MAX) &&
+               (physical_from_virtual(pointer_from_u64(end)) != INVALID_PHYSICAL))
+            end += PAGESIZE;
+        if (end > start) {
+            *run = irange(start, end);
+            *offset = sv->offset + start - sv->start;
+            *addr = end;
+            return true;
+        }
+    }
+    return false;
+}
+
+closure_function(2, 1, void, snapshot_complete,
+                 fsfile, f, buffer, b,
+                 status s)
+{
+    assert(is_syscall_context(get_current_context(current_cpu())));
+    sysreturn rv;
+    if (is_ok(s)) {
+        rv = 0;
+    } else {
+        msg_err("snapshot failed: %v", s);
+        timm_dealloc(s);
+        rv = -EIO;
+    }
+    deallocate_buffer(bound(b));
+    fsfile_release(bound(f));
+    syscall_return(current, rv);
+    closure_finish();
+}
+
+closure_function(7, 1, void, snapshot_write_complete,
+                 fsfile, f, sg_io, write, sg_list, sg, struct snapshot_header *, h, u64, index, u64, addr, status_handler, complete,
+                 status s)
+{
+    sg_list sg = bound(sg);
+    sg_list_release(sg);
+    range run;
+    u64 offset;
+    if (is_ok(s) && snapshot_next_run(bound(h), &bound(index), &bound(addr), &run, &offset)) {
+        snapshot_debug("writing %R at offset 0x%lx\n", run, offset);
+        sg_buf sgb = sg_list_tail_add(sg, range_span(run));
+        assert(sgb != INVALID_ADDRESS);
+        sgb->buf = pointer_from_u64(run.start);
+        sgb->offset = 0;
+        sgb->refcount = 0;
+        sgb->size = range_span(run);
+        apply(bound(write), sg, irangel(offset, range_span(run)), (status_handler)closure_self());
+        return;
+    }
+    deallocate_sg_list(sg);
+    if (is_ok(s))
+        fsfile_flush(bound(f), false, bound(complete));
+    else
+        apply(bound(complete), s);
+    closure_finish();
+}
+
+closure_function(2, 1, boolean, snapshot_check_vmap,
+                 u64 *, count, boolean *, valid,
+                 vmap vm)
+{
+    if ((vm->flags & (VMAP_FLAG_MMAP | VMAP_FLAG_STACK | VMAP_FLAG_HEAP |
+                      VMAP_FLAG_BSS | VMAP_FLAG_PROG)) == 0)
+        return true;    /* vdso, vvar and vsyscall mappings are set up at process creation */
+    if ((vm->flags & VMAP_FLAG_SHARED) ||
+        ((vm->flags & VMAP_FLAG_MMAP) &&
+         ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_CUSTOM))) {
+        *bound(valid) = false;
+        return false;
+    }
+    (*bound(count))++;
+    return true;
+}
+
+closure_function(2, 1, boolean, snapshot_add_vmap,
+                 struct snapshot_header *, h, u64 *, offset,
+                 vmap vm)
+{
+    if ((vm->flags & (VMAP_FLAG_MMAP | VMAP_FLAG_STACK | VMAP_FLAG_HEAP |
+                      VMAP_FLAG_BSS | VMAP_FLAG_PROG)) == 0)
+        return true;
+    struct snapshot_header *h = bound(h);
+    struct snapshot_vmap *sv = &snapshot_vmaps(h)[h->vmap_count++];
+    sv->start = vm->node.r.start;
+    sv->end = vm->node.r.end;
+    sv->flags = vm->flags;
+    sv->allowed_flags = vm->allowed_flags;
+    sv->offset = *bound(offset);
+    *bound(offset) += range_span(vm->node.r);
+    snapshot_debug("vmap %R flags 0x%x, offset 0x%lx\n", vm->node.r, vm->flags, sv->offset);
+    return true;
+}
+
+/* File-backed pages that have not been accessed yet are not mapped: fault them in, so that they
+ * are written to the snapshot file. */
+static boolean snapshot_fault_in(process p, struct snapshot_vmap *sv)
+{
+    if (!snapshot_vmap_has_data(sv))
+        return true;
+    u64 len = 0;
+    vmap_lock(p);
+    vmap vm = vmap_from_vaddr(p, sv->start);
+    if ((vm != INVALID_ADDRESS) && vm->cache_node) {
+        u64 node_len = pad(pagecache_get_node_length(vm->cache_node), PAGESIZE);
+        if (node_len > vm->node_offset)
+            len = MIN(node_len - vm->node_offset, sv->end - sv->start);
+    }
+    vmap_unlock(p);
+    return (len == 0) || fault_in_memory(pointer_from_u64(sv->start), len);
+}
+
+/* Starts writing the snapshot header in b and the process memory to file f; on success, the
+ * syscall is completed by snapshot_complete(). */
+static int snapshot_write(fsfile f, buffer b, u64 length)
+{
+    heap h = heap_locked(get_kernel_heaps());
+    struct snapshot_header *hdr = buffer_ref(b, 0);
+    int fss = fsfile_truncate(f, 0);
+    if (fss == 0)
+        fss = fsfile_truncate(f, length);
+    if (fss != 0)
+        return fss;
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return -ENOMEM;
+    status_handler complete = contextual_closure(snapshot_complete, f, b);
+    if (complete == INVALID_ADDRESS)
+        goto out_sg;
+    sg_io write = pagecache_node_get_writer(fsfile_get_cachenode(f));
+    status_handler sh = closure(h, snapshot_write_complete, f, write, sg, hdr, 0, 0, complete);
+    if (sh == INVALID_ADDRESS) {
+        deallocate_closure(complete);
+        goto out_sg;
+    }
+    snapshot_debug("writing snapshot, length 0x%lx\n", length);
+    sg_buf sgb = sg_list_tail_add(sg, hdr->hdr_len);
+    assert(sgb != INVALID_ADDRESS);
+    sgb->buf = hdr;
+    sgb->offset = 0;
+    sgb->refcount = 0;
+    sgb->size = hdr->hdr_len;
+    apply(write, sg, irangel(0, hdr->hdr_len), sh);
+    return 0;
+  out_sg:
+    deallocate_sg_list(sg);
+    return -ENOMEM;
+}
+
+closure_function(3, 1, void, snapshot_dealloc_complete,
+                 fsfile, f, buffer, b, u64, length,
+                 int status)
+{
+    if (status == 0)
+        status = snapshot_write(bound(f), bound(b), bound(length));
+    if (status != 0) {
+        deallocate_buffer(bound(b));
+        fsfile_release(bound(f));
+        syscall_return(current, status);
+    }
+    closure_finish();
+}
+
+sysreturn snapshot_process(thread t)
+{
+    process p = t->p;
+    tuple root = p->process_root;
+    string path = get_string(root, sym(snapshot));
+    if (!path || !get(root, sym(noaslr)))
+        return -EINVAL;
+    if (snapshot_restored || (rbtree_get_count(p->threads) != 1))
+        return -EBUSY;
+
+    /* Only the standard files can be re-created on restore. */
+    process_lock(p);
+    boolean busy = false;
+    for (int fd = 0; fd < vector_length(p->files); fd++) {
+        fdesc f = vector_get(p->files, fd);
+        if (f && ((fd > 2) || (f->type != FDESC_TYPE_STDIO))) {
+            busy = true;
+            break;
+        }
+    }
+    process_unlock(p);
+    if (busy)
+        return -EBUSY;
+
+    u64 vmap_count = 0;
+    boolean valid = true;
+    vmap_iterator(p, stack_closure(snapshot_check_vmap, &vmap_count, &valid));
+    if (!valid)
+        return -EBUSY;
+
+    heap h = heap_locked(get_kernel_heaps());
+    u64 extended_len = snapshot_extended_len();
+    u64 hdr_len = pad(sizeof(struct snapshot_header) + vmap_count * sizeof(struct snapshot_vmap) +
+                      extended_len, PAGESIZE);
+    buffer b = allocate_buffer(h, hdr_len);
+    if (b == INVALID_ADDRESS)
+        return -ENOMEM;
+    zero(buffer_ref(b, 0), hdr_len);
+    buffer_produce(b, hdr_len);
+    struct snapshot_header *hdr = buffer_ref(b, 0);
+    hdr->magic = SNAPSHOT_MAGIC;
+    hdr->version = SNAPSHOT_VERSION;
+    hdr->hdr_len = hdr_len;
+    hdr->vdso_base = p->vdso_base;
+    hdr->vdso_hash = snapshot_vdso_hash();
+    hdr->extended_len = extended_len;
+    hdr->brk = u64_from_pointer(p->brk);
+    hdr->heap_base = p->heap_base;
+    hdr->rlimit_stack = p->rlimit_stack;
+    hdr->saved_args_begin = u64_from_pointer(p->saved_args_begin);
+    hdr->saved_args_end = u64_from_pointer(p->saved_args_end);
+    runtime_memcpy(hdr->saved_aux, p->saved_aux, sizeof(hdr->saved_aux));
+    runtime_memcpy(hdr->sigactions, p->sigactions, sizeof(hdr->sigactions));
+    hdr->signal_mask = t->signal_mask;
+    hdr->clear_tid = u64_from_pointer(t->clear_tid);
+    hdr->robust_list = u64_from_pointer(t->robust_list);
+    runtime_memcpy(hdr->name, t->name, sizeof(hdr->name));
+    if (file_get_path(p->cwd_fs, p->cwd, hdr->cwd, sizeof(hdr->cwd)) < 0)
+        hdr->cwd[0] = '\0';
+    runtime_memcpy(hdr->frame, thread_frame(t), sizeof(hdr->frame));
+
+    /* The vmap array is sized from the first pass; the address space cannot change in between,
+     * since the calling thread is the only thread in the process. */
+    u64 offset = hdr_len;
+    vmap_iterator(p, stack_closure(snapshot_add_vmap, hdr, &offset));
+    assert(hdr->vmap_count == vmap_count);
+#ifdef __x86_64__
+    runtime_memcpy(snapshot_extended(hdr), frame_extended(thread_frame(t)), extended_len);
+#endif
+    for (u64 i = 0; i < vmap_count; i++) {
+        if (!snapshot_fault_in(p, &snapshot_vmaps(hdr)[i])) {
+            deallocate_buffer(b);
+            return -EFAULT;
+        }
+    }
+
+    sysreturn rv;
+    fsfile f = fsfile_open_or_create(buffer_to_sstring(path), false);
+    if (!f) {
+        rv = -ENOENT;
+        goto out_dealloc;
+    }
+
+    /* Release the storage of any previous snapshot, so that none of its contents survive in the
+     * file ranges that are not written by this snapshot. */
+    u64 old_length = fsfile_get_length(f);
+    if (old_length > 0) {
+        fs_status_handler fsh = closure(h, snapshot_dealloc_complete, f, b, offset);
+        if (fsh == INVALID_ADDRESS) {
+            rv = -ENOMEM;
+            goto out_release;
+        }
+        snapshot_debug("deallocating previous snapshot, length 0x%lx\n", old_length);
+        filesystem_dealloc(f, 0, old_length, fsh);
+        return thread_maybe_sleep_uninterruptible(t);
+    }
+    rv = snapshot_write(f, b, offset);
+    if (rv == 0)
+        return thread_maybe_sleep_uninterruptible(t);
+  out_release:
+    fsfile_release(f);
+  out_dealloc:
+    deallocate_buffer(b);
+    return rv;
+}
+
+closure_function(1, 1, boolean, snapshot_trace_notify,
+                 process, p,
+                 value v)
+{
+    bound(p)->trace = trace_get_flags(v);
+    return true;
+}
+
+static status snapshot_restore_process(process kp, fsfile f, struct snapshot_header *h)
+{
+    tuple root = kp->process_root;
+    if (!get(root, sym(noaslr)))
+        return timm("result", "restore requires noaslr");
+    if (h->vdso_hash != snapshot_vdso_hash())
+        return timm("result", "snapshot taken with a different kernel");
+    if (h->extended_len != snapshot_extended_len())
+        return timm("result", "extended frame size mismatch");
+    status s;
+    process p = create_process(kp->uh, root, kp->root_fs);
+    if (p->vdso_base != h->vdso_base) {
+        s = timm("result", "vdso base mismatch (0x%lx, expected 0x%lx)",
+                 p->vdso_base, h->vdso_base);
+        goto out_process;
+    }
+    thread t = create_thread(p, p->pid);
+    if (t == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate thread");
+        goto out_process;
+    }
+    pagecache_node pn = fsfile_get_cachenode(f);
+
+    /* Memory contents are mapped privately from the snapshot file. The restored heap contents
+     * cannot grow or shrink (they are not backed by anonymous memory), thus heap adjustments via
+     * brk() start at the end of the restored heap. */
+    u64 heap_end = pad(h->brk, PAGESIZE);
+    for (u64 i = 0; i < h->vmap_count; i++) {
+        struct snapshot_vmap *sv = &snapshot_vmaps(h)[i];
+        u32 flags = (sv->flags & VMAP_FLAG_PROT_MASK) | VMAP_FLAG_MMAP |
+                    VMAP_MMAP_TYPE_FILEBACKED;
+        snapshot_debug("restoring vmap %R, flags 0x%x, offset 0x%lx\n",
+                       irange(sv->start, sv->end), sv->flags, sv->offset);
+        if (sv->start == sv->end)
+            continue;
+        vmap vm = allocate_vmap(p, irange(sv->start, sv->end),
+                                ivmap(flags, (sv->allowed_flags & VMAP_FLAG_PROT_MASK), sv->offset,
+                                      pn, 0));
+        if (vm == INVALID_ADDRESS) {
+            s = timm("result", "failed to allocate vmap %R", irange(sv->start, sv->end));
+            goto out_thread;
+        }
+        if (sv->flags & VMAP_FLAG_STACK)
+            p->stack_map = vm;
+    }
+    p->brk = pointer_from_u64(h->brk);
+    p->heap_base = heap_end;
+    p->heap_map = allocate_vmap(p, irange(heap_end, heap_end),
+                                ivmap(VMAP_FLAG_HEAP | VMAP_FLAG_READABLE | VMAP_FLAG_WRITABLE,
+                                      0, 0, 0, 0));
+    assert(p->heap_map != INVALID_ADDRESS);
+    p->rlimit_stack = h->rlimit_stack;
+    p->saved_args_begin = pointer_from_u64(h->saved_args_begin);
+    p->saved_args_end = pointer_from_u64(h->saved_args_end);
+    runtime_memcpy(p->saved_aux, h->saved_aux, sizeof(p->saved_aux));
+    runtime_memcpy(p->sigactions, h->sigactions, sizeof(p->sigactions));
+
+    context_frame frame = thread_frame(t);
+    runtime_memcpy(frame, h->frame, sizeof(h->frame));
+#ifdef __x86_64__
+    runtime_memcpy(frame_extended(frame), snapshot_extended(h), h->extended_len);
+#endif
+    t->signal_mask = h->signal_mask;
+    t->clear_tid = pointer_from_u64(h->clear_tid);
+    t->robust_list = pointer_from_u64(h->robust_list);
+    runtime_memcpy(t->name, h->name, sizeof(t->name));
+
+    register_root_notify(sym(trace), closure(heap_locked(get_kernel_heaps()),
+                                             snapshot_trace_notify, p));
+    h->cwd[sizeof(h->cwd) - 1] = '\0';
+    if (h->cwd[0]) {
+        int fss = filesystem_chdir(p, sstring_from_cstring(h->cwd, sizeof(h->cwd)));
+        if (fss != 0)
+            msg_warn("snapshot: unable to change cwd to \"%s\"; %s", h->cwd,
+                     string_from_errno(-fss));
+    }
+
+    /* The restored thread returns from the snapshot request with a value of 1. */
+    fsfile_reserve(f);
+    snapshot_restored = true;
+    set_syscall_return(t, 1);
+    t->syscall = 0;
+    frame[FRAME_FULL] = true;
+    thread_reserve(t);
+    schedule_thread(t);
+    return STATUS_OK;
+  out_thread:
+    exit_thread(t);
+  out_process:
+    deallocate_process(p);
+    return s;
+}
+
+closure_function(4, 2, void, snapshot_read_complete,
+                 process, kp, fsfile, f, buffer, b, status_handler, complete,
+                 status s, bytes length)
+{
+    buffer b = bound(b);
+    if (!is_ok(s))
+        goto out;
+    buffer_produce(b, length);
+    struct snapshot_header *h = buffer_ref(b, 0);
+    if ((buffer_length(b) < sizeof(*h)) || (h->magic != SNAPSHOT_MAGIC) ||
+        (h->version != SNAPSHOT_VERSION)) {
+        s = timm("result", "invalid snapshot header");
+        goto out;
+    }
+    if (h->hdr_len > buffer_length(b)) {
+        if ((h->hdr_len > fsfile_get_length(bound(f))) ||
+            (sizeof(*h) + h->vmap_count * sizeof(struct snapshot_vmap) + h->extended_len >
+             h->hdr_len)) {
+            s = timm("result", "invalid snapshot header length");
+            goto out;
+        }
+        u64 curr = buffer_length(b);
+        if (!buffer_extend(b, h->hdr_len - curr)) {
+            s = timm("result", "failed to allocate snapshot header");
+            goto out;
+        }
+        filesystem_read_linear(bound(f), buffer_ref(b, curr), irange(curr, h->hdr_len),
+                               (io_status_handler)closure_self());
+        return;
+    }
+    s = snapshot_restore_process(bound(kp), bound(f), h);
+  out:
+    deallocate_buffer(b);
+    fsfile_release(bound(f));
+    apply(bound(complete), s);
+    closure_finish();
+}
+
+void snapshot_restore(process kp, fsfile f, status_handler complete)
+{
+    heap h = heap_locked(get_kernel_heaps());
+    buffer b = allocate_buffer(h, PAGESIZE);
+    if (b == INVALID_ADDRESS) {
+        fsfile_release(f);
+        apply(complete, timm("result", "failed to allocate snapshot header"));
+        return;
+    }
+    io_status_handler sh = closure(h, snapshot_read_complete, kp, f, b, complete);
+    if (sh == INVALID_ADDRESS) {
+        deallocate_buffer(b);
+        fsfile_release(f);
+        apply(complete, timm("result", "failed to allocate closure"));
+        return;
+    }
+    filesystem_read_linear(f, buffer_ref(b, 0), irangel(0, MIN(PAGESIZE, fsfile_get_length(f))),
+                           sh);
+}
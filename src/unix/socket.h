@@ -44,6 +44,32 @@ struct mmsghdr {
     unsigned int msg_len;
 };
 
+struct cmsghdr {
+    u64 cmsg_len;
+    int cmsg_level;
+    int cmsg_type;
+};
+
+#define CMSG_ALIGN(len) pad(len, sizeof(u64))
+#define CMSG_LEN(len)   (sizeof(struct cmsghdr) + (len))
+#define CMSG_DATA(cmsg) ((void *)((cmsg) + 1))
+
+#define CMSG_FIRSTHDR(msg)                                                      \
+    (((msg)->msg_controllen >= sizeof(struct cmsghdr)) ?                        \
+     (struct cmsghdr *)(msg)->msg_control : (struct cmsghdr *)0)
+
+static inline struct cmsghdr *CMSG_NXTHDR(const struct msghdr *msg, struct cmsghdr *cmsg)
+{
+    if (cmsg->cmsg_len < sizeof(struct cmsghdr))
+        return 0;
+    void *next = (void *)cmsg + CMSG_ALIGN(cmsg->cmsg_len);
+    void *end = msg->msg_control + msg->msg_controllen;
+    if ((next + sizeof(struct cmsghdr) > end) ||
+        (next + CMSG_ALIGN(((struct cmsghdr *)next)->cmsg_len) > end))
+        return 0;
+    return next;
+}
+
 #define IFNAMSIZ    16
 
 struct ifmap {
@@ -105,6 +131,14 @@ struct sock {
                          int flags, boolean in_bh, io_completion completion);
     sysreturn (*recvmsg)(struct sock *sock, struct msghdr *msg, int flags, boolean in_bh,
                          io_completion completion);
+
+    /* optional batched variants of sendmsg and recvmsg, which never block: sendmmsg returns the
+     * number of messages sent, recvmmsg the number of messages received (0 if no message is
+     * available) */
+    sysreturn (*sendmmsg)(struct sock *sock, struct mmsghdr *msgvec, unsigned int vlen,
+                          int flags);
+    sysreturn (*recvmmsg)(struct sock *sock, struct mmsghdr *msgvec, unsigned int vlen,
+                          int flags);
     sysreturn (*shutdown)(struct sock *sock, int how);
 };
 
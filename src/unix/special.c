@@ -2,6 +2,7 @@
 #include <filesystem.h>
 #include <ftrace.h>
 #include <storage.h>
+#include <virtio/virtio.h>
 
 typedef struct special_file {
     sstring path;
@@ -207,6 +208,49 @@ static u32 cpu_online_events(file f)
     return (EPOLLIN | EPOLLOUT);
 }
 
+static sysreturn virtqueue_stats_read(file f, void *dest, u64 length, u64 offset)
+{
+    heap h = heap_locked(get_kernel_heaps());
+    buffer b = allocate_buffer(h, 512);
+    if (b == INVALID_ADDRESS)
+        return -ENOMEM;
+    virtqueue_print_stats(b);
+    context ctx = get_current_context(current_cpu());
+    if (!context_set_err(ctx))
+        length = buffer_read_at(b, offset, dest, length);
+    else
+        length = -EFAULT;
+    deallocate_buffer(b);
+    return length;
+}
+
+static sysreturn balloon_stats_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(128);
+    virtio_balloon_print_stats(b);
+    return buffer_read_at(b, offset, dest, length);
+}
+
+static sysreturn halt_poll_stats_read(file f, void *dest, u64 length, u64 offset)
+{
+    struct halt_poll_stats stats;
+    halt_poll_get_stats(&stats);
+    buffer b = little_stack_buffer(64);
+    bprintf(b, "successes failures\n%ld %ld\n", stats.successes, stats.failures);
+    return buffer_read_at(b, offset, dest, length);
+}
+
+static sysreturn sched_stats_read(file f, void *dest, u64 length, u64 offset)
+{
+    u64 migrations[SCHED_DOMAINS];
+    sched_get_migrations(migrations);
+    buffer b = little_stack_buffer(128);
+    bprintf(b, "core_migrations llc_migrations package_migrations system_migrations\n"
+            "%ld %ld %ld %ld\n", migrations[SCHED_DOMAIN_CORE], migrations[SCHED_DOMAIN_LLC],
+            migrations[SCHED_DOMAIN_PACKAGE], migrations[SCHED_DOMAIN_SYSTEM]);
+    return buffer_read_at(b, offset, dest, length);
+}
+
 static const special_file special_files[] = {
     { ss_static_init("/dev/urandom"), .read = urandom_read, .write = 0, .events = urandom_events },
     { ss_static_init("/dev/null"), .read = null_read, .write = null_write, .events = null_events },
@@ -217,6 +261,11 @@ static const special_file special_files[] = {
     { ss_static_init("/proc/self/maps"), .read = maps_read, .events = maps_events, },
     { ss_static_init("/sys/devices/system/cpu/online"), .read = cpu_online_read,
       .write = null_write, .events = cpu_online_events },
+    { ss_static_init("/sys/net/busy_poll/stats"), .read = netsock_busy_poll_stats_read },
+    { ss_static_init("/sys/virtio/virtqueue/stats"), .read = virtqueue_stats_read },
+    { ss_static_init("/sys/virtio/balloon/stats"), .read = balloon_stats_read },
+    { ss_static_init("/sys/kernel/halt_poll/stats"), .read = halt_poll_stats_read },
+    { ss_static_init("/sys/kernel/sched/stats"), .read = sched_stats_read },
     FTRACE_SPECIAL_FILES
 };
 
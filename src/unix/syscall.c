@@ -569,20 +569,26 @@ closure_func_basic(file_iov, sysreturn, file_readv,
     return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
 }
 
+static sysreturn file_check_seals(file f, u64 offset, u64 len)
+{
+    filesystem fs = f->fs;
+    u64 seals;
+    if ((len > 0) && fs->get_seals && (fs->get_seals(fs, f->fsf, &seals) == 0)) {
+        if ((seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) ||
+            ((seals & F_SEAL_GROW) && (offset + len > fsfile_get_length(f->fsf))))
+            return -EPERM;
+    }
+    return 0;
+}
+
 static sysreturn file_write_check(file f, u64 offset, struct iovec *iov, int count, sg_list *sgp)
 {
-    fsfile fsf = f->fsf;
-    if (!fsf)
+    if (!f->fsf)
         return -EBADF;
-    filesystem fs = f->fs;
-    if (fs->get_seals) {
-        u64 len = iov_total_len(iov, count);
-        u64 seals;
-        if ((len > 0) && (fs->get_seals(fs, fsf, &seals) == 0)) {
-            if ((seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) ||
-                ((seals & F_SEAL_GROW) && (offset + len > fsfile_get_length(fsf))))
-                return -EPERM;
-        }
+    if (f->fs->get_seals) {
+        sysreturn rv = file_check_seals(f, offset, iov_total_len(iov, count));
+        if (rv < 0)
+            return rv;
     }
     return file_io_init_sg(f, offset, iov, count, sgp);
 }
@@ -687,6 +693,312 @@ closure_func_basic(file_iov, sysreturn, file_writev,
     return io_complete(completion, rv);
 }
 
+/* File range copies (copy_file_range() and the FICLONE/FICLONERANGE ioctls): the part of the source
+ * range whose offset is congruent with the destination offset modulo the page size is cloned, i.e.
+ * the destination file shares the storage blocks of the source file; the rest of the range, or the
+ * whole range if the filesystem cannot clone it, is copied through the page cache. */
+
+#define FILE_COPY_CHUNK (256 * KB)
+
+typedef struct file_copy {
+    heap h;
+    thread t;
+    file in, out;
+    u64 in_offset, out_offset;
+    u64 remain;
+    u64 done;
+    range clone;            /* source range to be cloned */
+    boolean clone_only;     /* do not copy any data, and do not update any file offsets */
+    s64 *off_in, *off_out;  /* user-supplied offsets, or 0 to use the file offsets */
+    sg_list sg;
+    u64 chunk;              /* length of the data being copied */
+    boolean writing;
+    sysreturn rv;
+    closure_struct(thunk, next);
+    closure_struct(status_handler, io_complete);
+    closure_struct(fs_status_handler, cloned);
+} *file_copy;
+
+static void file_copy_finish(file_copy fc)
+{
+    thread t = fc->t;
+    sysreturn rv = fc->rv;
+    thread_log(t, "%s: done %ld, rv %ld", func_ss, fc->done, rv);
+    if (!fc->clone_only && (fc->done > 0)) {
+        rv = fc->done;
+        if (fc->off_in) {
+            s64 offset = fc->in_offset;
+            if (!set_user_value(fc->off_in, offset))
+                rv = -EFAULT;
+        } else {
+            fc->in->offset = fc->in_offset;
+        }
+        if (fc->off_out) {
+            s64 offset = fc->out_offset;
+            if (!set_user_value(fc->off_out, offset))
+                rv = -EFAULT;
+        } else {
+            fc->out->offset = fc->out_offset;
+        }
+    }
+    fdesc_put(&fc->in->f);
+    fdesc_put(&fc->out->f);
+    deallocate(fc->h, fc, sizeof(*fc));
+    syscall_return(t, rv);
+}
+
+/* Runs in the syscall context, so that user-supplied offsets can be updated on completion. */
+closure_func_basic(thunk, void, file_copy_next)
+{
+    file_copy fc = struct_from_field(closure_self(), file_copy, next);
+    if ((fc->rv < 0) || (fc->remain == 0)) {
+        file_copy_finish(fc);
+        return;
+    }
+    if ((fc->in_offset == fc->clone.start) && (range_span(fc->clone) > 0)) {
+        filesystem_clone(fc->out->fsf, fc->out_offset, fc->in->fsf, fc->in_offset,
+                         range_span(fc->clone), (fs_status_handler)&fc->cloned);
+        return;
+    }
+    u64 n = MIN(fc->remain, FILE_COPY_CHUNK);
+    if (fc->in_offset < fc->clone.start)
+        n = MIN(n, fc->clone.start - fc->in_offset);
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS) {
+        fc->rv = -ENOMEM;
+        file_copy_finish(fc);
+        return;
+    }
+    fc->sg = sg;
+    fc->writing = false;
+    pagecache_node_fetch_pages(fsfile_get_cachenode(fc->in->fsf), irangel(fc->in_offset, n), sg,
+                               (status_handler)&fc->io_complete);
+}
+
+/* The pages fetched from the source file are written to the destination file without any
+ * intermediate buffer. */
+closure_func_basic(status_handler, void, file_copy_io_complete,
+                   status s)
+{
+    file_copy fc = struct_from_field(closure_self(), file_copy, io_complete);
+    sg_list sg = fc->sg;
+    if (!is_ok(s)) {
+        fc->rv = sysreturn_from_fs_status_value(s);
+        timm_dealloc(s);
+    } else if (!fc->writing) {
+        fc->chunk = sg->count;
+        if (fc->chunk > 0) {
+            fc->writing = true;
+            apply(pagecache_node_get_writer(fsfile_get_cachenode(fc->out->fsf)), sg,
+                  irangel(fc->out_offset, fc->chunk), (status_handler)closure_self());
+            return;
+        }
+        fc->remain = 0; /* the source file has been truncated */
+    } else {
+        fc->in_offset += fc->chunk;
+        fc->out_offset += fc->chunk;
+        fc->done += fc->chunk;
+        fc->remain -= fc->chunk;
+    }
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    async_apply((thunk)&fc->next);
+}
+
+closure_func_basic(fs_status_handler, void, file_copy_cloned,
+                   int fss)
+{
+    file_copy fc = struct_from_field(closure_self(), file_copy, cloned);
+    thread_log(fc->t, "%s: range %R, status %d", func_ss, fc->clone, fss);
+    if (fss == 0) {
+        u64 len = range_span(fc->clone);
+        fc->in_offset += len;
+        fc->out_offset += len;
+        fc->done += len;
+        fc->remain -= len;
+    } else if (fc->clone_only) {
+        fc->rv = fss;
+    }
+    /* if the range cannot be cloned, its data is copied */
+    fc->clone = irange(0, 0);
+    async_apply((thunk)&fc->next);
+}
+
+/* Takes ownership of the references to the file descriptors. */
+static sysreturn file_copy_start(file in, u64 in_offset, file out, u64 out_offset, u64 len,
+                                 s64 *off_in, s64 *off_out, boolean clone_only)
+{
+    thread t = current;
+    heap h = heap_locked(get_kernel_heaps());
+    sysreturn rv;
+    file_copy fc = allocate(h, sizeof(*fc));
+    if (fc == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    u64 clone_start = pad(in_offset, PAGESIZE);
+    u64 clone_end = in_offset + len;
+    if ((clone_end != fsfile_get_length(in->fsf)) ||
+        (out_offset + len < fsfile_get_length(out->fsf)))
+        clone_end &= ~PAGEMASK;
+    if (((in_offset - out_offset) & PAGEMASK) || (clone_end <= clone_start))
+        fc->clone = irange(0, 0);
+    else
+        fc->clone = irange(clone_start, clone_end);
+    if (clone_only && !range_equal(fc->clone, irangel(in_offset, len))) {
+        deallocate(h, fc, sizeof(*fc));
+        rv = -EINVAL;
+        goto out;
+    }
+    thread_log(t, "%s: in %p offset %ld, out %p offset %ld, len %ld, clone %R",
+               func_ss, in, in_offset, out, out_offset, len, fc->clone);
+    fc->h = h;
+    fc->t = t;
+    fc->in = in;
+    fc->out = out;
+    fc->in_offset = in_offset;
+    fc->out_offset = out_offset;
+    fc->remain = len;
+    fc->done = 0;
+    fc->clone_only = clone_only;
+    fc->off_in = off_in;
+    fc->off_out = off_out;
+    fc->rv = 0;
+    init_closure_func(&fc->next, thunk, file_copy_next);
+    closure_set_context(&fc->next, get_current_context(current_cpu()));
+    init_closure_func(&fc->io_complete, status_handler, file_copy_io_complete);
+    init_closure_func(&fc->cloned, fs_status_handler, file_copy_cloned);
+    begin_file_write(out, len);
+    apply((thunk)&fc->next);
+    return thread_maybe_sleep_uninterruptible(t);
+  out:
+    fdesc_put(&in->f);
+    fdesc_put(&out->f);
+    return rv;
+}
+
+/* Checks common to copy_file_range() and the clone ioctls. */
+static sysreturn file_copy_check(fdesc in, fdesc out)
+{
+    if (!fdesc_is_readable(in) || !fdesc_is_writable(out) || (out->flags & O_APPEND))
+        return -EBADF;
+    if ((in->type == FDESC_TYPE_DIRECTORY) || (out->type == FDESC_TYPE_DIRECTORY))
+        return -EISDIR;
+    if ((in->type != FDESC_TYPE_REGULAR) || (out->type != FDESC_TYPE_REGULAR))
+        return -EINVAL;
+    return 0;
+}
+
+static boolean file_copy_overlaps(file in, u64 in_offset, file out, u64 out_offset, u64 len)
+{
+    return (in->fsf == out->fsf) &&
+           ranges_intersect(irangel(in_offset, len), irangel(out_offset, len));
+}
+
+static sysreturn copy_file_range(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len,
+                                 unsigned int flags)
+{
+    s64 in_offset, out_offset;
+    if (flags)
+        return -EINVAL;
+    if (off_in) {
+        if (!get_user_value(off_in, &in_offset))
+            return -EFAULT;
+        if (in_offset < 0)
+            return -EINVAL;
+    }
+    if (off_out) {
+        if (!get_user_value(off_out, &out_offset))
+            return -EFAULT;
+        if (out_offset < 0)
+            return -EINVAL;
+    }
+    fdesc infile = resolve_fd(current->p, fd_in);
+    fdesc outfile = fdesc_get(current->p, fd_out);
+    if (!outfile) {
+        fdesc_put(infile);
+        return -EBADF;
+    }
+    sysreturn rv = file_copy_check(infile, outfile);
+    if (rv < 0)
+        goto out;
+    file in = (file)infile, out = (file)outfile;
+    if (!off_in)
+        in_offset = in->offset;
+    if (!off_out)
+        out_offset = out->offset;
+    u64 in_length = fsfile_get_length(in->fsf);
+    len = (in_offset < in_length) ? MIN(len, in_length - in_offset) : 0;
+    if (len == 0)
+        goto out;
+    if (out_offset + len < out_offset) {
+        rv = -EFBIG;
+        goto out;
+    }
+    if (file_copy_overlaps(in, in_offset, out, out_offset, len)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    rv = file_check_seals(out, out_offset, len);
+    if (rv < 0)
+        goto out;
+    return file_copy_start(in, in_offset, out, out_offset, len, off_in, off_out, false);
+  out:
+    fdesc_put(infile);
+    fdesc_put(outfile);
+    return rv;
+}
+
+/* FICLONE and FICLONERANGE: the whole range must be cloned. Takes ownership of the reference to the
+ * destination file descriptor. */
+static sysreturn file_clone_ioctl(fdesc outfile, unsigned long request, void *arg)
+{
+    struct file_clone_range fcr;
+    if (request == FICLONE) {
+        fcr.src_fd = (int)u64_from_pointer(arg);
+        fcr.src_offset = fcr.src_length = fcr.dest_offset = 0;
+    } else if (!copy_from_user(arg, &fcr, sizeof(fcr))) {
+        fdesc_put(outfile);
+        return -EFAULT;
+    }
+    fdesc infile = fdesc_get(current->p, fcr.src_fd);
+    if (!infile) {
+        fdesc_put(outfile);
+        return -EBADF;
+    }
+    sysreturn rv = file_copy_check(infile, outfile);
+    if (rv < 0)
+        goto out;
+    file in = (file)infile, out = (file)outfile;
+    u64 in_length = fsfile_get_length(in->fsf);
+    u64 len = fcr.src_length;
+    if (fcr.src_offset > in_length) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (len == 0) {
+        len = in_length - fcr.src_offset;   /* clone to the end of the source file */
+        if (len == 0)
+            goto out;
+    } else if ((fcr.src_offset + len < fcr.src_offset) || (fcr.src_offset + len > in_length) ||
+               (fcr.dest_offset + len < fcr.dest_offset)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (file_copy_overlaps(in, fcr.src_offset, out, fcr.dest_offset, len)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    rv = file_check_seals(out, fcr.dest_offset, len);
+    if (rv < 0)
+        goto out;
+    return file_copy_start(in, fcr.src_offset, out, fcr.dest_offset, len, 0, 0, true);
+  out:
+    fdesc_put(infile);
+    fdesc_put(outfile);
+    return rv;
+}
+
 closure_func_basic(fdesc_close, sysreturn, file_close,
                    context ctx, io_completion completion)
 {
@@ -2083,6 +2395,15 @@ sysreturn ioctl(int fd, unsigned long request, ...)
     vlist args;
     sysreturn rv;
     vstart(args, request);
+    switch (request) {
+    case FICLONE:
+    case FICLONERANGE: {
+        /* the file descriptor is released when the operation completes, since it may sleep */
+        void *arg = varg(args, void *);
+        vend(args);
+        return file_clone_ioctl(f, request, arg);
+    }
+    }
     if (f->ioctl)
         rv = apply(f->ioctl, request, args);
     else
@@ -2250,6 +2571,8 @@ sysreturn prctl(int option, u64 arg2, u64 arg3, u64 arg4, u64 arg5)
         if (!copy_to_user((void *)arg2, current->name, sizeof(current->name)))
             return -EFAULT;
         break;
+    case PR_NANOS_SNAPSHOT:
+        return snapshot_process(current);
     }
 
     return 0;
@@ -2288,9 +2611,8 @@ sysreturn getcpu(unsigned int *cpu, unsigned int *node, void *tcache)
         return -EFAULT;
     if (cpu)
         *cpu = ci->id;
-    /* XXX to do */
     if (node)
-        *node = 0;
+        *node = ci->numa_node;
     context_clear_err(ctx);
     return 0;
 }
@@ -2339,6 +2661,7 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, preadv, preadv);
     register_syscall(map, pwritev, pwritev);
     register_syscall(map, sendfile, sendfile);
+    register_syscall(map, copy_file_range, copy_file_range);
     register_syscall(map, truncate, truncate);
     register_syscall(map, ftruncate, ftruncate);
     register_syscall(map, fdatasync, fdatasync);
@@ -2427,6 +2750,53 @@ static void syscall_context_pre_suspend(context ctx)
     check_syscall_context_replace(current_cpu(), ctx);
 }
 
+/* Objects are allocated from the arena only by the context that owns it (so that allocations are
+ * serialized), but may be freed from any context. Objects may outlive the syscall that allocated
+ * them: the arena holds a reference to its context while any object is live, so that the context
+ * (and the arena memory with it) is not freed until the last object is. */
+static u64 syscall_arena_alloc(heap h, bytes b)
+{
+    syscall_arena a = (syscall_arena)h;
+    syscall_context sc = struct_from_field(a, syscall_context, arena);
+    context ctx = &sc->uc.kc.context;
+    if (get_current_context(current_cpu()) == ctx) {
+        if (a->live == 0)
+            a->next = 0;
+        bytes size = pad(b, sizeof(u64));
+        if (a->next + size <= SYSCALL_CONTEXT_ARENA_SIZE) {
+            u64 p = u64_from_pointer(a->buf + a->next);
+            a->next += size;
+            if (fetch_and_add(&a->live, 1) == 0)
+                context_reserve_refcount(ctx);
+            return p;
+        }
+    }
+    return allocate_u64(a->parent, b);
+}
+
+static void syscall_arena_dealloc(heap h, u64 x, bytes b)
+{
+    syscall_arena a = (syscall_arena)h;
+    if ((x >= u64_from_pointer(a->buf)) && (x < u64_from_pointer(a->buf + SYSCALL_CONTEXT_ARENA_SIZE))) {
+        if (fetch_and_add(&a->live, (word)-1) == 1)
+            context_release_refcount(&struct_from_field(a, syscall_context, arena)->uc.kc.context);
+    } else {
+        deallocate_u64(a->parent, x, b);
+    }
+}
+
+static void syscall_arena_init(syscall_context sc, heap parent)
+{
+    syscall_arena a = &sc->arena;
+    zero(&a->h, sizeof(a->h));
+    a->h.alloc = syscall_arena_alloc;
+    a->h.dealloc = syscall_arena_dealloc;
+    a->parent = parent;
+    a->next = 0;
+    a->live = 0;
+    sc->uc.kc.context.transient_heap = &a->h;
+}
+
 syscall_context allocate_syscall_context(cpuinfo ci)
 {
     build_assert((SYSCALL_CONTEXT_SIZE & (SYSCALL_CONTEXT_SIZE - 1)) == 0);
@@ -2440,6 +2810,7 @@ syscall_context allocate_syscall_context(cpuinfo ci)
     c->pause = syscall_context_pause;
     c->resume = syscall_context_resume;
     c->pre_suspend = syscall_context_pre_suspend;
+    syscall_arena_init(sc, c->transient_heap);
     return sc;
 }
 
@@ -2466,7 +2837,7 @@ void syscall_handler(thread t)
     ctx->fault_handler = t->context.fault_handler;
     sc->start_time = 0;
     sc->call = call;
-    assert(ctx->refcount.c == 1);
+    assert((ctx->refcount.c == 1) || (ctx->refcount.c == 2));    /* see syscall_arena_alloc() */
     t->syscall = sc;
     context_pause(&t->context);
     context_release(&t->context);
@@ -123,6 +123,16 @@ struct flock {
 #define FIONCLEX        0x5450
 #define FIOCLEX         0x5451
 
+#define FICLONE         0x40049409
+#define FICLONERANGE    0x4020940d
+
+struct file_clone_range {
+    s64 src_fd;
+    u64 src_offset;
+    u64 src_length;
+    u64 dest_offset;
+};
+
 #define AT_NULL         0               /* End of vector */
 #define AT_IGNORE       1               /* Entry should be ignored */
 #define AT_EXECFD       2               /* File descriptor of program */
@@ -192,8 +202,47 @@ struct flock {
 #define MS_SYNC       4
 
 /* madvise */
+#define MADV_NORMAL         0
+#define MADV_RANDOM         1
+#define MADV_SEQUENTIAL     2
+#define MADV_WILLNEED       3
+#define MADV_DONTNEED       4
+#define MADV_FREE           8
+#define MADV_REMOVE         9
+#define MADV_DONTFORK       10
+#define MADV_DOFORK         11
+#define MADV_MERGEABLE      12
+#define MADV_UNMERGEABLE    13
 #define MADV_HUGEPAGE       14
 #define MADV_NOHUGEPAGE     15
+#define MADV_DONTDUMP       16
+#define MADV_DODUMP         17
+#define MADV_WIPEONFORK     18
+#define MADV_KEEPONFORK     19
+#define MADV_COLD           20
+#define MADV_PAGEOUT        21
+
+/* NUMA memory policies */
+#define MPOL_DEFAULT        0
+#define MPOL_PREFERRED      1
+#define MPOL_BIND           2
+#define MPOL_INTERLEAVE     3
+#define MPOL_LOCAL          4
+#define MPOL_MAX            5
+
+#define MPOL_F_STATIC_NODES     (1 << 15)
+#define MPOL_F_RELATIVE_NODES   (1 << 14)
+#define MPOL_MODE_FLAGS         (MPOL_F_STATIC_NODES | MPOL_F_RELATIVE_NODES)
+
+/* get_mempolicy flags */
+#define MPOL_F_NODE         (1 << 0)
+#define MPOL_F_ADDR         (1 << 1)
+#define MPOL_F_MEMS_ALLOWED (1 << 2)
+
+/* mbind flags */
+#define MPOL_MF_STRICT      (1 << 0)
+#define MPOL_MF_MOVE        (1 << 1)
+#define MPOL_MF_MOVE_ALL    (1 << 2)
 
 typedef int clockid_t;
 
@@ -859,11 +908,16 @@ struct io_uring_params {
 #define SO_ACCEPTCONN   30
 #define SO_PROTOCOL     38
 #define SO_DOMAIN       39
+#define SO_BUSY_POLL    46
+#define SO_INCOMING_CPU 49
+#define SO_ZEROCOPY     60
+#define SO_PREFER_BUSY_POLL 69
 
 #define IP_TOS              1
 #define IP_TTL              2
 #define IP_OPTIONS          4
 #define IP_MTU_DISCOVER     10
+#define IP_RECVERR          11
 #define IP_MINTTL           21
 #define IP_MULTICAST_IF     32
 #define IP_MULTICAST_TTL    33
@@ -875,6 +929,7 @@ struct io_uring_params {
 #define IPV6_MULTICAST_IF   17
 #define IPV6_MULTICAST_HOPS 18
 #define IPV6_MULTICAST_LOOP 19
+#define IPV6_RECVERR        25
 #define IPV6_V6ONLY     26
 #define IPV6_RECVPKTINFO    49
 #define IPV6_RECVHOPLIMIT   51
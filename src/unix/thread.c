@@ -73,6 +73,7 @@ static sysreturn clone_internal(struct clone_args_internal *args)
 
      clone_frame_pstate(f, thread_frame(current));
      thread_clone_sigmask(t, current);
+     t->mpol = current->mpol;
 
      set_syscall_return(t, 0);
      f[SYSCALL_FRAME_SP] = (u64)stack + stack_size;
@@ -437,6 +438,9 @@ thread create_thread(process p, u64 tid)
 
     t->signal_stack = 0;
     t->signal_stack_length = 0;
+    t->mpol.mode = MPOL_DEFAULT;
+    t->mpol.nodes = 0;
+    t->il_next = 0;
     bitmap affinity = allocate_bitmap(h, h, total_processors);
     if (affinity == INVALID_ADDRESS)
         goto fail_affinity;
@@ -547,3 +551,13 @@ void init_threads(process p)
     spin_lock_init(&p->threads_lock);
     init_futices(p);
 }
+
+void deinit_threads(process p)
+{
+    heap h = heap_locked(get_kernel_heaps());
+    assert(rbtree_get_count(p->threads) == 0);
+    deallocate_table(p->futices);
+    deallocate_closure(p->threads->key_compare);
+    deallocate_closure(p->threads->print_key);
+    deallocate(h, p->threads, sizeof(struct rbtree));
+}
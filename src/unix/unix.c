@@ -544,7 +544,7 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
         init_vdso(p);
     } else {
         p->virtual = 0;
-        p->vmaps = INVALID_ADDRESS;
+        p->vmaps = p->lazyfree = INVALID_ADDRESS;
     }
     filesystem_reserve(fs); /* because it hosts the current working directory */
     p->root_fs = p->cwd_fs = fs;
@@ -578,6 +578,36 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
     return p;
 }
 
+/* Releases a process that has been created but has never run; its threads must have been
+ * released already. */
+void deallocate_process(process p)
+{
+    if ((u64)p->pid - 1 < MAX_PROCESSES)
+        processes[p->pid - 1] = 0;
+    deallocate_vector(p->aio);
+    destroy_heap((heap)p->aio_ids);
+    deallocate_timerqueue(p->cpu_timers);
+    deallocate_vector(p->itimers);
+    deallocate_vector(p->posix_timers);
+    destroy_heap((heap)p->posix_timer_ids);
+    deallocate_notify_set(p->signalfds);
+    deinit_threads(p);
+    for (int fd = 0; fd < vector_length(p->files); fd++) {
+        fdesc f = vector_get(p->files, fd);
+        if (f) {
+            deallocate_fd(p, fd);
+            fdesc_put(f);
+        }
+    }
+    deallocate_vector(p->files);
+    destroy_heap((heap)p->fdallocator);
+    filesystem_release(p->cwd_fs);
+    if (p->pid > 1)
+        mmap_process_deinit(p);
+    deallocate_u64((heap)p->uh->processes, p->pid, 1);
+    deallocate(heap_locked(get_kernel_heaps()), p, sizeof(struct process));
+}
+
 void process_get_cwd(process p, filesystem *cwd_fs, inode *cwd)
 {
     process_lock(p);
@@ -5,6 +5,7 @@ typedef struct thread *thread;
 
 process init_unix(kernel_heaps kh, tuple root, filesystem fs);
 process create_process(unix_heaps uh, tuple root, filesystem fs);
+void deallocate_process(process p);
 void process_get_cwd(process p, filesystem *cwd_fs, inode *cwd);
 thread create_thread(process p, u64 tid);
 void exec_elf(process kp, string program_path, status_handler complete);
@@ -19,6 +19,8 @@
 #define VMAP_FLAG_BSS      0x2000
 #define VMAP_FLAG_TAIL_BSS 0x4000
 #define VMAP_FLAG_THP      0x8000   /* Transparent Huge Pages */
+#define VMAP_FLAG_SEQ_READ  0x10000 /* MADV_SEQUENTIAL */
+#define VMAP_FLAG_RAND_READ 0x20000 /* MADV_RANDOM */
 
 #define VMAP_MMAP_TYPE_MASK       0x0f00
 #define VMAP_MMAP_TYPE_ANONYMOUS  0x0100
@@ -152,6 +154,11 @@ typedef struct unix_heaps {
 #define BLOCKQ_BLOCK_REQUIRED       SYSRETURN_INVALID
 
 closure_type(io_completion, void, sysreturn rv);
+closure_type(busy_poll_cond, boolean);
+
+/* Busy polls the network devices (if configured) until cond returns true; used by waits on
+ * multiple file descriptors. Returns the value of cond. */
+boolean netsock_busy_poll_wait(busy_poll_cond cond);
 closure_type(blockq_action, sysreturn, u64 flags);
 closure_type(blockq_action_handler, void, blockq_action action);
 
@@ -184,11 +191,23 @@ typedef struct process_context {
 
 process_context get_process_context(void);
 
+/* Bump allocator for transient closures of a syscall context: it is reset when all allocated
+ * objects have been freed (i.e. typically when the syscall completes), and falls back to the parent
+ * heap when full. */
+typedef struct syscall_arena {
+    struct heap h;
+    heap parent;
+    bytes next;
+    word live;                  /* number of allocated objects */
+    u8 buf[SYSCALL_CONTEXT_ARENA_SIZE] __attribute__((aligned(sizeof(u64))));
+} *syscall_arena;
+
 typedef struct syscall_context {
     struct unix_context uc;
     thread t;                   /* corresponding thread */
     timestamp start_time;
     int call;                   /* syscall number */
+    struct syscall_arena arena;
 } *syscall_context;
 
 syscall_context allocate_syscall_context(cpuinfo ci);
@@ -292,6 +311,12 @@ pending_fault new_pending_fault_locked(process p, context ctx, u64 addr);
 
 #define thread_frame(t) ((t)->context.frame)
 
+/* NUMA memory policy */
+typedef struct mempolicy {
+    u16 mode;
+    u64 nodes;
+} *mempolicy;
+
 typedef struct thread {
     struct context context;
 
@@ -339,6 +364,9 @@ typedef struct thread {
     void *signal_stack;
     u64 signal_stack_length;
 
+    struct mempolicy mpol;  /* set by set_mempolicy syscall */
+    u32 il_next;            /* interleave counter */
+
     struct spinlock lock;   /* generic lock for struct members without a specific lock */
 
 #ifdef CONFIG_TRACELOG
@@ -437,6 +465,7 @@ typedef struct vmap {
         fdesc fd;
         u64 bss_offset;
     };
+    struct mempolicy mpol;  /* set by mbind syscall */
     status (*fault)(process p, context ctx, u64 vaddr, struct vmap *vm, pending_fault *pf);
 } *vmap;
 
@@ -506,6 +535,8 @@ typedef struct process {
     u64               mmap_min_addr;
     struct spinlock   vmap_lock;
     rangemap          vmaps;    /* process mappings */
+    rangemap          lazyfree; /* MADV_FREE ranges, reclaimable under memory pressure */
+    closure_struct(mem_cleaner, lazyfree_cleaner);
     vmap              stack_map;
     vmap              heap_map;
     struct aux        saved_aux[NAUX];
@@ -707,8 +738,10 @@ boolean validate_user_memory_permissions(process p, const void *buf, bytes lengt
 
 boolean fault_in_memory(const void *buf, bytes length);
 boolean fault_in_user_memory(const void *buf, bytes length, boolean writable);
+u64 pin_user_page(process p, u64 vaddr);
 
 void mmap_process_init(process p, tuple root);
+void mmap_process_deinit(process p);
 
 /* This "validation" is just a simple limit check right now, but this
    could optionally expand to do more rigorous validation (e.g. vmap
@@ -800,6 +833,7 @@ static inline sigaction sigaction_from_sig(thread t, int signum)
     return &t->p->sigactions[signum - 1];
 }
 
+boolean thread_signal_pending(thread t);
 boolean dispatch_signals(thread t);
 void deliver_signal_to_thread(thread t, struct siginfo *);
 void deliver_signal_to_process(process p, struct siginfo *);
@@ -967,6 +1001,7 @@ static inline u64 iov_total_len(struct iovec *iov, int iovcnt)
 
 void init_syscalls(process p);
 void init_threads(process p);
+void deinit_threads(process p);
 void init_futices(process p);
 
 sysreturn futex(int *uaddr, int futex_op, int val, u64 val2, int *uaddr2, int val3);
@@ -1019,6 +1054,7 @@ typedef struct special_file_wrapper {
 closure_type(spec_file_open, sysreturn, file f);
 
 void register_special_files(process p);
+sysreturn netsock_busy_poll_stats_read(file f, void *dest, u64 length, u64 offset);
 boolean create_special_file(sstring path, spec_file_open open, u64 size, u64 rdev);
 sysreturn spec_open(file f, tuple t);
 file spec_allocate(tuple t);
@@ -1029,9 +1065,13 @@ void reg_copy_out(struct core_regs *r, thread t);
 u64 fpreg_size(void);
 void fpreg_copy_out(void *b, thread t);
 
+sysreturn snapshot_process(thread t);
+void snapshot_restore(process kp, fsfile f, status_handler complete);
+
 /* Values to pass as first argument to prctl() */
 #define PR_SET_NAME    15               /* Set process name */
 #define PR_GET_NAME    16               /* Get process name */
+#define PR_NANOS_SNAPSHOT   0x4e530001  /* Save process snapshot (nanos-specific) */
 
 /* getrandom(2) flags */
 #define GRND_NONBLOCK               1
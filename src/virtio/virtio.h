@@ -7,3 +7,6 @@ void init_virtio_scsi(kernel_heaps kh, storage_attach a);
 void init_virtio_socket(kernel_heaps kh);
 
 void virtio_mmio_enum_devs(kernel_heaps kh);
+
+void virtqueue_print_stats(buffer b);
+void virtio_balloon_print_stats(buffer b);
@@ -22,6 +22,14 @@
 
 #define VIRTIO_BALLOON_RETRY_INTERVAL_SEC 5
 
+/* Free page reporting: free memory is reported to the host in chunks of 2 MB, up to
+ * VIRTIO_BALLOON_REPORT_CHUNKS chunks at a time; reporting runs periodically, and only covers (an
+ * estimate of) the memory that has been freed since the last report. */
+#define VIRTIO_BALLOON_REPORT_INTERVAL_SEC  2
+#define VIRTIO_BALLOON_REPORT_ORDER         21
+#define VIRTIO_BALLOON_REPORT_SIZE          U64_FROM_BIT(VIRTIO_BALLOON_REPORT_ORDER)
+#define VIRTIO_BALLOON_REPORT_CHUNKS        32
+
 /* Virtio interface is always 4K pages. */
 #define VIRTIO_BALLOON_PAGE_ORDER PAGELOG
 #define VIRTIO_BALLOON_PAGE_SIZE  U64_FROM_BIT(VIRTIO_BALLOON_PAGE_ORDER)
@@ -37,6 +45,9 @@
 #define VIRTIO_BALLOON_F_MUST_TELL_HOST 1
 #define VIRTIO_BALLOON_F_STATS_VQ       2
 #define VIRTIO_BALLOON_F_DEFLATE_ON_OOM 4
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT 8
+#define VIRTIO_BALLOON_F_PAGE_POISON    16
+#define VIRTIO_BALLOON_F_REPORTING      32
 
 struct virtio_balloon_stat {
 #define VIRTIO_BALLOON_S_SWAP_IN      0
@@ -64,8 +75,16 @@ struct virtio_balloon {
     virtqueue inflateq;
     virtqueue deflateq;
     virtqueue statsq;
+    virtqueue reportq;
     struct timer retry_timer;
     closure_struct(timer_handler, timer_task);
+    struct timer report_timer;
+    closure_struct(timer_handler, report_task);
+    closure_struct(vqfinish, report_complete);
+    u64 report_chunks[VIRTIO_BALLOON_REPORT_CHUNKS];
+    int report_count;   /* number of chunks being reported */
+    u64 report_free;    /* free memory after the last report */
+    u64 reported_bytes;
     struct virtio_balloon_stat *stats;
     u64 stats_phys;
     int next_tag;
@@ -89,7 +108,10 @@ struct virtio_balloon_config {
 #define VIRTIO_BALLOON_R_NUM_PAGES (offsetof(struct virtio_balloon_config *, num_pages))
 #define VIRTIO_BALLOON_R_ACTUAL    (offsetof(struct virtio_balloon_config *, actual))
 
-#define VIRTIO_BALLOON_DRV_FEATURES (VIRTIO_BALLOON_F_STATS_VQ | VIRTIO_BALLOON_F_MUST_TELL_HOST)
+/* Free page hinting is only used by the host during live migration, and page poisoning is not
+ * negotiated because freed pages are not poisoned. */
+#define VIRTIO_BALLOON_DRV_FEATURES (VIRTIO_BALLOON_F_STATS_VQ | VIRTIO_BALLOON_F_MUST_TELL_HOST | \
+                                     VIRTIO_BALLOON_F_REPORTING)
 
 static inline boolean balloon_must_tell_host(void)
 {
@@ -101,6 +123,11 @@ static inline boolean balloon_has_stats_vq(void)
     return (virtio_balloon.dev->features & VIRTIO_BALLOON_F_STATS_VQ) != 0;
 }
 
+static inline boolean balloon_has_reporting(void)
+{
+    return (virtio_balloon.dev->features & VIRTIO_BALLOON_F_REPORTING) != 0;
+}
+
 static void update_actual_pages(s64 delta)
 {
     assert(delta > 0 || virtio_balloon.actual_pages >= -delta);
@@ -349,6 +376,76 @@ closure_func_basic(timer_handler, void, virtio_balloon_timer_task,
     }
 }
 
+/* Chunks being reported are held by the driver (and thus cannot be used by the guest) until the
+ * host acknowledges the report, then they are returned to the physical heap. */
+closure_func_basic(vqfinish, void, virtio_balloon_report_complete,
+                   u64 len)
+{
+    for (int i = 0; i < virtio_balloon.report_count; i++)
+        deallocate_u64(virtio_balloon.physical, virtio_balloon.report_chunks[i],
+                       VIRTIO_BALLOON_REPORT_SIZE);
+    virtio_balloon.reported_bytes += virtio_balloon.report_count * VIRTIO_BALLOON_REPORT_SIZE;
+    virtio_balloon_verbose("%s: reported %d chunks (total %ld bytes)\n", func_ss,
+                           virtio_balloon.report_count, virtio_balloon.reported_bytes);
+    virtio_balloon.report_count = 0;
+    virtio_balloon.report_free = heap_free(virtio_balloon.physical);
+}
+
+static void virtio_balloon_report(void)
+{
+    if (virtio_balloon.report_count)
+        return;
+    heap physical = virtio_balloon.physical;
+    u64 free = heap_free(physical);
+    if (free <= virtio_balloon.report_free) {
+        /* memory has been allocated since the last report */
+        virtio_balloon.report_free = free;
+        return;
+    }
+    u64 chunks = MIN((free - virtio_balloon.report_free) >> VIRTIO_BALLOON_REPORT_ORDER,
+                     VIRTIO_BALLOON_REPORT_CHUNKS);
+    int count;
+    for (count = 0; count < chunks; count++) {
+        if (heap_free(physical) < BALLOON_MEMORY_MINIMUM + VIRTIO_BALLOON_REPORT_SIZE)
+            break;
+        u64 phys = allocate_u64(physical, VIRTIO_BALLOON_REPORT_SIZE);
+        if (phys == INVALID_PHYSICAL)
+            break;
+        virtio_balloon.report_chunks[count] = phys;
+    }
+    if (count == 0)
+        return;
+    virtio_balloon_verbose("%s: reporting %d chunks\n", func_ss, count);
+    virtqueue vq = virtio_balloon.reportq;
+    vqmsg m = allocate_vqmsg(vq);
+    assert(m != INVALID_ADDRESS);
+    for (int i = 0; i < count; i++)
+        vqmsg_push(vq, m, virtio_balloon.report_chunks[i], VIRTIO_BALLOON_REPORT_SIZE, true);
+    virtio_balloon.report_count = count;
+    vqmsg_commit(vq, m, (vqfinish)&virtio_balloon.report_complete);
+}
+
+closure_func_basic(timer_handler, void, virtio_balloon_report_task,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns != timer_disabled)
+        virtio_balloon_report();
+}
+
+static void virtio_balloon_init_reporting(void)
+{
+    /* memory that has never been used by the guest does not need to be reported */
+    virtio_balloon.report_free = heap_free(virtio_balloon.physical);
+    virtio_balloon.report_count = 0;
+    virtio_balloon.reported_bytes = 0;
+    init_closure_func(&virtio_balloon.report_complete, vqfinish, virtio_balloon_report_complete);
+    init_timer(&virtio_balloon.report_timer);
+    timestamp interval = seconds(VIRTIO_BALLOON_REPORT_INTERVAL_SEC);
+    register_timer(kernel_timers, &virtio_balloon.report_timer, CLOCK_ID_MONOTONIC, interval,
+                   false, interval, init_closure_func(&virtio_balloon.report_task, timer_handler,
+                                                      virtio_balloon_report_task));
+}
+
 static boolean virtio_balloon_attach(heap general, backed_heap backed, heap physical, vtdev v)
 {
     virtio_balloon_debug("   dev_features 0x%lx, features 0x%lx\n",
@@ -384,6 +481,16 @@ static boolean virtio_balloon_attach(heap general, backed_heap backed, heap phys
     } else {
         virtio_balloon.statsq = 0;
     }
+    if (balloon_has_reporting()) {
+        /* Virtqueue indexes are assigned to the queues that are present, in the order defined by
+         * the specification (the free page virtqueue is never present). */
+        s = virtio_alloc_virtqueue(v, ss("virtio balloon reportq"),
+                                   balloon_has_stats_vq() ? 3 : 2, &virtio_balloon.reportq);
+        if (!is_ok(s))
+            goto fail;
+    } else {
+        virtio_balloon.reportq = 0;
+    }
     virtio_balloon_debug("   virtqueues allocated, setting driver status OK\n");
     vtdev_set_status(v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
     update_actual_pages(0);
@@ -394,12 +501,24 @@ static boolean virtio_balloon_attach(heap general, backed_heap backed, heap phys
         deallocate_closure(bd);
     if (balloon_has_stats_vq())
         virtio_balloon_init_statsq();
+    if (balloon_has_reporting())
+        virtio_balloon_init_reporting();
     return true;
   fail:
     msg_err("vtbln failed to attach: %v", s);
     return false;
 }
 
+/* Prints the balloon size (in balloon pages) and the amount of memory reported as free to the
+ * host; nothing is printed if no balloon device is present. */
+void virtio_balloon_print_stats(buffer b)
+{
+    if (!virtio_balloon.dev)
+        return;
+    bprintf(b, "pages reporting reported_bytes\n%d %d %ld\n", virtio_balloon.actual_pages,
+            balloon_has_reporting(), virtio_balloon.reported_bytes);
+}
+
 closure_function(3, 1, boolean, vtpci_balloon_probe,
                  heap, general, backed_heap, backed, heap, physical,
                  pci_dev d)
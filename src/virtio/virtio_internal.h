@@ -127,6 +127,17 @@ physical virtqueue_used_paddr(struct virtqueue *vq);
 u16 virtqueue_entries(virtqueue vq);
 u16 virtqueue_free_entries(virtqueue vq);
 void virtqueue_set_polling(virtqueue vq, boolean enable);
+void virtqueue_set_batch_handler(virtqueue vq, thunk batch_complete, u16 budget);
+u16 virtqueue_busy_poll(virtqueue vq, u16 budget, boolean defer_events);
+
+typedef struct virtqueue_stats {
+    u64 interrupts;
+    u64 polls;                  /* batch processing passes */
+    u64 irq_completions;        /* completions retrieved on device notification */
+    u64 polled_completions;     /* completions retrieved by polling */
+    u64 delayed_notifications;
+    u64 busy_poll_completions;  /* completions retrieved by busy polling */
+} *virtqueue_stats;
 
 typedef struct vqmsg *vqmsg;
 
@@ -61,10 +61,15 @@
      VIRTIO_NET_F_MRG_RXBUF | VIRTIO_F_ANY_LAYOUT | VIRTIO_F_RING_EVENT_IDX |       \
      VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ)
 
+/* maximum number of packets processed by an rx queue before yielding to other work */
+#define VNET_RX_BUDGET  64
+
 typedef struct vnet_rx {
     virtqueue q;
     u32 seqno;
     struct virtio_net_hdr_mrg_rxbuf *hdr;
+    struct net_gro gro;
+    closure_struct(thunk, batch_complete);
 } *vnet_rx;
 
 typedef struct vnet {
@@ -78,6 +83,7 @@ typedef struct vnet {
     int rxbuflen;
     virtqueue *txq_map;
     vnet_rx rx;
+    u16 rx_queues;  /* number of rx queues set up */
     struct virtqueue *ctl;
     u64 empty_phys;
     void *empty; // just a mac..fix, from pre-heap days
@@ -110,6 +116,12 @@ closure_function(1, 1, void, tx_complete,
 }
 
 
+closure_func_basic(thunk, void, vnet_tx_flush)
+{
+    vnet vn = struct_from_closure(vnet, ndev.tx_flush);
+    virtqueue_kick(vn->txq_map[current_cpu()->id]);
+}
+
 static err_t low_level_output(struct netif *netif, struct pbuf *p)
 {
     vnet vn = netif->state;
@@ -124,8 +136,9 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
     for (struct pbuf * q = p; q != NULL; q = q->next)
         vqmsg_push(txq, m, physical_from_virtual(q->payload), q->len, false);
 
-    vqmsg_commit(txq, m, closure((heap)vn->txhandlers, tx_complete, p));
-    
+    vqmsg_commit_seqno(txq, m, closure((heap)vn->txhandlers, tx_complete, p), 0,
+                       !netif_tx_defer(&vn->ndev));
+
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
         /* broadcast or multicast packet*/
@@ -273,17 +286,35 @@ closure_func_basic(vqfinish, void, vnet_input,
             err = true;
         }
     }
-    if (!err)
-        err = (vn->ndev.n.input(&x->p.pbuf, &vn->ndev.n) != ERR_OK);
   out:
     if (err)
         receive_buffer_release(&x->p.pbuf);
+    else
+        gro_receive(&rx->gro, &x->p.pbuf);
     // we need to get a signal from the device side that there was
     // an underrun here to open up the window
     post_receive(vn, rx);
 }
 
 
+/* Invoked at the end of each batch of rx queue completions. */
+closure_func_basic(thunk, void, vnet_rx_batch_complete)
+{
+    vnet_rx rx = struct_from_closure(vnet_rx, batch_complete);
+    gro_flush(&rx->gro);
+}
+
+/* Busy polling: processes received packets from the calling context. */
+closure_func_basic(netif_dev_poll, u32, vnet_rx_poll,
+                   u32 budget, boolean defer_irq)
+{
+    vnet vn = struct_from_closure(vnet, ndev.rx_poll);
+    u32 processed = 0;
+    for (u16 i = 0; (i < vn->rx_queues) && (processed < budget); i++)
+        processed += virtqueue_busy_poll(vn->rx[i].q, budget - processed, defer_irq);
+    return processed;
+}
+
 static int post_receive(vnet vn, vnet_rx rx)
 {
     virtqueue rxq = rx->q;
@@ -460,6 +491,10 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
         rx[i].q = vq;
         rx[i].seqno = 0;
         rx[i].hdr = 0;
+        gro_init(&rx[i].gro, &vn->ndev.n);
+        virtqueue_set_batch_handler(vq, init_closure_func(&rx[i].batch_complete, thunk,
+                                                          vnet_rx_batch_complete),
+                                    VNET_RX_BUDGET);
         rxq_entries += virtqueue_entries(vq);
         vq_index++;
         s = virtio_alloc_vq_aff(dev, ss("virtio net tx"), vq_index, cpu_affinity, &vq);
@@ -490,7 +525,10 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
     virtio_net_debug("%s: net_header_len %d, rx_allocsize %d, rxbuffers_pagesize %d "
                      "tx_handler_size %d tx_handler_pagesize %d\n", func_ss, vn->net_header_len,
                      rx_allocsize, rxbuffers_pagesize, tx_handler_size, tx_handler_pagesize);
-    vn->rxbuffers = allocate_objcache(h, contiguous, rx_allocsize, rxbuffers_pagesize, true);
+    if (rx_allocsize <= PKTBUF_SIZE)
+        vn->rxbuffers = pktbuf_heap();
+    else
+        vn->rxbuffers = allocate_objcache(h, contiguous, rx_allocsize, rxbuffers_pagesize, true);
     if (vn->rxbuffers == INVALID_ADDRESS)
         goto err2;
     vn->txhandlers = allocate_objcache(h, contiguous, tx_handler_size, tx_handler_pagesize, true);
@@ -518,12 +556,16 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
         netif_set_link_up(&vn->ndev.n);
     }
     vtdev_set_status(dev, VIRTIO_CONFIG_STATUS_DRIVER_OK);
-    mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vnet_mem_cleaner));
+    write_barrier();
+    vn->rx_queues = vq_pairs;
+    if (vn->rxbuffers != pktbuf_heap())
+        mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vnet_mem_cleaner));
     return true;
   err4:
       destroy_heap((heap)vn->txhandlers);
   err3:
-    destroy_heap((heap)vn->rxbuffers);
+    if (vn->rxbuffers != pktbuf_heap())
+        destroy_heap((heap)vn->rxbuffers);
   err2:
     deallocate(h, vn->txq_map, total_processors * sizeof(vn->txq_map[0]));
   err1:
@@ -543,7 +585,11 @@ static void virtio_net_attach(vtdev dev)
     backed_heap contiguous = dev->contiguous;
     vnet vn = allocate(h, sizeof(struct vnet));
     assert(vn != INVALID_ADDRESS);
+    netif_dev_init(&vn->ndev);
     init_closure_func(&vn->ndev.setup, netif_dev_setup, virtio_net_setup);
+    init_closure_func(&vn->ndev.tx_flush, thunk, vnet_tx_flush);
+    init_closure_func(&vn->ndev.rx_poll, netif_dev_poll, vnet_rx_poll);
+    vn->rx_queues = 0;
     vn->net_header_len = (dev->features & VIRTIO_F_VERSION_1) ||
         (dev->features & VIRTIO_NET_F_MRG_RXBUF) != 0 ?
         sizeof(struct virtio_net_hdr_mrg_rxbuf) : sizeof(struct virtio_net_hdr);
@@ -428,6 +428,8 @@ closure_func_basic(storage_req_handler, void, virtio_scsi_req_handler,
     case STORAGE_OP_WRITE:
         virtio_scsi_io(d, SCSI_CMD_WRITE_16, req->data, req->blocks, req->completion);
         break;
+    default:
+        storage_op_unsupported(req);
     }
 }
 
@@ -12,12 +12,21 @@
 #define virtio_blk_debug(x, ...)
 #endif
 
+/* discard and write zeroes segment */
+struct virtio_blk_dwz_seg {
+    u64 sector;
+    u32 num_sectors;
+    u32 flags;
+} __attribute__((packed));
+
 // this is not really a struct...fix the general encoding problem
 typedef struct virtio_blk_req {
     u32 type;
     u32 reserved;
     u64 sector;
     u8 status;
+    u8 unused[7];
+    struct virtio_blk_dwz_seg seg;  /* discard and write zeroes requests only */
 } __attribute__((packed)) *virtio_blk_req;
 
 // device configuration offsets
@@ -42,7 +51,8 @@ struct virtio_blk_config {
        u32 opt_io_size;
     } topology;
     u8 writeback;
-    u8 unused0[3];
+    u8 unused0;
+    u16 num_queues;
     u32 max_discard_sectors;
     u32 max_discard_seg;
     u32 discard_sector_alignment;
@@ -60,6 +70,9 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_F_FLUSH      U64_FROM_BIT(9)
 #define VIRTIO_BLK_F_TOPOLOGY   U64_FROM_BIT(10)
 #define VIRTIO_BLK_F_CONFIG_WCE U64_FROM_BIT(11)
+#define VIRTIO_BLK_F_MQ         U64_FROM_BIT(12)
+#define VIRTIO_BLK_F_DISCARD    U64_FROM_BIT(13)
+#define VIRTIO_BLK_F_WRITE_ZEROES   U64_FROM_BIT(14)
 
 #define VIRTIO_BLK_R_CAPACITY_LOW                (offsetof(struct virtio_blk_config *, capacity))
 #define VIRTIO_BLK_R_CAPACITY_HIGH               (offsetof(struct virtio_blk_config *, capacity) + 4)
@@ -74,6 +87,7 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_R_TOPOLOGY_MIN_IO_SIZE        (offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, min_io_size))
 #define VIRTIO_BLK_R_TOPOLOGY_OPT_IO_SIZE        (offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, opt_io_size))
 #define VIRTIO_BLK_R_WRITEBACK                   (offsetof(struct virtio_blk_config *, writeback))
+#define VIRTIO_BLK_R_NUM_QUEUES                  (offsetof(struct virtio_blk_config *, num_queues))
 #define VIRTIO_BLK_R_MAX_DISCARD_SECTORS         (offsetof(struct virtio_blk_config *, max_discard_sectors))
 #define VIRTIO_BLK_R_MAX_DISCARD_SEG             (offsetof(struct virtio_blk_config *, max_discard_seg))
 #define VIRTIO_BLK_R_DISCARD_SECTOR_ALIGNMENT    (offsetof(struct virtio_blk_config *, discard_sector_alignment))
@@ -87,23 +101,36 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
 #define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_T_DISCARD    11
+#define VIRTIO_BLK_T_WRITE_ZEROES   13
+
+#define VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP  U64_FROM_BIT(0)
 
 #define VIRTIO_BLK_S_OK         0
 #define VIRTIO_BLK_S_IOERR      1
 #define VIRTIO_BLK_S_UNSUPP     2
 
-#define VIRTIO_BLK_DRIVER_FEATURES  \
-    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH)
+#define VIRTIO_BLK_DRIVER_FEATURES                                                              \
+    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH |  \
+     VIRTIO_BLK_F_MQ | VIRTIO_BLK_F_DISCARD | VIRTIO_BLK_F_WRITE_ZEROES)
 
 typedef struct storage {
     vtdev v;
     closure_struct(storage_req_handler, req_handler);
-    struct virtqueue *command;
+    struct virtqueue **queue_map;   /* per-CPU request queue */
     u64 capacity;
     u64 block_size;
     u32 seg_max;
+    u32 max_discard_sectors;
+    u32 max_write_zeroes_sectors;
+    boolean write_zeroes_unmap;
 } *storage;
 
+static inline virtqueue virtio_blk_queue(storage st)
+{
+    return st->queue_map[current_cpu()->id];
+}
+
 static virtio_blk_req allocate_virtio_blk_req(storage st, u32 type, u64 sector, u64 *phys)
 {
     virtio_blk_req req = alloc_map(st->v->contiguous, sizeof(struct virtio_blk_req), phys);
@@ -155,7 +182,7 @@ static inline void storage_rw_internal(storage st, boolean write, void * buf,
         apply(sh, timm_oom);
         return;
     }
-    virtqueue vq = st->command;
+    virtqueue vq = virtio_blk_queue(st);
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
@@ -186,7 +213,7 @@ static void virtio_storage_io_sg(storage st, boolean write, sg_list sg, range bl
     virtio_blk_req req = 0;
     u64 req_phys;
     heap h = st->v->general;
-    virtqueue vq = st->command;
+    virtqueue vq = virtio_blk_queue(st);
     vqmsg msg;
     u32 desc_count;
     merge m = 0;
@@ -226,6 +253,41 @@ static void virtio_storage_io_sg(storage st, boolean write, sg_list sg, range bl
         apply(sh, STATUS_OK);
 }
 
+/* Discard and write zeroes requests are issued with a single segment each. */
+static void virtio_storage_dwz(storage st, u32 type, range blocks, status_handler sh)
+{
+    virtio_blk_debug("%s: type %d, blocks %R, sh %F\n", func_ss, type, blocks, sh);
+    u64 max_sectors = (type == VIRTIO_BLK_T_DISCARD) ? st->max_discard_sectors :
+                                                      st->max_write_zeroes_sectors;
+    virtqueue vq = virtio_blk_queue(st);
+    merge m = 0;
+    while (range_span(blocks)) {
+        u64 req_phys;
+        virtio_blk_req req = allocate_virtio_blk_req(st, type, 0, &req_phys);
+        if (req == INVALID_ADDRESS) {
+            apply(m ? apply_merge(m) : sh, timm_oom);
+            break;
+        }
+        u64 nsectors = MIN(range_span(blocks), max_sectors);
+        req->seg.sector = blocks.start;
+        req->seg.num_sectors = nsectors;
+        req->seg.flags = ((type == VIRTIO_BLK_T_WRITE_ZEROES) && st->write_zeroes_unmap) ?
+                         VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP : 0;
+        blocks.start += nsectors;
+        vqmsg msg = allocate_vqmsg(vq);
+        assert(msg != INVALID_ADDRESS);
+        vqmsg_push(vq, msg, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
+        vqmsg_push(vq, msg, req_phys + offsetof(virtio_blk_req, seg), sizeof(req->seg), false);
+        if (!m && range_span(blocks)) {
+            m = allocate_merge(st->v->general, sh);
+            sh = apply_merge(m);
+        }
+        virtio_storage_io_commit(st, vq, msg, req, req_phys, m ? apply_merge(m) : sh);
+    }
+    if (m)
+        apply(sh, STATUS_OK);
+}
+
 static void storage_flush(storage st, status_handler s)
 {
     virtio_blk_debug("%s: handler %p (%F)\n", func_ss, s, s);
@@ -235,7 +297,7 @@ static void storage_flush(storage st, status_handler s)
         apply(s, timm_oom);
         return;
     }
-    virtqueue vq = st->command;
+    virtqueue vq = virtio_blk_queue(st);
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
@@ -268,6 +330,20 @@ closure_func_basic(storage_req_handler, void, virtio_storage_req_handler,
     case STORAGE_OP_WRITE:
         storage_rw_internal(st, true, req->data, req->blocks, req->completion);
         break;
+    case STORAGE_OP_ZERO:
+        if (st->max_write_zeroes_sectors)
+            virtio_storage_dwz(st, VIRTIO_BLK_T_WRITE_ZEROES, req->blocks, req->completion);
+        else
+            storage_op_unsupported(req);
+        break;
+    case STORAGE_OP_DISCARD:
+        if (st->max_discard_sectors)
+            virtio_storage_dwz(st, VIRTIO_BLK_T_DISCARD, req->blocks, req->completion);
+        else
+            storage_op_unsupported(req);
+        break;
+    default:
+        storage_op_unsupported(req);
     }
 }
 
@@ -282,7 +358,41 @@ static void virtio_blk_attach(heap general, storage_attach a, vtdev v)
     s->capacity = (vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_LOW) |
 		   ((u64) vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_HIGH) << 32)) * s->block_size;
     virtio_blk_debug("%s: capacity 0x%lx, block size 0x%x\n", func_ss, s->capacity, s->block_size);
-    virtio_alloc_virtqueue(v, ss("virtio blk"), 0, &s->command);
+    u64 num_queues = (v->features & VIRTIO_BLK_F_MQ) ?
+            vtdev_cfg_read_2(v, VIRTIO_BLK_R_NUM_QUEUES) : 1;
+    num_queues = MAX(MIN(num_queues, total_processors), 1);
+    virtio_blk_debug("   %ld request queues\n", num_queues);
+    s->queue_map = allocate(general, total_processors * sizeof(s->queue_map[0]));
+    assert(s->queue_map != INVALID_ADDRESS);
+
+    /* Distribute CPUs evenly among queues, so that each CPU submits requests to (and receives
+     * completion interrupts from) its own queue. */
+    u64 cpus_per_queue = total_processors / num_queues;
+    u64 excess_cpus = total_processors % num_queues;
+    u64 first_cpu = 0, num_cpus = 0;
+    for (u64 i = 0; i < num_queues; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_queue + 1) : cpus_per_queue;
+        virtqueue vq;
+        status st = virtio_alloc_vq_aff(v, ss("virtio blk"), i,
+                                        (num_queues > 1) ? irangel(first_cpu, num_cpus) :
+                                                           irange(0, 0), &vq);
+        assert(is_ok(st));
+        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
+            s->queue_map[j] = vq;
+    }
+    if (v->features & VIRTIO_BLK_F_DISCARD)
+        s->max_discard_sectors = vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_DISCARD_SECTORS);
+    else
+        s->max_discard_sectors = 0;
+    if (v->features & VIRTIO_BLK_F_WRITE_ZEROES) {
+        s->max_write_zeroes_sectors = vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_WRITE_ZEROS_SECTORS);
+        s->write_zeroes_unmap = vtdev_cfg_read_1(v, VIRTIO_BLK_R_WRITE_ZEROS_MAY_UNMAP) != 0;
+    } else {
+        s->max_write_zeroes_sectors = 0;
+    }
+    virtio_blk_debug("   max discard sectors %d, max write zeroes sectors %d\n",
+                     s->max_discard_sectors, s->max_write_zeroes_sectors);
 
     s->seg_max = (v->features & VIRTIO_BLK_F_SEG_MAX) ?
             vtdev_cfg_read_4(v, VIRTIO_BLK_R_SEG_MAX) : 1;
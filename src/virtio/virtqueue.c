@@ -43,6 +43,9 @@
 # define virtqueue_debug_verbose(...) do { } while(0)
 #endif // defined(VIRTQUEUE_DEBUG_VERBOSE)
 
+#define VQ_EVENT_DELAY_MAX      32
+#define VQ_EVENT_DELAY_TIMEOUT  microseconds(50)
+
 #define VQ_RING_DESC_CHAIN_END  32768
 #define VRING_DESC_F_NEXT       1
 #define VRING_DESC_F_WRITE      2
@@ -104,11 +107,28 @@ typedef struct virtqueue {
     u16 last_used_idx;          /* irq only */
     struct list msg_queue;
     struct list free_msgs;
+    thunk batch_complete;
+    u16 budget;
+    u16 event_delay;
+    u64 run_completions;        /* since last re-enabling of notifications */
+    boolean service_scheduled;
+    boolean service_notified;
+    closure_struct(thunk, service);
+    struct timer delay_timer;
+    closure_struct(timer_handler, delay_timeout);
+    struct virtqueue_stats stats;
+    struct list l;              /* in the list of all virtqueues */
     u32 msg_seqno;
     struct spinlock lock;
     vqmsg msgs[0];
 } *virtqueue;
 
+/* all allocated virtqueues, for statistics reporting */
+static struct list virtqueues = {
+    &virtqueues, &virtqueues
+};
+static struct spinlock virtqueues_lock;
+
 /* Most uses here are a chain of 3 or less descriptors. */
 #define VQMSG_DEFAULT_SIZE     3
 vqmsg allocate_vqmsg(virtqueue vq)
@@ -154,6 +174,8 @@ void vqmsg_push(virtqueue vq, vqmsg m, u64 phys_addr, u32 len, boolean write)
 }
 
 static void virtqueue_fill(virtqueue vq);
+static void vq_enable_events(virtqueue vq);
+static void vq_disable_events(virtqueue vq);
 
 /* If seqno is non-null, the value it points to is set to a sequence number whose value is
  * initialized (when the virtqueue is created) to zero and incremented by one each time this
@@ -181,42 +203,223 @@ void virtqueue_kick(virtqueue vq)
     spin_unlock_irq(lock, irqflags);
 }
 
-static void vq_poll(virtqueue vq)
+/* Returns the next message completed by the device (if any), after reclaiming its descriptors. */
+static vqmsg vq_get_used(virtqueue vq)
+{
+    if (vq->last_used_idx == vq->used->idx)
+        return 0;
+    volatile struct vring_used_elem *uep = vq->used->ring + (vq->last_used_idx & (vq->entries - 1));
+    virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
+                            func_ss, vq->name, vq->last_used_idx, uep->id, uep->len);
+    u16 head = uep->id;
+    vqmsg m = vq->msgs[head];
+
+    /* return descriptor(s) to free list */
+    int dcount = 1;
+    volatile struct vring_desc *d = vq->desc + head;
+    while ((d->flags & VRING_DESC_F_NEXT)) {
+        d = vq->desc + d->next;
+        dcount++;
+    }
+    assert(dcount == m->count);
+    d->next = vq->desc_idx;
+    vq->desc_idx = head;
+
+    vq->last_used_idx++;
+    fetch_and_add(&vq->free_cnt, m->count);
+    m->len = uep->len;
+    vq->msgs[head] = 0;
+    virtqueue_debug("add msg %p\n", m);
+    return m;
+}
+
+static u64 vq_poll(virtqueue vq)
 {
     // ensure we see up-to-date used->idx (updated by host)
     memory_barrier();
-    
-    while (vq->last_used_idx != vq->used->idx) {
-        volatile struct vring_used_elem *uep = vq->used->ring + (vq->last_used_idx & (vq->entries - 1));
-        virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
-                                func_ss, vq->name, vq->last_used_idx, uep->id, uep->len);
-        u16 head = uep->id;
-        vqmsg m = vq->msgs[head];
-
-        /* return descriptor(s) to free list */
-        int dcount = 1;
-        volatile struct vring_desc *d = vq->desc + head;
-        while ((d->flags & VRING_DESC_F_NEXT)) {
-            d = vq->desc + d->next;
-            dcount++;
-        }
-        assert(dcount == m->count);
-        d->next = vq->desc_idx;
-        vq->desc_idx = head;
-
-        vq->last_used_idx++;
-        fetch_and_add(&vq->free_cnt, m->count);
-        m->len = uep->len;
-        vq->msgs[head] = 0;
-        virtqueue_debug("add msg %p\n", m);
 
+    u64 count = 0;
+    vqmsg m;
+    while ((m = vq_get_used(vq))) {
         async_apply_1(m->completion, (void*)m->len);
 
         /* TODO should probably observe a limit / drain method here */
         list_insert_after(&vq->free_msgs, &m->l);
+        count++;
+    }
+    return count;
+}
+
+/* Moves up to budget completed messages to the batch list. */
+static u16 vq_collect(virtqueue vq, struct list *batch, u16 budget)
+{
+    memory_barrier();
+    u16 count = 0;
+    vqmsg m;
+    while ((count < budget) && (m = vq_get_used(vq))) {
+        list_push_back(batch, &m->l);
+        count++;
+    }
+    return count;
+}
+
+/* Called with lock held. */
+static void vq_schedule_service(virtqueue vq)
+{
+    vq_disable_events(vq);
+    vq->service_scheduled = true;
+    vq->service_notified = true;
+    async_apply_bh((thunk)&vq->service);
+}
+
+/* Re-enables device notifications when a batching virtqueue has been drained. With
+ * VIRTIO_F_RING_EVENT_IDX, under sustained load the notification is delayed until a few more
+ * buffers are used: the delay grows while the service keeps exhausting its budget and shrinks
+ * otherwise, and a timer bounds the latency added to a lone completion. */
+static void vq_enable_events_adaptive(virtqueue vq)
+{
+    if (!(vq->dev->features & VIRTIO_F_RING_EVENT_IDX)) {
+        vq_enable_events(vq);
+        return;
+    }
+    if (vq->run_completions >= vq->budget)
+        vq->event_delay = MIN(MAX(2 * vq->event_delay, 1),
+                              MIN(VQ_EVENT_DELAY_MAX, vq->entries / 4));
+    else
+        vq->event_delay /= 2;
+    vq->run_completions = 0;
+    *vq->used_event = vq->last_used_idx + vq->event_delay;
+    vq->events_enabled = true;
+    if (vq->event_delay) {
+        vq->stats.delayed_notifications++;
+        if (!timer_is_active(&vq->delay_timer))
+            register_timer(kernel_timers, &vq->delay_timer, CLOCK_ID_MONOTONIC,
+                           VQ_EVENT_DELAY_TIMEOUT, false, 0, (timer_handler)&vq->delay_timeout);
     }
 }
 
+/* Processes completed messages of a batching virtqueue with notifications disabled: completions
+ * are invoked in order on a single CPU, and the batch completion handler is invoked after each
+ * batch. After processing up to budget messages, the service yields to other bottom halves and
+ * is rescheduled; notifications are re-enabled only when the ring has been drained. */
+closure_func_basic(thunk, void, vq_service)
+{
+    virtqueue vq = struct_from_closure(virtqueue, service);
+    struct list batch;
+    u16 processed = 0;
+    list_init(&batch);
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    vq->stats.polls++;
+    while (processed < vq->budget) {
+        u16 count = vq_collect(vq, &batch, vq->budget - processed);
+        if (count == 0) {
+            vq_enable_events_adaptive(vq);
+
+            /* Poll again, to cover cases where a new buffer has been used after the previous poll
+             * but before re-enabling notifications. */
+            count = vq_collect(vq, &batch, vq->budget - processed);
+            if (count == 0) {
+                vq->service_scheduled = false;
+                spin_unlock_irq(&vq->lock, irqflags);
+                return;
+            }
+            vq_disable_events(vq);
+        }
+        if (vq->service_notified) {
+            vq->stats.irq_completions += count;
+            vq->service_notified = false;
+        } else {
+            vq->stats.polled_completions += count;
+        }
+        vq->run_completions += count;
+        spin_unlock_irq(&vq->lock, irqflags);
+        list_foreach(&batch, l) {
+            vqmsg m = struct_from_list(l, vqmsg, l);
+            apply(m->completion, m->len);
+        }
+        apply(vq->batch_complete);
+        irqflags = spin_lock_irq(&vq->lock);
+        list_foreach(&batch, l) {
+            list_delete(l);
+            list_insert_after(&vq->free_msgs, l);
+        }
+        processed += count;
+    }
+    async_apply_bh((thunk)&vq->service);
+    spin_unlock_irq(&vq->lock, irqflags);
+}
+
+closure_func_basic(timer_handler, void, vq_delay_timeout,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    virtqueue vq = struct_from_closure(virtqueue, delay_timeout);
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    if (!vq->service_scheduled) {
+        /* Stop delaying (or deferring, after a busy poll) notifications, so that a completion is
+         * not held indefinitely if the device does not use more buffers. */
+        vq_enable_events(vq);
+        memory_barrier();
+        if (vq->last_used_idx != vq->used->idx)
+            vq_schedule_service(vq);
+    }
+    spin_unlock_irq(&vq->lock, irqflags);
+}
+
+/* Processes up to budget completed messages of a batching virtqueue in the calling context (e.g.
+ * a thread busy-polling for network packets), unless the virtqueue service is scheduled (in which
+ * case the messages will be processed by the service). If defer_events is set and any message has
+ * been processed, device notifications are left disabled for a short time, in the expectation
+ * that the caller polls again soon; otherwise, they are re-enabled. Returns the number of
+ * processed messages. */
+u16 virtqueue_busy_poll(virtqueue vq, u16 budget, boolean defer_events)
+{
+    struct list batch;
+    list_init(&batch);
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    if (vq->service_scheduled) {
+        spin_unlock_irq(&vq->lock, irqflags);
+        return 0;
+    }
+    u16 count = vq_collect(vq, &batch, budget);
+    if (count == 0) {
+        spin_unlock_irq(&vq->lock, irqflags);
+        return 0;
+    }
+
+    /* prevent the service from running (and invoking completions) concurrently */
+    vq->service_scheduled = true;
+    vq->stats.busy_poll_completions += count;
+    spin_unlock_irq(&vq->lock, irqflags);
+    list_foreach(&batch, l) {
+        vqmsg m = struct_from_list(l, vqmsg, l);
+        apply(m->completion, m->len);
+    }
+    apply(vq->batch_complete);
+    irqflags = spin_lock_irq(&vq->lock);
+    list_foreach(&batch, l) {
+        list_delete(l);
+        list_insert_after(&vq->free_msgs, l);
+    }
+    vq->service_scheduled = false;
+    if (defer_events) {
+        vq_disable_events(vq);
+        if (!timer_is_active(&vq->delay_timer))
+            register_timer(kernel_timers, &vq->delay_timer, CLOCK_ID_MONOTONIC,
+                           VQ_EVENT_DELAY_TIMEOUT, false, 0, (timer_handler)&vq->delay_timeout);
+    } else {
+        /* The used event index may have been passed while processing messages, and a device
+         * notification may have been ignored because the service was marked as scheduled. */
+        vq_enable_events(vq);
+        memory_barrier();
+        if (vq->last_used_idx != vq->used->idx)
+            vq_schedule_service(vq);
+    }
+    spin_unlock_irq(&vq->lock, irqflags);
+    return count;
+}
+
 closure_function(1, 0, void, vq_interrupt,
                  virtqueue, vq)
 {
@@ -226,8 +429,15 @@ closure_function(1, 0, void, vq_interrupt,
                             vq->last_used_idx, vq->used->idx, vq->desc_idx);
 
     spin_lock(&vq->lock);
+    vq->stats.interrupts++;
+    if (vq->batch_complete) {
+        if (!vq->service_scheduled)
+            vq_schedule_service(vq);
+        spin_unlock(&vq->lock);
+        return;
+    }
   poll:
-    vq_poll(vq);
+    vq->stats.irq_completions += vq_poll(vq);
     if (!vq->polling && (vq->dev->features & VIRTIO_F_RING_EVENT_IDX) &&
         (vq->last_used_idx != *vq->used_event)) {
         *vq->used_event = vq->last_used_idx;
@@ -271,6 +481,9 @@ status virtqueue_alloc(vtdev dev,
     vq->free_cnt = size;
     list_init(&vq->msg_queue);
     list_init(&vq->free_msgs);
+    init_closure_func(&vq->service, thunk, vq_service);
+    init_timer(&vq->delay_timer);
+    init_closure_func(&vq->delay_timeout, timer_handler, vq_delay_timeout);
     spin_lock_init(&vq->lock);
 
     if ((vq->ring_mem = allocate_zero(&dev->contiguous->h, alloc)) == INVALID_ADDRESS) {
@@ -293,6 +506,9 @@ status virtqueue_alloc(vtdev dev,
     vq->desc[vq->entries - 1].next = VQ_RING_DESC_CHAIN_END;
 
     *t = closure(dev->general, vq_interrupt, vq);
+    spin_lock(&virtqueues_lock);
+    list_push_back(&virtqueues, &vq->l);
+    spin_unlock(&virtqueues_lock);
     *vqp = vq;
     return STATUS_OK;
 }
@@ -350,6 +566,33 @@ void virtqueue_set_polling(virtqueue vq, boolean enable)
     vq->polling = enable;
 }
 
+/* Must be called before any message is queued. */
+void virtqueue_set_batch_handler(virtqueue vq, thunk batch_complete, u16 budget)
+{
+    vq->batch_complete = batch_complete;
+    vq->budget = budget;
+}
+
+/* Prints the statistics of all virtqueues, one line per queue. The queue name, which may contain
+ * spaces, is in the last column. */
+void virtqueue_print_stats(buffer b)
+{
+    bprintf(b, "interrupts polls irq_completions polled_completions delayed_notifications "
+               "busy_poll_completions name\n");
+    spin_lock(&virtqueues_lock);
+    list_foreach(&virtqueues, l) {
+        virtqueue vq = struct_from_list(l, virtqueue, l);
+        struct virtqueue_stats stats;
+        u64 irqflags = spin_lock_irq(&vq->lock);
+        runtime_memcpy(&stats, &vq->stats, sizeof(stats));
+        spin_unlock_irq(&vq->lock, irqflags);
+        bprintf(b, "%ld %ld %ld %ld %ld %ld %s\n", stats.interrupts, stats.polls,
+                stats.irq_completions, stats.polled_completions, stats.delayed_notifications,
+                stats.busy_poll_completions, vq->name);
+    }
+    spin_unlock(&virtqueues_lock);
+}
+
 static int virtqueue_notify(virtqueue vq, u16 added)
 {
     // ensure used->flags update is visible to us
@@ -375,7 +618,7 @@ static void virtqueue_fill(virtqueue vq)
     u16 added = 0;
   begin:
     if (vq->polling)
-        vq_poll(vq);
+        vq->stats.polled_completions += vq_poll(vq);
     while (n && n != &vq->msg_queue) {
         vqmsg m = struct_from_list(n, vqmsg, l);
         virtqueue_debug_verbose("   vqmsg %p, count %d\n", m, m->count);
@@ -21,15 +21,21 @@
 # define vmxnet3_net_debug(...) do { } while (0)
 #endif // defined(VMXNET3_NET_DEBUG)
 
+typedef struct vmxnet3_rx {
+    struct vmxnet3 *vn;
+    struct vmxnet3_rxqueue *rxq;
+    queue servicequeue;
+    closure_struct(thunk, intr_handler);
+    closure_struct(thunk, service);     /* for bhqueue processing */
+} *vmxnet3_rx;
+
 typedef struct vmxnet3 {
     struct netif_dev ndev;
     vmxnet3_pci dev;
     caching_heap rxbuffers;
     int rxbuflen;
-    closure_struct(mem_cleaner, mem_cleaner);
-    thunk rx_intr_handler;
-    thunk rx_service;           /* for bhqueue processing */
-    queue rx_servicequeue;
+    vmxnet3_rx rx;
+    struct vmxnet3_txqueue **txq_map;   /* indexed by CPU id */
 } *vmxnet3;
 
 typedef struct xpbuf
@@ -39,12 +45,16 @@ typedef struct xpbuf
     struct list l;
 } *xpbuf;
 
-static void vmxnet3_interrupts_enable(vmxnet3_pci dev)
+static void vmxnet3_rxq_intr_enable(vmxnet3_pci dev, struct vmxnet3_rxqueue *rxq)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 0);
 }
 
+static void vmxnet3_rxq_intr_disable(vmxnet3_pci dev, struct vmxnet3_rxqueue *rxq)
+{
+    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 1);
+}
+
 boolean vmxnet3_probe(pci_dev d)
 {
     if (pci_get_vendor(d) != VMXNET3_VMWARE_VENDOR_ID)
@@ -107,13 +117,21 @@ void init_vmxnet3_driver_shared(vmxnet3_pci dev)
     // vmxnet3_queues_shared_alloc()
     vmx_ds->mtu = VMXNET3_RX_MAXSEGSIZE - sizeof(struct eth_hdr);
     vmx_ds->nrxsg_max = VMXNET3_MAX_RX_SEGS;
-    vmx_ds->ntxqueue = VMXNET3_DEF_TX_QUEUES;
-    vmx_ds->nrxqueue = VMXNET3_DEF_RX_QUEUES;
+    vmx_ds->ntxqueue = dev->ntxqueues;
+    vmx_ds->nrxqueue = dev->nrxqueues;
 
     vmx_ds->automask = 0;
-    vmx_ds->nintr = 2;
+    vmx_ds->nintr = 1 + dev->nrxqueues;
     vmx_ds->evintr = 0;
 
+    if (dev->vmx_rss) {
+        vmx_ds->upt_features |= UPT1_F_RSS;
+        vmx_ds->rss.version = 1;
+        vmx_ds->rss.paddr = physical_from_virtual(dev->vmx_rss);
+        assert(vmx_ds->rss.paddr != INVALID_PHYSICAL);
+        vmx_ds->rss.len = sizeof(*dev->vmx_rss);
+    }
+
     vmx_ds->rxmode = VMXNET3_RXMODE_UCAST | VMXNET3_RXMODE_MCAST | VMXNET3_RXMODE_BCAST |
         VMXNET3_RXMODE_ALLMULTI;
 
@@ -130,29 +148,34 @@ void init_vmxnet3_driver_shared(vmxnet3_pci dev)
 
 static void vmxnet3_interrupts_disable(vmxnet3_pci dev)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
-    struct vmxnet3_txqueue *txq = dev->vmx_txq[0];
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 1);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(txq->vxtxq_intr_idx), 1);
+    for (int i = 0; i < dev->nrxqueues; i++)
+        vmxnet3_rxq_intr_disable(dev, dev->vmx_rxq[i]);
+    for (int i = 0; i < dev->ntxqueues; i++)
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(dev->vmx_txq[i]->vxtxq_intr_idx), 1);
 }
 
-static void kick_pending(vmxnet3_pci dev)
+static void kick_pending(vmxnet3_pci dev, struct vmxnet3_txqueue *vmx_txq)
 {
-    struct vmxnet3_txqueue* vmx_txq = dev->vmx_txq[0];
     if (vmx_txq->vxtxq_ts->npending) {
         vmx_txq->vxtxq_ts->npending = 0;
-        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_TXH(0), vmx_txq->vxtxq_cmd_ring.vxtxr_head);
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_TXH(vmx_txq->vxtxq_id),
+                        vmx_txq->vxtxq_cmd_ring.vxtxr_head);
     }
 }
 
 static err_t low_level_output(struct netif *netif, struct pbuf *p)
 {
     vmxnet3 vn = netif->state;
-
-    err_t e = vmxnet3_isc_txd_encap(vn->dev, p);
+    if (!vn->txq_map)
+        return ERR_IF;
+    struct vmxnet3_txqueue *txq = vn->txq_map[current_cpu()->id];
+    u64 irqflags = spin_lock_irq(&txq->vxtxq_lock);
+    err_t e = vmxnet3_isc_txd_encap(txq, p);
+    if (e == ERR_OK)
+        kick_pending(vn->dev, txq);
+    spin_unlock_irq(&txq->vxtxq_lock, irqflags);
     if (e != ERR_OK)
         return e;
-    kick_pending(vn->dev)
 
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
@@ -212,7 +235,7 @@ static err_t vmxif_init(struct netif *netif)
         __func__,
         netif->hwaddr[0], netif->hwaddr[1], netif->hwaddr[2],
         netif->hwaddr[3], netif->hwaddr[4], netif->hwaddr[5]);
-    netif->mtu = vn->dev->vmx_ds->mtu;
+    netif->mtu = VMXNET3_RX_MAXSEGSIZE - sizeof(struct eth_hdr);
 
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
@@ -221,13 +244,11 @@ static err_t vmxif_init(struct netif *netif)
     return ERR_OK;
 }
 
-static void process_interrupt(vmxnet3 vn);
+static void process_interrupt(vmxnet3_rx rx);
 
-closure_function(1, 0, void, rx_interrupt,
-                 vmxnet3, vn)
+closure_func_basic(thunk, void, rx_interrupt)
 {
-    vmxnet3 vn = bound(vn);
-    process_interrupt(vn);
+    process_interrupt(struct_from_field(closure_self(), vmxnet3_rx, intr_handler));
 }
 
 static void receive_buffer_release(struct pbuf *p)
@@ -236,12 +257,12 @@ static void receive_buffer_release(struct pbuf *p)
     deallocate((heap)x->vn->rxbuffers, x, x->vn->rxbuflen + sizeof(struct xpbuf));
 }
 
-closure_function(1, 0, void, vmxnet3_rx_service_bh,
-                 vmxnet3, vn)
+closure_func_basic(thunk, void, vmxnet3_rx_service_bh)
 {
-    vmxnet3 vn = bound(vn);
+    vmxnet3_rx rx = struct_from_field(closure_self(), vmxnet3_rx, service);
+    vmxnet3 vn = rx->vn;
     list l;
-    while ((l = (list)dequeue(vn->rx_servicequeue)) != INVALID_ADDRESS) {
+    while ((l = (list)dequeue(rx->servicequeue)) != INVALID_ADDRESS) {
         struct list q;
         assert(l);
         assert(l->prev);
@@ -260,15 +281,7 @@ closure_function(1, 0, void, vmxnet3_rx_service_bh,
     }
 }
 
-void vmxnet3_newbuf(vmxnet3 vdev, int rid);
-
-closure_func_basic(mem_cleaner, u64, vmxnet3_mem_cleaner,
-                   u64 clean_bytes)
-{
-    vmxnet3 vn = struct_from_field(closure_self(), vmxnet3, mem_cleaner);
-    return cache_drain(vn->rxbuffers, clean_bytes,
-                       NET_RX_BUFFERS_RETAIN * (sizeof(struct xpbuf) + vn->rxbuflen));
-}
+void vmxnet3_newbuf(vmxnet3 vdev, struct vmxnet3_rxqueue *rxq, int rid);
 
 static void test_shared(vmxnet3 vn)
 {
@@ -297,7 +310,7 @@ static void test_shared(vmxnet3 vn)
     assert(vxtxq_ts->error == 0);
 
     struct vmxnet3_rxq_shared *vxrxq_rs = dev->vmx_rxq[0]->vxrxq_rs;
-    assert(dev->queues_shared_mem + sizeof(struct vmxnet3_txq_shared) == vxrxq_rs);
+    assert(dev->queues_shared_mem + dev->ntxqueues * sizeof(struct vmxnet3_txq_shared) == vxrxq_rs);
 
     assert(vxrxq_rs->update_rxhead == 0);
     assert(vxrxq_rs->cmd_ring[0] == physical_from_virtual(dev->rx_desc_mem));
@@ -324,7 +337,8 @@ static void test_shared(vmxnet3 vn)
         assert(rxr->vxrxr_desc_skips == 0);
         assert(rxr->vxrxr_refill_start == 0);
         for(int j = 0; j<rxr->vxrxr_ndesc; ++j) {
-            assert(rxr->vxrxr_rxd[j].addr == physical_from_virtual(dev->rx_pbuf[i][j]->payload));
+            assert(rxr->vxrxr_rxd[j].addr ==
+                   physical_from_virtual(dev->vmx_rxq[0]->vxrxq_pbuf[i][j]->payload));
             assert(rxr->vxrxr_rxd[j].btype == (i == 0 ? VMXNET3_BTYPE_HEAD : VMXNET3_BTYPE_BODY));
             assert(rxr->vxrxr_rxd[j].dtype == 0);
             assert(rxr->vxrxr_rxd[j].len == vn->rxbuflen);
@@ -345,9 +359,129 @@ static void test_shared(vmxnet3 vn)
 #endif
 }
 
+static void vmxnet3_rss_init(vmxnet3_pci dev)
+{
+    struct vmxnet3_rss_shared *rss = allocate_zero(dev->contiguous, sizeof(*rss));
+    assert(rss != INVALID_ADDRESS);
+    rss->hash_type = UPT1_RSS_HASH_TYPE_IPV4 | UPT1_RSS_HASH_TYPE_TCP_IPV4 |
+        UPT1_RSS_HASH_TYPE_IPV6 | UPT1_RSS_HASH_TYPE_TCP_IPV6;
+    rss->hash_func = UPT1_RSS_HASH_FUNC_TOEPLITZ;
+    rss->hash_key_size = UPT1_RSS_MAX_KEY_SIZE;
+    rss->ind_table_size = UPT1_RSS_MAX_IND_TABLE_SIZE;
+    for (int i = 0; i < UPT1_RSS_MAX_KEY_SIZE; i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(rss->hash_key + i, &r, sizeof(r));
+    }
+    for (int i = 0; i < UPT1_RSS_MAX_IND_TABLE_SIZE; i++)
+        rss->ind_table[i] = i % dev->nrxqueues;
+    dev->vmx_rss = rss;
+}
+
+/* Each rx queue interrupt is routed to a subset of CPUs, and each CPU transmits on the tx queue
+ * with the same index as the rx queue it serves. */
+static void vmxnet3_interrupts_setup(vmxnet3 vn, struct vmxnet3_txqueue **txq_map)
+{
+    vmxnet3_pci dev = vn->dev;
+    int nq = dev->nrxqueues;
+    u64 cpus_per_queue = total_processors / nq;
+    u64 excess_cpus = total_processors - cpus_per_queue * nq;
+    u64 first_cpu = 0, num_cpus = 0;
+    for (int i = 0; i < nq; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_queue + 1) : cpus_per_queue;
+        vmxnet3_rx rx = &vn->rx[i];
+        struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[i];
+        assert(pci_setup_msix_aff(dev->dev, rxq->vxrxq_intr_idx,
+                                  init_closure_func(&rx->intr_handler, thunk, rx_interrupt),
+                                  ss("vmxnet3 rx"), irangel(first_cpu, num_cpus)) !=
+               INVALID_PHYSICAL);
+        for (u64 cpu = first_cpu; cpu < first_cpu + num_cpus; cpu++)
+            txq_map[cpu] = dev->vmx_txq[i];
+    }
+    // interrupts are not used for tx
+}
+
+closure_func_basic(netif_dev_setup, boolean, vmxnet3_setup,
+                   tuple config)
+{
+    vmxnet3 vn = struct_from_closure(vmxnet3, ndev.setup);
+    vmxnet3_pci dev = vn->dev;
+    u64 nq = VMXNET3_DEF_QUEUES;
+    u64 io_queues;
+    if (config && get_u64(config, sym_this("io-queues"), &io_queues) && (io_queues > 0))
+        nq = MIN(nq, io_queues);
+    nq = MIN(nq, total_processors);
+
+    /* one MSI-X vector for each rx queue, plus the event vector */
+    int msix_avail = pci_enable_msix(dev->dev);
+    if (msix_avail < 2) {
+        msg_err("vmxnet3: insufficient MSI-X vectors (%d)", msix_avail);
+        return false;
+    }
+    nq = MIN(nq, msix_avail - 1);
+
+    /* the RSS indirection table spreads flows evenly only over a power-of-2 number of queues */
+    nq = U64_FROM_BIT(msb(nq));
+    vmxnet3_net_debug("%s: using %ld queue pairs\n", __func__, nq);
+    dev->ntxqueues = dev->nrxqueues = nq;
+
+    vn->ndev.qstats = allocate_zero(dev->general, nq * sizeof(struct netif_qstats));
+    assert(vn->ndev.qstats != INVALID_ADDRESS);
+    vn->rx = allocate_zero(dev->general, nq * sizeof(*vn->rx));
+    assert(vn->rx != INVALID_ADDRESS);
+    struct vmxnet3_txqueue **txq_map = allocate(dev->general,
+                                                total_processors * sizeof(txq_map[0]));
+    assert(txq_map != INVALID_ADDRESS);
+
+    vmxnet3_tx_queues_alloc(dev);
+    vmxnet3_rx_queues_alloc(dev);
+
+    vmxnet3_queues_shared_alloc(dev);
+
+    for (int q = 0; q < nq; q++) {
+        struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[q];
+        vmxnet3_rx rx = &vn->rx[q];
+        rx->vn = vn;
+        rx->rxq = rxq;
+        rx->servicequeue = allocate_queue(dev->general, VMXNET3_RX_SERVICEQUEUE_DEPTH);
+        assert(rx->servicequeue != INVALID_ADDRESS);
+        init_closure_func(&rx->service, thunk, vmxnet3_rx_service_bh);
+        rxq->vxrxq_stats = &vn->ndev.qstats[q];
+        dev->vmx_txq[q]->vxtxq_stats = &vn->ndev.qstats[q];
+        for (int i = 0; i < VMXNET3_RXRINGS_PERQ; i++) {
+            for (int idx = 0; idx < VMXNET3_MAX_RX_NDESC; idx++)
+                vmxnet3_newbuf(vn, rxq, i);
+        }
+    }
+
+    vmxnet3_init_shared_data(dev);
+
+    vmxnet3_set_interrupt_idx(dev);
+
+    vmxnet3_interrupts_disable(dev);
+    vmxnet3_interrupts_setup(vn, txq_map);
+
+    if (nq > 1)
+        vmxnet3_rss_init(dev);
+
+    /* enable device */
+    init_vmxnet3_driver_shared(dev);
+    test_shared(vn);
+    vmxnet3_read_cmd(dev, VMXNET3_CMD_ENABLE);
+    for (int q = 0; q < nq; q++) {
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(q), 0);
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(q), 0);
+    }
+    vn->txq_map = txq_map;
+    vn->ndev.num_queues = nq;
+    for (int q = 0; q < nq; q++)
+        vmxnet3_rxq_intr_enable(dev, dev->vmx_rxq[q]);
+    return true;
+}
+
 static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
 {
-    struct vmxnet3_pci *dev = allocate(general, sizeof(struct vmxnet3_pci));
+    struct vmxnet3_pci *dev = allocate_zero(general, sizeof(struct vmxnet3_pci));
     assert(dev != INVALID_ADDRESS);
 
     dev->dev = d;
@@ -357,7 +491,6 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
 
     pci_set_bus_master(dev->dev);
     pci_enable_io_and_memory(d);
-    pci_enable_msix(dev->dev);
 
     dev->general = general;
     dev->contiguous = page_allocator;
@@ -365,59 +498,29 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
     vmxnet3_write_cmd(dev, VMXNET3_CMD_DISABLE);
     vmxnet3_write_cmd(dev, VMXNET3_CMD_RESET);
 
+    /* Check device versions */
+    vmxnet3_check_version(dev);
+
     vmxnet3 vn = allocate(dev->general, sizeof(struct vmxnet3));
     assert(vn != INVALID_ADDRESS);
     vn->dev = dev;
+    vn->txq_map = 0;
     netif_dev_init(&vn->ndev);
 
-    vn->rxbuflen = VMXNET3_RX_MAXSEGSIZE;
-    vn->rxbuffers = allocate_objcache(dev->general, page_allocator,
-                                      vn->rxbuflen + sizeof(struct xpbuf), PAGESIZE_2M, true);
-    assert(vn->rxbuffers != INVALID_ADDRESS);
-    mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vmxnet3_mem_cleaner));
+    /* frames larger than a packet buffer span multiple rx descriptors */
+    vn->rxbuflen = PKTBUF_SIZE - sizeof(struct xpbuf);
+    vn->rxbuffers = pktbuf_heap();
 
     dev->vmx_ds = allocate_zero(dev->contiguous, sizeof(struct vmxnet3_driver_shared));
     assert(dev->vmx_ds != INVALID_ADDRESS);
 
-    vn->rx_servicequeue = allocate_queue(dev->general, VMXNET3_RX_SERVICEQUEUE_DEPTH);
-    assert(vn->rx_servicequeue != INVALID_ADDRESS);
-    vn->rx_service = closure(dev->general, vmxnet3_rx_service_bh, vn);
-
-    vn->rx_intr_handler = closure(dev->general, rx_interrupt, vn);
-    assert(pci_setup_msix(dev->dev, 1, vn->rx_intr_handler, ss("vmxnet3 rx")) != INVALID_PHYSICAL);
-    // interrupts are not used for tx
-
-    vmxnet3_tx_queues_alloc(dev);
-    vmxnet3_rx_queues_alloc(dev);
-
-    vmxnet3_queues_shared_alloc(dev);
-
-    for (int i = 0; i < VMXNET3_RXRINGS_PERQ; i++) {
-        for (int idx = 0; idx < VMXNET3_MAX_RX_NDESC; idx++)
-            vmxnet3_newbuf(vn, i);
-    }
-
-    vmxnet3_init_shared_data(dev);
-
-    /* Check device versions */
-    vmxnet3_check_version(dev);
-
-    vmxnet3_set_interrupt_idx(dev);
-
-    vmxnet3_interrupts_disable(dev);
-
-    /* enable device */
-    init_vmxnet3_driver_shared(dev);
-    test_shared(vn);
-    vmxnet3_read_cmd(dev, VMXNET3_CMD_ENABLE);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(0), 0);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(0), 0);
+    /* queues are set up when the interface configuration is known */
+    init_closure_func(&vn->ndev.setup, netif_dev_setup, vmxnet3_setup);
     netif_add(&vn->ndev.n,
               0, 0, 0,
               vn,
               vmxif_init,
               ethernet_input);
-    vmxnet3_interrupts_enable(dev);
 }
 
 closure_function(2, 1, boolean, vmxnet3_net_probe,
@@ -439,9 +542,8 @@ void init_vmxnet3_network(kernel_heaps kh)
     register_pci_driver(closure(h, vmxnet3_net_probe, h, (heap)heap_linear_backed(kh)), 0);
 }
 
-static void vmxnet3_discard(vmxnet3_pci dev, int rid, int idx)
+static void vmxnet3_discard(struct vmxnet3_rxqueue *rxq, int rid, int idx)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
     struct vmxnet3_rxdesc *rxd = &rxr->vxrxr_rxd[idx];
     rxd->gen = rxr->vxrxr_gen;
@@ -451,10 +553,8 @@ static void vmxnet3_discard(vmxnet3_pci dev, int rid, int idx)
     }
 }
 
-void vmxnet3_newbuf(vmxnet3 vdev, int rid)
+void vmxnet3_newbuf(vmxnet3 vdev, struct vmxnet3_rxqueue *rxq, int rid)
 {
-    vmxnet3_pci dev = vdev->dev;
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
 
     int idx = rxr->vxrxr_refill_start;
@@ -472,7 +572,7 @@ void vmxnet3_newbuf(vmxnet3 vdev, int rid)
                         x+1,
                         vdev->rxbuflen);
 
-    dev->rx_pbuf[rid][idx] = (struct pbuf*)x;
+    rxq->vxrxq_pbuf[rid][idx] = (struct pbuf*)x;
 
     rxd->addr = physical_from_virtual(x+1);
     assert(rxd->addr != INVALID_PHYSICAL);
@@ -487,10 +587,9 @@ void vmxnet3_newbuf(vmxnet3 vdev, int rid)
     }
 }
 
-void vmxnet3_receive(vmxnet3 vdev, struct list *l)
+void vmxnet3_receive(vmxnet3 vdev, struct vmxnet3_rxqueue *rxq, struct list *l)
 {
     vmxnet3_pci dev = vdev->dev;
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     struct vmxnet3_comp_ring *rxc = &rxq->vxrxq_comp_ring;
 
     for(;;) {
@@ -500,19 +599,20 @@ void vmxnet3_receive(vmxnet3 vdev, struct list *l)
             break;
         read_barrier();
 
-        assert(rxcd->qid < VMXNET3_RXRINGS_PERQ);
+        /* ring 0 of queue q completes with qid q, ring 1 with qid q + nrxqueues */
+        assert(rxcd->qid < VMXNET3_RXRINGS_PERQ * dev->nrxqueues);
 
         if (++rxc->vxcr_next == rxc->vxcr_ndesc) {
             rxc->vxcr_next = 0;
             rxc->vxcr_gen ^= 1;
         }
 
-        u32 rid = rxcd->qid;
+        u32 rid = (rxcd->qid < dev->nrxqueues) ? 0 : 1;
         u32 idx = rxcd->rxd_idx;
         u32 length = rxcd->len;
         struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
         struct vmxnet3_rxdesc *rxd = &rxr->vxrxr_rxd[idx];
-        struct pbuf *m = dev->rx_pbuf[rid][idx];
+        struct pbuf *m = rxq->vxrxq_pbuf[rid][idx];
 
         assert(m != NULL);
 
@@ -525,78 +625,82 @@ void vmxnet3_receive(vmxnet3 vdev, struct list *l)
         }
 
         if (rxcd->eop && rxcd->error) {
-            vmxnet3_discard(dev, rid, idx);
+            vmxnet3_discard(rxq, rid, idx);
             goto next;
         }
 
         /* Check and handle SOP/EOP state errors */
-        if (rxcd->sop && dev->currpkt_head) {
-            receive_buffer_release(dev->currpkt_head);
-            dev->currpkt_head = dev->currpkt_tail =  NULL;
-        } else if (!rxcd->sop && !dev->currpkt_head) {
-            vmxnet3_discard(dev, rid, idx);
+        if (rxcd->sop && rxq->vxrxq_currpkt_head) {
+            receive_buffer_release(rxq->vxrxq_currpkt_head);
+            rxq->vxrxq_currpkt_head = rxq->vxrxq_currpkt_tail =  NULL;
+        } else if (!rxcd->sop && !rxq->vxrxq_currpkt_head) {
+            vmxnet3_discard(rxq, rid, idx);
             goto next;
         }
 
        if (rxcd->sop) {
             assert(rxd->btype == VMXNET3_BTYPE_HEAD);
             assert((idx % 1) == 0);
-            assert(dev->currpkt_head == NULL);
+            assert(rxq->vxrxq_currpkt_head == NULL);
 
             if (length == 0) {
-                vmxnet3_discard(dev, rid, idx);
+                vmxnet3_discard(rxq, rid, idx);
                 goto next;
             }
 
             m->tot_len = length;
             m->len = length;
 
-            dev->currpkt_head = dev->currpkt_tail = m;
+            rxq->vxrxq_currpkt_head = rxq->vxrxq_currpkt_tail = m;
         } else {
             assert(rxd->btype == VMXNET3_BTYPE_BODY);
-            assert(dev->currpkt_head != NULL);
+            assert(rxq->vxrxq_currpkt_head != NULL);
 
             m->len = length;
-            dev->currpkt_head->tot_len += length;
-            dev->currpkt_tail->next = m;
-            dev->currpkt_tail = m;
+            rxq->vxrxq_currpkt_head->tot_len += length;
+            rxq->vxrxq_currpkt_tail->next = m;
+            rxq->vxrxq_currpkt_tail = m;
         }
 
         if (rxcd->eop) {
-            list_insert_before(l, &((struct xpbuf*)dev->currpkt_head)->l);
-            dev->currpkt_head = dev->currpkt_tail = NULL;
+            rxq->vxrxq_stats->rx_packets++;
+            rxq->vxrxq_stats->rx_bytes += rxq->vxrxq_currpkt_head->tot_len;
+            list_insert_before(l, &((struct xpbuf*)rxq->vxrxq_currpkt_head)->l);
+            rxq->vxrxq_currpkt_head = rxq->vxrxq_currpkt_tail = NULL;
         }
-        vmxnet3_newbuf(vdev, rid);
+        vmxnet3_newbuf(vdev, rxq, rid);
 
 next:
         if (rxq->vxrxq_rs->update_rxhead) {
             idx = (idx + 1) % rxr->vxrxr_ndesc;
 
             if (rid == 0)
-                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(0), idx);
+                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(rxq->vxrxq_id), idx);
             else
-                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(0), idx);
+                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(rxq->vxrxq_id), idx);
         }
     }
 
 }
 
-static void process_interrupt(vmxnet3 vn)
+static void process_interrupt(vmxnet3_rx rx)
 {
+    vmxnet3 vn = rx->vn;
     vmxnet3_pci dev = vn->dev;
+    struct vmxnet3_rxqueue *rxq = rx->rxq;
     struct list q;
     list_init(&q);
 
-    vmxnet3_interrupts_disable(dev);
-    while (vmxnet3_rxq_available(dev)) {
-        vmxnet3_receive(vn, &q);
+    vmxnet3_rxq_intr_disable(dev, rxq);
+    while (vmxnet3_rxq_available(rxq)) {
+        vmxnet3_receive(vn, rxq, &q);
     }
-    vmxnet3_interrupts_enable(dev);
+    vmxnet3_rxq_intr_enable(dev, rxq);
     list l = list_get_next(&q);
     if (l) {
         /* trick: remove (local) head and queue first element */
         list_delete(&q);
-        assert(enqueue(vn->rx_servicequeue, l));
-        async_apply_bh(vn->rx_service);
+        assert(enqueue(rx->servicequeue, l));
+        async_apply_bh((thunk)&rx->service);
     }
 }
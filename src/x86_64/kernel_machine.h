@@ -48,6 +48,10 @@
 #define KERNEL_GS_MSR    0xc0000102
 #define TSC_AUX_MSR      0xc0000103
 
+/* TSC_AUX value layout (same as Linux): NUMA node in bits 12 and above, CPU number below */
+#define TSC_AUX_NODE_SHIFT  12
+#define TSC_AUX_CPU_MASK    MASK32(TSC_AUX_NODE_SHIFT)
+
 #define SEV_STATUS_MSR   0xc0010131
 #define SEV_ENABLED      (1 << 0)
 
@@ -74,13 +74,85 @@ void init_cpu_features()
     }
 }
 
+/* CPUID level 1 (EDX) */
+#define CPUID_HTT   (1<<28)
+
+/* extended topology enumeration leaves */
+#define CPUID_LEAF_TOPOLOGY     0x0b
+#define CPUID_LEAF_TOPOLOGY_V2  0x1f
+#define CPUID_TOPO_SHIFT(eax)   ((eax) & 0x1f)
+#define CPUID_TOPO_TYPE(ecx)    (((ecx) >> 8) & 0xff)
+#define CPUID_TOPO_TYPE_SMT     1
+
+/* deterministic cache parameters leaves */
+#define CPUID_LEAF_CACHE        0x04
+#define CPUID_LEAF_CACHE_AMD    0x8000001d
+#define CPUID_CACHE_TYPE(eax)   ((eax) & 0x1f)
+#define CPUID_CACHE_LEVEL(eax)  (((eax) >> 5) & 0x7)
+#define CPUID_CACHE_SHARING(eax)    ((((eax) >> 14) & 0xfff) + 1)
+
+/* Returns the number of low-order APIC ID bits that identify logical CPUs sharing the last level
+ * cache, or -1 if cache parameters are not enumerated via the given leaf. */
+static int cpu_llc_shift(u32 leaf)
+{
+    u32 v[4];
+    int level = 0, shift = -1;
+    for (u32 i = 0; ; i++) {
+        cpuid(leaf, i, v);
+        if (!CPUID_CACHE_TYPE(v[0]))
+            break;
+        if (CPUID_CACHE_LEVEL(v[0]) > level) {
+            level = CPUID_CACHE_LEVEL(v[0]);
+            shift = find_order(CPUID_CACHE_SHARING(v[0]));
+        }
+    }
+    return shift;
+}
+
+static void cpu_topology_init(cpuinfo ci)
+{
+    u32 v[4];
+    u32 max_leaf = cpuid_highest_fn(false);
+    cpuid(1, 0, v);
+    u32 apic_id = v[1] >> 24;
+    u32 smt_shift = 0;
+    u32 pkg_shift = (v[3] & CPUID_HTT) ? find_order((v[1] >> 16) & 0xff) : 0;
+    u32 leaf = (max_leaf >= CPUID_LEAF_TOPOLOGY_V2) ? CPUID_LEAF_TOPOLOGY_V2 : CPUID_LEAF_TOPOLOGY;
+    if (max_leaf >= leaf) {
+        cpuid(leaf, 0, v);
+        if (!v[1] && (leaf == CPUID_LEAF_TOPOLOGY_V2)) {
+            leaf = CPUID_LEAF_TOPOLOGY;
+            cpuid(leaf, 0, v);
+        }
+        if (v[1]) {
+            /* the shift value of the outermost level identifies the package */
+            for (u32 i = 1; CPUID_TOPO_TYPE(v[2]); i++) {
+                if (CPUID_TOPO_TYPE(v[2]) == CPUID_TOPO_TYPE_SMT)
+                    smt_shift = CPUID_TOPO_SHIFT(v[0]);
+                pkg_shift = CPUID_TOPO_SHIFT(v[0]);
+                apic_id = v[3];
+                cpuid(leaf, i, v);
+            }
+        }
+    }
+    int llc_shift = (max_leaf >= CPUID_LEAF_CACHE) ? cpu_llc_shift(CPUID_LEAF_CACHE) : -1;
+    if ((llc_shift < 0) && (cpuid_highest_fn(true) >= CPUID_LEAF_CACHE_AMD))
+        llc_shift = cpu_llc_shift(CPUID_LEAF_CACHE_AMD);
+    if ((llc_shift < 0) || (llc_shift > pkg_shift))
+        llc_shift = pkg_shift;
+    ci->topology.core_id = apic_id >> smt_shift;
+    ci->topology.llc_id = apic_id >> llc_shift;
+    ci->topology.package_id = apic_id >> pkg_shift;
+}
+
 void cpu_init(int cpu)
 {
-    u64 addr = u64_from_pointer(cpuinfo_from_id(cpu));
+    cpuinfo ci = cpuinfo_from_id(cpu);
     write_msr(KERNEL_GS_MSR, 0); /* clear user GS */
-    write_msr(GS_MSR, addr);
-    if (VVAR_REF(vdso_dat).machine.platform_has_rdtscp)
-        write_msr(TSC_AUX_MSR, cpu);    /* used by vdso_getcpu() */
+    write_msr(GS_MSR, u64_from_pointer(ci));
+    cpu_topology_init(ci);
+    if (VVAR_REF(vdso_dat).machine.platform_has_rdtscp)   /* used by vdso_getcpu() */
+        write_msr(TSC_AUX_MSR, ((u64)ci->numa_node << TSC_AUX_NODE_SHIFT) | cpu);
     init_syscall_handler();
 }
 
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+/* Smoke test for virtio balloon free page reporting: memory freed by the program is expected to be
+ * reported to the host within a few reporting intervals. The test is skipped if no balloon device
+ * is present, and the reporting check is skipped if the device does not support reporting. */
+
+#define BALLOON_STATS       "/sys/virtio/balloon/stats"
+#define BALLOON_TEST_SIZE   (128 * 1024 * 1024)
+#define BALLOON_TIMEOUT_SEC 20
+
+struct balloon_stats {
+    long pages;
+    int reporting;
+    long reported_bytes;
+};
+
+/* returns 0 if there is no balloon device */
+static int balloon_get_stats(struct balloon_stats *stats)
+{
+    FILE *f = fopen(BALLOON_STATS, "r");
+    if (!f)
+        test_perror("open " BALLOON_STATS);
+    char header[128];
+    int ret;
+    if (!fgets(header, sizeof(header), f)) {
+        ret = 0;
+    } else {
+        test_assert(!strcmp(header, "pages reporting reported_bytes\n"));
+        test_assert(fscanf(f, "%ld %d %ld", &stats->pages, &stats->reporting,
+                           &stats->reported_bytes) == 3);
+        ret = 1;
+    }
+    fclose(f);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    struct balloon_stats stats;
+    setbuf(stdout, NULL);
+    if (!balloon_get_stats(&stats)) {
+        printf("no balloon device, skipping test\n");
+        exit(EXIT_SUCCESS);
+    }
+    test_assert(stats.pages >= 0);
+    test_assert(stats.reported_bytes >= 0);
+    if (!stats.reporting) {
+        printf("free page reporting not supported, skipping test\n");
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Only memory freed after the last reporting pass is reported: allocate memory and let a
+     * reporting pass run before freeing it. */
+    uint8_t *p = mmap(NULL, BALLOON_TEST_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    test_assert(p != MAP_FAILED);
+    memset(p, 0xa5, BALLOON_TEST_SIZE);
+    sleep(5);
+    test_assert(balloon_get_stats(&stats));
+    long reported = stats.reported_bytes;
+    test_assert(munmap(p, BALLOON_TEST_SIZE) == 0);
+    int sec;
+    for (sec = 0; sec < BALLOON_TIMEOUT_SEC; sec++) {
+        sleep(1);
+        test_assert(balloon_get_stats(&stats));
+        if (stats.reported_bytes > reported)
+            break;
+    }
+    if (sec == BALLOON_TIMEOUT_SEC)
+        test_error("no free memory reported after %d seconds", BALLOON_TIMEOUT_SEC);
+    printf("%ld bytes reported, balloon test passed\n", stats.reported_bytes - reported);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,89 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+/* The image contains a file stored with compressed extents, generated at build time with a line
+ * for each number from 0 to COMPRESS_LINES - 1: reading the file in different ways must return
+ * the generated data. */
+
+#define COMPRESS_FILE   "/compress_data"
+#define COMPRESS_LINES  262144
+#define LINE_LEN        9
+
+#define CLUSTER_SIZE    (64 * 1024)
+
+static void generate(unsigned char *buf)
+{
+    for (int i = 0; i < COMPRESS_LINES; i++)
+        sprintf((char *)buf + i * LINE_LEN, "%08d\n", i);
+}
+
+int main(int argc, char **argv)
+{
+    struct stat st;
+    size_t size = COMPRESS_LINES * LINE_LEN;
+    test_assert(stat(COMPRESS_FILE, &st) == 0);
+    test_assert(st.st_size == size);
+
+    /* the file takes less storage than its size */
+    printf("file size %ld, allocated %ld\n", st.st_size, st.st_blocks * 512);
+    test_assert(st.st_blocks * 512 < size);
+
+    unsigned char *expected = malloc(size + 1);
+    unsigned char *data = malloc(size);
+    test_assert(expected && data);
+    generate(expected);
+
+    /* sequential reads in chunks that are not aligned to cluster boundaries; the file is not
+     * cached yet, thus this measures the read throughput of compressed data */
+    int fd = open(COMPRESS_FILE, O_RDONLY);
+    if (fd < 0)
+        test_perror("open");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t offset = 0; offset < size;) {
+        ssize_t n = read(fd, data + offset, 3000);
+        if (n <= 0)
+            test_perror("read at offset %ld", offset);
+        offset += n;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unsigned long long us = (end.tv_sec - start.tv_sec) * 1000000ull +
+                            end.tv_nsec / 1000 - start.tv_nsec / 1000;
+    printf("read %ld bytes in %llu us (%llu MB/s)\n", size, us, us ? size / us : 0);
+    test_assert(read(fd, data, 1) == 0);
+    test_assert(!memcmp(data, expected, size));
+
+    /* reads across cluster boundaries */
+    unsigned char buf[512];
+    for (off_t offset = CLUSTER_SIZE - 100; offset + sizeof(buf) <= size; offset += CLUSTER_SIZE) {
+        test_assert(pread(fd, buf, sizeof(buf), offset) == sizeof(buf));
+        test_assert(!memcmp(buf, expected + offset, sizeof(buf)));
+    }
+
+    /* reads past the end of the file */
+    test_assert(pread(fd, buf, sizeof(buf), size - 10) == 10);
+    test_assert(!memcmp(buf, expected + size - 10, 10));
+    test_assert(pread(fd, buf, sizeof(buf), size) == 0);
+    close(fd);
+
+    /* memory-mapped access */
+    fd = open(COMPRESS_FILE, O_RDONLY);
+    test_assert(fd >= 0);
+    unsigned char *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    test_assert(p != MAP_FAILED);
+    test_assert(!memcmp(p, expected, size));
+    test_assert(munmap(p, size) == 0);
+    close(fd);
+
+    free(expected);
+    free(data);
+    printf("compression test passed\n");
+    exit(EXIT_SUCCESS);
+}
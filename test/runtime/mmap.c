@@ -16,6 +16,8 @@
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
 
 /* for sha */
 #include <runtime.h>
@@ -1591,6 +1593,130 @@ static void thp_test(void)
            elapsed.tv_sec, elapsed.tv_nsec, (1000000000ull / MB) * map_len / ns);
 }
 
+static void madvise_anon_test(void)
+{
+    size_t map_len = 4 * PAGESIZE;
+    uint8_t vec[4];
+    u8 *addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (addr == MAP_FAILED) {
+        test_perror("mmap");
+    }
+    test_assert((madvise(addr, map_len, -1) == -1) && (errno == EINVAL));
+    test_assert((madvise(addr + 1, PAGESIZE, MADV_DONTNEED) == -1) && (errno == EINVAL));
+    test_assert((madvise(addr, map_len, MADV_REMOVE) == -1) && (errno == EINVAL));
+    test_assert(madvise(addr, map_len, MADV_DONTFORK) == 0);
+
+    /* MADV_DONTNEED: private anonymous memory is zero-filled on the next access */
+    memset(addr, 0xa5, map_len);
+    test_assert(madvise(addr + PAGESIZE, 2 * PAGESIZE, MADV_DONTNEED) == 0);
+    test_assert(mincore(addr, map_len, vec) == 0);
+    test_assert(vec[0] && !vec[1] && !vec[2] && vec[3]);
+    for (int i = 0; i < map_len; i += PAGESIZE / 4)
+        test_assert(addr[i] == (((i >= PAGESIZE) && (i < 3 * PAGESIZE)) ? 0 : 0xa5));
+
+    /* MADV_FREE: pages written to after the madvise() call are retained, the other pages contain
+     * either the old data or zeros */
+    memset(addr, 0x5a, map_len);
+    test_assert(madvise(addr, map_len, MADV_FREE) == 0);
+    addr[0] = 0x3c;
+    test_assert(addr[0] == 0x3c);
+    for (int i = 1; i < map_len; i += PAGESIZE / 4)
+        test_assert((addr[i] == 0x5a) || (addr[i] == 0));
+    munmap(addr, map_len);
+
+    /* MADV_FREE is only allowed on private anonymous memory */
+    addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+    if (addr == MAP_FAILED) {
+        test_perror("mmap");
+    }
+    test_assert((madvise(addr, map_len, MADV_FREE) == -1) && (errno == EINVAL));
+    memset(addr, 0x5a, map_len);
+    test_assert(madvise(addr, map_len, MADV_REMOVE) == 0);
+    test_assert(addr[0] == 0);
+    munmap(addr, map_len);
+}
+
+static void madvise_file_test(void)
+{
+    size_t map_len = 4 * PAGESIZE;
+    u8 buf[PAGESIZE];
+    int fd = open("madvise_file", O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        test_perror("open");
+    memset(buf, 0x7e, sizeof(buf));
+    for (int i = 0; i < map_len / PAGESIZE; i++)
+        test_assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+
+    /* MADV_DONTNEED on a private file mapping discards the private copy of modified pages */
+    u8 *addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        test_perror("mmap");
+    }
+    addr[0] = 0x11;
+    test_assert(madvise(addr, map_len, MADV_DONTNEED) == 0);
+    test_assert(addr[0] == 0x7e);
+    test_assert((madvise(addr, map_len, MADV_FREE) == -1) && (errno == EINVAL));
+    test_assert((madvise(addr, map_len, MADV_REMOVE) == -1) && (errno == EINVAL));
+    test_assert(madvise(addr, map_len, MADV_SEQUENTIAL) == 0);
+    test_assert(madvise(addr, map_len, MADV_RANDOM) == 0);
+    test_assert(madvise(addr, map_len, MADV_WILLNEED) == 0);
+    test_assert(madvise(addr, map_len, MADV_NORMAL) == 0);
+    test_assert(addr[map_len - 1] == 0x7e);
+    munmap(addr, map_len);
+
+    /* MADV_REMOVE on a shared file mapping punches a hole in the file */
+    addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        test_perror("mmap");
+    }
+    test_assert(madvise(addr + PAGESIZE, PAGESIZE, MADV_REMOVE) == 0);
+    test_assert((addr[0] == 0x7e) && (addr[PAGESIZE] == 0) && (addr[2 * PAGESIZE - 1] == 0) &&
+                (addr[2 * PAGESIZE] == 0x7e));
+    test_assert(pread(fd, buf, sizeof(buf), PAGESIZE) == sizeof(buf));
+    for (int i = 0; i < sizeof(buf); i++)
+        test_assert(buf[i] == 0);
+    munmap(addr, map_len);
+
+    addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        test_perror("mmap");
+    }
+    test_assert((madvise(addr, map_len, MADV_REMOVE) == -1) && (errno == EACCES));
+    munmap(addr, map_len);
+    close(fd);
+    test_assert(unlink("madvise_file") == 0);
+}
+
+/* Measures how quickly memory released with MADV_DONTNEED and MADV_FREE can be re-used. */
+static void madvise_bench(void)
+{
+    size_t map_len = 64 * MB;
+    int advice[] = {MADV_DONTNEED, MADV_FREE};
+    const char *advice_names[] = {"MADV_DONTNEED", "MADV_FREE"};
+    u8 *addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (addr == MAP_FAILED) {
+        test_perror("mmap");
+    }
+    for (int a = 0; a < sizeof(advice) / sizeof(advice[0]); a++) {
+        struct sysinfo before, after;
+        struct timespec start, end, elapsed;
+        for (int i = 0; i < map_len; i += PAGESIZE)
+            addr[i] = 1;
+        test_assert(sysinfo(&before) == 0);
+        test_assert(clock_gettime(CLOCK_MONOTONIC, &start) == 0);
+        test_assert(madvise(addr, map_len, advice[a]) == 0);
+        for (int i = 0; i < map_len; i += PAGESIZE)   /* re-use the memory */
+            addr[i] = 2;
+        test_assert(clock_gettime(CLOCK_MONOTONIC, &end) == 0);
+        test_assert(sysinfo(&after) == 0);
+        timespec_sub(&end, &start, &elapsed);
+        printf("%s: %s and re-use of %lu bytes in %ld.%.9ld seconds, free memory %lu -> %lu\n",
+               __func__, advice_names[a], map_len, elapsed.tv_sec, elapsed.tv_nsec,
+               before.freeram * before.mem_unit, after.freeram * after.mem_unit);
+    }
+    munmap(addr, map_len);
+}
+
 static void madvise_test(void)
 {
     size_t map_len = 2 * PAGESIZE;
@@ -1603,9 +1729,64 @@ static void madvise_test(void)
     test_assert((madvise(addr, map_len, MADV_HUGEPAGE) == -1) && (errno == ENOMEM));
     munmap(addr + map_len / 2, map_len / 2);
 
+    madvise_anon_test();
+    madvise_file_test();
+    madvise_bench();
     thp_test();
 }
 
+#define MPOL_DEFAULT    0
+#define MPOL_BIND       2
+#define MPOL_INTERLEAVE 3
+#define MPOL_LOCAL      4
+
+#define MPOL_F_NODE     (1 << 0)
+#define MPOL_F_ADDR     (1 << 1)
+
+static void mempolicy_test(void)
+{
+    unsigned long nodemask = 1, invalid_nodemask = 1ul << 63;
+    unsigned long maxnode = 8 * sizeof(nodemask);
+    int mode;
+
+    test_assert(syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask, maxnode) == 0);
+    test_assert(syscall(SYS_get_mempolicy, &mode, &nodemask, maxnode, NULL, 0) == 0);
+    test_assert((mode == MPOL_BIND) && (nodemask == 1));
+    test_assert(syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, &nodemask, maxnode) == 0);
+    test_assert(syscall(SYS_get_mempolicy, &mode, NULL, 0, NULL, MPOL_F_NODE) == 0);
+    test_assert(mode == 0);
+    test_assert((syscall(SYS_set_mempolicy, MPOL_BIND, NULL, 0) == -1) && (errno == EINVAL));
+    test_assert((syscall(SYS_set_mempolicy, MPOL_BIND, &invalid_nodemask, maxnode) == -1) &&
+                (errno == EINVAL));
+    test_assert((syscall(SYS_set_mempolicy, MPOL_LOCAL, &nodemask, maxnode) == -1) &&
+                (errno == EINVAL));
+
+    size_t map_len = 4 * PAGESIZE;
+    unsigned char *addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                               MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (addr == MAP_FAILED)
+        test_perror("mmap");
+    test_assert(syscall(SYS_mbind, addr + PAGESIZE, PAGESIZE, MPOL_BIND, &nodemask, maxnode,
+                        0) == 0);
+    test_assert(syscall(SYS_get_mempolicy, &mode, NULL, 0, addr, MPOL_F_ADDR) == 0);
+    test_assert(mode == MPOL_DEFAULT);
+    test_assert(syscall(SYS_get_mempolicy, &mode, &nodemask, maxnode, addr + PAGESIZE,
+                        MPOL_F_ADDR) == 0);
+    test_assert((mode == MPOL_BIND) && (nodemask == 1));
+    memset(addr, 0xa5, map_len);
+    for (int i = 0; i < map_len / PAGESIZE; i++) {
+        test_assert(syscall(SYS_get_mempolicy, &mode, NULL, 0, addr + i * PAGESIZE,
+                            MPOL_F_NODE | MPOL_F_ADDR) == 0);
+        test_assert(mode == 0);
+    }
+    test_assert((syscall(SYS_mbind, addr + 1, PAGESIZE, MPOL_BIND, &nodemask, maxnode, 0) == -1)
+                && (errno == EINVAL));
+    munmap(addr, map_len);
+    test_assert((syscall(SYS_mbind, addr, PAGESIZE, MPOL_BIND, &nodemask, maxnode, 0) == -1) &&
+                (errno == EFAULT));
+    test_assert(syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) == 0);
+}
+
 int main(int argc, char * argv[])
 {
     /*
@@ -1633,6 +1814,7 @@ int main(int argc, char * argv[])
     multithread_filebacked_test(h, MT_N_THREADS);
     filebacked_sigbus_test();
     madvise_test();
+    mempolicy_test();
     check_fault_in_user_memory();
 
     printf("\n**** all tests passed ****\n");
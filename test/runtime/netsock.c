@@ -1,7 +1,12 @@
 #define _GNU_SOURCE
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <net/if.h>
+#include <linux/errqueue.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <linux/tls.h>
 #include <poll.h>
 #include <pthread.h>
 #include <string.h>
@@ -19,6 +24,11 @@
 
 #define NETSOCK_TEST_BASIC_PORT 1233
 #define NETSOCK_TEST_FAULT_PORT 1237
+#define NETSOCK_TEST_GSO_PORT   1238
+#define NETSOCK_TEST_ZC_PORT    1240
+#define NETSOCK_TEST_BP_PORT    1241
+#define NETSOCK_TEST_TLS_PORT   1242
+#define NETSOCK_TEST_RP_PORT    1243
 
 #define NETSOCK_TEST_FIO_COUNT  8
 
@@ -534,6 +544,30 @@ static void netsock_test_netconf(void)
     ifr.ifr_ifindex = 1;
     test_assert(ioctl(fd, SIOCGIFNAME, &ifr) == 0);
     test_assert(ioctl(fd, SIOCGIFHWADDR, &ifr) == 0);
+
+    /* ethtool channel and statistics queries on the first non-loopback interface */
+    ifr.ifr_ifindex = 2;
+    if (ioctl(fd, SIOCGIFNAME, &ifr) == 0) {
+        struct ethtool_channels channels = { .cmd = ETHTOOL_GCHANNELS };
+        ifr.ifr_data = (void *)&channels;
+        test_assert(ioctl(fd, SIOCETHTOOL, &ifr) == 0);
+        test_assert((channels.combined_count >= 1) &&
+                    (channels.combined_count <= channels.max_combined));
+        struct {
+            struct ethtool_sset_info info;
+            __u32 len;
+        } sset = { .info = { .cmd = ETHTOOL_GSSET_INFO, .sset_mask = 1ULL << ETH_SS_STATS } };
+        ifr.ifr_data = (void *)&sset;
+        test_assert(ioctl(fd, SIOCETHTOOL, &ifr) == 0);
+        test_assert(sset.info.sset_mask == 1ULL << ETH_SS_STATS);
+        struct ethtool_stats *stats = malloc(sizeof(*stats) + sset.len * sizeof(__u64));
+        test_assert(stats != NULL);
+        stats->cmd = ETHTOOL_GSTATS;
+        ifr.ifr_data = (void *)stats;
+        test_assert(ioctl(fd, SIOCETHTOOL, &ifr) == 0);
+        test_assert(stats->n_stats == sset.len);
+        free(stats);
+    }
     close(fd);
 }
 
@@ -687,6 +721,223 @@ static void netsock_test_msg(int sock_type)
         test_assert(close(listen_fd) == 0);
 }
 
+#define NETSOCK_TEST_GSO_SEGSIZE    100
+#define NETSOCK_TEST_GSO_LEN        (4 * NETSOCK_TEST_GSO_SEGSIZE + 40)
+
+/* Receives the segments of a UDP GSO message, coalesced or not depending on whether UDP GRO is
+ * enabled. */
+static void netsock_test_udp_gso_recv(int fd, const char *tx_buf, int gro)
+{
+    char rx_buf[2 * NETSOCK_TEST_GSO_LEN];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr msg;
+    int received = 0;
+    while (received < NETSOCK_TEST_GSO_LEN) {
+        iov.iov_base = rx_buf;
+        iov.iov_len = sizeof(rx_buf);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int len = recvmsg(fd, &msg, 0);
+        test_assert(len > 0);
+        test_assert(msg.msg_flags == 0);
+        test_assert(!memcmp(rx_buf, tx_buf + received, len));
+        received += len;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (!gro) {
+            test_assert(cmsg == NULL);
+            test_assert((len == NETSOCK_TEST_GSO_SEGSIZE) || (received == NETSOCK_TEST_GSO_LEN));
+        } else if (cmsg) {
+            test_assert((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO));
+            test_assert(*(int *)CMSG_DATA(cmsg) == NETSOCK_TEST_GSO_SEGSIZE);
+            test_assert(len > NETSOCK_TEST_GSO_SEGSIZE);
+        }
+    }
+    test_assert(received == NETSOCK_TEST_GSO_LEN);
+}
+
+static void netsock_test_udp_gso(void)
+{
+    int tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    char tx_buf[NETSOCK_TEST_GSO_LEN];
+    int val;
+    socklen_t len;
+
+    rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(rx_fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_GSO_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(rx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(tx_fd > 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    for (int i = 0; i < sizeof(tx_buf); i++)
+        tx_buf[i] = i;
+
+    /* segment size set via socket option */
+    val = NETSOCK_TEST_GSO_SEGSIZE;
+    test_assert(setsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+    val = 0;
+    len = sizeof(val);
+    test_assert(getsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, &len) == 0);
+    test_assert((len == sizeof(val)) && (val == NETSOCK_TEST_GSO_SEGSIZE));
+    test_assert(send(tx_fd, tx_buf, sizeof(tx_buf), 0) == sizeof(tx_buf));
+    netsock_test_udp_gso_recv(rx_fd, tx_buf, 0);
+
+    /* too many segments */
+    val = 1;
+    test_assert(setsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+    test_assert((send(tx_fd, tx_buf, sizeof(tx_buf), 0) == -1) && (errno == EINVAL));
+    val = 0;
+    test_assert(setsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+
+    /* segment size set via control message, received with GRO */
+    val = 1;
+    test_assert(setsockopt(rx_fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0);
+    val = 0;
+    len = sizeof(val);
+    test_assert(getsockopt(rx_fd, SOL_UDP, UDP_GRO, &val, &len) == 0);
+    test_assert(val == 1);
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct iovec iov = {
+        .iov_base = tx_buf,
+        .iov_len = sizeof(tx_buf),
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *(uint16_t *)CMSG_DATA(cmsg) = NETSOCK_TEST_GSO_SEGSIZE;
+    test_assert(sendmsg(tx_fd, &msg, 0) == sizeof(tx_buf));
+    netsock_test_udp_gso_recv(rx_fd, tx_buf, 1);
+
+    test_assert((close(tx_fd) == 0) && (close(rx_fd) == 0));
+}
+
+#define NETSOCK_TEST_ZC_CHUNK   (16 * KB)
+#define NETSOCK_TEST_ZC_SENDS   4
+
+/* Reads a zerocopy completion notification from the error queue, and returns the number of sends
+ * it covers. */
+static int netsock_test_zerocopy_notif(int fd, uint32_t next_id)
+{
+    struct pollfd pfd = {
+        .fd = fd,
+        .events = 0,
+    };
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *ee;
+
+    test_assert(poll(&pfd, 1, 5000) == 1);
+    test_assert(pfd.revents & POLLERR);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control);
+    test_assert(recvmsg(fd, &msg, MSG_ERRQUEUE) == 0);
+    test_assert(msg.msg_flags & MSG_ERRQUEUE);
+    test_assert(!(msg.msg_flags & MSG_CTRUNC));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    test_assert(cmsg != NULL);
+    test_assert((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR));
+    ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+    test_assert(ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY);
+    test_assert(ee->ee_errno == 0);
+    /* notifications are delivered in order, and may cover a range of sends */
+    test_assert(ee->ee_info == next_id);
+    test_assert(ee->ee_data >= ee->ee_info);
+    return ee->ee_data - ee->ee_info + 1;
+}
+
+static void netsock_test_zerocopy(void)
+{
+    int listen_fd, tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    int val;
+    socklen_t len;
+    uint8_t rx_buf[NETSOCK_TEST_ZC_CHUNK];
+    struct msghdr msg;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(listen_fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_ZC_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(listen(listen_fd, 1) == 0);
+    tx_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(tx_fd > 0);
+    len = sizeof(val);
+    test_assert(getsockopt(tx_fd, SOL_SOCKET, SO_ZEROCOPY, &val, &len) == 0);
+    test_assert((len == sizeof(val)) && (val == 0));
+    val = 1;
+    test_assert(setsockopt(tx_fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) == 0);
+    test_assert(getsockopt(tx_fd, SOL_SOCKET, SO_ZEROCOPY, &val, &len) == 0);
+    test_assert(val == 1);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    rx_fd = accept(listen_fd, NULL, NULL);
+    test_assert(rx_fd > 0);
+
+    /* nothing to report yet */
+    memset(&msg, 0, sizeof(msg));
+    test_assert(recvmsg(tx_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1);
+    test_assert(errno == EAGAIN);
+
+    uint8_t *tx_buf = mmap(NULL, NETSOCK_TEST_ZC_SENDS * NETSOCK_TEST_ZC_CHUNK,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    test_assert(tx_buf != MAP_FAILED);
+    for (int i = 0; i < NETSOCK_TEST_ZC_SENDS * NETSOCK_TEST_ZC_CHUNK; i++)
+        tx_buf[i] = i % 251;
+    for (int i = 0; i < NETSOCK_TEST_ZC_SENDS; i++) {
+        uint8_t *chunk = tx_buf + i * NETSOCK_TEST_ZC_CHUNK;
+        test_assert(send(tx_fd, chunk, NETSOCK_TEST_ZC_CHUNK, MSG_ZEROCOPY) ==
+                    NETSOCK_TEST_ZC_CHUNK);
+        for (int received = 0; received < NETSOCK_TEST_ZC_CHUNK;) {
+            int n = read(rx_fd, rx_buf + received, NETSOCK_TEST_ZC_CHUNK - received);
+            test_assert(n > 0);
+            received += n;
+        }
+        test_assert(!memcmp(rx_buf, chunk, NETSOCK_TEST_ZC_CHUNK));
+    }
+
+    /* small sends are copied, but still generate a notification */
+    test_assert(send(tx_fd, tx_buf, 100, MSG_ZEROCOPY) == 100);
+    test_assert(read(rx_fd, rx_buf, sizeof(rx_buf)) == 100);
+    test_assert(!memcmp(rx_buf, tx_buf, 100));
+    for (uint32_t id = 0; id < NETSOCK_TEST_ZC_SENDS + 1;)
+        id += netsock_test_zerocopy_notif(tx_fd, id);
+    test_assert(recvmsg(tx_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1);
+    test_assert(errno == EAGAIN);
+
+    /* without SO_ZEROCOPY, the flag is ignored */
+    test_assert(send(rx_fd, tx_buf, NETSOCK_TEST_ZC_CHUNK, MSG_ZEROCOPY) ==
+                NETSOCK_TEST_ZC_CHUNK);
+    for (int received = 0; received < NETSOCK_TEST_ZC_CHUNK;) {
+        int n = read(tx_fd, rx_buf + received, NETSOCK_TEST_ZC_CHUNK - received);
+        test_assert(n > 0);
+        received += n;
+    }
+    test_assert(recvmsg(rx_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1);
+    test_assert(errno == EAGAIN);
+    test_assert((close(tx_fd) == 0) && (close(rx_fd) == 0) && (close(listen_fd) == 0));
+    test_assert(munmap(tx_buf, NETSOCK_TEST_ZC_SENDS * NETSOCK_TEST_ZC_CHUNK) == 0);
+}
+
 static void *netsock_test_fault_udp_thread(void *arg)
 {
     int fd;
@@ -726,6 +977,275 @@ static int netsock_test_fault_udp_setup(pthread_t *pt, void **fault_addr)
     return fd;
 }
 
+static void netsock_test_busy_poll(void)
+{
+    int tx_fd, rx_fd, efd;
+    struct sockaddr_in addr;
+    struct epoll_event event;
+    char buf[64];
+    int val;
+    socklen_t len = sizeof(val);
+
+    rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(rx_fd >= 0);
+    test_assert(getsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &val, &len) == 0);
+    test_assert((len == sizeof(val)) && (val >= 0));
+    val = -1;
+    test_assert(setsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) == -1);
+    test_assert(errno == EINVAL);
+    val = 1000000;  /* clamped to the maximum busy poll time */
+    test_assert(setsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) == 0);
+    test_assert(getsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &val, &len) == 0);
+    test_assert((val > 0) && (val < 1000000));
+    val = 50;
+    test_assert(setsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) == 0);
+    val = 0;
+    test_assert(getsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &val, &len) == 0);
+    test_assert(val == 50);
+    val = 1;
+    test_assert(setsockopt(rx_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val)) == 0);
+    val = 0;
+    test_assert(getsockopt(rx_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, &len) == 0);
+    test_assert(val == 1);
+
+    /* blocking reads and epoll waits behave the same with busy polling enabled */
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_BP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(rx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(tx_fd >= 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(send(tx_fd, "busy", 4, 0) == 4);
+    test_assert(recv(rx_fd, buf, sizeof(buf), 0) == 4);
+    test_assert(!memcmp(buf, "busy", 4));
+    efd = epoll_create1(0);
+    test_assert(efd >= 0);
+    event.events = EPOLLIN;
+    event.data.fd = rx_fd;
+    test_assert(epoll_ctl(efd, EPOLL_CTL_ADD, rx_fd, &event) == 0);
+    test_assert(epoll_wait(efd, &event, 1, 10) == 0);
+    test_assert(send(tx_fd, "poll", 4, 0) == 4);
+    test_assert(epoll_wait(efd, &event, 1, -1) == 1);
+    test_assert((event.events & EPOLLIN) && (event.data.fd == rx_fd));
+    test_assert(recv(rx_fd, buf, sizeof(buf), 0) == 4);
+    test_assert(!memcmp(buf, "poll", 4));
+    test_assert((close(efd) == 0) && (close(tx_fd) == 0) && (close(rx_fd) == 0));
+}
+
+static void netsock_test_read_all(int fd, uint8_t *buf, int len)
+{
+    while (len > 0) {
+        int n = read(fd, buf, len);
+        test_assert(n > 0);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Checks the framing of a TLS 1.2 AES-GCM record: header, explicit nonce and encrypted payload. */
+static void netsock_test_ktls_record(int fd, uint8_t type, const uint8_t *iv, uint8_t iv_inc,
+                                     const uint8_t *data, int len)
+{
+    uint8_t rec[5 + TLS_CIPHER_AES_GCM_128_IV_SIZE + 256 + TLS_CIPHER_AES_GCM_128_TAG_SIZE];
+    int rec_len = 5 + TLS_CIPHER_AES_GCM_128_IV_SIZE + len + TLS_CIPHER_AES_GCM_128_TAG_SIZE;
+
+    test_assert(rec_len <= sizeof(rec));
+    netsock_test_read_all(fd, rec, rec_len);
+    test_assert((rec[0] == type) && (rec[1] == 0x03) && (rec[2] == 0x03));
+    test_assert(((rec[3] << 8) | rec[4]) == rec_len - 5);
+    test_assert(!memcmp(rec + 5, iv, TLS_CIPHER_AES_GCM_128_IV_SIZE - 1));
+    test_assert(rec[5 + TLS_CIPHER_AES_GCM_128_IV_SIZE - 1] ==
+                (uint8_t)(iv[TLS_CIPHER_AES_GCM_128_IV_SIZE - 1] + iv_inc));
+    test_assert(memcmp(rec + 5 + TLS_CIPHER_AES_GCM_128_IV_SIZE, data, len));
+}
+
+static void netsock_test_ktls(void)
+{
+    int listen_fd, tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    struct tls12_crypto_info_aes_gcm_128 ci;
+    uint8_t buf[256];
+    char cbuf[CMSG_SPACE(sizeof(uint8_t))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(listen_fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_TLS_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(listen(listen_fd, 1) == 0);
+    tx_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(tx_fd > 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    rx_fd = accept(listen_fd, NULL, NULL);
+    test_assert(rx_fd > 0);
+
+    memset(&ci, 0, sizeof(ci));
+    ci.info.version = TLS_1_2_VERSION;
+    ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    for (int i = 0; i < sizeof(ci.iv); i++)
+        ci.iv[i] = 0x10 + i;
+    memset(ci.key, 0x5a, sizeof(ci.key));
+    memset(ci.salt, 0xa5, sizeof(ci.salt));
+    test_assert(setsockopt(tx_fd, SOL_TLS, TLS_TX, &ci, sizeof(ci)) == -1);
+    test_assert(errno == ENOPROTOOPT);  /* no ULP attached yet */
+    if (setsockopt(tx_fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        test_assert(errno == ENOENT);   /* TLS klib not loaded */
+        printf("kTLS not available, skipping test\n");
+        goto out;
+    }
+    ci.info.version = 0;
+    test_assert(setsockopt(tx_fd, SOL_TLS, TLS_TX, &ci, sizeof(ci)) == -1);
+    test_assert(errno == EINVAL);
+    ci.info.version = TLS_1_2_VERSION;
+    test_assert(setsockopt(tx_fd, SOL_TLS, TLS_TX, &ci, sizeof(ci)) == 0);
+
+    /* each send is framed into an application data record, with the explicit nonce incremented
+     * for each record */
+    for (int i = 0; i < sizeof(buf); i++)
+        buf[i] = i;
+    test_assert(write(tx_fd, buf, sizeof(buf)) == sizeof(buf));
+    netsock_test_ktls_record(rx_fd, 23, ci.iv, 0, buf, sizeof(buf));
+    test_assert(write(tx_fd, buf, 100) == 100);
+    netsock_test_ktls_record(rx_fd, 23, ci.iv, 1, buf, 100);
+
+    /* record type set via control message */
+    iov.iov_base = buf;
+    iov.iov_len = 2;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint8_t));
+    *CMSG_DATA(cmsg) = 21;  /* alert */
+    test_assert(sendmsg(tx_fd, &msg, 0) == 2);
+    netsock_test_ktls_record(rx_fd, 21, ci.iv, 2, buf, 2);
+  out:
+    test_assert((close(tx_fd) == 0) && (close(rx_fd) == 0) && (close(listen_fd) == 0));
+}
+
+#define NETSOCK_TEST_RP_CONNS   16
+
+static void netsock_test_reuseport(void)
+{
+    int listen_fds[2], conn_fds[NETSOCK_TEST_RP_CONNS];
+    int accepted[2] = {0, 0};
+    struct sockaddr_in addr;
+    struct pollfd pfds[2];
+    socklen_t len;
+    int fd, val = 1;
+    char buf[8];
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_RP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* UDP sockets can bind to the same port, and a datagram is received by one of them */
+    for (int i = 0; i < 2; i++) {
+        listen_fds[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        test_assert(listen_fds[i] >= 0);
+        test_assert(setsockopt(listen_fds[i], SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) == 0);
+        len = sizeof(val);
+        test_assert(getsockopt(listen_fds[i], SOL_SOCKET, SO_REUSEPORT, &val, &len) == 0);
+        test_assert(val == 1);
+        test_assert(bind(listen_fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        pfds[i].fd = listen_fds[i];
+        pfds[i].events = POLLIN;
+    }
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(fd >= 0);
+    test_assert(sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, sizeof(addr)) ==
+                sizeof(buf));
+    test_assert(poll(pfds, 2, 5000) == 1);
+    for (int i = 0; i < 2; i++) {
+        if (pfds[i].revents & POLLIN)
+            test_assert(recv(listen_fds[i], buf, sizeof(buf), 0) == sizeof(buf));
+        test_assert(close(listen_fds[i]) == 0);
+    }
+    test_assert(close(fd) == 0);
+
+    for (int i = 0; i < 2; i++) {
+        listen_fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        test_assert(listen_fds[i] > 0);
+        test_assert(setsockopt(listen_fds[i], SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) == 0);
+        test_assert(bind(listen_fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        test_assert(listen(listen_fds[i], NETSOCK_TEST_RP_CONNS) == 0);
+        pfds[i].fd = listen_fds[i];
+        pfds[i].events = POLLIN;
+    }
+
+    /* connections are spread across the accept queues of both listening sockets */
+    for (int i = 0; i < NETSOCK_TEST_RP_CONNS; i++) {
+        conn_fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        test_assert(conn_fds[i] > 0);
+        test_assert(connect(conn_fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    }
+    while (accepted[0] + accepted[1] < NETSOCK_TEST_RP_CONNS) {
+        test_assert(poll(pfds, 2, 5000) > 0);
+        for (int i = 0; i < 2; i++) {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+            while ((fd = accept(listen_fds[i], NULL, NULL)) > 0) {
+                accepted[i]++;
+                test_assert(close(fd) == 0);
+            }
+            test_assert(errno == EAGAIN);
+        }
+    }
+    test_assert((accepted[0] > 0) && (accepted[1] > 0));
+    for (int i = 0; i < NETSOCK_TEST_RP_CONNS; i++)
+        test_assert(close(conn_fds[i]) == 0);
+
+    /* a socket with SO_INCOMING_CPU set gets the connections processed on that CPU */
+    for (int i = 0; i < 2; i++) {
+        test_assert(setsockopt(listen_fds[i], SOL_SOCKET, SO_INCOMING_CPU, &i, sizeof(i)) == 0);
+        len = sizeof(val);
+        test_assert(getsockopt(listen_fds[i], SOL_SOCKET, SO_INCOMING_CPU, &val, &len) == 0);
+        test_assert(val == i);
+    }
+    for (int i = 0; i < NETSOCK_TEST_RP_CONNS; i++) {
+        conn_fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        test_assert(conn_fds[i] > 0);
+        test_assert(connect(conn_fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    }
+    accepted[0] = accepted[1] = 0;
+    while (accepted[0] + accepted[1] < NETSOCK_TEST_RP_CONNS) {
+        test_assert(poll(pfds, 2, 5000) > 0);
+        for (int i = 0; i < 2; i++) {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+            while ((fd = accept(listen_fds[i], NULL, NULL)) > 0) {
+                accepted[i]++;
+                len = sizeof(val);
+                test_assert(getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &val, &len) == 0);
+                test_assert((val >= 0) && ((val >= 2) || (val == i)));
+                test_assert(close(fd) == 0);
+            }
+            test_assert(errno == EAGAIN);
+        }
+    }
+    for (int i = 0; i < NETSOCK_TEST_RP_CONNS; i++)
+        test_assert(close(conn_fds[i]) == 0);
+
+    /* the remaining socket keeps accepting connections after the first one is closed */
+    test_assert(close(listen_fds[0]) == 0);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    test_assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(poll(&pfds[1], 1, 5000) == 1);
+    conn_fds[0] = accept(listen_fds[1], NULL, NULL);
+    test_assert(conn_fds[0] > 0);
+    test_assert((close(conn_fds[0]) == 0) && (close(fd) == 0) && (close(listen_fds[1]) == 0));
+}
+
 static void *netsock_test_fault_tcp_thread(void *arg)
 {
     int fd;
@@ -855,6 +1375,11 @@ int main(int argc, char **argv)
     netsock_test_netconf();
     netsock_test_msg(SOCK_STREAM);
     netsock_test_msg(SOCK_DGRAM);
+    netsock_test_udp_gso();
+    netsock_test_zerocopy();
+    netsock_test_busy_poll();
+    netsock_test_ktls();
+    netsock_test_reuseport();
     netsock_test_fault();
     printf("Network socket tests OK\n");
     return EXIT_SUCCESS;
@@ -0,0 +1,94 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+/* This test runs twice on the same image: the first run saves a process snapshot and then
+ * modifies the process memory, the second run is restored from the snapshot and checks that the
+ * memory contents are those at the time the snapshot was taken. */
+
+#define PR_NANOS_SNAPSHOT   0x4e530001
+
+#define BUF_SIZE    (64 * 1024)
+#define MMAP_SIZE   (1024 * 1024)
+
+static uint8_t bss_buf[BUF_SIZE];
+static uint64_t data_val = 0x0123456789abcdefull;
+
+static void fill(uint8_t *buf, size_t len, uint8_t seed)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = seed + i;
+}
+
+static int check(uint8_t *buf, size_t len, uint8_t seed)
+{
+    for (size_t i = 0; i < len; i++)
+        if (buf[i] != (uint8_t)(seed + i))
+            return 0;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t stack_buf[4096];
+    uint8_t *heap_buf = malloc(BUF_SIZE);
+    test_assert(heap_buf != NULL);
+    uint8_t *mmap_buf = mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    test_assert(mmap_buf != MAP_FAILED);
+
+    fill(bss_buf, sizeof(bss_buf), 1);
+    fill(stack_buf, sizeof(stack_buf), 2);
+    fill(heap_buf, BUF_SIZE, 3);
+    /* only the first half of the anonymous mapping is touched */
+    fill(mmap_buf, MMAP_SIZE / 2, 4);
+
+    int ret = prctl(PR_NANOS_SNAPSHOT, 0, 0, 0, 0);
+    if (ret < 0)
+        test_perror("snapshot");
+    if (ret == 0) {
+        /* A snapshot cannot be taken when files other than the standard ones are open. */
+        int fds[2];
+        test_assert(pipe(fds) == 0);
+        test_assert((prctl(PR_NANOS_SNAPSHOT, 0, 0, 0, 0) == -1) && (errno == EBUSY));
+        close(fds[0]);
+        close(fds[1]);
+
+        memset(bss_buf, 0xff, sizeof(bss_buf));
+        memset(stack_buf, 0xff, sizeof(stack_buf));
+        memset(heap_buf, 0xff, BUF_SIZE);
+        memset(mmap_buf, 0xff, MMAP_SIZE);
+        data_val = 0;
+        printf("snapshot saved\n");
+        exit(EXIT_SUCCESS);
+    }
+
+    test_assert(ret == 1);
+    test_assert(check(bss_buf, sizeof(bss_buf), 1));
+    test_assert(check(stack_buf, sizeof(stack_buf), 2));
+    test_assert(check(heap_buf, BUF_SIZE, 3));
+    test_assert(check(mmap_buf, MMAP_SIZE / 2, 4));
+    for (size_t i = MMAP_SIZE / 2; i < MMAP_SIZE; i++)
+        test_assert(mmap_buf[i] == 0);
+    test_assert(data_val == 0x0123456789abcdefull);
+
+    /* Restored memory is copy-on-write. */
+    memset(heap_buf, 0x5a, BUF_SIZE);
+    memset(mmap_buf, 0x5a, MMAP_SIZE);
+    for (size_t i = 0; i < MMAP_SIZE; i++)
+        test_assert(mmap_buf[i] == 0x5a);
+    uint8_t *new_buf = malloc(4 * BUF_SIZE);
+    test_assert(new_buf != NULL);
+    fill(new_buf, 4 * BUF_SIZE, 5);
+    test_assert(check(new_buf, 4 * BUF_SIZE, 5));
+
+    /* A restored process cannot be snapshotted again. */
+    test_assert((prctl(PR_NANOS_SNAPSHOT, 0, 0, 0, 0) == -1) && (errno == EBUSY));
+    printf("snapshot restore test passed\n");
+    exit(EXIT_SUCCESS);
+}
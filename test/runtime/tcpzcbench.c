@@ -0,0 +1,248 @@
+/* TCP transmit benchmark: measures the throughput and the CPU time spent by the sender when data
+ * is sent with plain send() calls (which copy the data into kernel buffers) and with MSG_ZEROCOPY
+ * (which transmits the data directly from the user buffers, and reports through the socket error
+ * queue when each buffer can be reused). The sender cycles through a ring of buffers, waiting for
+ * the completion notification of a buffer before writing to it again.
+ * Data is sent to a receiver thread via the loopback interface, or to a remote host (e.g. a
+ * `nc -l <port> > /dev/null` instance) if an address is specified.
+ * Runs both as a host program and in a unikernel instance.
+ *
+ * usage: tcpzcbench [-s send-size] [-n megabytes] [-r ring-buffers] [address:port]
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+#define TCPZCBENCH_MAX_RING     64
+#define TCPZCBENCH_RX_BUF_SIZE  (256 * 1024)
+
+static int send_size = 64 * 1024;
+static long total_mb = 1024;
+static int ring_size = 16;
+static struct sockaddr_in remote;
+
+struct tcpzcbench_rx {
+    int fd;
+    long bytes;
+};
+
+/* state of the MSG_ZEROCOPY completion notifications */
+struct tcpzcbench_zc {
+    uint32_t next_id;   /* id of the next send */
+    uint32_t done_id;   /* all sends with a lower id have completed */
+    long notifs;
+    long copied;        /* sends for which the kernel fell back to copying the data */
+};
+
+static double elapsed_secs(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static double thread_cpu_secs(void)
+{
+    struct rusage ru;
+    test_assert(getrusage(RUSAGE_THREAD, &ru) == 0);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void *tcpzcbench_receiver(void *arg)
+{
+    struct tcpzcbench_rx *rx = arg;
+    char *buf = malloc(TCPZCBENCH_RX_BUF_SIZE);
+    test_assert(buf != NULL);
+    while (1) {
+        ssize_t n = read(rx->fd, buf, TCPZCBENCH_RX_BUF_SIZE);
+        if (n == 0)
+            break;
+        test_assert(n > 0);
+        rx->bytes += n;
+    }
+    free(buf);
+    return NULL;
+}
+
+/* Reads the pending completion notifications; if block is set, waits for at least one. */
+static void tcpzcbench_reap(int fd, struct tcpzcbench_zc *zc, int block)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            test_assert(errno == EAGAIN);
+            if (!block)
+                return;
+            struct pollfd pfd = {
+                .fd = fd,
+                .events = 0,
+            };
+            test_assert(poll(&pfd, 1, -1) == 1);
+            continue;
+        }
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        test_assert(cmsg != NULL);
+        struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        test_assert(ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY);
+        test_assert(ee->ee_info == zc->done_id);
+        zc->done_id = ee->ee_data + 1;
+        zc->notifs++;
+        if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            zc->copied += ee->ee_data - ee->ee_info + 1;
+        block = 0;
+    }
+}
+
+static void tcpzcbench_run(int zerocopy)
+{
+    struct tcpzcbench_rx rx = {0};
+    struct tcpzcbench_zc zc = {0};
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    pthread_t receiver;
+    struct timespec start;
+    int listen_fd = -1;
+    uint32_t buf_id[TCPZCBENCH_MAX_RING];
+    long total = total_mb * 1024 * 1024;
+    long sent = 0;
+    size_t ring_len = (size_t)ring_size * send_size;
+
+    /* anonymous memory, which can be pinned for zerocopy transmission */
+    char *ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    test_assert(ring != MAP_FAILED);
+    memset(ring, 0xa5, ring_len);
+
+    if (remote.sin_family) {
+        addr = remote;
+    } else {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        test_assert(listen_fd >= 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        test_assert(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        test_assert(getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen) == 0);
+        test_assert(listen(listen_fd, 1) == 0);
+    }
+    int tx_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(tx_fd >= 0);
+    if (zerocopy) {
+        int val = 1;
+        test_assert(setsockopt(tx_fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) == 0);
+    }
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    if (listen_fd >= 0) {
+        rx.fd = accept(listen_fd, NULL, NULL);
+        test_assert(rx.fd >= 0);
+        test_assert(pthread_create(&receiver, NULL, tcpzcbench_receiver, &rx) == 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double cpu_start = thread_cpu_secs();
+    for (long i = 0; sent < total; i++) {
+        int slot = i % ring_size;
+        char *buf = ring + (size_t)slot * send_size;
+        if (zerocopy) {
+            /* the buffer can be modified only after its previous send has completed */
+            tcpzcbench_reap(tx_fd, &zc, 0);
+            while ((i >= ring_size) && ((int32_t)(zc.done_id - buf_id[slot]) <= 0))
+                tcpzcbench_reap(tx_fd, &zc, 1);
+            buf_id[slot] = zc.next_id;
+        }
+        buf[0] = i; /* the application writes the buffer contents */
+        ssize_t n = send(tx_fd, buf, send_size, zerocopy ? MSG_ZEROCOPY : 0);
+        if (n < 0) {
+            test_assert((errno == ENOBUFS) || (errno == EAGAIN));
+            i--;
+            continue;
+        }
+        if (zerocopy)
+            zc.next_id++;
+        sent += n;
+    }
+    while (zc.done_id != zc.next_id)
+        tcpzcbench_reap(tx_fd, &zc, 1);
+    double cpu_secs = thread_cpu_secs() - cpu_start;
+    double secs = elapsed_secs(&start);
+    test_assert(shutdown(tx_fd, SHUT_WR) == 0);
+    if (listen_fd >= 0) {
+        test_assert(pthread_join(receiver, NULL) == 0);
+        test_assert(rx.bytes == sent);
+        close(rx.fd);
+        close(listen_fd);
+    }
+    double mb = sent / (1024.0 * 1024.0);
+    printf("%-10s %12.1f %11.1f%% %12.1f %12ld %11.1f%%\n", zerocopy ? "zerocopy" : "copy",
+           mb / secs, 100.0 * cpu_secs / secs, cpu_secs * 1e6 / mb, zc.notifs,
+           zc.next_id ? 100.0 * zc.copied / zc.next_id : 0.0);
+    close(tx_fd);
+    munmap(ring, ring_len);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "s:n:r:")) != -1) {
+        switch (c) {
+        case 's':
+            send_size = atoi(optarg);
+            break;
+        case 'n':
+            total_mb = atol(optarg);
+            break;
+        case 'r':
+            ring_size = atoi(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind < argc) {
+        char *port = strchr(argv[optind], ':');
+        if (!port)
+            goto usage;
+        *port++ = '\0';
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons(atoi(port));
+        if (inet_pton(AF_INET, argv[optind], &remote.sin_addr) != 1)
+            goto usage;
+    }
+    if ((send_size <= 0) || (total_mb <= 0) || (ring_size <= 0) ||
+        (ring_size > TCPZCBENCH_MAX_RING)) {
+        fprintf(stderr, "invalid parameters\n");
+        return EXIT_FAILURE;
+    }
+    printf("%d-byte sends, %ld MB per test, %d buffers, %s receiver\n", send_size, total_mb,
+           ring_size, remote.sin_family ? "remote" : "loopback");
+    printf("%-10s %12s %12s %12s %12s %12s\n", "mode", "MB/s", "sender CPU", "CPU us/MB",
+           "notifs", "copied");
+    tcpzcbench_run(0);
+    tcpzcbench_run(1);
+    return EXIT_SUCCESS;
+  usage:
+    fprintf(stderr, "usage: %s [-s send-size] [-n megabytes] [-r ring-buffers] [address:port]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+}
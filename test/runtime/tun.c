@@ -11,6 +11,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <runtime.h>
@@ -166,6 +167,7 @@ static void tun_test_pi(void)
     struct sockaddr_in addr;
     socklen_t addr_len;
     uint8_t buf[KB];
+    struct iovec iov[3];
     const int pkt_len = sizeof(buf) / 2;
     const int tot_len =
             sizeof(struct tun_pi) + sizeof(struct iphdr) + sizeof(struct udphdr) + pkt_len;
@@ -220,6 +222,35 @@ static void tun_test_pi(void)
     for (int i = 0; i < pkt_len; i++)
         test_assert(buf[i] == (uint8_t)i);
 
+    /* A packet read with readv() is scattered over all buffers, and a packet written with writev()
+     * is gathered from all buffers (e.g. packet information in the first buffer and IP packet in
+     * the others). */
+    for (int i = 0; i < pkt_len; i++)
+        buf[i] = i;
+    test_assert(send(sock_fd, buf, pkt_len, 0) == pkt_len);
+    memset(buf, 0, sizeof(buf));
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(struct tun_pi);
+    iov[1].iov_base = ip_hdr;
+    iov[1].iov_len = 10;    /* split the IP header */
+    iov[2].iov_base = (uint8_t *)ip_hdr + iov[1].iov_len;
+    iov[2].iov_len = sizeof(buf) - iov[0].iov_len - iov[1].iov_len;
+    test_assert(readv(tun_fd, iov, 3) == tot_len);
+    test_assert(pi->proto == htons(ETH_P_IP));
+    test_assert(!(pi->flags & TUN_PKT_STRIP));
+    test_assert(ip_hdr->daddr == htonl(TUN_PEER_ADDR));
+    for (int i = 0; i < pkt_len; i++)
+        test_assert(buf[tot_len - pkt_len + i] == (uint8_t)i);
+    ip_hdr->saddr = htonl(TUN_PEER_ADDR);
+    ip_hdr->daddr = htonl(TUN_ADDR);
+    udp_hdr->source = htons(TUN_PEER_PORT);
+    udp_hdr->dest = addr.sin_port;
+    iov[2].iov_len = tot_len - iov[0].iov_len - iov[1].iov_len;
+    test_assert(writev(tun_fd, iov, 3) == tot_len);
+    test_assert(recv(sock_fd, buf, sizeof(buf), 0) == pkt_len);
+    for (int i = 0; i < pkt_len; i++)
+        test_assert(buf[i] == (uint8_t)i);
+
     test_assert(close(sock_fd) == 0);
     test_assert(close(tun_fd) == 0);
 }
@@ -240,7 +271,69 @@ static int tun_set_queue(int fd, int enable)
     return ioctl(fd, TUNSETQUEUE, (void *)&ifr);
 }
 
-#define MQ_COUNT 4
+#define MQ_COUNT    4
+#define MQ_FLOWS    8
+#define MQ_BATCH    4
+
+/* Check that packets of a given flow are always steered to the same queue. */
+static void tun_test_mq_steering(int *fds)
+{
+    int sock_fd;
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    struct pollfd pfds[MQ_COUNT];
+    uint8_t bufs[MQ_BATCH + 1][256];
+    const int pkt_len = 64;
+    const int tot_len = sizeof(struct iphdr) + sizeof(struct udphdr) + pkt_len;
+    int q;
+
+    for (int i = 0; i < MQ_COUNT; i++) {
+        int nbio = 1;
+        test_assert(ioctl(fds[i], FIONBIO, &nbio) == 0);
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+    for (int flow = 0; flow < MQ_FLOWS; flow++) {
+        sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        test_assert(sock_fd > 0);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(TUN_PEER_ADDR);
+        addr.sin_port = htons(TUN_PEER_PORT + flow);
+        test_assert(connect(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        for (int i = 0; i < MQ_BATCH; i++) {
+            memset(bufs[0], i, pkt_len);
+            test_assert(send(sock_fd, bufs[0], pkt_len, 0) == pkt_len);
+        }
+
+        /* All packets must be queued in a single queue. */
+        test_assert(poll(pfds, MQ_COUNT, 0) == 1);
+        for (q = 0; !(pfds[q].revents & POLLIN); q++);
+        for (int i = 0; i < MQ_BATCH; i++) {
+            test_assert(read(fds[q], bufs[i], sizeof(bufs[i])) == tot_len);
+            test_assert(bufs[i][tot_len - 1] == (uint8_t)i);
+        }
+        test_assert((read(fds[q], bufs[0], sizeof(bufs[0])) == -1) && (errno == EAGAIN));
+
+        /* Send the packets back to the socket. */
+        addr_len = sizeof(addr);
+        test_assert(getsockname(sock_fd, (struct sockaddr *)&addr, &addr_len) == 0);
+        for (int i = 0; i < MQ_BATCH; i++) {
+            struct iphdr *ip_hdr = (struct iphdr *)bufs[i];
+            struct udphdr *udp_hdr = (struct udphdr *)(ip_hdr + 1);
+            ip_hdr->saddr = htonl(TUN_PEER_ADDR);
+            ip_hdr->daddr = htonl(TUN_ADDR);
+            udp_hdr->source = htons(TUN_PEER_PORT + flow);
+            udp_hdr->dest = addr.sin_port;
+            test_assert(write(fds[q], bufs[i], tot_len) == tot_len);
+        }
+        for (int i = 0; i < MQ_BATCH; i++) {
+            test_assert(recv(sock_fd, bufs[MQ_BATCH], sizeof(bufs[MQ_BATCH]), 0) == pkt_len);
+            test_assert(bufs[MQ_BATCH][0] == (uint8_t)i);
+        }
+        test_assert(close(sock_fd) == 0);
+    }
+}
+
 /* Test the multi-queue option when creating an interface */
 static void tun_test_multiqueue(void)
 {
@@ -275,10 +368,30 @@ static void tun_test_multiqueue(void)
     test_assert(tun_set_queue(fds[0], -1) == -1);
     for (int i = 0; i < MQ_COUNT; i++)
         test_assert(tun_set_queue(fds[i], 0) == 0);
+    test_assert((tun_set_queue(fds[0], 0) == -1) && (errno == EINVAL));
     for (int i = 0; i < MQ_COUNT; i++)
         test_assert(tun_set_queue(fds[i], 1) == 0);
+    test_assert((tun_set_queue(fds[0], 1) == -1) && (errno == EINVAL));
+    tun_test_mq_steering(fds);
     for (int i = 0; i < MQ_COUNT; i++)
         test_assert(close(fds[i]) == 0);
+
+    /* Multiple queues cannot be attached to an interface created without IFF_MULTI_QUEUE. */
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_name[0] = 's';
+    ifr.ifr_name[1] = 'q';
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    fds[0] = open("/dev/net/tun", O_RDWR);
+    test_assert(fds[0] > 0);
+    test_assert(ioctl(fds[0], TUNSETIFF, &ifr) == 0);
+    fds[1] = open("/dev/net/tun", O_RDWR);
+    test_assert(fds[1] > 0);
+    test_assert((ioctl(fds[1], TUNSETIFF, &ifr) == -1) && (errno == EBUSY));
+    ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    test_assert((ioctl(fds[1], TUNSETIFF, &ifr) == -1) && (errno == EINVAL));
+    test_assert((tun_set_queue(fds[0], 0) == -1) && (errno == EINVAL));
+    test_assert(close(fds[1]) == 0);
+    test_assert(close(fds[0]) == 0);
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,214 @@
+/* UDP packet rate benchmark: measures the rate at which datagrams are sent to and received from
+ * the loopback interface with different system call patterns: one datagram per sendto(), batches
+ * of datagrams per sendmmsg(), and UDP GSO (a batch of datagrams per send()). The receiver uses
+ * recvmmsg(), optionally with UDP GRO.
+ * Runs both as a host program and in a unikernel instance.
+ *
+ * usage: udpbench [-s datagram-size] [-n datagrams] [-b batch-size] [-g]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+#define UDPBENCH_MAX_BATCH      64
+#define UDPBENCH_MAX_PAYLOAD    65507
+#define UDPBENCH_RX_TIMEOUT     500 /* milliseconds */
+
+enum udpbench_mode {
+    UDPBENCH_SENDTO,
+    UDPBENCH_SENDMMSG,
+    UDPBENCH_GSO,
+};
+
+static const char *mode_names[] = {"sendto", "sendmmsg", "gso"};
+
+static int dgram_size = 64;
+static long dgram_count = 1000000;
+static int batch_size = 32;
+static int gro;
+
+struct udpbench_rx {
+    int fd;
+    long bytes;
+    long msgs;
+};
+
+static double elapsed_secs(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Receives datagrams until no datagram arrives for UDPBENCH_RX_TIMEOUT milliseconds. */
+static void *udpbench_receiver(void *arg)
+{
+    struct udpbench_rx *rx = arg;
+    int buf_size = gro ? UDPBENCH_MAX_PAYLOAD : dgram_size;
+    char *bufs = malloc(UDPBENCH_MAX_BATCH * buf_size);
+    struct iovec iov[UDPBENCH_MAX_BATCH];
+    struct mmsghdr msgs[UDPBENCH_MAX_BATCH];
+    struct pollfd pfd = {
+        .fd = rx->fd,
+        .events = POLLIN,
+    };
+    test_assert(bufs != NULL);
+    for (int i = 0; i < UDPBENCH_MAX_BATCH; i++) {
+        iov[i].iov_base = bufs + i * buf_size;
+        iov[i].iov_len = buf_size;
+    }
+    while (poll(&pfd, 1, UDPBENCH_RX_TIMEOUT) == 1) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < UDPBENCH_MAX_BATCH; i++) {
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(rx->fd, msgs, UDPBENCH_MAX_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            test_assert(errno == EAGAIN);
+            continue;
+        }
+        for (int i = 0; i < n; i++)
+            rx->bytes += msgs[i].msg_len;
+        rx->msgs += n;
+    }
+    free(bufs);
+    return NULL;
+}
+
+static long udpbench_send(int fd, enum udpbench_mode mode, char *buf)
+{
+    struct iovec iov[UDPBENCH_MAX_BATCH];
+    struct mmsghdr msgs[UDPBENCH_MAX_BATCH];
+    long calls = 0;
+    long sent = 0;
+    int gso_batch = batch_size;
+    if (mode == UDPBENCH_GSO) {
+        if (gso_batch * dgram_size > UDPBENCH_MAX_PAYLOAD)
+            gso_batch = UDPBENCH_MAX_PAYLOAD / dgram_size;
+        test_assert(setsockopt(fd, SOL_UDP, UDP_SEGMENT, &dgram_size, sizeof(dgram_size)) == 0);
+    } else if (mode == UDPBENCH_SENDMMSG) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < batch_size; i++) {
+            iov[i].iov_base = buf;
+            iov[i].iov_len = dgram_size;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+    while (sent < dgram_count) {
+        long n = dgram_count - sent;
+        switch (mode) {
+        case UDPBENCH_SENDTO:
+            n = (send(fd, buf, dgram_size, 0) == dgram_size) ? 1 : -1;
+            break;
+        case UDPBENCH_SENDMMSG:
+            n = sendmmsg(fd, msgs, (n < batch_size) ? n : batch_size, 0);
+            break;
+        case UDPBENCH_GSO:
+            if (n > gso_batch)
+                n = gso_batch;
+            n = (send(fd, buf, n * dgram_size, 0) == n * dgram_size) ? n : -1;
+            break;
+        }
+        if (n < 0) {
+            /* the transmit path may be temporarily out of buffers */
+            test_assert((errno == ENOBUFS) || (errno == EAGAIN) || (errno == ENOMEM));
+            continue;
+        }
+        sent += n;
+        calls++;
+    }
+    return calls;
+}
+
+static void udpbench_run(enum udpbench_mode mode)
+{
+    struct udpbench_rx rx = {0};
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    pthread_t receiver;
+    struct timespec start;
+    char *buf = malloc(UDPBENCH_MAX_PAYLOAD);
+    test_assert(buf != NULL);
+    memset(buf, 0xa5, UDPBENCH_MAX_PAYLOAD);
+
+    rx.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(rx.fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(rx.fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(getsockname(rx.fd, (struct sockaddr *)&addr, &addrlen) == 0);
+    if (gro) {
+        int val = 1;
+        test_assert(setsockopt(rx.fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0);
+    }
+    int tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(tx_fd >= 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(pthread_create(&receiver, NULL, udpbench_receiver, &rx) == 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long calls = udpbench_send(tx_fd, mode, buf);
+    double tx_secs = elapsed_secs(&start);
+    test_assert(pthread_join(receiver, NULL) == 0);
+    long received = rx.bytes / dgram_size;
+    printf("%-10s %12.0f %12ld %11.1f%% %12.1f\n", mode_names[mode], dgram_count / tx_secs,
+           calls, 100.0 * received / dgram_count, (double)received / (rx.msgs ? rx.msgs : 1));
+    close(tx_fd);
+    close(rx.fd);
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "s:n:b:g")) != -1) {
+        switch (c) {
+        case 's':
+            dgram_size = atoi(optarg);
+            break;
+        case 'n':
+            dgram_count = atol(optarg);
+            break;
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'g':
+            gro = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s datagram-size] [-n datagrams] [-b batch-size] [-g]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((dgram_size <= 0) || (dgram_size > UDPBENCH_MAX_PAYLOAD) || (dgram_count <= 0) ||
+        (batch_size <= 0) || (batch_size > UDPBENCH_MAX_BATCH)) {
+        fprintf(stderr, "invalid parameters\n");
+        return EXIT_FAILURE;
+    }
+    printf("%d-byte datagrams, %ld datagrams per test, batch size %d, GRO %s\n", dgram_size,
+           dgram_count, batch_size, gro ? "on" : "off");
+    printf("%-10s %12s %12s %12s %12s\n", "mode", "tx pkts/s", "tx calls", "received",
+           "pkts/rx msg");
+    udpbench_run(UDPBENCH_SENDTO);
+    udpbench_run(UDPBENCH_SENDMMSG);
+    udpbench_run(UDPBENCH_GSO);
+    return EXIT_SUCCESS;
+}
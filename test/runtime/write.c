@@ -8,9 +8,11 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <linux/fs.h>
 
 #include "../test_utils.h"
 
@@ -277,6 +279,177 @@ void append_write_test()
     exit(EXIT_FAILURE);
 }
 
+static void read_file_contents(const char *path, char *buf, ssize_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        test_perror("open %s", path);
+    *len = read(fd, buf, BUFLEN);
+    if (*len < 0)
+        test_perror("read %s", path);
+    close(fd);
+}
+
+/* The files "shared1" and "shared2" have identical contents, which are stored in blocks shared
+ * between the two files: writing to (or deleting) one file must not affect the other. */
+void shared_write_test(void)
+{
+    char orig[BUFLEN], buf[BUFLEN];
+    ssize_t orig_len, len;
+
+    read_file_contents("shared1", orig, &orig_len);
+    read_file_contents("shared2", buf, &len);
+    if ((len != orig_len) || memcmp(buf, orig, len))
+        test_error("shared files differ");
+    int fd = open("shared1", O_WRONLY);
+    if (fd < 0)
+        test_perror("open shared1");
+    if (write(fd, str, strlen(str)) != strlen(str))
+        test_perror("write shared1");
+    if (fsync(fd) < 0)
+        test_perror("fsync shared1");
+    close(fd);
+    read_file_contents("shared1", buf, &len);
+    if ((len != ((orig_len > strlen(str)) ? orig_len : strlen(str))) ||
+        memcmp(buf, str, strlen(str)))
+        test_error("shared1 contents not updated");
+    read_file_contents("shared2", buf, &len);
+    if ((len != orig_len) || memcmp(buf, orig, len))
+        test_error("shared2 modified by write to shared1");
+    if (unlink("shared1") < 0)
+        test_perror("unlink shared1");
+    read_file_contents("shared2", buf, &len);
+    if ((len != orig_len) || memcmp(buf, orig, len))
+        test_error("shared2 modified by unlink of shared1");
+    writetest_debug("shared write test passed\n");
+}
+
+#define CLONE_FILE_LEN  (3 * 4096 + 1234)
+
+static void clone_file_check(int fd, const char *name, const unsigned char *data, size_t len)
+{
+    unsigned char buf[CLONE_FILE_LEN];
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        test_perror("fstat %s", name);
+    if (st.st_size != len)
+        test_error("%s: unexpected size %ld (expected %ld)", name, st.st_size, len);
+    if (pread(fd, buf, len, 0) != len)
+        test_perror("pread %s", name);
+    if (memcmp(buf, data, len))
+        test_error("%s: unexpected contents", name);
+}
+
+static int clone_file_create(const char *name)
+{
+    int fd = open(name, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        test_perror("open %s", name);
+    return fd;
+}
+
+/* File ranges copied with copy_file_range() or cloned with FICLONE/FICLONERANGE may share storage
+ * blocks with the source file: writing to the destination file must not affect the source file. */
+void clone_write_test(void)
+{
+    unsigned char data[CLONE_FILE_LEN], buf[CLONE_FILE_LEN];
+    for (int i = 0; i < CLONE_FILE_LEN; i++)
+        data[i] = i * 7 + (i >> 8);
+    int src = clone_file_create("clone_src");
+    if (write(src, data, CLONE_FILE_LEN) != CLONE_FILE_LEN)
+        test_perror("write clone_src");
+    if (lseek(src, 0, SEEK_SET) != 0)
+        test_perror("lseek clone_src");
+
+    /* whole file, using the file offsets */
+    int dst = clone_file_create("clone_copy");
+    ssize_t total = 0, n;
+    while ((n = copy_file_range(src, NULL, dst, NULL, CLONE_FILE_LEN, 0)) > 0)
+        total += n;
+    if (n < 0)
+        test_perror("copy_file_range");
+    if (total != CLONE_FILE_LEN)
+        test_error("copy_file_range: copied %ld bytes", total);
+    if ((lseek(src, 0, SEEK_CUR) != CLONE_FILE_LEN) || (lseek(dst, 0, SEEK_CUR) != CLONE_FILE_LEN))
+        test_error("copy_file_range: file offsets not updated");
+    clone_file_check(dst, "clone_copy", data, CLONE_FILE_LEN);
+
+    /* writing to the copy does not affect the source file */
+    if (pwrite(dst, "xyz", 3, 4096 + 10) != 3)
+        test_perror("pwrite clone_copy");
+    if (fsync(dst) < 0)
+        test_perror("fsync clone_copy");
+    clone_file_check(src, "clone_src", data, CLONE_FILE_LEN);
+    close(dst);
+
+    /* unaligned ranges, using and updating explicit offsets */
+    dst = clone_file_create("clone_range");
+    loff_t off_in = 100, off_out = 3000;
+    total = 0;
+    while (total < 5000) {
+        n = copy_file_range(src, &off_in, dst, &off_out, 5000 - total, 0);
+        if (n <= 0)
+            test_perror("copy_file_range with offsets");
+        total += n;
+    }
+    if ((off_in != 5100) || (off_out != 8000))
+        test_error("copy_file_range: offsets not updated (%ld, %ld)", off_in, off_out);
+    if (lseek(src, 0, SEEK_CUR) != CLONE_FILE_LEN)
+        test_error("copy_file_range: source file offset modified");
+    if (pread(dst, buf, 5000, 3000) != 5000)
+        test_perror("pread clone_range");
+    if (memcmp(buf, data + 100, 5000))
+        test_error("clone_range: unexpected contents");
+
+    /* overlapping ranges in the same file, and invalid flags */
+    off_in = 0;
+    off_out = 4096;
+    if ((copy_file_range(src, &off_in, src, &off_out, 8192, 0) != -1) || (errno != EINVAL))
+        test_error("copy_file_range with overlapping ranges: unexpected result");
+    if ((copy_file_range(src, &off_in, dst, &off_out, 1, 1) != -1) || (errno != EINVAL))
+        test_error("copy_file_range with invalid flags: unexpected result");
+    close(dst);
+
+    /* clone of the whole file */
+    dst = clone_file_create("clone_ficlone");
+    if (ioctl(dst, FICLONE, src) < 0) {
+        if (errno != EOPNOTSUPP)
+            test_perror("FICLONE");
+        writetest_debug("file cloning not supported\n");
+    } else {
+        clone_file_check(dst, "clone_ficlone", data, CLONE_FILE_LEN);
+        if (pwrite(dst, "xyz", 3, 10) != 3)
+            test_perror("pwrite clone_ficlone");
+        if (fsync(dst) < 0)
+            test_perror("fsync clone_ficlone");
+        clone_file_check(src, "clone_src", data, CLONE_FILE_LEN);
+        if ((pread(dst, buf, 3, 10) != 3) || memcmp(buf, "xyz", 3))
+            test_error("clone_ficlone: write not applied");
+
+        /* clone of a page range, and misaligned range */
+        struct file_clone_range fcr = {
+            .src_fd = src,
+            .src_offset = 4096,
+            .src_length = 4096,
+            .dest_offset = 0,
+        };
+        if (ioctl(dst, FICLONERANGE, &fcr) < 0)
+            test_perror("FICLONERANGE");
+        if ((pread(dst, buf, 4096, 0) != 4096) || memcmp(buf, data + 4096, 4096))
+            test_error("clone_ficlone: unexpected contents after FICLONERANGE");
+        fcr.src_offset = 1;
+        if ((ioctl(dst, FICLONERANGE, &fcr) != -1) || (errno != EINVAL))
+            test_error("FICLONERANGE with misaligned offset: unexpected result");
+    }
+    close(dst);
+    close(src);
+    unlink("clone_src");
+    unlink("clone_copy");
+    unlink("clone_range");
+    unlink("clone_ficlone");
+    writetest_debug("clone write test passed\n");
+}
+
 void sync_write_test(void)
 {
     int fd = open("sync_write", O_CREAT | O_RDWR | O_SYNC, S_IRUSR | S_IWUSR);
@@ -923,6 +1096,8 @@ int main(int argc, char **argv)
         basic_write_test();
         scatter_write_test(1 << 18, 64, 1 << 12);
         append_write_test();
+        shared_write_test();
+        clone_write_test();
         sync_write_test();
         truncate_test(argv[0]);
         write_exec_test(argv[0]);
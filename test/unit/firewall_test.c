@@ -0,0 +1,203 @@
+#include <runtime.h>
+
+#include "../test_utils.h"
+#include "../../klib/firewall.h"
+
+#define IP_PROTO_TCP    6
+#define IP_PROTO_UDP    17
+
+#define RULE_SETS       200
+#define MAX_RULES       300
+#define PKTS_PER_SET    2000
+#define ADDR_POOL       16
+#define PORT_POOL       8
+
+/* Addresses and ports are drawn from small pools, so that random packets match random rules. */
+static u8 addr_pool[ADDR_POOL][16];
+static u16 port_pool[PORT_POOL];
+
+static u64 rand_below(u64 n)
+{
+    return random_u64() % n;
+}
+
+static void rand_src(u8 ip_version, u8 *src)
+{
+    int addr_len = (ip_version == 4) ? 4 : 16;
+    runtime_memcpy(src, addr_pool[rand_below(ADDR_POOL)], addr_len);
+    if (rand_below(4) == 0)   /* flip a random bit */
+        src[rand_below(addr_len)] ^= 1 << rand_below(8);
+}
+
+static firewall_constraint_val alloc_constraint_val(heap h, int type, u64 val, boolean equals)
+{
+    firewall_constraint_val c = allocate(h, sizeof(*c));
+    test_assert(c != INVALID_ADDRESS);
+    c->c.type = type;
+    c->c.equals = equals;
+    c->val = val;
+    return c;
+}
+
+static firewall_rule random_rule(heap h, u32 index)
+{
+    firewall_rule rule = allocate_zero(h, sizeof(*rule));
+    test_assert(rule != INVALID_ADDRESS);
+    rule->index = index;
+    rule->drop = rand_below(2);
+    int r = rand_below(3);
+    rule->ip_version = (r == 0) ? 0 : ((r == 1) ? 4 : 6);
+    if (rule->ip_version) {
+        rule->l3_match = allocate_vector(h, 2);
+        test_assert(rule->l3_match != INVALID_ADDRESS);
+        if (rand_below(16)) {
+            int max_len = (rule->ip_version == 4) ? 32 : 128;
+            u64 len = rand_below(2) ? max_len : (1 + rand_below(max_len));
+            firewall_constraint_buf c = allocate_zero(h, sizeof(*c) + 16);
+            test_assert(c != INVALID_ADDRESS);
+            c->c.type = FW_L3_SRC;
+            c->c.equals = (rand_below(16) != 0);
+            c->len = len;
+            rand_src(rule->ip_version, c->buf);
+            vector_push(rule->l3_match, c);
+        }
+        if (rand_below(4) == 0)
+            vector_push(rule->l3_match, alloc_constraint_val(h, FW_L3_FRAG, rand_below(2), true));
+    }
+    /* rules that match any packet would hide all subsequent rules, so they are rare */
+    if (!rule->ip_version || rand_below(2)) {
+        rule->l4_proto = rand_below(2) ? IP_PROTO_TCP : IP_PROTO_UDP;
+        if (!rule->l3_match) {
+            rule->l3_match = allocate_vector(h, 2);
+            test_assert(rule->l3_match != INVALID_ADDRESS);
+        }
+        vector_push(rule->l3_match, alloc_constraint_val(h, FW_L3_PROTO, rule->l4_proto, true));
+        if (!rule->ip_version || rand_below(4)) {
+            rule->l4_match = allocate_vector(h, 1);
+            test_assert(rule->l4_match != INVALID_ADDRESS);
+            vector_push(rule->l4_match, alloc_constraint_val(h, FW_L4_DEST,
+                                                             port_pool[rand_below(PORT_POOL)],
+                                                             rand_below(16) != 0));
+        }
+    }
+    if (rule->l3_match && (vector_length(rule->l3_match) == 0)) {
+        deallocate_vector(rule->l3_match);
+        rule->l3_match = 0;
+    }
+    return rule;
+}
+
+static void destroy_rule(heap h, firewall_rule rule)
+{
+    firewall_constraint c;
+    if (rule->l3_match) {
+        vector_foreach(rule->l3_match, c) {
+            if (c->type == FW_L3_SRC)
+                deallocate(h, c, sizeof(struct firewall_constraint_buf) + 16);
+            else
+                deallocate(h, c, sizeof(struct firewall_constraint_val));
+        }
+        deallocate_vector(rule->l3_match);
+    }
+    if (rule->l4_match) {
+        vector_foreach(rule->l4_match, c)
+            deallocate(h, c, sizeof(struct firewall_constraint_val));
+        deallocate_vector(rule->l4_match);
+    }
+    deallocate(h, rule, sizeof(*rule));
+}
+
+static void random_pkt(firewall_pkt pkt)
+{
+    zero(pkt, sizeof(*pkt));
+    int r = rand_below(16);
+    pkt->ip_version = (r == 0) ? 5 : ((r & 1) ? 4 : 6);
+    if ((pkt->ip_version == 5) || (rand_below(32) == 0))
+        return;
+    pkt->flags = FW_PKT_L3;
+    rand_src(pkt->ip_version, pkt->src);
+    if (rand_below(8) == 0)
+        pkt->flags |= FW_PKT_FRAG;
+    if ((pkt->ip_version == 4) || rand_below(16))
+        pkt->flags |= FW_PKT_PROTO;
+    else
+        return;
+    r = rand_below(8);
+    pkt->proto = (r == 0) ? 1 : ((r & 1) ? IP_PROTO_TCP : IP_PROTO_UDP);
+    if ((pkt->proto != 1) && !(pkt->flags & FW_PKT_FRAG) && rand_below(16)) {
+        pkt->flags |= FW_PKT_L4;
+        pkt->dest = rand_below(4) ? port_pool[rand_below(PORT_POOL)] : random_u64();
+    }
+}
+
+static boolean random_test(heap h)
+{
+    struct firewall_pkt pkts[PKTS_PER_SET];
+    for (int set = 0; set < RULE_SETS; set++) {
+        struct list rules;
+        list_init(&rules);
+        int rule_count = rand_below(MAX_RULES + 1);
+        for (int i = 0; i < rule_count; i++)
+            list_push_back(&rules, &random_rule(h, i)->l);
+        firewall_classifier fc = firewall_compile(h, &rules);
+        test_assert(fc != INVALID_ADDRESS);
+        firewall_cache cache = firewall_cache_alloc(h);
+        test_assert(cache != INVALID_ADDRESS);
+        u64 expected_default = 0;
+        for (int i = 0; i < PKTS_PER_SET; i++) {
+            /* repeat some packets, to exercise cache hits */
+            if (i && (rand_below(4) == 0))
+                pkts[i] = pkts[rand_below(i)];
+            else
+                random_pkt(&pkts[i]);
+            firewall_rule expected = firewall_linear_lookup(&rules, &pkts[i]);
+            if (!expected)
+                expected_default += 2;
+            firewall_rule rule = firewall_classify(fc, &pkts[i], 0);
+            if (rule != expected) {
+                msg_err("%s: set %d packet %d: classifier returned rule %d, expected %d",
+                        func_ss, set, i, rule ? rule->index : -1, expected ? expected->index : -1);
+                return false;
+            }
+            rule = firewall_classify(fc, &pkts[i], cache);
+            if (rule != expected) {
+                msg_err("%s: set %d packet %d: cached lookup returned rule %d, expected %d",
+                        func_ss, set, i, rule ? rule->index : -1, expected ? expected->index : -1);
+                return false;
+            }
+        }
+        u64 hits = 0;
+        list_foreach(&rules, elem) {
+            firewall_rule rule = struct_from_list(elem, firewall_rule, l);
+            hits += rule->hits;
+        }
+        test_assert(firewall_default_hits(fc) == expected_default);
+        test_assert(hits + expected_default == 2 * PKTS_PER_SET);
+        firewall_cache_dealloc(h, cache);
+        firewall_classifier_destroy(fc);
+        list_foreach(&rules, elem) {
+            list_delete(elem);
+            destroy_rule(h, struct_from_list(elem, firewall_rule, l));
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+    for (int i = 0; i < ADDR_POOL; i++)
+        for (int j = 0; j < 16; j++)
+            addr_pool[i][j] = random_u64();
+    for (int i = 0; i < PORT_POOL; i++)
+        port_pool[i] = random_u64();
+
+    if (!random_test(h))
+        goto fail;
+
+    msg_debug("test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("Firewall test failed");
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,153 @@
+#include <runtime.h>
+#include <lz4.h>
+
+#include "../test_utils.h"
+
+#define LZ4_TEST_BLOCK_SIZE (64 * KB)
+
+static u8 workmem[LZ4_WORKMEM_SIZE];
+
+static boolean roundtrip(heap h, const u8 *data, u64 len, u64 *clen)
+{
+    u64 bound = lz4_compress_bound(len);
+    u8 *c = allocate(h, bound);
+    u8 *d = allocate(h, len + 1);
+    test_assert((c != INVALID_ADDRESS) && (d != INVALID_ADDRESS));
+    u64 n = lz4_compress(data, len, c, bound, workmem);
+    test_assert(n > 0);
+    test_assert(lz4_decompress(c, n, d, len) == len);
+    test_assert(runtime_memcmp(d, data, len) == 0);
+
+    /* truncated compressed data and a too small output buffer must be detected */
+    if (len > 0) {
+        test_assert(lz4_decompress(c, n, d, len - 1) == -1);
+        test_assert(lz4_decompress(c, n - 1, d, len + 1) != len);
+    }
+    if (n > 1)
+        test_assert(lz4_compress(data, len, c, n - 1, workmem) == 0);
+    if (clen)
+        *clen = n;
+    deallocate(h, c, bound);
+    deallocate(h, d, len + 1);
+    return true;
+}
+
+static void fill_text(u8 *buf, u64 len, u64 seed)
+{
+    static const char *words[] = {
+        "the ", "extent ", "of ", "a ", "file ", "is ", "stored ", "in ", "compressed ", "form ",
+        "and ", "read ", "back ", "into ", "page ", "cache ", "\n", "filesystem ", "block ", "data ",
+    };
+    u64 i = 0;
+    while (i < len) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        const char *w = words[(seed >> 33) % _countof(words)];
+        for (; *w && (i < len); w++)
+            buf[i++] = *w;
+    }
+}
+
+static boolean format_test(heap h)
+{
+    u8 buf[LZ4_TEST_BLOCK_SIZE];
+    u8 out[64];
+
+    /* short inputs are stored as literals */
+    for (u64 len = 0; len < 32; len++) {
+        for (u64 i = 0; i < len; i++)
+            buf[i] = 'a';
+        test_assert(roundtrip(h, buf, len, 0));
+    }
+
+    /* overlapping matches (offset smaller than the match length) */
+    u64 clen;
+    zero(buf, sizeof(buf));
+    test_assert(roundtrip(h, buf, sizeof(buf), &clen));
+    test_assert(clen < sizeof(buf) / 200);
+    for (u64 i = 0; i < sizeof(buf); i++)
+        buf[i] = i % 3;
+    test_assert(roundtrip(h, buf, sizeof(buf), &clen));
+    test_assert(clen < sizeof(buf) / 200);
+
+    /* incompressible data must still round-trip */
+    for (u64 i = 0; i < sizeof(buf); i++)
+        buf[i] = random_u64();
+    test_assert(roundtrip(h, buf, sizeof(buf), &clen));
+    test_assert(clen <= lz4_compress_bound(sizeof(buf)));
+
+    /* malformed input: match offset pointing before the start of the output */
+    u8 bad[] = {0x10, 'a', 0x05, 0x00};
+    test_assert(lz4_decompress(bad, sizeof(bad), out, sizeof(out)) == -1);
+    bad[2] = 0;
+    test_assert(lz4_decompress(bad, sizeof(bad), out, sizeof(out)) == -1);
+
+    /* literal length extending past the end of the input */
+    u8 bad_len[] = {0xf0, 0xff};
+    test_assert(lz4_decompress(bad_len, sizeof(bad_len), out, sizeof(out)) == -1);
+
+    /* hand-encoded block: 4 literals, then a match of 8 bytes at offset 4 */
+    u8 good[] = {0x44, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x00};
+    test_assert(lz4_decompress(good, sizeof(good), out, sizeof(out)) == 12);
+    test_assert(runtime_memcmp(out, "abcdabcdabcd", 12) == 0);
+    return true;
+}
+
+/* Reports the compression ratio of text-like data and the compression and decompression
+ * throughput for blocks of the size used for compressed filesystem extents. */
+static boolean bench_test(heap h)
+{
+    const u64 total = 64 * MB;
+    const u64 blocks = total / LZ4_TEST_BLOCK_SIZE;
+    u8 *data = allocate(h, total);
+    u64 bound = lz4_compress_bound(LZ4_TEST_BLOCK_SIZE);
+    u8 *c = allocate(h, blocks * bound);
+    u64 *clen = allocate(h, blocks * sizeof(u64));
+    u8 *d = allocate(h, LZ4_TEST_BLOCK_SIZE);
+    test_assert((data != INVALID_ADDRESS) && (c != INVALID_ADDRESS) && (clen != INVALID_ADDRESS) &&
+                (d != INVALID_ADDRESS));
+    fill_text(data, total, 1);
+
+    u64 ctotal = 0;
+    timestamp start = now(CLOCK_ID_MONOTONIC_RAW);
+    for (u64 i = 0; i < blocks; i++) {
+        clen[i] = lz4_compress(data + i * LZ4_TEST_BLOCK_SIZE, LZ4_TEST_BLOCK_SIZE, c + i * bound,
+                               bound, workmem);
+        test_assert(clen[i] > 0);
+        ctotal += clen[i];
+    }
+    u64 comp_ns = nsec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - start);
+    start = now(CLOCK_ID_MONOTONIC_RAW);
+    for (u64 i = 0; i < blocks; i++) {
+        test_assert(lz4_decompress(c + i * bound, clen[i], d, LZ4_TEST_BLOCK_SIZE) ==
+                    LZ4_TEST_BLOCK_SIZE);
+        if (i == blocks / 2)
+            test_assert(runtime_memcmp(d, data + i * LZ4_TEST_BLOCK_SIZE, LZ4_TEST_BLOCK_SIZE) == 0);
+    }
+    u64 decomp_ns = nsec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - start);
+    test_assert(ctotal < total / 2);
+    rprintf("%ld KB blocks: compression ratio %ld.%02ld, compression %ld MB/s, "
+            "decompression %ld MB/s\n", LZ4_TEST_BLOCK_SIZE / KB, total / ctotal,
+            (total % ctotal) * 100 / ctotal, (total / MB) * BILLION / MAX(comp_ns, 1),
+            (total / MB) * BILLION / MAX(decomp_ns, 1));
+    deallocate(h, data, total);
+    deallocate(h, c, blocks * bound);
+    deallocate(h, clen, blocks * sizeof(u64));
+    deallocate(h, d, LZ4_TEST_BLOCK_SIZE);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!format_test(h))
+        goto fail;
+    if (!bench_test(h))
+        goto fail;
+
+    msg_debug("test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("lz4 test failed");
+    exit(EXIT_FAILURE);
+}
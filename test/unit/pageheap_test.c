@@ -5,6 +5,9 @@
 
 #define PH_TEST_MAX_PAGESIZE    PAGESIZE_2M
 
+/* upper bound of the memory cached in the per-CPU lists of a CPU */
+#define PAGEHEAP_TEST_PCP_BYTES (128 * PAGESIZE + 2 * PH_TEST_MAX_PAGESIZE)
+
 static u64 ph_test_range(heap h, void *mem_base, range r, u64 max_page_size)
 {
     heap ph = pageheap_init(h);
@@ -249,6 +252,232 @@ static void ph_test_multipage(heap h, void *mem_base, u64 mem_size)
     }
 }
 
+static u32 ph_test_node;
+static u64 ph_test_allowed;
+
+static u32 ph_test_node_pref(u64 *allowed)
+{
+    *allowed = ph_test_allowed;
+    return ph_test_node;
+}
+
+/* Test node-local allocations and fallback to other nodes. */
+static void ph_test_numa(heap h, void *mem_base, u64 mem_size)
+{
+    heap ph = pageheap_init(h);
+    const u64 node_size = 8 * PH_TEST_MAX_PAGESIZE;
+    u64 addrs[2 * node_size / PH_TEST_MAX_PAGESIZE];
+    int page_count, node_pages;
+    u64 p;
+
+    test_assert(pageheap_add_range(0, 2 * node_size));
+    pageheap_init_done(mem_base, PH_TEST_MAX_PAGESIZE);
+    test_assert(pageheap_node_count() == 1);
+    test_assert(pageheap_set_node(node_size, node_size, 1));
+    test_assert(pageheap_node_count() == 2);
+    test_assert(pageheap_page_node(0) == 0);
+    test_assert(pageheap_page_node(node_size - PAGESIZE) == 0);
+    test_assert(pageheap_page_node(node_size) == 1);
+    test_assert(pageheap_page_node(2 * node_size - PAGESIZE) == 1);
+    pageheap_set_node_pref(ph_test_node_pref);
+
+    /* Allocations restricted to a single node must not use memory from other nodes. */
+    for (ph_test_node = 0; ph_test_node < 2; ph_test_node++) {
+        ph_test_allowed = U64_FROM_BIT(ph_test_node);
+        for (page_count = 0; page_count < _countof(addrs); page_count++) {
+            p = allocate_u64(ph, PH_TEST_MAX_PAGESIZE);
+            if (p == INVALID_PHYSICAL)
+                break;
+            test_assert(pageheap_page_node(p) == ph_test_node);
+            addrs[page_count] = p;
+        }
+        test_assert(page_count > 0);
+        for (int page = 0; page < page_count; page++)
+            deallocate_u64(ph, addrs[page], PH_TEST_MAX_PAGESIZE);
+        test_assert(heap_allocated(ph) == 0);
+    }
+
+    /* Allocations fall back to other nodes when the preferred node has no free memory. */
+    ph_test_node = 1;
+    ph_test_allowed = -1ull;
+    for (page_count = 0; page_count < _countof(addrs); page_count++) {
+        p = allocate_u64(ph, PH_TEST_MAX_PAGESIZE);
+        if (p == INVALID_PHYSICAL)
+            break;
+        addrs[page_count] = p;
+    }
+    for (node_pages = 0; node_pages < page_count; node_pages++)
+        if (pageheap_page_node(addrs[node_pages]) != 1)
+            break;
+    test_assert((node_pages > 0) && (node_pages < page_count));
+    for (int page = node_pages; page < page_count; page++)
+        test_assert(pageheap_page_node(addrs[page]) == 0);
+    for (int page = 0; page < page_count; page++)
+        deallocate_u64(ph, addrs[page], PH_TEST_MAX_PAGESIZE);
+    test_assert(heap_allocated(ph) == 0);
+
+    /* Memory that is already in use by the heap is not moved to a different node. */
+    test_assert(pageheap_set_node(0, PH_TEST_MAX_PAGESIZE, 1));
+    test_assert(pageheap_page_node(0) == 0);
+}
+
+static u32 ph_test_cpu;
+
+static u32 ph_test_cpu_id(void)
+{
+    return ph_test_cpu;
+}
+
+static void ph_test_percpu(heap h, void *mem_base, u64 mem_size)
+{
+    heap ph = pageheap_init(h);
+    const u64 heap_size = 8 * PH_TEST_MAX_PAGESIZE;
+    u64 addrs[heap_size / PAGESIZE];
+    int page_count;
+    u64 p;
+
+    test_assert(pageheap_add_range(0, heap_size));
+    pageheap_init_done(mem_base, PH_TEST_MAX_PAGESIZE);
+    test_assert(pageheap_init_percpu(2, ph_test_cpu_id));
+
+    /* A page freed on a CPU is reused by the next allocation on the same CPU. */
+    ph_test_cpu = 0;
+    p = allocate_u64(ph, PAGESIZE);
+    test_assert(p != INVALID_PHYSICAL);
+    deallocate_u64(ph, p, PAGESIZE);
+    test_assert(allocate_u64(ph, PAGESIZE) == p);
+    deallocate_u64(ph, p, PAGESIZE);
+    p = allocate_u64(ph, PH_TEST_MAX_PAGESIZE);
+    test_assert(p != INVALID_PHYSICAL);
+    deallocate_u64(ph, p, PH_TEST_MAX_PAGESIZE);
+    test_assert(allocate_u64(ph, PH_TEST_MAX_PAGESIZE) == p);
+    deallocate_u64(ph, p, PH_TEST_MAX_PAGESIZE);
+
+    /* Pages cached in per-CPU lists are accounted as allocated until drained. */
+    bytes allocated = heap_allocated(ph);
+    test_assert(allocated > 0);
+    test_assert(pageheap_drain_percpu() == allocated);
+    test_assert(heap_allocated(ph) == 0);
+
+    /* Pages cached on a CPU are made available to other CPUs when memory runs out. */
+    ph_test_cpu = 1;
+    for (page_count = 0; page_count < _countof(addrs); page_count++) {
+        p = allocate_u64(ph, PAGESIZE);
+        if (p == INVALID_PHYSICAL)
+            break;
+        addrs[page_count] = p;
+    }
+    test_assert(page_count > 0);
+    for (int page = 0; page < page_count; page++)
+        deallocate_u64(ph, addrs[page], PAGESIZE);
+    ph_test_cpu = 0;
+    for (int page = 0; page < page_count; page++) {
+        addrs[page] = allocate_u64(ph, PAGESIZE);
+        test_assert(addrs[page] != INVALID_PHYSICAL);
+    }
+    for (int page = 0; page < page_count; page++)
+        deallocate_u64(ph, addrs[page], PAGESIZE);
+    test_assert(heap_allocated(ph) <= 2 * PAGEHEAP_TEST_PCP_BYTES);
+    pageheap_drain_percpu();
+    test_assert(heap_allocated(ph) == 0);
+
+    /* Single pages cached in per-CPU lists do not prevent allocation of large pages. */
+    for (page_count = 0; page_count < _countof(addrs); page_count++) {
+        p = allocate_u64(ph, PAGESIZE);
+        if (p == INVALID_PHYSICAL)
+            break;
+        addrs[page_count] = p;
+    }
+    for (int page = 0; page < page_count; page++)
+        deallocate_u64(ph, addrs[page], PAGESIZE);
+    for (page_count = 0; allocate_u64(ph, PH_TEST_MAX_PAGESIZE) != INVALID_PHYSICAL;
+         page_count++);
+    test_assert(page_count >= heap_size / PH_TEST_MAX_PAGESIZE - 1);
+}
+
+/* Test per-CPU lists with allocations preferring a node other than the node of the CPU. */
+static void ph_test_percpu_numa(heap h, void *mem_base, u64 mem_size)
+{
+    heap ph = pageheap_init(h);
+    const u64 node_size = 8 * PH_TEST_MAX_PAGESIZE;
+    u64 addrs[PAGEHEAP_TEST_PCP_BYTES / PAGESIZE + 1];
+    bytes allocated = heap_allocated(ph);    /* pages left allocated by previous tests */
+    u64 p;
+
+    test_assert(pageheap_add_range(0, 2 * node_size));
+    pageheap_init_done(mem_base, PH_TEST_MAX_PAGESIZE);
+    test_assert(pageheap_set_node(node_size, node_size, 1));
+    test_assert(pageheap_init_percpu(2, ph_test_cpu_id));
+    pageheap_set_cpu_node(0, 0);
+    pageheap_set_cpu_node(1, 1);
+    pageheap_set_node_pref(ph_test_node_pref);
+    ph_test_allowed = -1ull;
+    ph_test_cpu = 0;
+
+    /* Allocations preferring a remote node get pages from that node, and do not fill the lists
+     * of the local CPU with remote pages. */
+    ph_test_node = 1;
+    for (int i = 0; i < _countof(addrs); i++) {
+        addrs[i] = allocate_u64(ph, PAGESIZE);
+        test_assert(addrs[i] != INVALID_PHYSICAL);
+        test_assert(pageheap_page_node(addrs[i]) == 1);
+    }
+    for (int i = 0; i < _countof(addrs); i++)
+        deallocate_u64(ph, addrs[i], PAGESIZE);
+    test_assert(heap_allocated(ph) == allocated);
+    ph_test_node = 0;
+    for (int i = 0; i < _countof(addrs); i++) {
+        addrs[i] = allocate_u64(ph, PAGESIZE);
+        test_assert(addrs[i] != INVALID_PHYSICAL);
+        test_assert(pageheap_page_node(addrs[i]) == 0);
+    }
+    for (int i = 0; i < _countof(addrs); i++)
+        deallocate_u64(ph, addrs[i], PAGESIZE);
+
+    /* Pages cached on a CPU are not used for allocations preferring a different node. */
+    p = allocate_u64(ph, PAGESIZE);
+    test_assert(pageheap_page_node(p) == 0);
+    deallocate_u64(ph, p, PAGESIZE);
+    ph_test_node = 1;
+    p = allocate_u64(ph, PAGESIZE);
+    test_assert(pageheap_page_node(p) == 1);
+    deallocate_u64(ph, p, PAGESIZE);
+    ph_test_cpu = 1;
+    p = allocate_u64(ph, PAGESIZE);
+    test_assert(pageheap_page_node(p) == 1);
+    deallocate_u64(ph, p, PAGESIZE);
+    pageheap_drain_percpu();
+    test_assert(heap_allocated(ph) == allocated);
+
+    /* When the node of a CPU is out of memory, allocations on that CPU get pages from other nodes
+     * without refilling the per-CPU lists with remote pages. */
+    u64 node_pages[node_size / PAGESIZE];
+    int page_count;
+    ph_test_cpu = 0;
+    ph_test_node = 0;
+    ph_test_allowed = U64_FROM_BIT(0);
+    for (page_count = 0; page_count < _countof(node_pages); page_count++) {
+        p = allocate_u64(ph, PAGESIZE);
+        if (p == INVALID_PHYSICAL)
+            break;
+        node_pages[page_count] = p;
+    }
+    test_assert(page_count > 0);
+    ph_test_allowed = -1ull;
+    bytes node_allocated = heap_allocated(ph);
+    p = allocate_u64(ph, PAGESIZE);
+    test_assert(p != INVALID_PHYSICAL);
+    test_assert(pageheap_page_node(p) == 1);
+    test_assert(heap_allocated(ph) == node_allocated + PAGESIZE);
+    deallocate_u64(ph, p, PAGESIZE);
+    test_assert(heap_allocated(ph) == node_allocated);
+    for (int page = 0; page < page_count; page++)
+        deallocate_u64(ph, node_pages[page], PAGESIZE);
+    pageheap_drain_percpu();
+    test_assert(heap_allocated(ph) == allocated);
+    pageheap_set_node_pref(0);
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -261,6 +490,9 @@ int main(int argc, char **argv)
         ph_test_basic(h, mem_base, mem_size, max_page_size);
     ph_test_mru(h, mem_base, mem_size);
     ph_test_multipage(h, mem_base, mem_size);
+    ph_test_numa(h, mem_base, mem_size);
+    ph_test_percpu(h, mem_base, mem_size);
+    ph_test_percpu_numa(h, mem_base, mem_size);
     munmap(mem_base, mem_size);
     return 0;
 }
@@ -14,7 +14,8 @@
 #include <string.h>
 #include <limits.h>
 
-#define DUMP_OPT_TREE  (1U << 0)
+#define DUMP_OPT_TREE     (1U << 0)
+#define DUMP_OPT_STORAGE  (1U << 1)
 
 #define TERM_COLOR_BLUE     94
 #define TERM_COLOR_CYAN     96
@@ -150,6 +151,107 @@ static void dump_fsentry(int indent, symbol name, tuple t)
         print_colored(indent, TERM_COLOR_WHITE, name, true);
 }
 
+/* storage usage statistics, in filesystem blocks */
+typedef struct storage_stats {
+    u64 files;
+    u64 data_blocks;        /* file data */
+    u64 referenced_blocks;  /* storage blocks referenced by file extents */
+    u64 shared_extents;
+    u64 compressed_extents;
+    u64 compressed_data_blocks;     /* file data in compressed extents */
+    u64 compressed_blocks;          /* storage blocks referenced by compressed extents */
+    rangemap used;          /* storage blocks referenced by at least one extent */
+} *storage_stats;
+
+static void storage_stats_fsentry(storage_stats stats, tuple t);
+
+closure_function(1, 2, boolean, storage_stats_each_child,
+                 storage_stats, stats,
+                 value k, value v)
+{
+    if (k == sym_this(".") || k == sym_this(".."))
+        return true;
+    if (is_tuple(v))
+        storage_stats_fsentry(bound(stats), (tuple)v);
+    return true;
+}
+
+closure_function(1, 2, boolean, storage_stats_each_extent,
+                 storage_stats, stats,
+                 value k, value v)
+{
+    storage_stats stats = bound(stats);
+    u64 length, start_block, allocated;
+    if (!is_tuple(v) || !get_u64(v, sym(length), &length) ||
+        !get_u64(v, sym(offset), &start_block) || !get_u64(v, sym(allocated), &allocated)) {
+        msg_err("dump: invalid extent %v", v);
+        exit(EXIT_FAILURE);
+    }
+    stats->data_blocks += length;
+    stats->referenced_blocks += allocated;
+    if (get(v, sym(shared)))
+        stats->shared_extents++;
+    if (get(v, sym(compression))) {
+        stats->compressed_extents++;
+        stats->compressed_data_blocks += length;
+        stats->compressed_blocks += allocated;
+    }
+    if ((allocated > 0) && !rangemap_insert_range(stats->used, irangel(start_block, allocated))) {
+        msg_err("dump: out of memory");
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+static void storage_stats_fsentry(storage_stats stats, tuple t)
+{
+    tuple c = children(t);
+    if (c) {
+        iterate(c, stack_closure(storage_stats_each_child, stats));
+        return;
+    }
+    tuple extents = get_tuple(t, sym(extents));
+    if (extents) {
+        stats->files++;
+        iterate(extents, stack_closure(storage_stats_each_extent, stats));
+    }
+}
+
+closure_function(1, 1, boolean, storage_stats_destruct_node,
+                 heap, h,
+                 rmnode n)
+{
+    deallocate(bound(h), n, sizeof(*n));
+    return true;
+}
+
+/* Storage blocks shared between files (e.g. cloned file ranges) are counted once in the used
+ * storage. */
+static void dump_storage_stats(heap h, filesystem fs, tuple root)
+{
+    struct storage_stats stats = {
+        .used = allocate_rangemap(h),
+    };
+    assert(stats.used != INVALID_ADDRESS);
+    storage_stats_fsentry(&stats, root);
+    u64 used_blocks = 0;
+    rangemap_foreach(stats.used, n)
+        used_blocks += range_span(n->r);
+    u64 block_size = fs_blocksize(fs);
+    printf("files: %lld\n", stats.files);
+    printf("data size: %lld bytes\n", stats.data_blocks * block_size);
+    printf("referenced storage: %lld bytes\n", stats.referenced_blocks * block_size);
+    printf("shared extents: %lld\n", stats.shared_extents);
+    printf("used storage: %lld bytes\n", used_blocks * block_size);
+    printf("saved by sharing: %lld bytes\n", (stats.referenced_blocks - used_blocks) * block_size);
+    printf("compressed extents: %lld\n", stats.compressed_extents);
+    if (stats.compressed_extents)
+        printf("compressed data: %lld bytes stored in %lld bytes (ratio %.2f)\n",
+               stats.compressed_data_blocks * block_size, stats.compressed_blocks * block_size,
+               (double)stats.compressed_data_blocks / stats.compressed_blocks);
+    deallocate_rangemap(stats.used, stack_closure(storage_stats_destruct_node, h));
+}
+
 closure_function(3, 2, void, fsc,
                  heap, h, buffer, b, unsigned int, options,
                  filesystem fs, status s)
@@ -169,7 +271,7 @@ closure_function(3, 2, void, fsc,
     bprintf(rb, "Label: %s\n", filesystem_get_label(fs));
     bprintf(rb, "UUID: ");
     print_uuid(rb, uuid);
-    if (!(options & DUMP_OPT_TREE)) {
+    if (!(options & (DUMP_OPT_TREE | DUMP_OPT_STORAGE))) {
         bprintf(rb, "\nmetadata\n");
         print_value(rb, root, timm("indent", "0"));
     }
@@ -184,6 +286,9 @@ closure_function(3, 2, void, fsc,
     if (options & DUMP_OPT_TREE)
         dump_fsentry(0, sym_this("/"), root);
 
+    if (options & DUMP_OPT_STORAGE)
+        dump_storage_stats(h, fs, root);
+
     closure_finish();
 }
 
@@ -259,6 +364,7 @@ static void usage(const char *prog)
             "<fs image> into <target dir>\n");
     fprintf(stderr, "  -t\t\t\tDisplay filesystem from <fs image> as a tree\n");
     fprintf(stderr, "  -l\t\t\tDisplay contents of crash log\n");
+    fprintf(stderr, "  -s\t\t\tDisplay storage usage of <fs image>\n");
     exit(EXIT_FAILURE);
 }
 
@@ -269,7 +375,7 @@ int main(int argc, char **argv)
     unsigned int options = 0;
     boolean print_klog = false;
 
-    while ((c = getopt(argc, argv, "d:tl")) != EOF) {
+    while ((c = getopt(argc, argv, "d:tls")) != EOF) {
         switch (c) {
         case 'd':
             target_dir = alloca_wrap_buffer(optarg, strlen(optarg));
@@ -280,6 +386,9 @@ int main(int argc, char **argv)
         case 'l':
             print_klog = true;
             break;
+        case 's':
+            options |= DUMP_OPT_STORAGE;
+            break;
         default:
             usage(argv[0]);
         }
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Benchmarks mkfs over a sample directory tree (by default, /usr/lib): for each mkfs configuration,
+# reports build time, image size and the deduplication and sparse statistics printed by mkfs.
+#
+# usage: mkfs-bench.py [-m mkfs-binary] [-r runs] [sample-dir]
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+name_re = re.compile(r'^[A-Za-z0-9._+@-]+$')
+
+def manifest_dir(path, stats):
+    entries = []
+    try:
+        names = sorted(os.listdir(path))
+    except OSError:
+        return entries
+    for name in names:
+        if not name_re.match(name):
+            continue
+        p = os.path.join(path, name)
+        if os.path.islink(p):
+            continue
+        if os.path.isdir(p):
+            sub = manifest_dir(p, stats)
+            if sub:
+                entries.append('%s:(children:(%s))' % (name, ' '.join(sub)))
+        elif os.path.isfile(p) and os.access(p, os.R_OK):
+            entries.append('%s:(contents:(host:%s))' % (name, p))
+            stats['files'] += 1
+            stats['bytes'] += os.path.getsize(p)
+    return entries
+
+def main():
+    parser = argparse.ArgumentParser(description='mkfs benchmark')
+    parser.add_argument('-m', dest='mkfs', default='output/tools/bin/mkfs')
+    parser.add_argument('-r', dest='runs', type=int, default=3)
+    parser.add_argument('dir', nargs='?', default='/usr/lib')
+    args = parser.parse_args()
+
+    stats = {'files': 0, 'bytes': 0}
+    manifest = '(children:(%s))' % ' '.join(manifest_dir(os.path.abspath(args.dir), stats))
+    print('%s: %d files, %d MB' % (args.dir, stats['files'], stats['bytes'] >> 20))
+
+    ncpus = os.cpu_count() or 1
+    configs = [('sequential, no dedup', ['-v', '-j', '1']),
+               ('sequential', ['-v', '-j', '1', '-d']),
+               ('%d threads, no dedup' % ncpus, ['-v', '-j', str(ncpus)]),
+               ('%d threads' % ncpus, ['-v', '-j', str(ncpus), '-d'])]
+    tmpdir = tempfile.mkdtemp(prefix='mkfs-bench')
+    image = os.path.join(tmpdir, 'image')
+    try:
+        print('%-24s %10s %12s %12s  %s' % ('config', 'time (s)', 'size (MB)', 'disk (MB)', 'mkfs'))
+        for name, opts in configs:
+            best = None
+            for run in range(args.runs):
+                start = time.monotonic()
+                p = subprocess.run([args.mkfs] + opts + [image], input=manifest.encode(),
+                                   stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+                elapsed = time.monotonic() - start
+                if p.returncode != 0:
+                    sys.exit('mkfs failed:\n' + p.stdout.decode(errors='replace'))
+                if best is None or elapsed < best:
+                    best = elapsed
+                lines = p.stdout.decode(errors='replace').strip().splitlines()
+                summary = lines[-1] if lines else ''
+            st = os.stat(image)
+            print('%-24s %10.3f %12d %12d  %s' % (name, best, st.st_size >> 20,
+                                                 (st.st_blocks * 512) >> 20, summary))
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
@@ -10,9 +10,12 @@
 #include <sys/mman.h>
 #include <storage.h>
 #include <tfs.h>
+#include <lz4.h>
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <kernel/region.h>
 
@@ -199,36 +202,327 @@ buffer lookup_file(heap h, const char *target_root, buffer name, struct stat *st
     return target_name;
 }
 
-// its nice that we can append a file to any existing buffer, but harsh we have to grow the buffer
-void read_file(heap h, const char *target_root, buffer dest, buffer name)
+static io_status_handler mkfs_write_status;
+
+/* Returns the host path (allocated with malloc) of a file in the manifest. */
+static char *host_path(heap h, const char *target_root, buffer name, struct stat *st)
 {
-    // mode bit metadata
-    struct stat st;
-    buffer target_name = lookup_file(h, target_root, name, &st);
-    if (target_name != NULL) {
-        //printf("%s -> %s\n", cstring(name), cstring(target_name));
+    buffer target_name = lookup_file(h, target_root, name, st);
+    if (target_name != NULL)
         name = target_name;
+    char *path = malloc(buffer_length(name) + 1);
+    assert(path);
+    runtime_memcpy(path, buffer_ref(name, 0), buffer_length(name));
+    path[buffer_length(name)] = '\0';
+    if (target_name != NULL)
+        deallocate_buffer(target_name);
+    return path;
+}
+
+/* Files are read and hashed by a pool of worker threads, while the main thread writes the file
+ * contents to the image in manifest order, so that the image layout does not depend on the number
+ * of threads. File contents are processed in chunks: all-zero chunks are left as holes, and chunks
+ * with the same contents as a chunk already written to the filesystem share its storage blocks.
+ * Files with (or inheriting from a parent directory) a "compression" attribute in the manifest are
+ * written as compressed chunks, except for chunks that do not compress to fewer storage blocks. */
+#define MKFS_CHUNK_SIZE     (64 * KB)
+#define MKFS_READAHEAD_MAX  (256 * MB)  /* file data read by workers and not yet written */
+
+#define MKFS_HASH_LEN   32
+
+typedef struct mkfs_chunk {
+    u8 hash[MKFS_HASH_LEN];
+    boolean zero;
+    void *cdata;    /* compressed contents (allocated with malloc), if any */
+    u64 clength;
+} *mkfs_chunk;
+
+typedef struct mkfs_job {
+    tuple f;
+    char *path;
+    int compression;
+    u64 size;
+    void *data;
+    struct mkfs_chunk *chunks;
+    int err;
+    boolean done;
+} *mkfs_job;
+
+static struct mkfs_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct mkfs_job *jobs;
+    u64 njobs;
+    u64 next;       /* next job to be picked by a worker */
+    u64 consumed;   /* jobs completed by the main thread */
+    u64 readahead;  /* bytes */
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int mkfs_threads;
+static boolean mkfs_dedup;
+static boolean mkfs_verbose;
+
+static struct mkfs_stats {
+    u64 files;
+    u64 bytes;
+    u64 written;
+    u64 deduplicated;
+    u64 sparse;
+    u64 compressed;
+    u64 compressed_size;
+} stats;
+
+static inline u64 mkfs_chunk_count(u64 size)
+{
+    return (size + MKFS_CHUNK_SIZE - 1) / MKFS_CHUNK_SIZE;
+}
+
+static boolean mkfs_is_zero(const u64 *p, u64 len)
+{
+    for (u64 i = 0; i < len / sizeof(u64); i++)
+        if (p[i])
+            return false;
+    for (u64 i = len & ~(sizeof(u64) - 1); i < len; i++)
+        if (((u8 *)p)[i])
+            return false;
+    return true;
+}
+
+/* Returns the compressed contents of a chunk, or NULL if compression does not save any storage
+ * blocks. */
+static void *mkfs_compress(mkfs_job j, void *p, u64 len, u64 *clength, void *workmem)
+{
+    u64 max_len = pad(len, SECTOR_SIZE) - SECTOR_SIZE;
+    if (max_len == 0)
+        return NULL;
+    void *c = malloc(max_len);
+    if (!c)
+        return NULL;
+    switch (j->compression) {
+    case TFS_COMPRESSION_LZ4:
+        *clength = lz4_compress(p, len, c, max_len, workmem);
+        break;
+    default:
+        *clength = 0;
+    }
+    if (*clength == 0) {
+        free(c);
+        return NULL;
     }
+    void *shrunk = realloc(c, *clength);
+    return shrunk ? shrunk : c;
+}
 
-    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-    int fd = open(cstring(name, tmpbuf), O_RDONLY);
-    if (fd < 0) halt("couldn't open file %b: %s\n", name, errno_sstring());
-    u64 size = st.st_size;
-    buffer_extend(dest, pad(st.st_size, SECTOR_SIZE));
+/* Runs in worker threads: must not use the runtime heaps. */
+static int mkfs_read_job(mkfs_job j)
+{
+    u32 workmem[LZ4_WORKMEM_SIZE / sizeof(u32)];
+    int fd = open(j->path, O_RDONLY);
+    if (fd < 0)
+        return errno;
+    j->data = malloc(j->size);
+    j->chunks = calloc(mkfs_chunk_count(j->size), sizeof(struct mkfs_chunk));
+    if (!j->data || !j->chunks) {
+        close(fd);
+        return ENOMEM;
+    }
     u64 total = 0;
-    while (total < size) {
-        int rv = read(fd, buffer_ref(dest, total), size - total);
-        if (rv < 0 && errno != EINTR) {
+    while (total < j->size) {
+        ssize_t rv = read(fd, j->data + total, j->size - total);
+        if (rv <= 0) {
+            if ((rv < 0) && (errno == EINTR))
+                continue;
+            int err = rv ? errno : EIO;   /* file truncated after stat */
             close(fd);
-            halt("read: %b: %s\n", name, errno_sstring());
+            return err;
         }
         total += rv;
     }
-    dest->end += size;
     close(fd);
+    for (u64 c = 0; c < mkfs_chunk_count(j->size); c++) {
+        void *p = j->data + c * MKFS_CHUNK_SIZE;
+        u64 len = MIN(MKFS_CHUNK_SIZE, j->size - c * MKFS_CHUNK_SIZE);
+        mkfs_chunk chunk = &j->chunks[c];
+        chunk->zero = mkfs_is_zero(p, len);
+        chunk->cdata = NULL;
+        if (chunk->zero)
+            continue;
+        if (mkfs_dedup) {
+            buffer dest = alloca_wrap_buffer(chunk->hash, MKFS_HASH_LEN);
+            buffer_clear(dest);
+            sha256(dest, alloca_wrap_buffer(p, len));
+        }
+        if (j->compression != TFS_COMPRESSION_NONE)
+            chunk->cdata = mkfs_compress(j, p, len, &chunk->clength, workmem);
+    }
+    return 0;
+}
 
-    if (target_name != NULL)
-        deallocate_buffer(target_name);
+static void *mkfs_worker(void *arg)
+{
+    pthread_mutex_lock(&pool.lock);
+    while (pool.next < pool.njobs) {
+        mkfs_job j = &pool.jobs[pool.next];
+
+        /* The job the main thread is waiting for is never held back. */
+        if ((pool.readahead >= MKFS_READAHEAD_MAX) && (pool.next != pool.consumed)) {
+            pthread_cond_wait(&pool.cond, &pool.lock);
+            continue;
+        }
+        pool.next++;
+        pool.readahead += j->size;
+        pthread_mutex_unlock(&pool.lock);
+        int err = j->path ? mkfs_read_job(j) : 0;
+        pthread_mutex_lock(&pool.lock);
+        j->err = err;
+        j->done = true;
+        pthread_cond_broadcast(&pool.cond);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+static mkfs_job mkfs_wait_job(u64 index)
+{
+    mkfs_job j = &pool.jobs[index];
+    pthread_mutex_lock(&pool.lock);
+    while (!j->done)
+        pthread_cond_wait(&pool.cond, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    return j;
+}
+
+static void mkfs_release_job(mkfs_job j)
+{
+    if (j->chunks) {
+        for (u64 c = 0; c < mkfs_chunk_count(j->size); c++)
+            free(j->chunks[c].cdata);
+    }
+    free(j->data);
+    free(j->chunks);
+    free(j->path);
+    pthread_mutex_lock(&pool.lock);
+    pool.readahead -= j->size;
+    pool.consumed++;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/* Location of a chunk written to the filesystem, looked up by contents. */
+typedef struct mkfs_chunk_ref {
+    u8 hash[MKFS_HASH_LEN];
+    u64 len;
+    fsfile f;
+    u64 offset;
+} *mkfs_chunk_ref;
+
+static key mkfs_chunk_key(void *x)
+{
+    return *(u64 *)((mkfs_chunk_ref)x)->hash;
+}
+
+static boolean mkfs_chunk_equal(void *x, void *y)
+{
+    mkfs_chunk_ref a = x, b = y;
+    return (a->len == b->len) && !runtime_memcmp(a->hash, b->hash, MKFS_HASH_LEN);
+}
+
+static void mkfs_write_data(fsfile f, mkfs_job j, range q)
+{
+    if (range_span(q) == 0)
+        return;
+    filesystem_write_linear(f, j->data + q.start, q, mkfs_write_status);
+    stats.written += range_span(q);
+}
+
+/* Run of duplicate chunks, found at contiguous offsets of a single file. */
+typedef struct mkfs_clone {
+    fsfile src;
+    u64 src_offset;
+    range q;
+} *mkfs_clone;
+
+static void mkfs_clone_data(fsfile f, mkfs_job j, mkfs_clone clone)
+{
+    u64 len = range_span(clone->q);
+    if (len == 0)
+        return;
+    int fss = filesystem_clone_range(f, clone->q.start, clone->src, clone->src_offset, len);
+    if (fss != 0)
+        halt("failed to share blocks of %s: %d\n", j->path, fss);
+    stats.deduplicated += len;
+    clone->q = irange(0, 0);
+}
+
+static void mkfs_write_file(heap h, filesystem fs, table chunks, tuple f, mkfs_job j)
+{
+    fsfile fsf = (fsfile)allocate_fsfile((tfs)fs, f);
+    assert(fsf != INVALID_ADDRESS);
+    range run = irange(0, 0);   /* data not yet written */
+    struct mkfs_clone clone = { .q = irange(0, 0) };    /* duplicate data not yet cloned */
+    for (u64 c = 0; c < mkfs_chunk_count(j->size); c++) {
+        mkfs_chunk chunk = &j->chunks[c];
+        range q = irangel(c * MKFS_CHUNK_SIZE, MIN(MKFS_CHUNK_SIZE, j->size - c * MKFS_CHUNK_SIZE));
+        if (chunk->zero) {
+            mkfs_write_data(fsf, j, run);
+            mkfs_clone_data(fsf, j, &clone);
+            run = irange(q.end, q.end);
+            stats.sparse += range_span(q);
+            continue;
+        }
+        if (mkfs_dedup) {
+            struct mkfs_chunk_ref k;
+            runtime_memcpy(k.hash, chunk->hash, MKFS_HASH_LEN);
+            k.len = range_span(q);
+            mkfs_chunk_ref ref = table_find(chunks, &k);
+            if (ref) {
+                /* the source chunk may be in the pending run */
+                mkfs_write_data(fsf, j, run);
+                run = irange(q.end, q.end);
+                if ((range_span(clone.q) == 0) || (ref->f != clone.src) ||
+                    (ref->offset != clone.src_offset + range_span(clone.q))) {
+                    mkfs_clone_data(fsf, j, &clone);
+                    clone.src = ref->f;
+                    clone.src_offset = ref->offset;
+                    clone.q.start = q.start;
+                }
+                clone.q.end = q.end;
+                continue;
+            }
+            mkfs_clone_data(fsf, j, &clone);
+            ref = allocate(h, sizeof(*ref));
+            assert(ref != INVALID_ADDRESS);
+            runtime_memcpy(ref, &k, sizeof(k));
+            ref->f = fsf;
+            ref->offset = q.start;
+            table_set(chunks, ref, ref);
+        }
+        if (chunk->cdata) {
+            mkfs_write_data(fsf, j, run);
+            run = irange(q.end, q.end);
+            filesystem_write_compressed(fsf, q, chunk->cdata, chunk->clength, j->compression,
+                                        mkfs_write_status);
+            stats.written += range_span(q);
+            stats.compressed += range_span(q);
+            stats.compressed_size += chunk->clength;
+            continue;
+        }
+        run.end = q.end;
+    }
+    mkfs_write_data(fsf, j, run);
+    mkfs_clone_data(fsf, j, &clone);
+
+    /* trailing hole */
+    if (fsfile_get_length(fsf) < j->size) {
+        if (!get(f, sym(extents)))
+            filesystem_write_eav((tfs)fs, f, sym(extents), allocate_tuple(), false);
+        int fss = filesystem_truncate(fs, fsf, j->size);
+        if (fss != 0)
+            halt("failed to set length of %s: %d\n", j->path, fss);
+    }
 }
 
 heap malloc_allocator();
@@ -247,8 +541,90 @@ closure_func_basic(parse_error, void, perr,
     exit(EXIT_FAILURE);
 }
 
-closure_function(2, 1, void, bwrite,
-                 descriptor, d, ssize_t, offset,
+/* Image writes are coalesced in a buffer, and written with direct I/O (bypassing the host page
+ * cache) where possible. */
+#define MKFS_WRITE_BUFSIZE  (8 * MB)
+#define MKFS_DIRECT_ALIGN   4096
+
+static struct mkfs_writer {
+    descriptor fd;
+    descriptor direct_fd;   /* -1 if direct I/O is not available */
+    u8 *buf;
+    u64 offset;             /* image offset of buffered data */
+    u64 len;
+} writer;
+
+static void mkfs_writer_init(descriptor fd, const char *image_path)
+{
+    writer.fd = fd;
+#ifdef O_DIRECT
+    writer.direct_fd = open(image_path, O_WRONLY | O_DIRECT);
+#else
+    writer.direct_fd = -1;
+#endif
+    assert(posix_memalign((void **)&writer.buf, MKFS_DIRECT_ALIGN, MKFS_WRITE_BUFSIZE) == 0);
+    writer.len = 0;
+}
+
+static boolean mkfs_pwrite(descriptor fd, u8 *p, u64 len, u64 offset)
+{
+    while (len > 0) {
+        ssize_t xfer = pwrite(fd, p, len, offset);
+        if (xfer < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += xfer;
+        len -= xfer;
+        offset += xfer;
+    }
+    return true;
+}
+
+static void mkfs_writer_flush(void)
+{
+    u8 *p = writer.buf;
+    u64 offset = writer.offset;
+    u64 len = writer.len;
+    writer.len = 0;
+    if ((writer.direct_fd >= 0) && !(offset & (MKFS_DIRECT_ALIGN - 1))) {
+        u64 direct_len = len & ~(MKFS_DIRECT_ALIGN - 1);
+        if (direct_len > 0) {
+            if (mkfs_pwrite(writer.direct_fd, p, direct_len, offset)) {
+                p += direct_len;
+                offset += direct_len;
+                len -= direct_len;
+            } else {
+                /* the host filesystem does not support direct I/O */
+                close(writer.direct_fd);
+                writer.direct_fd = -1;
+            }
+        }
+    }
+    if ((len > 0) && !mkfs_pwrite(writer.fd, p, len, offset))
+        halt("couldn't write image: %s\n", errno_sstring());
+}
+
+static void mkfs_writer_write(u64 offset, void *data, u64 len)
+{
+    while (len > 0) {
+        if ((writer.len > 0) &&
+            ((offset != writer.offset + writer.len) || (writer.len == MKFS_WRITE_BUFSIZE)))
+            mkfs_writer_flush();
+        if (writer.len == 0)
+            writer.offset = offset;
+        u64 xfer = MIN(len, MKFS_WRITE_BUFSIZE - writer.len);
+        runtime_memcpy(writer.buf + writer.len, data, xfer);
+        writer.len += xfer;
+        data += xfer;
+        offset += xfer;
+        len -= xfer;
+    }
+}
+
+closure_function(1, 1, void, bwrite,
+                 ssize_t, offset,
                  storage_req req)
 {
     switch (req->op) {
@@ -256,67 +632,48 @@ closure_function(2, 1, void, bwrite,
         break;
     case STORAGE_OP_READSG:
         sg_zero_fill(req->data, range_span(req->blocks) << SECTOR_OFFSET);
-        /* no break */
+        apply(req->completion, STATUS_OK);
+        return;
     case STORAGE_OP_FLUSH:
+        mkfs_writer_flush();
         apply(req->completion, STATUS_OK);
         return;
+    case STORAGE_OP_ZERO:
+    case STORAGE_OP_DISCARD:
+        storage_op_unsupported(req);
+        return;
     default:
         halt("%s: invalid storage op %d\n", func_ss, req->op);
     }
     sg_list sg = req->data;
     u64 offset = bound(offset) + (req->blocks.start << SECTOR_OFFSET);
     u64 total = range_span(req->blocks) << SECTOR_OFFSET;
-    struct iovec iov[IOV_MAX];
-    int iov_count;
-    ssize_t xfer;
-    lseek(bound(d), offset, SEEK_SET);
     while (total > 0) {
-        iov_count = 0;
-        xfer = 0;
-        sg_list_foreach(sg, sgb) {
-            iov[iov_count].iov_base = sgb->buf + sgb->offset;
-            iov[iov_count].iov_len = MIN(sg_buf_len(sgb), total - xfer);
-            xfer += iov[iov_count].iov_len;
-            if ((++iov_count == IOV_MAX) || (xfer == total))
-                break;
-        }
-        xfer = writev(bound(d), iov, iov_count);
-        if (xfer < 0 && errno != EINTR) {
-            apply(req->completion, timm("result", "write error %s", errno_sstring()));
-            return;
-        }
+        sg_buf sgb = sg_list_head_peek(sg);
+        u64 xfer = MIN(sg_buf_len(sgb), total);
+        mkfs_writer_write(offset, sgb->buf + sgb->offset, xfer);
         sg_consume(sg, xfer);
+        offset += xfer;
         total -= xfer;
     }
     apply(req->completion, STATUS_OK);
 }
 
-static buffer get_file_contents(heap h, const char *target_root, value v)
-{
-    value path = table_find((table)v, sym(host));
-    if (path) {
-        // seems like it wouldn't be to hard to arrange
-        // for this to avoid the staging copy
-        buffer dest = allocate_buffer(h, 1024);
-        read_file(h, target_root, dest, path);
-        return dest;
-    }
-    return 0;
-}
-
 static value translate(heap h, vector worklist,
-                       const char *target_root, filesystem fs, value v);
+                       const char *target_root, filesystem fs, value v, value compression);
 
-closure_function(5, 2, boolean, translate_each,
+closure_function(6, 2, boolean, translate_each,
                  heap, h, vector, worklist, const char *, target_root, filesystem, fs, tuple, out,
+                 value, compression,
                  value k, value child)
 {
     assert(is_symbol(k));
     if (k == sym(contents)) {
-        vector_push(bound(worklist), build_vector(bound(h), bound(out), child));
+        vector_push(bound(worklist), build_vector(bound(h), bound(out), child,
+                                                  bound(compression)));
     } else {
         set(bound(out), k, translate(bound(h), bound(worklist), bound(target_root),
-                                     bound(fs), child));
+                                     bound(fs), child, bound(compression)));
     }
     return true;
 }
@@ -324,11 +681,16 @@ closure_function(5, 2, boolean, translate_each,
 // dont really like the file/tuple duality, but we need to get something running today,
 // so push all the bodies onto a worklist
 static value translate(heap h, vector worklist,
-                       const char *target_root, filesystem fs, value v)
+                       const char *target_root, filesystem fs, value v, value compression)
 {
     if (is_tuple(v)) {
         tuple out = allocate_tuple();
-        iterate((tuple)v, stack_closure(translate_each, h, worklist, target_root, fs, out));
+        /* the compression attribute of a directory applies to all files in its subtree */
+        value c = get(v, sym(compression));
+        if (c)
+            compression = c;
+        iterate((tuple)v, stack_closure(translate_each, h, worklist, target_root, fs, out,
+                                        compression));
         return out;
     }
     return v;
@@ -336,7 +698,6 @@ static value translate(heap h, vector worklist,
 
 extern heap init_process_runtime();
 
-static io_status_handler mkfs_write_status;
 closure_func_basic(io_status_handler, void, mkfs_write_handler,
                    status s, bytes length)
 {
@@ -356,7 +717,7 @@ closure_function(4, 2, void, fsc,
 
     heap h = bound(h);
     vector worklist = allocate_vector(h, 10);
-    tuple md = translate(h, worklist, bound(target_root), fs, root);
+    tuple md = translate(h, worklist, bound(target_root), fs, root, 0);
 
     buffer b = allocate_buffer(transient, 64);
     u8 uuid[UUID_LEN];
@@ -371,26 +732,63 @@ closure_function(4, 2, void, fsc,
 
     tfs tfs = (struct tfs *)fs;
     filesystem_write_tuple(tfs, md);
-    vector i;
+    u64 njobs = vector_length(worklist);
+    struct mkfs_job *jobs = calloc(njobs, sizeof(struct mkfs_job));
+    assert(jobs || !njobs);
+    for (u64 index = 0; index < njobs; index++) {
+        vector i = vector_get(worklist, index);
+        mkfs_job j = &jobs[index];
+        j->f = vector_get(i, 0);
+        value compression = vector_get(i, 2);
+        if (compression) {
+            j->compression = is_string(compression) ?
+                             filesystem_compression_from_name(compression) : -1;
+            if (j->compression < 0)
+                halt("unsupported compression algorithm '%v'\n", compression);
+        }
+        value path = get(vector_get(i, 1), sym(host));
+        if (path) {
+            struct stat st;
+            j->path = host_path(h, bound(target_root), path, &st);
+            j->size = st.st_size;
+        }
+    }
+    pool.jobs = jobs;
+    pool.njobs = njobs;
+    pool.next = pool.consumed = pool.readahead = 0;
+    pthread_t threads[mkfs_threads];
+    for (int t = 0; t < mkfs_threads; t++)
+        assert(pthread_create(&threads[t], NULL, mkfs_worker, NULL) == 0);
+    table chunks = allocate_table(h, mkfs_chunk_key, mkfs_chunk_equal);
+    assert(chunks != INVALID_ADDRESS);
     buffer off = 0;
-    vector_foreach(worklist, i) {
-        tuple f = vector_get(i, 0);
-        buffer contents = get_file_contents(h, bound(target_root), vector_get(i, 1));
-        if (contents) {
-            if (buffer_length(contents) > 0) {
-                fsfile fsf = (fsfile)allocate_fsfile(tfs, f);
-                filesystem_write_linear(fsf, buffer_ref(contents, 0), irangel(0, buffer_length(contents)),
-                                        ignore_io_status);
-                deallocate_buffer(contents);
+    for (u64 index = 0; index < njobs; index++) {
+        mkfs_job j = mkfs_wait_job(index);
+        if (j->path) {
+            if (j->err) {
+                errno = j->err;
+                halt("couldn't read file %s: %s\n", j->path, errno_sstring());
+            }
+            stats.files++;
+            stats.bytes += j->size;
+            if (j->size > 0) {
+                mkfs_write_file(h, fs, chunks, j->f, j);
             } else {
                 if (!off)
                     off = value_from_u64(0);
                 /* make an empty file */
-                filesystem_write_eav(tfs, f, sym(extents), allocate_tuple(), false);
-                filesystem_write_eav(tfs, f, sym(filelength), off, false);
+                filesystem_write_eav(tfs, j->f, sym(extents), allocate_tuple(), false);
+                filesystem_write_eav(tfs, j->f, sym(filelength), off, false);
             }
         }
+        mkfs_release_job(j);
     }
+    for (int t = 0; t < mkfs_threads; t++)
+        pthread_join(threads[t], NULL);
+    table_foreach(chunks, k, v)
+        deallocate(h, k, sizeof(struct mkfs_chunk_ref));
+    deallocate_table(chunks);
+    free(jobs);
     filesystem_flush(fs, ignore_status);
     closure_finish();
 }
@@ -546,7 +944,11 @@ static void usage(const char *program_name)
            " in bytes, KB (with k or K suffix), MB (with m or M suffix), and GB"
            " (with g or G suffix)\n"
            "-t (key:value ...)  - add tuple(s) to manifest\n"
-           "-e                  - create empty filesystem\n",
+           "-e                  - create empty filesystem\n"
+           "-j threads          - specify number of threads reading files (default: number of"
+           " online CPUs)\n"
+           "-d                  - deduplicate file contents\n"
+           "-v                  - print image statistics\n",
            p, p);
 }
 
@@ -620,11 +1022,26 @@ int main(int argc, char **argv)
     cmdline_tuples = allocate_vector(h, 4);
     assert(cmdline_tuples != INVALID_ADDRESS);
 
-    while ((c = getopt(argc, argv, "eb:k:l:r:s:u:t:")) != EOF) {
+    mkfs_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((c = getopt(argc, argv, "edvb:j:k:l:r:s:u:t:")) != EOF) {
         switch (c) {
         case 'e':
             empty_fs = true;
             break;
+        case 'd':
+            mkfs_dedup = true;
+            break;
+        case 'v':
+            mkfs_verbose = true;
+            break;
+        case 'j':
+            mkfs_threads = atoi(optarg);
+            if (mkfs_threads <= 0) {
+                printf("invalid number of threads %s\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'b':
             bootimg_path = optarg;
             break;
@@ -680,6 +1097,11 @@ int main(int argc, char **argv)
     if (out < 0) {
         halt("couldn't open output file %s: %s\n", image_path, errno_sstring());
     }
+    if (mkfs_threads <= 0)
+        mkfs_threads = 1;
+    mkfs_writer_init(out, image_path);
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
 
     // prepend boot image (if any)
     ssize_t offset = 0;
@@ -782,8 +1204,9 @@ int main(int argc, char **argv)
             }
         }
         if (boot) {
-            create_filesystem(h, SECTOR_SIZE, BOOTFS_SIZE, closure(h, bwrite, out, offset), false,
+            create_filesystem(h, SECTOR_SIZE, BOOTFS_SIZE, closure(h, bwrite, offset), false,
                               sstring_empty(), closure(h, fsc, h, out, boot, target_root));
+            mkfs_writer_flush();
             offset += BOOTFS_SIZE;
 
             /* Remove tuple from root, so it doesn't end up in the root FS. */
@@ -796,10 +1219,13 @@ int main(int argc, char **argv)
     create_filesystem(h,
                       SECTOR_SIZE,
                       infinity,
-                      closure(h, bwrite, out, offset),
+                      closure(h, bwrite, offset),
                       false,
                       label,
                       closure(h, fsc, h, out, root, target_root));
+    mkfs_writer_flush();
+    if (writer.direct_fd >= 0)
+        close(writer.direct_fd);
 
     off_t current_size = lseek(out, 0, SEEK_END);
     if (current_size < 0) {
@@ -818,5 +1244,18 @@ int main(int argc, char **argv)
         write_mbr(out, uefi_loader != NULL);
 
     close(out);
+    if (mkfs_verbose) {
+        struct timespec end_time;
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        u64 elapsed_ms = (end_time.tv_sec - start_time.tv_sec) * 1000 +
+                         (end_time.tv_nsec - start_time.tv_nsec) / 1000000;
+        rprintf("%ld files, %ld bytes: %ld written, %ld deduplicated, %ld sparse; "
+                "%d threads, %ld ms\n", stats.files, stats.bytes, stats.written,
+                stats.deduplicated, stats.sparse, mkfs_threads, elapsed_ms);
+        if (stats.compressed)
+            rprintf("%ld bytes compressed to %ld bytes (ratio %ld.%02ld)\n", stats.compressed,
+                    stats.compressed_size, stats.compressed / stats.compressed_size,
+                    (stats.compressed % stats.compressed_size) * 100 / stats.compressed_size);
+    }
     exit(0);
 }
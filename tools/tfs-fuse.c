@@ -222,6 +222,10 @@ closure_function(2, 1, void, req_handle,
         break;
     case STORAGE_OP_FLUSH:
         break;
+    case STORAGE_OP_ZERO:
+    case STORAGE_OP_DISCARD:
+        storage_op_unsupported(req);
+        return;
     default:
         halt("%s: invalid storage op %d\n", func_ss, req->op);
     }